@@ -0,0 +1,175 @@
+#ifndef ACCESSLOG_H
+#define ACCESSLOG_H
+#include <stdint.h>
+#include <pthread.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Locker.h"
+#include "NumaMemory.h"
+
+/*日志文件的魔数和版本*/
+#define ACCESS_LOG_MAGIC 0x4c415357
+#define ACCESS_LOG_VERSION 2
+/*路径字典已满时请求记录使用的编号，不记录路径*/
+#define ACCESS_PATH_OTHER 0xffffffffu
+
+/**
+**二进制访问日志的文件格式
+**文件头之后是一串记录，每条记录以AccessRecordHeader开头，解码时跳过未知类型
+**路径编号只在一个线程缓冲区写出的连续记录内有效，路径记录在第一次使用它的请求记录之前，解码时按顺序读取
+*/
+struct AccessFileHeader
+{
+    uint32_t m_magic_;
+    uint32_t m_version_;
+	/*文件创建时间(微秒)*/
+    uint64_t m_created_us_;
+};
+
+/*记录类型*/
+enum ACCESS_RECORD_TYPE{ACCESS_RECORD_PAD=0,ACCESS_RECORD_REQUEST,ACCESS_RECORD_PATH};
+
+struct AccessRecordHeader
+{
+    uint16_t m_type_;
+	/*记录总长度，包含本头部*/
+    uint16_t m_length_;
+};
+
+/*请求处理的各个阶段*/
+enum ACCESS_STAGE{STAGE_READ=0,STAGE_QUEUE,STAGE_PROCESS,STAGE_WRITE,STAGE_COUNT};
+
+/*请求记录的标志位*/
+#define ACCESS_FLAG_KEEPALIVE 0x1
+#define ACCESS_FLAG_HTTP2 0x2
+
+/**
+**一个请求的访问记录，56字节
+*/
+struct AccessRequestRecord
+{
+    AccessRecordHeader m_header_;
+	/*方法，HttpConn::METHOD*/
+    uint8_t m_method_;
+    uint8_t m_flags_;
+	/*应答状态码*/
+    uint16_t m_status_;
+	/*客户端IPv4地址和端口(网络字节序)*/
+    uint32_t m_addr_;
+    uint16_t m_port_;
+    uint16_t m_reserved_;
+	/*请求路径的编号，对应ACCESS_RECORD_PATH记录*/
+    uint32_t m_path_id_;
+	/*从收到第一个字节到发送完应答的总耗时(微秒)*/
+    uint32_t m_total_us_;
+	/*请求开始时间(微秒)*/
+    uint64_t m_time_us_;
+	/*发送的字节数*/
+    uint64_t m_bytes_;
+	/*各阶段耗时(微秒)*/
+    uint32_t m_stage_us_[STAGE_COUNT];
+};
+
+/**
+**路径字典记录，路径紧跟在记录之后，不以'\0'结尾
+*/
+struct AccessPathRecord
+{
+    AccessRecordHeader m_header_;
+    uint32_t m_path_id_;
+};
+
+/**
+**二进制访问日志
+**每个线程写自己的缓冲区，写满后交给后台线程以大块顺序写入文件，文件超过大小后轮转
+*/
+class AccessLog
+{
+    public:
+		/*每个线程缓冲区的大小*/
+        static const size_t BUFFER_SIZE=256*1024;
+		/*O_DIRECT要求的对齐*/
+        static const size_t DIRECT_ALIGN=4096;
+		/*路径的最大长度，超过时截断*/
+        static const size_t MAX_PATH_LEN=512;
+		/*每个缓冲区的路径字典最多的路径数，超过后使用ACCESS_PATH_OTHER*/
+        static const size_t MAX_BUFFER_PATHS=1024;
+		/*后台线程检查未写满缓冲区的间隔(毫秒)*/
+        static const int FLUSH_INTERVAL_MS=1000;
+    public:
+        AccessLog();
+        virtual ~AccessLog();
+        static AccessLog* Instance();
+		/*打开日志，prefix为文件名前缀，rotate_bytes为单个文件的最大字节数，direct表示使用O_DIRECT*/
+        bool Open(const char* prefix,uint64_t rotate_bytes,bool direct);
+		/*写入所有缓冲区并停止后台线程*/
+        void Close();
+        bool IsOpen() const {return m_open_;}
+		/*写入一条请求记录，m_header_和m_path_id_之外的字段由调用者填写；路径不含查询字符串*/
+        void Log(AccessRequestRecord* record,const char* path);
+		/*当前时间(微秒)*/
+        static uint64_t NowUs();
+    private:
+		/*线程的日志缓冲区*/
+        struct Buffer
+        {
+            char* m_data_;
+			/*缓冲区所属的节点，用完后放回该节点的缓冲池*/
+            int m_node_;
+            size_t m_used_;
+			/*缓冲区第一条记录的写入时间(毫秒)*/
+            uint64_t m_first_ms_;
+        };
+		/*线程私有的缓冲区和它的路径字典，后台线程定期取走未写满的缓冲区，所以也需要锁*/
+        struct ThreadState
+        {
+            Buffer m_buffer_;
+            Locker m_locker_;
+			/*当前缓冲区中已写入路径记录的路径，换缓冲区时清空*/
+            std::unordered_map<std::string,uint32_t> m_paths_;
+        };
+    private:
+        ThreadState* GetThreadState();
+		/*保证缓冲区还有len字节，不够时交给后台线程并换新缓冲区，要求持有线程状态的锁*/
+        void Reserve(ThreadState* state,size_t len);
+		/*向线程缓冲区追加数据，缓冲区满时交给后台线程*/
+        void Append(ThreadState* state,const void* data,size_t len);
+		/*把路径映射为当前缓冲区中的编号，第一次出现时写入路径记录，要求持有线程状态的锁*/
+        uint32_t InternPath(ThreadState* state,const char* path);
+		/*把写满或超时的缓冲区放入待写队列*/
+        void Submit(Buffer& buffer);
+		/*从node节点的缓冲池取缓冲区，-1表示调用线程所在节点*/
+        Buffer NewBuffer(int node=-1);
+		/*后台写线程*/
+        static void* Writer(void* arg);
+        void Run();
+		/*把缓冲区写入文件，必要时填充对齐和轮转*/
+        void WriteBuffer(Buffer& buffer);
+		/*打开新的日志文件，写入文件头*/
+        bool Rotate();
+    private:
+        bool m_open_;
+        bool m_stop_;
+        bool m_direct_;
+        std::string m_prefix_;
+        uint64_t m_rotate_bytes_;
+		/*当前文件*/
+        int m_fd_;
+        uint64_t m_file_bytes_;
+		/*轮转序号*/
+        int m_sequence_;
+        pthread_t m_thread_;
+        pthread_key_t m_key_;
+		/*所有线程的状态，后台线程遍历*/
+        std::vector<ThreadState*> m_threads_;
+        Locker m_threads_locker_;
+		/*待写的缓冲区队列*/
+        std::list<Buffer> m_queue_;
+        Locker m_queue_locker_;
+        Sem m_queue_stat_;
+		/*按节点缓存的日志缓冲区，线程从所在节点取用*/
+        NumaBufferPool m_pool_;
+};
+#endif // ACCESSLOG_H
@@ -0,0 +1,61 @@
+#ifndef BUSYPOLL_H
+#define BUSYPOLL_H
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <sys/epoll.h>
+#include "Locker.h"
+
+/**
+**低延迟的忙轮询模式，适合独占CPU的主机
+**I/O线程在epoll_wait阻塞前先用0超时轮询一段时间，工作线程在等待任务的信号量前先自旋一段时间，
+**请求间隔很短时省掉睡眠和唤醒的开销；socket和epoll实例同时请求内核对网卡队列忙轮询(支持时)
+**自适应时每次自旋落空预算减半直至为0(退回直接阻塞)，阻塞的时间短于最大预算说明自旋本可以接住，恢复最大预算
+*/
+class BusyPoll
+{
+    public:
+		/*预算减半到低于这个值(微秒)时不再自旋*/
+        static const int MIN_SPIN_US=4;
+    public:
+        BusyPoll();
+        virtual ~BusyPoll();
+        static BusyPoll* Instance();
+		/*loop_us和worker_us为I/O线程和工作线程每次睡眠前最多自旋的微秒数，都为0时关闭；adaptive表示按命中情况调整*/
+        void Configure(int loop_us,int worker_us,bool adaptive);
+        bool Enabled() const {return m_loop_max_us_>0 || m_worker_max_us_>0;}
+		/*请求内核在socket上忙轮询网卡队列，不支持或没有权限时忽略*/
+        void SetupSocket(int sockfd);
+		/*设置epoll实例的忙轮询参数(Linux 6.9起)，不支持时忽略*/
+        void SetupEpoll(int epollfd);
+		/*代替I/O线程的epoll_wait：先轮询，没有事件再按timeout阻塞*/
+        int Wait(int epollfd,struct epoll_event* events,int max_events,int timeout);
+		/*代替工作线程的sem.Wait()：先自旋尝试，没有任务再阻塞*/
+        bool WaitSem(Sem& sem);
+		/*输出自旋和睡眠的时间，并清零统计*/
+        void Report(FILE* fp);
+    private:
+		/*按本次自旋是否命中调整预算*/
+        static int Adapt(int budget,int max_us,bool adaptive,bool hit,uint64_t slept_us);
+    private:
+        int m_loop_max_us_;
+        int m_worker_max_us_;
+        bool m_adaptive_;
+		/*I/O线程当前的预算，只在I/O线程使用*/
+        int m_loop_budget_us_;
+		/*I/O线程自旋和阻塞的时间(微秒)，自旋命中和落空的次数*/
+        uint64_t m_loop_spin_us_;
+        uint64_t m_loop_sleep_us_;
+        uint64_t m_loop_hits_;
+        uint64_t m_loop_misses_;
+		/*工作线程的统计，各线程共同累加*/
+        std::atomic<uint64_t> m_worker_spin_us_;
+        std::atomic<uint64_t> m_worker_sleep_us_;
+        std::atomic<uint64_t> m_worker_hits_;
+        std::atomic<uint64_t> m_worker_misses_;
+		/*socket和epoll实例的忙轮询是否设置成功*/
+        std::atomic<uint64_t> m_socket_ok_;
+        std::atomic<uint64_t> m_socket_failed_;
+        bool m_epoll_ok_;
+};
+#endif // BUSYPOLL_H
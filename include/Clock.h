@@ -0,0 +1,41 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+#include <stdint.h>
+#include <time.h>
+
+/**
+**单调时钟，用于计时、超时和限流，不受系统时间调整的影响
+*/
+
+/*纳秒*/
+inline uint64_t MonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/*微秒*/
+inline uint64_t MonotonicUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+/*毫秒*/
+inline uint64_t MonotonicMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+
+/*毫秒，精度为一个时钟节拍，比MonotonicMs便宜，用在每个请求都要调用的地方*/
+inline uint64_t MonotonicCoarseMs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE,&ts);
+    return (uint64_t)ts.tv_sec*1000+ts.tv_nsec/1000000;
+}
+#endif // CLOCK_H
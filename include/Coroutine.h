@@ -0,0 +1,278 @@
+#ifndef COROUTINE_H
+#define COROUTINE_H
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <queue>
+#include <string>
+#include <vector>
+#include "Locker.h"
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <exception>
+#endif
+
+class HttpRequest;
+class CoRequest;
+class CoTask;
+
+/*协程处理函数，需要用-std=c++20编译；c++11下可以登记但不会被调用*/
+typedef CoTask (*CoHandler)(CoRequest& request);
+
+/**
+**协程处理函数的路由表，在启动线程池之前登记，之后只读
+*/
+class CoRouter
+{
+    public:
+        static CoRouter* Instance();
+		/*登记路径(不含查询串)的处理函数*/
+        void Add(const char* path,CoHandler handler);
+		/*按请求目标查找处理函数，没有时返回NULL*/
+        CoHandler Find(const char* target) const;
+		/*是否支持协程(编译时启用了C++20协程)*/
+        static bool Supported();
+    private:
+        std::map<std::string,CoHandler> m_routes_;
+};
+
+/**
+**协程等待的定时器和其他描述符，由I/O线程检查
+**工作线程登记等待，I/O线程在到期或就绪后取出连接句柄交给线程池，由工作线程恢复协程
+*/
+class CoReactor
+{
+    public:
+        CoReactor();
+        virtual ~CoReactor();
+        static CoReactor* Instance();
+		/*创建唤醒I/O线程的eventfd，其他描述符注册到epollfd*/
+        bool Open(int epollfd);
+        int WakeFd() const {return m_wake_fd_;}
+		/*连接在deadline_ms之后就绪*/
+        void AddTimer(uint64_t handle,uint64_t deadline_ms);
+		/*fd可读(write为false)或可写时连接就绪，fd用代数0的句柄注册，失败返回false*/
+        bool WatchFd(int fd,bool write,uint64_t handle);
+		/*代数0的句柄上的事件，在I/O线程调用*/
+        void OnFdEvent(int fd);
+		/*连接已就绪，如连接socket上的数据发送完*/
+        void Ready(uint64_t handle);
+		/*读掉eventfd的计数*/
+        void ClearWakeup();
+		/*取走已就绪和已到期的连接句柄，在I/O线程调用*/
+        void TakeReady(std::vector<uint64_t>& handles,uint64_t now_ms);
+		/*距最近的定时器到期的毫秒数，没有定时器时返回-1*/
+        int NextTimeout(uint64_t now_ms);
+    private:
+		/*唤醒I/O线程重新计算epoll_wait的超时*/
+        void Wakeup();
+    private:
+        typedef std::pair<uint64_t,uint64_t> Timer;
+        std::priority_queue<Timer,std::vector<Timer>,std::greater<Timer> > m_timers_;
+		/*等待中的描述符到连接句柄*/
+        std::map<int,uint64_t> m_fds_;
+        std::vector<uint64_t> m_ready_;
+        Locker m_locker_;
+        int m_epollfd_;
+        int m_wake_fd_;
+};
+
+#if defined(__cpp_impl_coroutine)
+/**
+**协程帧的按线程缓存，按2的幂分级，超过最大级别的直接用malloc
+**协程可能在另一个工作线程上结束，帧放回结束时所在线程的缓存
+*/
+class CoFramePool
+{
+    public:
+		/*最小和最大的缓存级别，以及每级缓存的帧数上限*/
+        static const size_t MIN_FRAME=64;
+        static const int CLASS_COUNT=8;
+        static const size_t MAX_CACHED=1024;
+    public:
+        static void* Allocate(size_t size);
+        static void Free(void* frame,size_t size);
+};
+
+/**
+**协程处理函数的返回类型，创建时不执行，由连接或co_await它的协程启动
+**结束时恢复co_await它的协程，异常在co_await处重新抛出
+*/
+class CoTask
+{
+    public:
+        struct promise_type;
+        typedef std::coroutine_handle<promise_type> Handle;
+		/*结束时转到等待者，没有等待者时回到resume的调用者*/
+        struct FinalAwaiter
+        {
+            bool await_ready() noexcept {return false;}
+            std::coroutine_handle<> await_suspend(Handle handle) noexcept
+            {
+                std::coroutine_handle<> next=handle.promise().m_continuation_;
+                return next?next:std::noop_coroutine();
+            }
+            void await_resume() noexcept {}
+        };
+        struct promise_type
+        {
+            std::coroutine_handle<> m_continuation_;
+            std::exception_ptr m_exception_;
+            CoTask get_return_object() {return CoTask(Handle::from_promise(*this));}
+            std::suspend_always initial_suspend() noexcept {return {};}
+            FinalAwaiter final_suspend() noexcept {return {};}
+            void return_void() {}
+            void unhandled_exception() {m_exception_=std::current_exception();}
+            static void* operator new(size_t size) {return CoFramePool::Allocate(size);}
+            static void operator delete(void* frame,size_t size) {CoFramePool::Free(frame,size);}
+        };
+    public:
+        CoTask():m_handle_(nullptr) {}
+        explicit CoTask(Handle handle):m_handle_(handle) {}
+        CoTask(CoTask&& other) noexcept:m_handle_(other.m_handle_) {other.m_handle_=nullptr;}
+        CoTask& operator=(CoTask&& other) noexcept;
+        CoTask(const CoTask&)=delete;
+        CoTask& operator=(const CoTask&)=delete;
+        virtual ~CoTask();
+        Handle GetHandle() const {return m_handle_;}
+        bool Done() const {return !m_handle_ || m_handle_.done();}
+		/*处理函数抛出了异常*/
+        bool Failed() const {return m_handle_ && m_handle_.promise().m_exception_;}
+		/*co_await子任务：启动它，结束后回到当前协程*/
+        bool await_ready() const noexcept {return Done();}
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> caller) noexcept
+        {
+            m_handle_.promise().m_continuation_=caller;
+            return m_handle_;
+        }
+        void await_resume();
+    private:
+        Handle m_handle_;
+};
+#endif
+
+/**
+**协程处理函数看到的请求，提供可以co_await的读消息体、发送、定时和等待其他描述符
+**同一时刻只有一个线程访问：工作线程恢复协程，协程挂起后由HttpConn按等待的条件注册事件，
+**I/O线程只在条件满足前读写消息体和发送缓冲区
+*/
+class CoRequest
+{
+    public:
+		/*协程等待的条件*/
+        enum WAIT{WAIT_NONE=0,WAIT_BODY,WAIT_WRITE,WAIT_TIMER,WAIT_READABLE,WAIT_WRITABLE};
+		/*发送的结果*/
+        enum FLUSH{FLUSH_DONE=0,FLUSH_AGAIN,FLUSH_ERROR};
+		/*消息体的最大字节数*/
+        static const size_t MAX_BODY_SIZE=1024*1024;
+    public:
+		/*request和target指向连接的读缓冲区，在请求结束前有效；keep_alive为客户端是否要求保持连接*/
+        CoRequest(int sockfd,int method,const char* target,const HttpRequest* request,size_t content_length,bool keep_alive);
+        virtual ~CoRequest();
+		/*调用处理函数并运行到第一次挂起，不支持协程时返回false*/
+        bool Start(CoHandler handler);
+		/*等待的条件已满足时恢复协程，直到它等待下一个未满足的条件或结束*/
+        void Resume();
+		/*等待的条件是否已满足*/
+        bool Resumable() const;
+        bool Done() const;
+		/*处理函数抛出了异常*/
+        bool Failed() const;
+        WAIT Wait() const {return m_wait_;}
+		/*注册等待的描述符失败，恢复后co_await的结果为false*/
+        void FailWait() {m_wait_failed_=true;}
+        uint64_t Deadline() const {return m_deadline_ms_;}
+        int WaitFd() const {return m_wait_fd_;}
+		/*追加读到的消息体，超过Content-Length的部分丢弃，之后不再保持连接*/
+        void AppendBody(const char* data,size_t len);
+        bool BodyComplete() const {return m_body_.size()>=m_content_length_;}
+		/*发送缓冲区中的数据*/
+        FLUSH Flush();
+		/*应答已开始发送，状态码和已发送的字节数用于访问日志*/
+        bool Responded() const {return m_status_!=0;}
+        int Status() const {return m_status_;}
+        uint64_t BytesSent() const {return m_bytes_sent_;}
+		/*应答结束后能否继续在连接上处理请求*/
+        bool KeepAlive() const {return m_keep_alive_ && !m_broken_ && BodyComplete();}
+    public:
+		/*以下供处理函数使用*/
+        int Method() const {return m_method_;}
+		/*请求目标，包括查询串*/
+        const char* Target() const {return m_target_;}
+		/*查询串('?'之后的部分)，没有时为空串*/
+        const char* Query() const;
+        const HttpRequest& Request() const {return *m_request_;}
+		/*连接的socket，用于查询对端地址等，不要直接读写*/
+        int Socket() const {return m_sockfd_;}
+        const std::string& Body() const {return m_body_;}
+		/*连接已断开，之后的发送都会失败*/
+        bool Broken() const {return m_broken_;}
+#if defined(__cpp_impl_coroutine)
+		/*等待条件的awaiter，co_await的结果为条件是否正常满足*/
+        class Awaiter
+        {
+            public:
+                Awaiter(CoRequest* request,WAIT wait):m_request_(request),m_wait_(wait) {}
+                bool await_ready() {return m_request_->Poll(m_wait_);}
+                void await_suspend(std::coroutine_handle<> caller) {m_request_->Suspend(m_wait_,caller);}
+                bool await_resume() {return m_request_->Result(m_wait_);}
+            protected:
+                CoRequest* m_request_;
+                WAIT m_wait_;
+        };
+		/*co_await的结果为完整的消息体*/
+        class BodyAwaiter:public Awaiter
+        {
+            public:
+                explicit BodyAwaiter(CoRequest* request):Awaiter(request,WAIT_BODY) {}
+                const std::string& await_resume() {return m_request_->m_body_;}
+        };
+		/*读取完整的消息体*/
+        BodyAwaiter ReadBody() {return BodyAwaiter(this);}
+		/*发送原始数据，全部写入socket后继续*/
+        Awaiter Write(const char* data,size_t len);
+        Awaiter Write(const std::string& data) {return Write(data.data(),data.size());}
+		/*发送状态行和头部，content_length为-1时不带Content-Length且应答后关闭连接*/
+        Awaiter WriteHead(int status,const char* content_type,int64_t content_length);
+		/*发送完整的应答*/
+        Awaiter Respond(int status,const char* content_type,const std::string& body);
+		/*挂起ms毫秒*/
+        Awaiter SleepFor(uint64_t ms);
+		/*等待处理函数自己的非阻塞描述符可读或可写*/
+        Awaiter Readable(int fd);
+        Awaiter Writable(int fd);
+#endif
+    private:
+		/*条件能否立即满足，发送在这里尝试*/
+        bool Poll(WAIT wait);
+        void Suspend(WAIT wait,void* caller_address);
+		/*co_await的结果*/
+        bool Result(WAIT wait) const;
+#if defined(__cpp_impl_coroutine)
+        void Suspend(WAIT wait,std::coroutine_handle<> caller) {Suspend(wait,caller.address());}
+#endif
+    private:
+        int m_sockfd_;
+        int m_method_;
+        const char* m_target_;
+        const HttpRequest* m_request_;
+        size_t m_content_length_;
+        std::string m_body_;
+		/*待发送的数据，前m_out_pos_字节已发送*/
+        std::string m_out_;
+        size_t m_out_pos_;
+        bool m_keep_alive_;
+		/*发送出错或对端关闭*/
+        bool m_broken_;
+        int m_status_;
+        uint64_t m_bytes_sent_;
+		/*当前等待的条件和需要恢复的协程(最内层的子任务)*/
+        WAIT m_wait_;
+        uint64_t m_deadline_ms_;
+        int m_wait_fd_;
+        bool m_wait_failed_;
+        void* m_resume_;
+		/*处理函数返回的任务，类型不完整时用指针保存*/
+        CoTask* m_task_;
+};
+#endif // COROUTINE_H
@@ -0,0 +1,74 @@
+#ifndef DISKIO_H
+#define DISKIO_H
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <list>
+#include <vector>
+#include "Locker.h"
+
+struct FileEntry;
+
+/**
+**冷文件的磁盘读线程
+**I/O线程发送文件前用mincore检查下一个窗口是否已在页缓存中，不在时把窗口交给磁盘线程读入，
+**连接暂不注册epoll事件；读完后通过eventfd唤醒I/O线程，从断点继续发送
+*/
+class DiskIo
+{
+    public:
+		/*每次检查和读入的窗口大小*/
+        static const size_t WINDOW=1024*1024;
+		/*排队的读请求上限，超过时调用者直接发送(可能阻塞)*/
+        static const size_t MAX_JOBS=4096;
+    public:
+        DiskIo();
+        virtual ~DiskIo();
+        static DiskIo* Instance();
+		/*启动磁盘线程并创建唤醒用的eventfd*/
+        bool Start(int threads);
+		/*停止所有磁盘线程，未完成的请求被丢弃*/
+        void Stop();
+        int WakeFd() const {return m_wake_fd_;}
+		/*[address,address+len)是否全部在内存中，出错时按在内存中处理*/
+        static bool Resident(const char* address,size_t len);
+		/*读入entry中[offset,offset+len)并预读下一个窗口；handle非0时完成后唤醒该连接，返回false表示没有排队*/
+        bool Warm(FileEntry* entry,size_t offset,size_t len,uint64_t handle);
+		/*读掉eventfd的计数*/
+        void ClearWakeup();
+		/*取走已完成的连接句柄，在I/O线程调用*/
+        void TakeCompleted(std::vector<uint64_t>& handles);
+		/*输出统计*/
+        void Report(FILE* fp);
+    private:
+		/*一个读请求，持有文件的一个引用*/
+        struct Job
+        {
+            FileEntry* m_entry_;
+            size_t m_offset_;
+            size_t m_len_;
+            uint64_t m_handle_;
+        };
+    private:
+        static void* Worker(void* arg);
+        void Run();
+		/*把窗口读入内存并建立页表，之后I/O线程访问不会缺页阻塞*/
+        void Populate(const Job& job);
+    private:
+        std::vector<pthread_t> m_threads_;
+        bool m_stop_;
+		/*读请求队列*/
+        std::list<Job> m_jobs_;
+        Locker m_jobs_locker_;
+        Sem m_jobs_stat_;
+		/*已完成、需要唤醒的连接*/
+        std::vector<uint64_t> m_completed_;
+        Locker m_completed_locker_;
+        int m_wake_fd_;
+		/*连接因冷数据暂停的次数、读入的字节数、队列满时直接发送的次数*/
+        std::atomic<uint64_t> m_stalls_;
+        std::atomic<uint64_t> m_warmed_bytes_;
+        std::atomic<uint64_t> m_overflows_;
+};
+#endif // DISKIO_H
@@ -0,0 +1,113 @@
+#ifndef DOCARCHIVE_H
+#define DOCARCHIVE_H
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/*归档文件的魔数和版本*/
+#define DOC_ARCHIVE_MAGIC 0x52414457
+#define DOC_ARCHIVE_VERSION 1
+/*文件内容的对齐，与页大小相同*/
+#define DOC_ARCHIVE_ALIGN 4096
+
+/**
+**网站根目录打包后的归档文件格式，由tools/DocPacker生成，之后只读
+**文件头之后依次是条目表、完美哈希的位移表、字符串表，文件内容按页对齐放在最后
+*/
+struct DocArchiveHeader
+{
+    uint32_t m_magic_;
+    uint32_t m_version_;
+	/*条目数和位移表的桶数*/
+    uint32_t m_count_;
+    uint32_t m_buckets_;
+    uint64_t m_entries_offset_;
+    uint64_t m_seeds_offset_;
+    uint64_t m_strings_offset_;
+    uint64_t m_strings_size_;
+	/*归档文件的总字节数，用于检查是否完整*/
+    uint64_t m_file_size_;
+	/*打包时间(秒)*/
+    int64_t m_created_;
+};
+
+/**
+**一个文件的条目，字符串都是字符串表中以'\0'结尾的偏移
+*/
+struct DocArchiveEntry
+{
+	/*路径的哈希，查找时先比较它再比较路径*/
+    uint64_t m_hash_;
+	/*文件内容在归档中的偏移和长度*/
+    uint64_t m_data_offset_;
+    uint64_t m_size_;
+	/*预压缩的gzip内容，长度为0表示没有*/
+    uint64_t m_gzip_offset_;
+    uint64_t m_gzip_size_;
+	/*以'/'开头、相对于根目录的路径*/
+    uint32_t m_path_offset_;
+    uint32_t m_path_len_;
+	/*Content-Type和带引号的ETag，有预压缩内容时紧接着ETag的是它的ETag*/
+    uint32_t m_type_offset_;
+    uint32_t m_etag_offset_;
+    int64_t m_mtime_;
+};
+
+/*路径的哈希，打包工具和服务端共用*/
+static inline uint64_t DocArchiveHash(const char* data,size_t len)
+{
+    uint64_t hash=14695981039346656037ull;
+    for(size_t i=0;i<len;++i)
+    {
+        hash^=(unsigned char)data[i];
+        hash*=1099511628211ull;
+    }
+    return hash;
+}
+
+/*由路径的哈希和桶的位移值得到条目表中的位置*/
+static inline uint32_t DocArchiveSlot(uint64_t hash,uint32_t seed,uint32_t count)
+{
+    uint64_t x=hash^((uint64_t)seed*0x9e3779b97f4a7c15ull);
+    x^=x>>33;
+    x*=0xff51afd7ed558ccdull;
+    x^=x>>33;
+    x*=0xc4ceb9fe1a85ec53ull;
+    x^=x>>33;
+    return (uint32_t)(x%count);
+}
+
+struct FileEntry;
+
+/**
+**映射到内存的归档，启动时只需一次open和mmap，查找路径不需要系统调用
+**条目对应的FileEntry在第一次访问时创建并一直保留，由FileCache加锁访问
+*/
+class DocArchive
+{
+    public:
+        DocArchive();
+        virtual ~DocArchive();
+		/*打开并检查归档，失败返回false*/
+        bool Open(const char* path);
+        uint32_t Count() const {return m_header_?m_header_->m_count_:0;}
+		/*查找相对路径，返回条目序号，不存在时返回-1*/
+        int Find(const char* path,size_t len) const;
+        const DocArchiveEntry& At(int index) const {return m_entries_[index];}
+		/*条目对应的FileEntry，有预压缩内容时m_gzip_指向它的FileEntry；要求调用者加锁*/
+        FileEntry* Entry(int index);
+    private:
+        const char* String(uint32_t offset) const {return m_strings_+offset;}
+        FileEntry* NewEntry(const DocArchiveEntry& entry,uint64_t offset,uint64_t size);
+    private:
+        int m_fd_;
+        char* m_address_;
+        size_t m_size_;
+        const DocArchiveHeader* m_header_;
+        const DocArchiveEntry* m_entries_;
+        const uint32_t* m_seeds_;
+        const char* m_strings_;
+		/*按条目序号的FileEntry，未访问过的为NULL*/
+        std::vector<FileEntry*> m_files_;
+};
+#endif // DOCARCHIVE_H
@@ -0,0 +1,132 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+#include <time.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Locker.h"
+
+class DocArchive;
+
+/**
+**被缓存的文件，内容通过mmap映射到内存
+*/
+struct FileEntry
+{
+	/*文件的完整路径*/
+    std::string m_path_;
+	/*文件被mmap到内存的起始位置，空文件为NULL*/
+    char* m_address_;
+	/*文件大小*/
+    off_t m_size_;
+	/*文件的最后修改时间*/
+    time_t m_mtime_;
+	/*最近一次stat校验的时间*/
+    time_t m_checked_;
+	/*引用计数，为0且不在缓存中时释放*/
+    int m_refs_;
+	/*是否仍在缓存表中*/
+    bool m_cached_;
+	/*在LRU链表中的位置*/
+    std::list<FileEntry*>::iterator m_lru_;
+	/*所在的缓存分区*/
+    int m_partition_;
+	/*Content-Type和ETag，只有归档中的文件有，否则为NULL*/
+    const char* m_content_type_;
+    const char* m_etag_;
+	/*内容编码，预压缩的变体为"gzip"，否则为NULL*/
+    const char* m_encoding_;
+	/*预压缩的变体，没有时为NULL*/
+    FileEntry* m_gzip_;
+	/*可以用sendfile发送时为内容所在的描述符和偏移，-1表示只能从映射发送*/
+    int m_fd_;
+    off_t m_offset_;
+};
+
+/**
+**静态文件缓存类，HTTP/1.1和HTTP/2共用同一条stat/open/mmap路径
+**打开归档后根目录下的路径只在归档中查找，不再访问文件系统
+**缓存按根目录分区，每个分区有自己的LRU链表和字节数上限，只在分区内淘汰；分区0包含其他所有路径
+*/
+class FileCache
+{
+    public:
+		/*打开文件的结果*/
+        enum FILE_STATUS{FILE_OK=0,FILE_NOT_FOUND,FILE_FORBIDDEN,FILE_IS_DIR,FILE_ERROR};
+		/*缓存总字节数上限*/
+        static const size_t DEFAULT_CAPACITY=64*1024*1024;
+		/*单个文件可被缓存的最大字节数*/
+        static const size_t DEFAULT_MAX_ENTRY=4*1024*1024;
+		/*两次stat校验之间的最小间隔(秒)*/
+        static const int REVALIDATE_INTERVAL=1;
+    public:
+        FileCache(size_t capacity=DEFAULT_CAPACITY,size_t max_entry=DEFAULT_MAX_ENTRY);
+        virtual ~FileCache();
+		/*进程内共享的缓存实例*/
+        static FileCache* Instance();
+		/*增加一个分区，root下的文件只占用该分区的capacity字节，在处理请求之前调用；root已有分区时返回它的序号*/
+        int AddPartition(const char* root,size_t capacity);
+		/*用归档代替根目录root，在处理请求之前调用，失败返回false*/
+        bool OpenArchive(const char* path,const char* root);
+		/*获取文件，成功时entry持有一个引用，使用完后须调用Release*/
+        FILE_STATUS Acquire(const char* path,FileEntry** entry);
+		/*只在缓存中查找，不做任何系统调用；命中、在校验间隔内且不超过max_size时返回true并持有一个引用*/
+        bool TryAcquire(const char* path,size_t max_size,FileEntry** entry);
+		/*文件在缓存中时返回它的大小，否则返回-1，不改变LRU顺序*/
+        off_t CachedSize(const char* path);
+		/*为已持有的文件再增加一个引用，用于把文件交给其他线程*/
+        void Retain(FileEntry* entry);
+		/*释放文件引用*/
+        void Release(FileEntry* entry);
+		/*当前缓存的字节数*/
+        size_t Size();
+		/*输出每个分区的使用情况*/
+        void Report(FILE* fp);
+		/*按最近使用顺序导出最多max_keys个热点文件路径，用于热重启时交给新进程*/
+        void Snapshot(std::vector<std::string>& keys,size_t max_keys);
+		/*预先加载文件，热重启后的新进程不必从冷缓存开始*/
+        void Prewarm(const std::vector<std::string>& keys);
+    protected:
+    private:
+		/*一个分区，最近使用的文件在链表头*/
+        struct Partition
+        {
+            std::string m_root_;
+            size_t m_capacity_;
+            size_t m_size_;
+            std::list<FileEntry*> m_lru_;
+            uint64_t m_evictions_;
+        };
+    private:
+		/*路径所在的分区：根目录是路径前缀的分区中最长的一个，没有时为0*/
+        int PartitionOf(const char* path) const;
+		/*移到所在分区的LRU表头，要求持有锁*/
+        void Touch(FileEntry* entry);
+		/*从缓存表中移除，引用计数为0时释放映射*/
+        void Evict(FileEntry* entry);
+		/*在分区内淘汰最久未使用的文件直到容量满足要求*/
+        void Shrink(Partition* partition);
+		/*释放文件映射*/
+        static void Destroy(FileEntry* entry);
+		/*路径在归档的根目录下时返回条目序号，否则返回-1；*in_root表示是否在根目录下*/
+        int FindArchive(const char* path,bool* in_root) const;
+		/*取得条目的FileEntry并增加引用，要求持有锁*/
+        FileEntry* AcquireArchive(int index);
+    private:
+		/*单个文件可被缓存的最大字节数*/
+        size_t m_max_entry_;
+		/*路径到文件的映射，所有分区共用*/
+        std::unordered_map<std::string,FileEntry*> m_table_;
+		/*分区0的上限为构造时的容量*/
+        std::vector<Partition*> m_partitions_;
+		/*保护缓存表的互斥锁*/
+        Locker m_locker_;
+		/*代替根目录的归档，为NULL时直接访问文件系统*/
+        DocArchive* m_archive_;
+        std::string m_archive_root_;
+};
+#endif // FILECACHE_H
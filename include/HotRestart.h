@@ -0,0 +1,53 @@
+#ifndef HOTRESTART_H
+#define HOTRESTART_H
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+/**
+**热重启：运行中的进程启动一个新的自身副本，通过unix socket(SCM_RIGHTS)
+**把监听socket交给它，然后停止accept并排空已有连接
+**旧进程不阻塞等待：通信socket注册到epoll，新进程就绪或超时后由主循环完成交接
+*/
+class HotRestart
+{
+    public:
+		/*新进程通过该环境变量得到与旧进程通信的socket*/
+        static const char* ENV_CHANNEL;
+		/*等待新进程就绪的最长时间(毫秒)*/
+        static const int READY_TIMEOUT=10000;
+		/*交接的热点文件路径数上限*/
+        static const size_t MAX_SNAPSHOT_KEYS=4096;
+    public:
+		/*记录可执行文件路径和启动参数，必须在main开始时调用*/
+        static void Init(int argc,char* argv[]);
+		/*旧进程：启动新进程并交出监听socket和热点文件列表，返回等待就绪通知的通信socket，失败返回-1*/
+        static int StartHandoff(int listenfd,const std::vector<std::string>& keys);
+		/*旧进程：通信socket可读时调用，新进程就绪返回1，还没有通知返回0，失败(已结束新进程)返回-1*/
+        static int FinishHandoff();
+		/*旧进程：距离等待就绪超时的毫秒数，没有进行中的交接时返回-1*/
+        static int NextTimeout();
+		/*旧进程：等待超时，结束新进程并关闭通信socket*/
+        static void AbortHandoff();
+		/*新进程：从旧进程接收监听socket，不是热重启启动时返回-1*/
+        static int Receive(std::vector<std::string>& keys);
+		/*新进程：初始化完成，通知旧进程停止accept*/
+        static void Ready();
+    private:
+		/*发送监听socket和热点文件列表*/
+        static bool SendListenFd(int channel,int listenfd,const std::vector<std::string>& keys);
+		/*接收监听socket和热点文件列表*/
+        static int RecvListenFd(int channel,std::vector<std::string>& keys);
+    private:
+		/*可执行文件路径，二进制升级时指向新文件*/
+        static std::string m_exe_;
+		/*启动参数，新进程使用相同的参数(配置)*/
+        static std::vector<std::string> m_args_;
+		/*新进程与旧进程通信的socket，旧进程中为等待就绪通知的socket*/
+        static int m_channel_;
+		/*旧进程：正在交接的新进程和等待就绪的截止时间(毫秒)*/
+        static pid_t m_successor_;
+        static uint64_t m_deadline_ms_;
+};
+#endif // HOTRESTART_H
@@ -0,0 +1,102 @@
+#ifndef HPACK_H
+#define HPACK_H
+#include <stdint.h>
+#include <stddef.h>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*头部字段，名字和值*/
+typedef std::pair<std::string,std::string> HeaderField;
+
+/**
+**HPACK动态表，静态表之后的索引从62开始
+*/
+class HpackTable
+{
+    public:
+		/*静态表的条目数*/
+        static const int STATIC_TABLE_SIZE=61;
+		/*默认的动态表大小*/
+        static const size_t DEFAULT_TABLE_SIZE=4096;
+    public:
+        HpackTable();
+        virtual ~HpackTable();
+		/*按索引取条目，1..61为静态表，其余为动态表*/
+        const HeaderField* Get(size_t index) const;
+		/*插入动态表，超出容量时从尾部淘汰*/
+        void Add(const std::string& name,const std::string& value);
+		/*调整动态表的容量*/
+        void Resize(size_t max_size);
+		/*查找条目，完全匹配返回索引并置full为true，只匹配名字返回索引，否则返回0*/
+        size_t Find(const std::string& name,const std::string& value,bool* full) const;
+        size_t MaxSize() const {return m_max_size_;}
+    protected:
+    private:
+		/*淘汰条目直到大小不超过容量*/
+        void Evict();
+    private:
+		/*最新插入的条目在表头*/
+        std::deque<HeaderField> m_entries_;
+		/*条目大小之和，每个条目为名字长度+值长度+32*/
+        size_t m_size_;
+		/*容量*/
+        size_t m_max_size_;
+};
+
+/**
+**HPACK解码器
+*/
+class HpackDecoder
+{
+    public:
+        HpackDecoder();
+        virtual ~HpackDecoder();
+		/*解码一个完整的头部块，失败时返回false，连接应以COMPRESSION_ERROR关闭*/
+        bool Decode(const uint8_t* data,size_t len,std::vector<HeaderField>& headers);
+		/*对端(也就是我们)通过SETTINGS_HEADER_TABLE_SIZE允许的动态表上限*/
+        void SetMaxTableSize(size_t max_size) {m_settings_size_=max_size;}
+    protected:
+    private:
+        bool DecodeString(const uint8_t*& p,const uint8_t* end,std::string& out);
+    private:
+        HpackTable m_table_;
+		/*动态表大小更新指令不能超过的上限*/
+        size_t m_settings_size_;
+};
+
+/**
+**HPACK编码器
+*/
+class HpackEncoder
+{
+    public:
+        HpackEncoder();
+        virtual ~HpackEncoder();
+		/*开始一个新的头部块，必要时输出动态表大小更新指令*/
+        void Begin(std::string& out);
+		/*编码一个头部字段，indexing为false时不插入动态表(用于content-length等易变字段)*/
+        void Encode(const std::string& name,const std::string& value,std::string& out,bool indexing=true);
+		/*对端通过SETTINGS_HEADER_TABLE_SIZE限制的动态表大小*/
+        void SetMaxTableSize(size_t max_size);
+    protected:
+    private:
+        void EncodeString(const std::string& str,std::string& out);
+    private:
+        HpackTable m_table_;
+		/*待发送的动态表大小更新，-1表示没有*/
+        long m_pending_size_;
+};
+
+/*HPACK整数编码，prefix为前缀位数，flags为首字节的高位*/
+void HpackEncodeInteger(uint64_t value,int prefix,uint8_t flags,std::string& out);
+/*HPACK整数解码*/
+bool HpackDecodeInteger(const uint8_t*& p,const uint8_t* end,int prefix,uint64_t* value);
+/*Huffman编码后的长度(字节)*/
+size_t HuffmanEncodedLength(const std::string& str);
+/*Huffman编码*/
+void HuffmanEncode(const std::string& str,std::string& out);
+/*Huffman解码*/
+bool HuffmanDecode(const uint8_t* data,size_t len,std::string& out);
+#endif // HPACK_H
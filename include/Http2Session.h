@@ -0,0 +1,169 @@
+#ifndef HTTP2SESSION_H
+#define HTTP2SESSION_H
+#include <stdint.h>
+#include <list>
+#include <map>
+#include <string>
+#include <netinet/in.h>
+#include "Hpack.h"
+#include "FileCache.h"
+#include "RateLimiter.h"
+#include "VirtualHost.h"
+
+/**
+**HTTP/2流
+*/
+struct Http2Stream
+{
+	/*流标识符*/
+    uint32_t m_id_;
+	/*发送窗口，可能因SETTINGS_INITIAL_WINDOW_SIZE变小而为负*/
+    int64_t m_send_window_;
+	/*对端是否已经结束发送(END_STREAM)*/
+    bool m_remote_closed_;
+	/*是否已经在响应队列中*/
+    bool m_queued_;
+	/*HEADERS/CONTINUATION累积的头部块*/
+    std::string m_header_block_;
+	/*头部块结束后是否带END_STREAM*/
+    bool m_end_stream_pending_;
+	/*响应体来自文件缓存*/
+    FileEntry* m_file_;
+	/*响应体来自内存(错误页面)*/
+    const char* m_body_;
+	/*响应体长度*/
+    int64_t m_body_len_;
+	/*已发送的响应体字节数*/
+    int64_t m_sent_;
+	/*访问日志：方法(HttpConn::METHOD)、状态码和路径*/
+    int m_method_;
+    int m_status_;
+    std::string m_path_;
+	/*收到HEADERS的时间(微秒)，以及收到HEADERS和生成响应头部时的单调时间(微秒)*/
+    uint64_t m_time_us_;
+    uint64_t m_start_us_;
+    uint64_t m_respond_us_;
+	/*响应体中已确认在内存中的范围的终点*/
+    int64_t m_resident_end_;
+};
+
+/**
+**HTTP/2连接，负责帧的解析、流的多路复用和流量控制
+**读写由HttpConn完成，本类只处理内存中的字节
+*/
+class Http2Session
+{
+    public:
+		/*客户端连接前言*/
+        static const char PREFACE[];
+        static const int PREFACE_LEN=24;
+		/*帧头部长度*/
+        static const int FRAME_HEADER_LEN=9;
+		/*默认的最大帧长度和初始窗口*/
+        static const uint32_t DEFAULT_MAX_FRAME_SIZE=16384;
+        static const int64_t DEFAULT_WINDOW_SIZE=65535;
+		/*我们通告的最大并发流数*/
+        static const uint32_t MAX_CONCURRENT_STREAMS=128;
+		/*输出缓冲超过该值时暂停生成DATA帧*/
+        static const size_t OUTPUT_HIGH_WATER=256*1024;
+		/*未解析的输入超过该值时关闭连接*/
+        static const size_t INPUT_LIMIT=1024*1024;
+		/*帧类型*/
+        enum FRAME_TYPE{DATA=0,HEADERS,PRIORITY,RST_STREAM,SETTINGS,PUSH_PROMISE,PING,GOAWAY,WINDOW_UPDATE,CONTINUATION};
+		/*错误码*/
+        enum ERROR_CODE{NO_ERROR=0,PROTOCOL_ERROR,INTERNAL_ERROR,FLOW_CONTROL_ERROR,SETTINGS_TIMEOUT,STREAM_CLOSED,FRAME_SIZE_ERROR,REFUSED_STREAM,CANCEL,COMPRESSION_ERROR};
+    public:
+        Http2Session();
+        virtual ~Http2Session();
+		/*buf中是否是(可能不完整的)连接前言，len不足24时按前缀比较*/
+        static bool IsPreface(const char* buf,int len);
+		/*每个流都按连接所属客户端限流*/
+        void SetTicket(const RateTicket* ticket) {m_ticket_=ticket;}
+		/*客户端地址，用于访问日志*/
+        void SetPeer(const struct sockaddr_in* peer) {m_peer_=peer;}
+		/*发送服务端连接前言(SETTINGS帧)*/
+        void Start();
+		/*h2c升级：写入101响应和服务端前言，并把升级前的请求作为流1处理，method和host为升级请求的方法和虚拟主机，
+		charged为true表示升级请求已经取过令牌*/
+        bool Upgrade(const char* settings,const char* method,const char* path,const VirtualHost* host,bool charged);
+		/*追加从socket读到的数据，在I/O线程调用*/
+        bool Append(const char* data,int len);
+		/*解析已追加的数据，在工作线程调用，返回false表示连接应当关闭*/
+        bool Process();
+		/*在流量控制允许的范围内生成DATA帧；不在内存中的文件数据先跳过，blocking为true时不检查*/
+        void Pump(bool blocking=false);
+		/*上次Pump因数据不在内存中跳过的第一个流的文件和偏移*/
+        bool ColdWindow(FileEntry** entry,size_t* offset) const;
+		/*待发送的数据*/
+        const char* OutData() const {return m_out_.data()+m_out_pos_;}
+        size_t OutSize() const {return m_out_.size()-m_out_pos_;}
+		/*已发送n字节*/
+        void OutConsume(size_t n);
+		/*是否还有待发送的数据*/
+        bool WantWrite() const;
+		/*发送GOAWAY(NO_ERROR)，已有的流发送完后关闭连接*/
+        void Drain();
+		/*已发送GOAWAY且所有数据都已发送，连接可以关闭*/
+        bool Finished() const;
+    protected:
+    private:
+		/*处理一个完整的帧*/
+        bool OnFrame(uint8_t type,uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len);
+        bool OnHeaders(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len);
+        bool OnContinuation(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len);
+        bool OnData(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len);
+        bool OnSettings(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len);
+		/*应用SETTINGS参数，返回错误码*/
+        uint32_t ApplySettings(const uint8_t* payload,uint32_t len);
+        bool OnWindowUpdate(uint32_t stream_id,const uint8_t* payload,uint32_t len);
+        bool OnRstStream(uint32_t stream_id,uint32_t len);
+		/*头部块接收完毕，解码并生成响应*/
+        bool OnRequest(Http2Stream* stream);
+		/*为流生成响应头部，并把响应体排入发送队列，文件在host的根目录下查找；
+		charged为true表示这个请求已经按客户端和主机速率计数(h2c升级的请求)，不再检查*/
+        void Respond(Http2Stream* stream,const char* method,const char* path,const VirtualHost* host,bool charged=false);
+		/*写入帧头部*/
+        void WriteFrameHeader(uint32_t len,uint8_t type,uint8_t flags,uint32_t stream_id);
+        void WriteWindowUpdate(uint32_t stream_id,uint32_t increment);
+        void WriteRstStream(uint32_t stream_id,uint32_t error);
+		/*发送GOAWAY，之后不再处理新的流*/
+        bool GoAway(uint32_t error);
+		/*释放流*/
+        void CloseStream(Http2Stream* stream);
+        Http2Stream* FindStream(uint32_t stream_id);
+		/*流的响应体已全部排入输出，写访问日志*/
+        void LogStream(Http2Stream* stream);
+    private:
+		/*未解析的输入*/
+        std::string m_in_;
+		/*待发送的输出，m_out_pos_之前的已发送*/
+        std::string m_out_;
+        size_t m_out_pos_;
+		/*是否已收到客户端连接前言*/
+        bool m_preface_received_;
+		/*是否已发送GOAWAY*/
+        bool m_goaway_sent_;
+		/*正在接收头部块(CONTINUATION)的流，0表示没有*/
+        uint32_t m_continuation_stream_;
+		/*客户端创建的最大流标识符*/
+        uint32_t m_last_stream_id_;
+		/*连接级发送窗口*/
+        int64_t m_send_window_;
+		/*对端的SETTINGS_INITIAL_WINDOW_SIZE*/
+        int64_t m_peer_initial_window_;
+		/*对端的SETTINGS_MAX_FRAME_SIZE*/
+        uint32_t m_peer_max_frame_;
+		/*活跃的流*/
+        std::map<uint32_t,Http2Stream*> m_streams_;
+		/*有响应体等待发送的流，轮询发送*/
+        std::list<Http2Stream*> m_send_queue_;
+        HpackDecoder m_decoder_;
+        HpackEncoder m_encoder_;
+		/*连接所属客户端在限流表中的位置*/
+        const RateTicket* m_ticket_;
+        const struct sockaddr_in* m_peer_;
+		/*上次Pump跳过的冷数据，为NULL时没有*/
+        FileEntry* m_cold_file_;
+        int64_t m_cold_offset_;
+};
+#endif // HTTP2SESSION_H
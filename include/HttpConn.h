@@ -2,6 +2,18 @@
 #define HTTPCONN_H
 #include <arpa/inet.h>
 #include <sys/stat.h>
+#include <atomic>
+#include "AccessLog.h"
+#include "Coroutine.h"
+#include "HttpRequest.h"
+#include "RateLimiter.h"
+#include "SendScheduler.h"
+#include "Trace.h"
+#include "VirtualHost.h"
+
+struct FileEntry;
+class Http2Session;
+class WebSocketSession;
 
 /**
 **HTTP服务类
@@ -17,12 +29,19 @@ class HttpConn
         static const int WRITE_BUFFER_SIZE=1024;
 		/*HTTP请求方法*/
         enum METHOD{GET=0,POST,HEAD,PUT,DELETE,TRACE,OPTIONS,CONNECT,PATCH};
+        static const int METHOD_COUNT=PATCH+1;
+		/*METHOD对应的方法名，超出范围时返回NULL；增加方法时同时修改这张表*/
+        static const char* MethodName(int method)
+        {
+            static const char* const names[METHOD_COUNT]={"GET","POST","HEAD","PUT","DELETE","TRACE","OPTIONS","CONNECT","PATCH"};
+            return method>=0 && method<METHOD_COUNT?names[method]:NULL;
+        }
 		/*解析客户请求时，主状态机的状态*/
         enum CHECK_STATE{CHECK_STATE_REQUESTLINE=0,
                                                     CHECK_STATE_HEADER,
                                                     CHECK_STATE_CONTENT};
 		/*处理HTTP请求的结果*/
-        enum HTTP_CODE{NO_REQUEST,GET_REQUEST,BAD_REQUEST,NO_RESOURCE,FORBIDDEN_REQUEST,FILE_REQUEST,INTERNAL_ERROR,CLOSED_CONNECTION};
+        enum HTTP_CODE{NO_REQUEST,GET_REQUEST,BAD_REQUEST,NO_RESOURCE,FORBIDDEN_REQUEST,FILE_REQUEST,INTERNAL_ERROR,CLOSED_CONNECTION,TOO_MANY_REQUESTS,DEFERRED_REQUEST,WEBSOCKET_REQUEST,HANDLER_REQUEST,NOT_MODIFIED};
         /*行的读取状态*/
 		enum LINE_STATUS{LINE_OK=0,LINE_BAD,LINE_OPEN};
     public:
@@ -30,26 +49,66 @@ class HttpConn
         static int m_epollfd_;
 		/*用户数量*/
         static int m_user_count_;
+		/*热重启后正在排空连接，不再保持连接*/
+        static bool m_draining_;
+		/*在I/O线程上直接应答的已缓存文件的最大字节数，0表示关闭快速路径*/
+        static size_t m_inline_max_size_;
+		/*按短任务调度的已缓存文件的最大字节数，更大的或未缓存的文件按长任务调度*/
+        static size_t m_short_max_size_;
+		/*accept后立即读到请求的连接数，和没有数据、改为等待可读事件的连接数，只在I/O线程访问*/
+        static uint64_t m_accept_ready_;
+        static uint64_t m_accept_wait_;
     public:
         HttpConn();
         virtual ~HttpConn();
     public:
-		/*初始化连接*/
-        void Init(int sockfd,const struct sockaddr_in &addr);
+		/*初始化连接，ticket为accept时在限流表中占用的位置；arm为false时不注册事件，
+		描述符需要已是非阻塞的，之后由ReadOnAccept读取或注册*/
+        void Init(int sockfd,const struct sockaddr_in &addr,const RateTicket& ticket,bool arm=true);
 		/*关闭连接*/
 	    void Close(bool real_close=true);
 		/*处理客户请求*/
 	    void Process();
+		/*在I/O线程上处理请求，目标是已缓存的小文件时直接发送应答并返回true，否则返回false，由调用者交给线程池；
+		快速路径关闭时也在这里解析请求，LongTask据此分类*/
+        bool ProcessInline();
+		/*交给线程池的任务是否可能耗时较长：动态处理函数、未缓存或较大的文件*/
+        bool LongTask() const;
 		/*非阻塞读操作*/
         bool Read();
+		/*accept后立即读取第一个请求，出错返回false；读到数据时*ready为true，由调用者像可读事件一样处理，
+		此时描述符还没有加入epoll，第一次ModFd时才加入；没有数据时注册可读事件*/
+        bool ReadOnAccept(bool* ready);
+		/*输出accept快速路径的命中情况*/
+        static void ReportAccept(FILE* fp);
+		/*请求路径能否与根目录拼接：以'/'开头且没有".."段，查询字符串不检查*/
+        static bool SafePath(const char* path);
 		/*非阻塞写操作*/
         bool Write();
+		/*连接句柄：高32位为代数，低32位为槽位(连接对象在数组中的下标)，代数0留给非连接的描述符*/
+        static uint64_t MakeHandle(int slot,uint32_t generation) {return ((uint64_t)generation<<32)|(uint32_t)slot;}
+        static int HandleSlot(uint64_t handle) {return (int)(uint32_t)handle;}
+        static uint32_t HandleGeneration(uint64_t handle) {return (uint32_t)(handle>>32);}
+		/*当前句柄，连接关闭时代数加一，之前的epoll事件和排队任务中的旧句柄随即失效*/
+        uint64_t Handle() const {return MakeHandle(m_slot_,m_generation_.load(std::memory_order_acquire));}
+		/*当前请求的头部表，指向读缓冲区，在下一个请求开始前有效*/
+        const HttpRequest& Request() const {return m_request_;}
+		/*WebSocket连接的发送队列有新数据或需要关闭，在I/O线程调用*/
+        void WakeWebSocket();
+		/*记录accept阶段，start为accept之前的时间戳，在Init之后调用*/
+        void TraceAccept(uint64_t start);
     protected:
     private:
 		/*HTTP连接的socket*/
         int m_sockfd_;
+		/*连接对象的槽位，即accept时的描述符，关闭后保持不变*/
+        int m_slot_;
+		/*连接的代数，槽位每关闭一次加一*/
+        std::atomic<uint32_t> m_generation_;
 		/*客户端的ip地址*/
         struct sockaddr_in m_address_;
+		/*客户端地址在限流表中的位置*/
+        RateTicket m_ticket_;
 		/*读缓冲区*/
         char m_read_buf[READ_BUFFER_SIZE];
 		/*标识读缓冲区已经读入的客户端数据的最后一个字节的下一个位置*/
@@ -74,19 +133,62 @@ class HttpConn
         char* m_version_;
 		/*主机名*/
         char* m_host_;
+		/*按主机名选择的虚拟主机，没有Host头部时为默认主机*/
+        const VirtualHost* m_vhost_;
+		/*请求的全部头部*/
+        HttpRequest m_request_;
 		/*HTTP请求的消息体长度*/
         int m_content_length_;
 		/*HTTP请求是否要保持连接*/
         bool m_linger_;
 		/*客户请求的目标文件被mmap到内存的起始位置*/
         char* m_file_address_;
-		/*目标文件的状态*/
-        struct stat m_file_stat_;
+		/*目标文件在文件缓存中的条目*/
+        FileEntry* m_file_;
+		/*请求是否要求升级到h2c*/
+        bool m_h2c_upgrade_;
+		/*DoRequest已经为这个请求取得客户端和主机的令牌*/
+        bool m_charged_;
+		/*正在I/O线程上处理，DoRequest只接受已缓存的小文件*/
+        bool m_inline_;
+		/*请求已在I/O线程上解析完，交给工作线程后直接从DoRequest继续*/
+        bool m_deferred_;
+		/*h2c升级请求的HTTP2-Settings头部*/
+        char* m_h2_settings_;
+		/*HTTP/2连接状态，为NULL时是HTTP/1.1连接*/
+        Http2Session* m_h2_;
+		/*请求是否要求升级到WebSocket*/
+        bool m_ws_upgrade_;
+		/*WebSocket连接状态，为NULL时不是WebSocket连接*/
+        WebSocketSession* m_ws_;
+		/*请求路径登记的协程处理函数，为NULL时按静态文件处理*/
+        CoHandler m_handler_;
+		/*正在运行的协程处理函数，为NULL时没有*/
+        CoRequest* m_co_;
+		/*请求开始的时间(微秒)*/
+        uint64_t m_start_us_;
+		/*各阶段开始的单调时间(微秒)，最后一个是应答发送完的时间*/
+        uint64_t m_stamp_[STAGE_COUNT+1];
+		/*应答状态码*/
+        int m_status_;
+		/*当前应答已发送的字节数*/
+        uint64_t m_bytes_sent_;
 		/*成员iov_base指向一个缓冲区，存放readv所接收的数据或是writev将要发送的数据*/
 		/*ov_len确定接收的最大长度以及实际写入的长度*/
         struct iovec m_iv[2];
 		/*内存块的数量*/
         int m_iv_count_;
+		/*应答中还没有发送的字节数*/
+        size_t m_bytes_to_send_;
+		/*文件中还没有放入m_iv[1]的字节数，文件按窗口发送*/
+        size_t m_file_left_;
+		/*连接的发送速率令牌桶*/
+        TokenBucket m_send_bucket_;
+		/*下次按TCP_INFO调整发送缓冲区的时间(微秒)，以及当前设置的发送缓冲区(0表示系统默认)*/
+        uint64_t m_tune_us_;
+        int m_sndbuf_;
+		/*当前请求的追踪，开启追踪后第一次使用槽位时分配，为NULL时不追踪*/
+        RequestTrace* m_trace_;
     private:
 		/*初始化连接*/
         void Init();
@@ -102,6 +204,8 @@ class HttpConn
         HTTP_CODE ParseContent(char *text);
 		/*分析目标文件属性*/
         HTTP_CODE DoRequest();
+		/*已取得目标文件：ETag匹配时返回NOT_MODIFIED，客户端接受gzip且有预压缩的变体时换成变体*/
+        HTTP_CODE PrepareFile();
 		/*获取内容*/
         char *GetLine();
 		/*从状态机*/
@@ -118,9 +222,45 @@ class HttpConn
         bool AddHeaders(int content_length);
 		/*消息体长度*/
         bool AddContentLength(int content_length);
+		/*归档中的文件的Content-Type、ETag和内容编码*/
+        bool AddFileHeaders();
 		/*状态信息*/
         bool AddLinger();
 		/*标志信息*/
         bool AddBlankLine();
+		/*处理HTTP/2连接上的数据*/
+        void ProcessHttp2();
+		/*把下一个文件窗口放入m_iv[1]，窗口不在内存中时交给磁盘线程并返回false*/
+        bool PrepareFileWindow();
+		/*本次调用可以发送的字节数，为0时连接已交给调度器等待令牌*/
+        size_t SendBudget();
+		/*发送HTTP/2连接的待发送数据*/
+        bool WriteHttp2();
+		/*h2c升级，成功时连接切换为HTTP/2*/
+        bool UpgradeHttp2();
+		/*WebSocket握手，成功时连接切换为WebSocket*/
+        bool UpgradeWebSocket();
+		/*处理WebSocket连接上的帧*/
+        void ProcessWebSocket();
+		/*读取WebSocket连接的数据*/
+        bool ReadWebSocket();
+		/*发送WebSocket连接的发送队列*/
+        bool WriteWebSocket();
+		/*按发送队列注册事件，要求持有会话的锁*/
+        void ArmWebSocket();
+		/*启动路径对应的协程处理函数，失败时返回false*/
+        bool StartCoroutine();
+		/*恢复协程处理函数，挂起后按等待的条件注册事件，结束后准备下一个请求*/
+        void ProcessCoroutine();
+		/*读取协程处理函数的消息体*/
+        bool ReadCoroutine();
+		/*发送协程处理函数的发送缓冲区，发送完后交给线程池恢复协程*/
+        bool WriteCoroutine();
+		/*应答发送完后写访问日志*/
+        void LogAccess();
+		/*记录从start到现在的阶段*/
+        void Trace(TRACE_SPAN span,uint64_t start);
+		/*请求结束，按采样条件保留追踪*/
+        void FinishTrace();
 };
 #endif // HTTPCONN_H
@@ -0,0 +1,72 @@
+#ifndef HTTPREQUEST_H
+#define HTTPREQUEST_H
+
+/**
+**指向读缓冲区的字符串片段，不拷贝数据
+*/
+struct StringRef
+{
+    const char* m_data_;
+    int m_len_;
+};
+
+/**
+**HTTP请求的头部表，名字和值都是读缓冲区中的片段
+*/
+class HttpRequest
+{
+    public:
+		/*已知的头部，通过编译期完美哈希映射*/
+        enum HEADER_ID{HEADER_UNKNOWN=-1,HEADER_ACCEPT=0,HEADER_ACCEPT_ENCODING,HEADER_ACCEPT_LANGUAGE,
+                                    HEADER_AUTHORIZATION,HEADER_CACHE_CONTROL,HEADER_CONNECTION,HEADER_CONTENT_LENGTH,
+                                    HEADER_CONTENT_TYPE,HEADER_COOKIE,HEADER_EXPECT,HEADER_HOST,HEADER_IF_MATCH,
+                                    HEADER_IF_MODIFIED_SINCE,HEADER_IF_NONE_MATCH,HEADER_IF_RANGE,HEADER_IF_UNMODIFIED_SINCE,
+                                    HEADER_KEEP_ALIVE,HEADER_ORIGIN,HEADER_PRAGMA,HEADER_RANGE,HEADER_REFERER,HEADER_TE,
+                                    HEADER_TRANSFER_ENCODING,HEADER_UPGRADE,HEADER_USER_AGENT,HEADER_VIA,HEADER_X_FORWARDED_FOR,
+                                    HEADER_X_REAL_IP,HEADER_HTTP2_SETTINGS,HEADER_SEC_WEBSOCKET_KEY,HEADER_SEC_WEBSOCKET_VERSION,
+                                    HEADER_SEC_WEBSOCKET_PROTOCOL,HEADER_SEC_WEBSOCKET_EXTENSIONS,HEADER_COUNT};
+		/*头部表最多容纳的头部数，超过时请求无效*/
+        static const int MAX_HEADERS=64;
+		/*完美哈希表的大小*/
+        static const int HASH_SIZE=128;
+		/*头部字段*/
+        struct Header
+        {
+            StringRef m_name_;
+			/*值已去掉首尾空白，并以'\0'结尾*/
+            StringRef m_value_;
+            HEADER_ID m_id_;
+			/*同名的下一个头部在表中的位置，-1表示没有*/
+            int m_next_;
+        };
+    public:
+        HttpRequest();
+        virtual ~HttpRequest();
+		/*清空头部表*/
+        void Reset();
+		/*解析一行头部"name: value"，line以'\0'结尾且可被原地修改，格式错误或表满时返回false*/
+        bool AddHeader(char* line);
+		/*obs-fold：以空白开头的行是上一个头部值的延续，原地把折行替换为空格*/
+        bool Fold(char* line);
+		/*已知头部的第一次出现，O(1)*/
+        const Header* Find(HEADER_ID id) const;
+		/*同名头部的下一次出现*/
+        const Header* Next(const Header* header) const;
+		/*按名字查找任意头部(忽略大小写)*/
+        const Header* Find(const char* name) const;
+		/*逗号分隔的头部值(所有同名头部)中是否包含token，忽略大小写*/
+        bool HasToken(HEADER_ID id,const char* token) const;
+		/*头部数量*/
+        int Count() const {return m_count_;}
+        const Header& At(int i) const {return m_headers_[i];}
+		/*把头部名字映射为HEADER_ID，不区分大小写，不分配内存*/
+        static HEADER_ID Lookup(const char* name,int len);
+    protected:
+    private:
+        Header m_headers_[MAX_HEADERS];
+        int m_count_;
+		/*每个已知头部第一次和最后一次出现的位置*/
+        int m_first_[HEADER_COUNT];
+        int m_last_[HEADER_COUNT];
+};
+#endif // HTTPREQUEST_H
@@ -13,6 +13,10 @@ class Sem
         virtual ~Sem();
 		//等待信号量
         bool Wait();
+		//等待信号量，最多等待ms毫秒，超时返回false
+        bool TimedWait(int ms);
+		//不阻塞地尝试获取信号量，当前为0时返回false
+        bool TryWait();
 		//增加信号量
         bool Post();
     protected:
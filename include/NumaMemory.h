@@ -0,0 +1,108 @@
+#ifndef NUMAMEMORY_H
+#define NUMAMEMORY_H
+#include <stdint.h>
+#include <sched.h>
+#include <stdio.h>
+#include <atomic>
+#include <vector>
+#include "Locker.h"
+
+/**
+**大页和NUMA感知的内存分配
+**连接表等大块内存优先用2MB大页(MAP_HUGETLB)，不可用时退回普通页并提示透明大页；
+**多节点时按节点绑定内存，工作线程绑定到节点，并统计TLB缺失和跨节点访问
+**不依赖libnuma，直接使用mbind/set_mempolicy系统调用，拓扑来自/sys/devices/system/node
+*/
+class NumaMemory
+{
+    public:
+		/*大页大小*/
+        static const size_t HUGE_PAGE_SIZE=2*1024*1024;
+		/*支持的最大节点数(节点掩码的位数)*/
+        static const int MAX_NODES=64;
+		/*硬件计数器*/
+        enum COUNTER{COUNTER_DTLB_MISS=0,COUNTER_NODE_LOAD,COUNTER_NODE_MISS,COUNTER_COUNT};
+    public:
+        NumaMemory();
+        virtual ~NumaMemory();
+        static NumaMemory* Instance();
+		/*在任何分配之前调用：huge_pages表示使用大页，numa表示按节点分配和绑定线程*/
+        void Configure(bool huge_pages,bool numa);
+		/*节点数，单节点或读不到拓扑时为1*/
+        int Nodes() const {return (int)m_node_ids_.size();}
+		/*调用线程所在的节点(0到Nodes()-1)*/
+        int CurrentNode() const;
+		/*分配size字节，node为节点下标，-1表示在所有节点上交错分配；内容为0，失败返回NULL*/
+        void* Allocate(size_t size,int node);
+		/*释放Allocate分配的内存，size与分配时相同*/
+        void Free(void* address,size_t size);
+		/*提示内核用透明大页映射已有的区域，如缓存的大文件*/
+        void AdviseHuge(void* address,size_t size);
+		/*把第index个工作线程绑定到一个节点，之后该线程的内存优先从本节点分配*/
+        void BindWorker(int index);
+		/*为调用线程打开TLB缺失和跨节点访问计数器*/
+        void AttachThread();
+		/*输出分配情况和所有已登记线程的计数器之和*/
+        void Report(FILE* fp);
+    private:
+		/*按大页或普通页向上取整*/
+        size_t RoundUp(size_t size) const;
+		/*从sysfs读取节点和CPU的对应关系*/
+        void LoadTopology();
+    private:
+        bool m_huge_pages_;
+        bool m_numa_;
+		/*节点下标到节点编号，以及每个节点的CPU*/
+        std::vector<int> m_node_ids_;
+        std::vector<cpu_set_t> m_node_cpus_;
+		/*CPU到节点下标*/
+        std::vector<int> m_cpu_node_;
+		/*用MAP_HUGETLB分配的字节数，退回普通页(提示透明大页)的字节数和次数*/
+        std::atomic<uint64_t> m_huge_bytes_;
+        std::atomic<uint64_t> m_thp_bytes_;
+        std::atomic<uint64_t> m_fallbacks_;
+		/*提示透明大页的文件映射字节数*/
+        std::atomic<uint64_t> m_file_thp_bytes_;
+		/*各节点上绑定分配的字节数，交错分配的字节数，mbind失败次数*/
+        std::atomic<uint64_t> m_node_bytes_[MAX_NODES];
+        std::atomic<uint64_t> m_interleaved_bytes_;
+        std::atomic<uint64_t> m_bind_failures_;
+		/*各线程的计数器描述符，-1表示不可用*/
+        std::vector<int> m_counter_fds_[COUNTER_COUNT];
+        Locker m_counter_locker_;
+};
+
+/**
+**固定大小缓冲区的按节点缓冲池
+**缓冲区从所在节点的大页块中切分，用完后放回原节点的空闲链表，不归还给系统
+*/
+class NumaBufferPool
+{
+    public:
+		/*buffer_size须是4096的倍数，切分出的缓冲区按4096对齐*/
+        explicit NumaBufferPool(size_t buffer_size);
+        virtual ~NumaBufferPool();
+		/*从node节点取一个缓冲区，node为-1时取调用线程所在节点，*node返回实际节点，失败返回NULL*/
+        char* Get(int* node);
+		/*放回缓冲区所属节点的空闲链表*/
+        void Put(char* data,int node);
+    private:
+		/*一个节点的空闲缓冲区*/
+        struct Node
+        {
+            std::vector<char*> m_free_;
+            Locker m_locker_;
+        };
+		/*向节点申请的内存块*/
+        struct Chunk
+        {
+            void* m_address_;
+            size_t m_size_;
+        };
+    private:
+        size_t m_buffer_size_;
+        Node m_nodes_[NumaMemory::MAX_NODES];
+        std::vector<Chunk> m_chunks_;
+        Locker m_chunks_locker_;
+};
+#endif // NUMAMEMORY_H
@@ -0,0 +1,79 @@
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+#include <stdint.h>
+#include <atomic>
+#include <sys/socket.h>
+
+/**
+**一个连接在限流表中占用的位置，连接关闭时归还
+*/
+struct RateTicket
+{
+	/*单个地址和地址前缀(IPv4 /24，IPv6 /64)所在的槽，-1表示没有占用*/
+    int m_ip_slot_;
+    int m_prefix_slot_;
+	/*槽的所有者标签，用于确认槽没有被回收*/
+    uint64_t m_ip_tag_;
+    uint64_t m_prefix_tag_;
+};
+
+/**
+**按客户端地址限制连接数和请求速率
+**固定大小的开放寻址表，accept路径和工作线程只通过原子操作更新，不加锁
+*/
+class RateLimiter
+{
+    public:
+		/*表的槽数，必须是2的幂*/
+        static const int TABLE_SIZE=65536;
+		/*最多探测的槽数，超过时放行(不限流)*/
+        static const int MAX_PROBES=16;
+		/*连接数为0且空闲超过该时间(毫秒)的槽可以被其他地址回收*/
+        static const uint64_t IDLE_RECLAIM_MS=60000;
+    public:
+        RateLimiter();
+        virtual ~RateLimiter();
+        static RateLimiter* Instance();
+		/*设置限制，0表示不限制；速率为每秒请求数，突发为令牌桶容量*/
+        void Configure(int max_conn_per_ip,int max_conn_per_prefix,int rate_per_ip,int burst_per_ip,int rate_per_prefix,int burst_per_prefix);
+		/*accept时调用，超过连接数限制返回false，调用者应直接关闭连接*/
+        bool AcquireConnection(const struct sockaddr* addr,RateTicket* ticket);
+		/*连接关闭时归还连接数*/
+        void ReleaseConnection(RateTicket* ticket);
+		/*每个请求调用一次，超过请求速率返回false，调用者应答429*/
+        bool AllowRequest(const RateTicket* ticket);
+		/*虚拟主机整体的请求速率，host为主机序号，超过速率返回false*/
+        bool AllowHost(int host,int rate,int burst);
+		/*被拒绝的连接数和请求数*/
+        uint64_t RejectedConnections() const {return m_rejected_connections_.load(std::memory_order_relaxed);}
+        uint64_t RejectedRequests() const {return m_rejected_requests_.load(std::memory_order_relaxed);}
+    protected:
+    private:
+		/*表中的一个槽，16字节，一条缓存行4个槽*/
+        struct Entry
+        {
+			/*高48位为地址标签，低16位为当前连接数，为0表示空槽*/
+            std::atomic<uint64_t> m_owner_;
+			/*高24位为令牌数(千分之一个令牌)，低40位为上次补充令牌的时间(毫秒)*/
+            std::atomic<uint64_t> m_bucket_;
+        };
+    private:
+		/*找到键哈希所在的槽，不存在时插入或回收空闲槽，表满时返回-1*/
+        int FindSlot(uint64_t hash,uint64_t now);
+		/*增加连接数，超过limit返回false*/
+        bool AddConnection(int slot,uint64_t tag,int limit);
+        void RemoveConnection(int slot,uint64_t tag);
+		/*从令牌桶取一个令牌*/
+        bool TakeToken(int slot,uint64_t tag,int rate,int burst,uint64_t now);
+    private:
+        Entry* m_table_;
+        int m_max_conn_per_ip_;
+        int m_max_conn_per_prefix_;
+        int m_rate_per_ip_;
+        int m_burst_per_ip_;
+        int m_rate_per_prefix_;
+        int m_burst_per_prefix_;
+        std::atomic<uint64_t> m_rejected_connections_;
+        std::atomic<uint64_t> m_rejected_requests_;
+};
+#endif // RATELIMITER_H
@@ -0,0 +1,81 @@
+#ifndef SENDSCHEDULER_H
+#define SENDSCHEDULER_H
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <queue>
+#include <vector>
+
+/**
+**令牌桶，令牌数为可以发送的字节数
+*/
+struct TokenBucket
+{
+    int64_t m_tokens_;
+    uint64_t m_last_us_;
+};
+
+/**
+**应答数据的发送调度，只在I/O线程使用
+**每个连接每轮事件循环最多发送一个额度，用完后排到下一轮，其他就绪的连接不必等一个大文件发完；
+**可选的全局和单个连接的令牌桶限制发送速率，令牌不足的连接等到补足后再发送；
+**可选按TCP_INFO估算的带宽时延积设置每个连接的发送缓冲区
+*/
+class SendScheduler
+{
+    public:
+		/*每轮的默认额度*/
+        static const size_t DEFAULT_QUANTUM=256*1024;
+		/*令牌不足时至少等到能发送这么多字节，避免频繁的小块发送*/
+        static const size_t MIN_GRANT=16*1024;
+		/*令牌桶的容量对应的时间(微秒)*/
+        static const uint64_t BURST_US=50000;
+		/*两次调整发送缓冲区的最小间隔(微秒)，以及发送缓冲区的范围*/
+        static const uint64_t TUNE_INTERVAL_US=200000;
+        static const int MIN_SNDBUF=64*1024;
+        static const int MAX_SNDBUF=8*1024*1024;
+    public:
+        SendScheduler();
+        virtual ~SendScheduler();
+        static SendScheduler* Instance();
+		/*quantum为每轮额度，global_rate和conn_rate为字节/秒(0表示不限制)，autotune表示调整发送缓冲区*/
+        void Configure(size_t quantum,uint64_t global_rate,uint64_t conn_rate,bool autotune);
+		/*新连接的令牌桶*/
+        void InitBucket(TokenBucket* bucket,uint64_t now_us) const;
+		/*本次最多可以发送的字节数；为0时*wait_us为需要等待的时间*/
+        size_t Grant(TokenBucket* bucket,uint64_t now_us,uint64_t* wait_us);
+		/*已发送bytes字节，从令牌桶中扣除*/
+        void Consume(TokenBucket* bucket,size_t bytes);
+		/*连接用完了本轮额度，下一轮继续发送*/
+        void Defer(uint64_t handle);
+		/*连接的令牌不足，until_us之后继续发送*/
+        void Throttle(uint64_t handle,uint64_t until_us);
+		/*取出本轮可以继续发送的连接*/
+        void TakeRunnable(std::vector<uint64_t>& handles,uint64_t now_us);
+		/*距下一个连接可以发送的毫秒数，没有时返回-1*/
+        int NextTimeout(uint64_t now_us) const;
+		/*按TCP_INFO调整发送缓冲区，*next_us为下次调整的时间，*sndbuf为当前设置(0表示未设置)*/
+        void Tune(int sockfd,uint64_t now_us,uint64_t* next_us,int* sndbuf);
+		/*输出统计*/
+        void Report(FILE* fp);
+    private:
+		/*按经过的时间补充令牌*/
+        void Refill(TokenBucket* bucket,uint64_t rate,uint64_t now_us) const;
+        int64_t Burst(uint64_t rate) const;
+    private:
+        size_t m_quantum_;
+        uint64_t m_global_rate_;
+        uint64_t m_conn_rate_;
+        bool m_autotune_;
+        TokenBucket m_global_;
+		/*本轮用完额度的连接*/
+        std::vector<uint64_t> m_deferred_;
+		/*等待令牌的连接，按时间排序*/
+        typedef std::pair<uint64_t,uint64_t> Wakeup;
+        std::priority_queue<Wakeup,std::vector<Wakeup>,std::greater<Wakeup> > m_throttled_;
+		/*用完额度、等待令牌和调整发送缓冲区的次数*/
+        uint64_t m_deferrals_;
+        uint64_t m_throttles_;
+        uint64_t m_tunes_;
+};
+#endif // SENDSCHEDULER_H
@@ -1,27 +1,64 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 #include <pthread.h>
+#include <stdint.h>
+#include <atomic>
 #include <list>
 #include <stdio.h>
+#include <time.h>
+#include "BusyPoll.h"
+#include "Clock.h"
 #include "Locker.h"
+#include "NumaMemory.h"
+
+/*任务的类别：短任务(已缓存的小文件、协议帧)优先，长任务(大文件、未缓存的文件、动态处理)只占用部分线程*/
+enum TASK_CLASS{TASK_SHORT=0,TASK_LONG,TASK_CLASS_COUNT};
+
 /**
 **线程池模板类
+**任务队列中保存连接句柄而不是指针，T需要提供HandleSlot和Handle，句柄过期的任务直接丢弃
+**短任务和长任务分开排队：空闲线程优先取短任务，同时运行的长任务数有上限，保证短任务总有线程可用；
+**长任务排队超过老化时间后先于短任务执行，避免被持续的短任务饿死
 */
 template<typename T>
 class ThreadPool
 {
     public:
-        //创建并初始化线程池类，线程数，最大请求数
-        ThreadPool(int thread_number=4,int max_requests=10000);
+        //创建并初始化线程池类，连接对象数组，线程数，最大请求数
+        ThreadPool(T* slots,int thread_number=4,int max_requests=10000);
         //销毁线程池类
         virtual ~ThreadPool();
+        //长任务最多占用的线程数(至少1，不超过线程数)和长任务的老化时间(毫秒)，在添加任务前调用
+        void SetLongTaskLimit(int long_workers,int aging_ms);
         //向请求队列添加任务
-        bool Append(T* request);
+        bool Append(uint64_t handle,TASK_CLASS task_class=TASK_SHORT);
+        //输出各类任务的队列长度和排队时间，并清零统计周期内的最大值
+        void Report(FILE* fp);
         //处理函数
         static void* Worker(void *arg);
         //线程池运行
         void Run();
     protected:
+    private:
+        //排队的任务和入队时间(微秒)
+        struct Task
+        {
+            uint64_t m_handle_;
+            uint64_t m_enqueue_us_;
+        };
+        //一类任务的队列和统计
+        struct Queue
+        {
+            std::list<Task> m_tasks_;
+            //已取出的任务数，排队时间之和与最大值(微秒)，统计周期内的最大队列长度
+            uint64_t m_dequeued_;
+            uint64_t m_wait_us_;
+            uint64_t m_max_wait_us_;
+            size_t m_max_depth_;
+        };
+    private:
+        //取出下一个可以运行的任务，要求持有队列锁
+        bool Take(Task* task,TASK_CLASS* task_class);
     private:
         //线程数
         int m_thread_number_;
@@ -29,20 +66,37 @@ class ThreadPool
         int m_max_requests_;
         //描述线程池的数组
         pthread_t* m_threads_;
-        //请求队列
-        std::list<T*>m_workqueue_;
+        //连接对象数组，句柄的槽位是数组下标
+        T* m_slots_;
+        //各类任务的请求队列
+        Queue m_queues_[TASK_CLASS_COUNT];
         //保护请求队列的互斥锁
         Locker m_queuelocker_;
         //信号量，是否有任务处理
         Sem m_queuestat;
         //是否结束线程
         bool m_stop_;
+        //下一个启动的线程的序号，用于绑定NUMA节点
+        std::atomic<int> m_next_index_;
+        //长任务的线程数上限，正在运行的长任务数，老化时间(微秒)，因老化提前执行的长任务数
+        int m_long_workers_;
+        int m_long_running_;
+        uint64_t m_aging_us_;
+        uint64_t m_aged_;
 };
 
 template<typename T>
-ThreadPool<T>::ThreadPool(int thread_number,int max_requests):m_thread_number_(thread_number),m_max_requests_(max_requests),m_stop_(false),m_threads_(NULL)
+ThreadPool<T>::ThreadPool(T* slots,int thread_number,int max_requests):m_thread_number_(thread_number),m_max_requests_(max_requests),m_stop_(false),m_threads_(NULL),m_slots_(slots),m_next_index_(0),
+    m_long_workers_(thread_number),m_long_running_(0),m_aging_us_(0),m_aged_(0)
 {
-    if((thread_number<=0) || (max_requests<=0))
+    for(int i=0;i<TASK_CLASS_COUNT;++i)
+    {
+        m_queues_[i].m_dequeued_=0;
+        m_queues_[i].m_wait_us_=0;
+        m_queues_[i].m_max_wait_us_=0;
+        m_queues_[i].m_max_depth_=0;
+    }
+    if((thread_number<=0) || (max_requests<=0) || !slots)
     {
         throw std::exception();
     }
@@ -76,20 +130,103 @@ ThreadPool<T>::~ThreadPool()
 }
 
 template<typename T>
-bool ThreadPool<T>::Append(T* request)
+void ThreadPool<T>::SetLongTaskLimit(int long_workers,int aging_ms)
+{
+    if(long_workers<1)
+    {
+        long_workers=1;
+    }
+    if(long_workers>m_thread_number_)
+    {
+        long_workers=m_thread_number_;
+    }
+    m_queuelocker_.Lock();
+    m_long_workers_=long_workers;
+    m_aging_us_=(uint64_t)aging_ms*1000;
+    m_queuelocker_.Unlock();
+}
+
+template<typename T>
+bool ThreadPool<T>::Append(uint64_t handle,TASK_CLASS task_class)
 {
     m_queuelocker_.Lock();
-    if(m_workqueue_.size()>m_max_requests_)
+    if(m_queues_[TASK_SHORT].m_tasks_.size()+m_queues_[TASK_LONG].m_tasks_.size()>(size_t)m_max_requests_)
     {
         m_queuelocker_.Unlock();
         return false;
     }
-    m_workqueue_.push_back(request);
+    Queue& queue=m_queues_[task_class];
+    Task task={handle,MonotonicUs()};
+    queue.m_tasks_.push_back(task);
+    if(queue.m_tasks_.size()>queue.m_max_depth_)
+    {
+        queue.m_max_depth_=queue.m_tasks_.size();
+    }
     m_queuelocker_.Unlock();
     m_queuestat.Post();
     return true;
 }
 
+template<typename T>
+bool ThreadPool<T>::Take(Task* task,TASK_CLASS* task_class)
+{
+    std::list<Task>& shorts=m_queues_[TASK_SHORT].m_tasks_;
+    std::list<Task>& longs=m_queues_[TASK_LONG].m_tasks_;
+    uint64_t now=MonotonicUs();
+    TASK_CLASS chosen=TASK_SHORT;
+    if(!longs.empty() && m_long_running_<m_long_workers_)
+    {
+        bool aged=m_aging_us_>0 && now-longs.front().m_enqueue_us_>=m_aging_us_;
+        if(shorts.empty() || aged)
+        {
+            chosen=TASK_LONG;
+            if(!shorts.empty())
+            {
+                m_aged_++;
+            }
+        }
+    }
+    Queue& queue=m_queues_[chosen];
+    if(queue.m_tasks_.empty())
+    {
+        //只剩长任务且已达到上限，等运行中的长任务结束后再取
+        return false;
+    }
+    *task=queue.m_tasks_.front();
+    queue.m_tasks_.pop_front();
+    uint64_t wait=now-task->m_enqueue_us_;
+    queue.m_dequeued_++;
+    queue.m_wait_us_+=wait;
+    if(wait>queue.m_max_wait_us_)
+    {
+        queue.m_max_wait_us_=wait;
+    }
+    if(chosen==TASK_LONG)
+    {
+        m_long_running_++;
+    }
+    *task_class=chosen;
+    return true;
+}
+
+template<typename T>
+void ThreadPool<T>::Report(FILE* fp)
+{
+    static const char* names[TASK_CLASS_COUNT]={"short","long"};
+    m_queuelocker_.Lock();
+    for(int i=0;i<TASK_CLASS_COUNT;++i)
+    {
+        Queue& queue=m_queues_[i];
+        fprintf(fp,"pool %s: depth=%d max_depth=%d tasks=%llu avg_wait_us=%llu max_wait_us=%llu\n",names[i],
+                (int)queue.m_tasks_.size(),(int)queue.m_max_depth_,(unsigned long long)queue.m_dequeued_,
+                (unsigned long long)(queue.m_dequeued_?queue.m_wait_us_/queue.m_dequeued_:0),(unsigned long long)queue.m_max_wait_us_);
+        queue.m_max_depth_=queue.m_tasks_.size();
+        queue.m_max_wait_us_=0;
+    }
+    fprintf(fp,"pool long: running=%d limit=%d aged=%llu\n",m_long_running_,m_long_workers_,(unsigned long long)m_aged_);
+    m_queuelocker_.Unlock();
+}
+
 template <typename T>
 void* ThreadPool<T>::Worker(void* arg)
 {
@@ -101,23 +238,39 @@ void* ThreadPool<T>::Worker(void* arg)
 template<typename T>
 void ThreadPool<T>::Run()
 {
+    //工作线程按序号轮流绑定到各个节点
+    NumaMemory::Instance()->BindWorker(m_next_index_++);
     while(!m_stop_)
     {
-        m_queuestat.Wait();
+        //忙轮询模式下先自旋等待任务
+        BusyPoll::Instance()->WaitSem(m_queuestat);
         m_queuelocker_.Lock();
-        if(m_workqueue_.empty())
+        Task task;
+        TASK_CLASS task_class;
+        if(!Take(&task,&task_class))
         {
             m_queuelocker_.Unlock();
             continue;
         }
-        T* request=m_workqueue_.front();
-        m_workqueue_.pop_front();
         m_queuelocker_.Unlock();
-        if(!request)
+        T* request=m_slots_+T::HandleSlot(task.m_handle_);
+        //排队期间连接已关闭(槽位可能已被新连接复用)，丢弃任务
+        if(request->Handle()==task.m_handle_)
         {
-            continue;
+            request->Process();
+        }
+        if(task_class==TASK_LONG)
+        {
+            //被上限挡住的长任务的信号量已被消耗，结束时补上
+            m_queuelocker_.Lock();
+            m_long_running_--;
+            bool pending=!m_queues_[TASK_LONG].m_tasks_.empty();
+            m_queuelocker_.Unlock();
+            if(pending)
+            {
+                m_queuestat.Post();
+            }
         }
-        request->Process();
     }
 }
 #endif // THREADPOOL_H
@@ -0,0 +1,111 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include "Locker.h"
+
+/*请求处理中追踪的阶段*/
+enum TRACE_SPAN{SPAN_ACCEPT=0,SPAN_READ,SPAN_QUEUE,SPAN_PARSE,SPAN_FILE,SPAN_RESPOND,SPAN_HANDLER,SPAN_WRITE,SPAN_SEND,SPAN_COUNT};
+
+/**
+**一个阶段的起止时间(时间戳计数器的值)和所在的线程
+*/
+struct TraceSpan
+{
+    uint64_t m_start_;
+    uint64_t m_end_;
+    uint32_t m_tid_;
+    uint32_t m_span_;
+};
+
+/**
+**一个请求的追踪，保存在连接对象中，跟随连接在线程间传递，同一时刻只有一个线程访问
+**请求结束时再决定是否保留：按比例采样，或总耗时超过阈值
+*/
+struct RequestTrace
+{
+	/*每个请求最多记录的阶段数，超过的丢弃并计数，最后一个位置留给发送阶段*/
+    static const int MAX_SPANS=32;
+	/*请求编号，0表示还没有记录任何阶段*/
+    uint64_t m_id_;
+	/*第一个阶段的开始时间和最后一个阶段的结束时间(包括丢弃的)*/
+    uint64_t m_first_;
+    uint64_t m_last_;
+	/*进入线程池队列和开始发送的时间，0表示没有*/
+    uint64_t m_queued_;
+    uint64_t m_send_start_;
+    int m_count_;
+    uint32_t m_dropped_;
+    TraceSpan m_spans_[MAX_SPANS];
+	/*准备追踪下一个请求*/
+    void Reset();
+	/*记录一个阶段，第一个阶段分配请求编号*/
+    void Add(TRACE_SPAN span,uint64_t start,uint64_t end);
+};
+
+/**
+**请求追踪，导出为Chrome trace event格式的JSON，可以在chrome://tracing或Perfetto中查看
+**时间戳用时间戳计数器，导出时按单调时钟换算；每个线程把保留的请求写入自己的环形缓冲区
+*/
+class Tracer
+{
+    public:
+        Tracer();
+        virtual ~Tracer();
+        static Tracer* Instance();
+		/*sample_every为每多少个请求保留一个(0表示不按比例)，slow_ms为总是保留的耗时阈值(0表示不按耗时)，
+		buffer_events为每个线程保留的最近的阶段数；前两者都为0时关闭追踪*/
+        void Configure(int sample_every,int slow_ms,size_t buffer_events);
+        bool Enabled() const {return m_sample_every_>0 || m_slow_ticks_>0;}
+		/*当前时间戳*/
+        static uint64_t Now();
+		/*调用线程的线程号*/
+        static uint32_t ThreadId();
+        uint64_t NextId() {return ++m_next_id_;}
+		/*请求结束，按采样条件保留到调用线程的缓冲区，fd为连接的描述符*/
+        void Commit(const RequestTrace* trace,int fd);
+		/*导出所有线程缓冲区中的阶段*/
+        std::string Dump();
+		/*导出到文件，失败返回false*/
+        bool DumpFile(const char* path);
+    private:
+		/*保留下来的一个阶段*/
+        struct Event
+        {
+            TraceSpan m_span_;
+            uint64_t m_id_;
+            int m_fd_;
+        };
+		/*线程的环形缓冲区，导出时需要加锁*/
+        struct ThreadBuffer
+        {
+            std::vector<Event> m_events_;
+			/*已写入的总数，下一个写入位置为m_total_%容量*/
+            uint64_t m_total_;
+            Locker m_locker_;
+        };
+    private:
+        ThreadBuffer* GetThreadBuffer();
+		/*时间戳换算为单调时钟的微秒*/
+        double ToUs(uint64_t ticks,uint64_t base_ticks,double ticks_per_us) const;
+    private:
+        int m_sample_every_;
+        uint64_t m_slow_ticks_;
+        size_t m_buffer_events_;
+		/*校准时的时间戳和单调时钟(纳秒)*/
+        uint64_t m_base_ticks_;
+        uint64_t m_base_ns_;
+        double m_ticks_per_us_;
+        std::atomic<uint64_t> m_next_id_;
+		/*保留的请求数，以及这些请求中超出MAX_SPANS被丢弃的阶段数*/
+        std::atomic<uint64_t> m_committed_;
+        std::atomic<uint64_t> m_dropped_;
+        pthread_key_t m_key_;
+        std::vector<ThreadBuffer*> m_threads_;
+        Locker m_threads_locker_;
+};
+#endif // TRACE_H
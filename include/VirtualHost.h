@@ -0,0 +1,77 @@
+#ifndef VIRTUALHOST_H
+#define VIRTUALHOST_H
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+**一个虚拟主机：按Host头部选择，有自己的根目录、文件缓存预算和整个主机的请求速率
+*/
+struct VirtualHost
+{
+	/*配置中的第一个主机名，默认主机为"*"*/
+    std::string m_name_;
+	/*网站根目录，不以'/'结尾*/
+    std::string m_root_;
+	/*在主机表中的序号，也用作限流表的键*/
+    int m_index_;
+	/*整个主机的每秒请求数和突发，0表示不限制*/
+    int m_rate_;
+    int m_burst_;
+	/*请求数和超过主机速率被拒绝的请求数*/
+    mutable std::atomic<uint64_t> m_requests_;
+    mutable std::atomic<uint64_t> m_rejected_;
+};
+
+/**
+**虚拟主机表，启动时从配置文件加载，之后只读，解析请求时不加锁查找
+**配置文件每行一个主机：names root cache_mb [rate [burst]]
+**names为逗号分隔的主机名(不区分大小写，不含端口)，"*"表示未匹配任何主机名时使用的默认主机；#之后为注释
+*/
+class HostTable
+{
+    public:
+		/*主机名的最大长度*/
+        static const size_t MAX_NAME_LEN=255;
+		/*根目录的最大长度，与URL拼接后要放进HttpConn::FILENAME_LEN*/
+        static const size_t MAX_ROOT_LEN=128;
+    public:
+        HostTable();
+        virtual ~HostTable();
+        static HostTable* Instance();
+		/*加载配置，path为空时只有以root为根目录的默认主机；每个主机的根目录在文件缓存中有自己的预算，失败返回false*/
+        bool Load(const char* path,const char* root);
+		/*按Host头部或:authority查找，忽略端口和结尾的'.'，没有匹配时返回默认主机*/
+        const VirtualHost* Find(const char* host) const;
+        const VirtualHost* Default() const {return m_default_;}
+		/*取一个主机的请求令牌，超过主机速率返回false，调用者应答429*/
+        bool AllowRequest(const VirtualHost* host);
+		/*输出每个主机的请求数*/
+        void Report(FILE* fp);
+    private:
+		/*哈希表中的一个主机名，m_host_为NULL表示空位*/
+        struct HostName
+        {
+            uint64_t m_hash_;
+            std::string m_name_;
+            VirtualHost* m_host_;
+        };
+    private:
+		/*主机名去掉端口和结尾的'.'之后的长度*/
+        static size_t NameLength(const char* host);
+		/*不区分大小写的哈希*/
+        static uint64_t Hash(const char* name,size_t len);
+        bool Insert(const std::string& name,VirtualHost* host);
+		/*解析一行配置，主机名先放入names，全部读完后再建表*/
+        bool ParseLine(char* line,int lineno,const char* path,std::vector<std::pair<std::string,VirtualHost*> >& names);
+    private:
+        std::vector<VirtualHost*> m_hosts_;
+		/*开放寻址表，大小为2的幂且至少是主机名数的两倍*/
+        std::vector<HostName> m_slots_;
+        size_t m_mask_;
+        VirtualHost* m_default_;
+};
+#endif // VIRTUALHOST_H
@@ -0,0 +1,167 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+#include <stdint.h>
+#include <sys/uio.h>
+#include <atomic>
+#include <deque>
+#include <map>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+#include "Locker.h"
+
+class WebSocketSession;
+
+/*编码好的帧，广播时多个连接的发送队列共享同一份*/
+typedef std::shared_ptr<const std::string> WebSocketFrame;
+
+/*收到完整消息时调用，在工作线程上执行，opcode为TEXT或BINARY*/
+typedef void (*WebSocketHandler)(WebSocketSession* session,int opcode,const char* data,size_t len);
+
+/**
+**WebSocket连接，负责帧的解析、分片重组、控制帧和有界的发送队列
+**与Http2Session一样，读写由HttpConn完成，本类只处理内存中的字节
+**输入只由持有连接的线程访问；发送队列可能被广播线程同时访问，由m_locker_保护
+*/
+class WebSocketSession
+{
+    public:
+		/*帧类型*/
+        enum OPCODE{CONTINUATION=0x0,TEXT=0x1,BINARY=0x2,CLOSE=0x8,PING=0x9,PONG=0xa};
+		/*关闭状态码*/
+        enum CLOSE_CODE{CLOSE_NORMAL=1000,CLOSE_GOING_AWAY=1001,CLOSE_PROTOCOL_ERROR=1002,CLOSE_NO_STATUS=1005,
+                                        CLOSE_INVALID_DATA=1007,CLOSE_POLICY=1008,CLOSE_TOO_BIG=1009};
+		/*一条消息(包括所有分片)的最大字节数*/
+        static const size_t MAX_MESSAGE_SIZE=1024*1024;
+		/*未解析的输入超过该值时关闭连接*/
+        static const size_t INPUT_LIMIT=2*MAX_MESSAGE_SIZE;
+		/*发送队列的最大字节数，数据帧超过时视为慢消费者并断开，控制帧不受限制*/
+        static const size_t MAX_SEND_QUEUE=1024*1024;
+		/*一次writev最多的帧数*/
+        static const int MAX_IOV=16;
+		/*空闲超过该时间(毫秒)发送PING，之后仍收不到任何数据则断开*/
+        static const uint64_t PING_INTERVAL_MS=30000;
+        static const uint64_t PONG_TIMEOUT_MS=10000;
+    public:
+		/*handle为连接句柄，用于唤醒I/O线程；channel为升级请求的路径，广播按它分组*/
+        WebSocketSession(uint64_t handle,const char* channel,uint64_t now_ms);
+        virtual ~WebSocketSession();
+		/*计算握手应答的Sec-WebSocket-Accept，key不合法时返回false*/
+        static bool AcceptKey(const char* key,std::string& accept);
+		/*编码一个服务端帧(不加掩码)*/
+        static WebSocketFrame BuildFrame(int opcode,const char* data,size_t len);
+        uint64_t Handle() const {return m_handle_;}
+        const std::string& Channel() const {return m_channel_;}
+		/*追加从socket读到的数据，在I/O线程调用*/
+        bool Append(const char* data,int len,uint64_t now_ms);
+		/*解析已追加的数据并分发完整的消息，在工作线程调用*/
+        void Process();
+		/*发送一条消息，可在任何线程调用，慢消费者返回false*/
+        bool Send(int opcode,const char* data,size_t len);
+		/*把已编码的帧放入发送队列，control表示不受队列上限约束；关闭帧之后的帧被丢弃*/
+        bool Enqueue(const WebSocketFrame& frame,bool control);
+		/*发送关闭帧，之后不再接受数据帧*/
+        void SendClose(int code);
+		/*保活检查，在I/O线程调用*/
+        void Tick(uint64_t now_ms);
+		/*以下方法要求调用者持有Lock()*/
+        void Lock() {m_locker_.Lock();}
+        void Unlock() {m_locker_.Unlock();}
+		/*填充待发送的帧，返回iovec个数*/
+        int OutVec(struct iovec* iov,int max) const;
+		/*已发送n字节*/
+        void OutConsume(size_t n);
+		/*是否需要EPOLLOUT：有待发送的数据，或者连接需要由I/O线程关闭*/
+        bool WantWrite() const {return !m_out_.empty() || m_failed_;}
+		/*连接应当关闭：出错，或者关闭帧已发送完*/
+        bool Finished() const {return m_failed_ || (m_close_sent_ && m_out_.empty());}
+		/*描述符是否已在epoll中注册了事件，未注册时连接正被某个线程处理*/
+        bool Armed() const {return m_armed_;}
+        void SetArmed(bool armed) {m_armed_=armed;}
+		/*I/O线程处理唤醒时清除，之后的入队会再次唤醒*/
+        void ClearWake() {m_wake_pending_=false;}
+    protected:
+    private:
+		/*处理一个完整的帧，payload已去掉掩码，返回false表示停止解析*/
+        bool OnFrame(bool fin,int opcode,const char* payload,size_t len);
+		/*分发一条完整的消息*/
+        bool OnMessage(int opcode,const char* data,size_t len);
+		/*放入发送队列，close表示这是关闭帧*/
+        bool Push(const WebSocketFrame& frame,bool control,bool close);
+		/*协议错误：发送关闭帧并停止解析*/
+        bool Fail(int code);
+    private:
+        uint64_t m_handle_;
+        std::string m_channel_;
+		/*未解析的输入*/
+        std::string m_in_;
+		/*正在重组的分片消息及其类型，m_fragmented_为false时没有*/
+        std::string m_message_;
+        int m_message_opcode_;
+        bool m_fragmented_;
+		/*已收到对端的关闭帧*/
+        bool m_close_received_;
+		/*最后一次收到数据的时间(毫秒)，以及此后是否已发送PING，只在I/O线程访问*/
+        uint64_t m_last_recv_ms_;
+        bool m_ping_sent_;
+		/*以下成员由m_locker_保护*/
+        Locker m_locker_;
+		/*发送队列，队首帧的前m_out_pos_字节已发送*/
+        std::deque<WebSocketFrame> m_out_;
+        size_t m_out_pos_;
+        size_t m_out_bytes_;
+        bool m_close_sent_;
+        bool m_failed_;
+        bool m_armed_;
+        bool m_wake_pending_;
+};
+
+/**
+**所有WebSocket连接的登记表
+**按频道广播，发送队列变化时通过eventfd唤醒I/O线程注册EPOLLOUT
+*/
+class WebSocketHub
+{
+    public:
+		/*保活检查的间隔(毫秒)*/
+        static const uint64_t TICK_INTERVAL_MS=1000;
+    public:
+        WebSocketHub();
+        virtual ~WebSocketHub();
+        static WebSocketHub* Instance();
+		/*创建唤醒I/O线程的eventfd*/
+        bool Open();
+        int WakeFd() const {return m_wake_fd_;}
+		/*设置消息处理函数，NULL恢复默认(广播给同一频道)*/
+        void SetHandler(WebSocketHandler handler);
+        void Dispatch(WebSocketSession* session,int opcode,const char* data,size_t len) {m_handler_(session,opcode,data,len);}
+        void Register(WebSocketSession* session);
+        void Unregister(WebSocketSession* session);
+        int Count() const {return m_count_.load(std::memory_order_relaxed);}
+		/*帧只编码一次，放入频道内所有连接的发送队列；channel为NULL时发给所有连接，返回接收的连接数*/
+        int Broadcast(const char* channel,int opcode,const char* data,size_t len);
+		/*请求I/O线程处理连接的发送队列*/
+        void Wake(uint64_t handle);
+		/*读掉eventfd的计数*/
+        void ClearWakeup();
+		/*取走待唤醒的连接句柄，在I/O线程调用*/
+        void TakePending(std::vector<uint64_t>& handles);
+		/*距上次检查超过TICK_INTERVAL_MS时检查所有连接的保活，在I/O线程调用*/
+        void Tick(uint64_t now_ms);
+		/*热重启排空时向所有连接发送关闭帧(1001)*/
+        void GoingAway();
+    private:
+		/*默认的消息处理：广播给发送者所在的频道*/
+        static void Relay(WebSocketSession* session,int opcode,const char* data,size_t len);
+    private:
+        std::map<std::string,std::set<WebSocketSession*> > m_channels_;
+        std::atomic<int> m_count_;
+        Locker m_locker_;
+        WebSocketHandler m_handler_;
+        int m_wake_fd_;
+        std::vector<uint64_t> m_pending_;
+        Locker m_pending_locker_;
+        uint64_t m_last_tick_ms_;
+};
+#endif // WEBSOCKET_H
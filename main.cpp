@@ -1,25 +1,106 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <sys/epoll.h>
 #include <signal.h>
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
 #include <errno.h>
+#include <time.h>
+#include <new>
 #include "ThreadPool.h"
 #include "HttpConn.h"
+#include "FileCache.h"
+#include "HotRestart.h"
+#include "RateLimiter.h"
+#include "AccessLog.h"
+#include "WebSocket.h"
+#include "NumaMemory.h"
+#include "DiskIo.h"
+#include "Coroutine.h"
+#include "SendScheduler.h"
+#include "BusyPoll.h"
+#include "Trace.h"
+#include "VirtualHost.h"
+#include "Clock.h"
 
 //最大文件描述符
 #define MAX_FD 65536
 //最大事件数
 #define MAX_EVENT_NUMBER 10000
+//监听队列长度
+#define LISTEN_BACKLOG 1024
+//热重启后排空旧连接的最长时间(秒)
+#define DRAIN_TIMEOUT 30
+//单个客户端地址和地址前缀(/24或/64)的最大连接数，0表示不限制
+#define MAX_CONN_PER_IP 256
+#define MAX_CONN_PER_PREFIX 1024
+//单个客户端地址每秒的请求数和突发请求数，超过时应答429
+#define REQUEST_RATE_PER_IP 1000
+#define REQUEST_BURST_PER_IP 2000
+//地址前缀每秒的请求数和突发请求数
+#define REQUEST_RATE_PER_PREFIX 4000
+#define REQUEST_BURST_PER_PREFIX 8000
+//在I/O线程上直接应答的已缓存文件的最大字节数，0表示所有请求都交给线程池
+#define INLINE_MAX_FILE_SIZE (64*1024)
+//按短任务调度的已缓存文件的最大字节数，更大的、未缓存的文件和协程处理函数按长任务调度
+#define SHORT_TASK_MAX_FILE_SIZE (256*1024)
+//长任务最多同时占用的工作线程数，其余线程保留给短任务
+#define LONG_TASK_WORKERS 2
+//长任务排队超过该时间(毫秒)后先于短任务执行
+#define LONG_TASK_AGING_MS 100
+//二进制访问日志的文件名前缀，文件名为前缀.时间.序号.wsal
+#define ACCESS_LOG_PREFIX "access"
+//单个访问日志文件的最大字节数，超过时轮转
+#define ACCESS_LOG_ROTATE_BYTES (256ull*1024*1024)
+//是否以O_DIRECT写访问日志，绕过页缓存
+#define ACCESS_LOG_DIRECT false
+//连接表和日志缓冲区是否使用2MB大页，没有预留大页时退回普通页并提示透明大页
+#define USE_HUGE_PAGES true
+//多节点机器上是否把工作线程绑定到节点，并从线程所在节点分配缓冲区
+#define NUMA_AWARE true
+//每个连接每轮事件循环最多发送的字节数，用完后让给其他连接
+#define SEND_QUANTUM (256*1024)
+//全局和单个连接的发送速率上限(字节/秒)，0表示不限制
+#define EGRESS_RATE_LIMIT 0
+#define CONN_RATE_LIMIT 0
+//按TCP_INFO估算的带宽时延积设置每个连接的发送缓冲区，关闭时使用内核的自动调整
+#define SNDBUF_AUTOTUNE false
+//读入冷文件数据的磁盘线程数，0表示在I/O线程上直接缺页读入
+#define DISK_IO_THREADS 2
+//忙轮询：I/O线程和工作线程每次睡眠前最多自旋的微秒数，0表示关闭；只适合CPU独占、追求尾延迟的主机
+#define BUSY_POLL_LOOP_US 0
+#define BUSY_POLL_WORKER_US 0
+//自旋总是落空时逐步缩短直至直接阻塞，负载回升时恢复
+#define BUSY_POLL_ADAPTIVE true
+//协程处理函数示例的路径：读取消息体，按查询串delay=毫秒等待后原样返回；空串表示不登记
+#define ECHO_HANDLER_PATH "/echo"
+//请求追踪：每多少个请求保留一个，以及总耗时超过多少毫秒的请求总是保留，都为0时关闭
+#define TRACE_SAMPLE_EVERY 0
+#define TRACE_SLOW_MS 0
+//每个线程保留的最近的追踪阶段数
+#define TRACE_BUFFER_EVENTS 65536
+//导出追踪的管理路径，只应答本机的请求；收到SIGUSR1时同时写到当前目录的trace.<pid>.json
+#define TRACE_DUMP_PATH "/debug/trace"
+//代替网站根目录的归档(由tools/DocPacker生成)，空串表示直接访问根目录；第三个命令行参数优先
+#define DOC_ARCHIVE ""
+//虚拟主机配置文件，每行：主机名 根目录 缓存MB [每秒请求数 [突发]]，空表示只服务命令行的根目录
+#define VHOST_CONFIG ""
+//TCP_DEFER_ACCEPT的秒数：请求数据到达后才完成accept，0表示不设置
+#define DEFER_ACCEPT_SECONDS 0
+//TCP Fast Open等待accept的队列长度，SYN可以携带请求，0表示不启用(还需要net.ipv4.tcp_fastopen允许服务端)
+#define FAST_OPEN_QUEUE 0
+//accept后立即读取第一个请求，有数据时在同一轮事件循环中处理，与TCP_DEFER_ACCEPT一起使用命中率最高
+#define READ_ON_ACCEPT false
 
-//定义添加需要监听的文件描述符，是否设置为只能被一个线程操作
-extern int AddFd(int epollfd,int fd,bool one_shot);
+//定义添加需要监听的文件描述符，是否设置为只能被一个线程操作，handle随事件返回
+extern void AddFd(int epollfd,int fd,bool one_shot,uint64_t handle);
 //移除监听的文件描述符
-extern int RemoveFd(int epollfd,int fd);
+extern void RemoveFd(int epollfd,int fd);
 
 //设置信号的处理函数
 void AddSig(int sig,void(handler)(int),bool restart=true)
@@ -35,6 +116,23 @@ void AddSig(int sig,void(handler)(int),bool restart=true)
     assert(sigaction(sig,&sa,NULL)!=-1);
 }
 
+//收到SIGUSR2(二进制升级)或SIGHUP(重新加载配置)时置位
+static volatile sig_atomic_t restart_requested=0;
+
+//热重启信号的处理函数，只置标志，由主循环完成交接
+void RestartHandler(int)
+{
+    restart_requested=1;
+}
+
+//收到SIGUSR1时置位，主循环输出内存统计
+static volatile sig_atomic_t stats_requested=0;
+
+void StatsHandler(int)
+{
+    stats_requested=1;
+}
+
 //输出错误信息
 void ShowError(int connfd,const char* info)
 {
@@ -43,74 +141,354 @@ void ShowError(int connfd,const char* info)
     close(connfd);
 }
 
-int main()
+#if defined(__cpp_impl_coroutine)
+//协程处理函数示例，等待期间不占用工作线程
+static CoTask EchoHandler(CoRequest& request)
+{
+    const std::string& body=co_await request.ReadBody();
+    const char* delay=strstr(request.Query(),"delay=");
+    if(delay)
+    {
+        co_await request.SleepFor(strtoul(delay+6,NULL,10));
+    }
+    co_await request.Respond(200,"application/octet-stream",body);
+}
+
+//导出请求追踪，只应答本机的请求
+static CoTask TraceHandler(CoRequest& request)
+{
+    struct sockaddr_in peer;
+    socklen_t len=sizeof(peer);
+    if(getpeername(request.Socket(),(struct sockaddr*)&peer,&len)!=0 || peer.sin_family!=AF_INET ||
+       (ntohl(peer.sin_addr.s_addr)>>24)!=127)
+    {
+        co_await request.Respond(403,"text/plain","Forbidden\n");
+        co_return;
+    }
+    co_await request.Respond(200,"application/json",Tracer::Instance()->Dump());
+}
+#endif
+
+//网站根目录，定义在HttpConn.cpp
+extern const char* doc_root;
+
+int main(int argc,char* argv[])
 {
     const char* ip="0.0.0.0";
     int port=8080;
+	//可选参数：端口、网站根目录和归档，热重启时原样传给新进程
+    const char* archive=DOC_ARCHIVE;
+    if(argc>1)
+    {
+        port=atoi(argv[1]);
+    }
+    if(argc>2)
+    {
+        doc_root=argv[2];
+    }
+    if(argc>3)
+    {
+        archive=argv[3];
+    }
+    HotRestart::Init(argc,argv);
 	//忽略SIGPIPE信号
     AddSig(SIGPIPE,SIG_IGN);
+	//热重启信号不能自动重启epoll_wait，主循环需要被打断
+    AddSig(SIGUSR2,RestartHandler,false);
+    AddSig(SIGHUP,RestartHandler,false);
+    AddSig(SIGUSR1,StatsHandler,false);
+	//内存分配策略要在第一次分配之前确定
+    NumaMemory::Instance()->Configure(USE_HUGE_PAGES,NUMA_AWARE);
+    NumaMemory::Instance()->AttachThread();
+	//按客户端地址限制连接数和请求速率
+    RateLimiter::Instance()->Configure(MAX_CONN_PER_IP,MAX_CONN_PER_PREFIX,REQUEST_RATE_PER_IP,REQUEST_BURST_PER_IP,
+                                       REQUEST_RATE_PER_PREFIX,REQUEST_BURST_PER_PREFIX);
+	//访问日志打开失败时不记录，不影响服务
+    if(!AccessLog::Instance()->Open(ACCESS_LOG_PREFIX,ACCESS_LOG_ROTATE_BYTES,ACCESS_LOG_DIRECT))
+    {
+        printf("access log disabled\n");
+    }
+	//预先为可能的客户分配连接对象，连接表被所有线程访问，在各节点上交错分配
+    void* users_memory=NumaMemory::Instance()->Allocate(sizeof(HttpConn)*MAX_FD,-1);
+    assert(users_memory);
+    HttpConn* users=(HttpConn*)users_memory;
+    for(int i=0;i<MAX_FD;++i)
+    {
+        new(users+i) HttpConn;
+    }
+	//协程处理函数的路由在线程池启动前登记，之后只读
+#if defined(__cpp_impl_coroutine)
+    if(strlen(ECHO_HANDLER_PATH)>0)
+    {
+        CoRouter::Instance()->Add(ECHO_HANDLER_PATH,EchoHandler);
+    }
+#endif
+	//追踪要在处理第一个请求之前开启
+    Tracer::Instance()->Configure(TRACE_SAMPLE_EVERY,TRACE_SLOW_MS,TRACE_BUFFER_EVENTS);
+#if defined(__cpp_impl_coroutine)
+    if(Tracer::Instance()->Enabled() && strlen(TRACE_DUMP_PATH)>0)
+    {
+        CoRouter::Instance()->Add(TRACE_DUMP_PATH,TraceHandler);
+    }
+#endif
+	//工作线程启动前确定是否自旋等待任务
+    BusyPoll::Instance()->Configure(BUSY_POLL_LOOP_US,BUSY_POLL_WORKER_US,BUSY_POLL_ADAPTIVE);
+	//任务队列中是连接句柄，线程池通过句柄的槽位找到连接对象
     ThreadPool<HttpConn>* pool=NULL;
     try
     {
-        pool=new ThreadPool<HttpConn>;
+        pool=new ThreadPool<HttpConn>(users);
+        pool->SetLongTaskLimit(LONG_TASK_WORKERS,LONG_TASK_AGING_MS);
     }
     catch(...)
     {
         return 1;
     }
-	//预先为可能的客户分配连接对象
-    HttpConn* users=new HttpConn[MAX_FD];
-    assert(users);
     //int user_count=0;
-    int listenfd=socket(PF_INET,SOCK_STREAM,0);
-    assert(listenfd>=0);
-	//设置连接的断开方式，强制退出
-    struct linger tmp={1,0};
-	//设置套接口选项
-    setsockopt(listenfd,SOL_SOCKET,SO_LINGER,&tmp,sizeof(tmp));
-    int ret=0;
-    struct sockaddr_in address;
-    bzero(&address,sizeof(address));
-    address.sin_family=AF_INET;
-    inet_pton(AF_INET,ip,&address.sin_addr);
-    address.sin_port=htons(port);
-    ret=bind(listenfd,(struct sockaddr*)&address,sizeof(address));
-    assert(ret>=0);
-    ret=listen(listenfd,5);
-    assert(ret>=0);
+	//热重启启动时从旧进程接收监听socket和热点文件列表
+    std::vector<std::string> hot_keys;
+    int listenfd=HotRestart::Receive(hot_keys);
+    if(listenfd<0)
+    {
+        listenfd=socket(PF_INET,SOCK_STREAM,0);
+        assert(listenfd>=0);
+		//不再设置SO_LINGER{1,0}：它会被accept的连接继承，关闭时发送RST
+        int reuse=1;
+        setsockopt(listenfd,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
+        int ret=0;
+        struct sockaddr_in address;
+        bzero(&address,sizeof(address));
+        address.sin_family=AF_INET;
+        inet_pton(AF_INET,ip,&address.sin_addr);
+        address.sin_port=htons(port);
+        ret=bind(listenfd,(struct sockaddr*)&address,sizeof(address));
+        assert(ret>=0);
+		//热重启时这些选项随监听socket一起传给新进程
+        if(DEFER_ACCEPT_SECONDS>0)
+        {
+            int seconds=DEFER_ACCEPT_SECONDS;
+            setsockopt(listenfd,IPPROTO_TCP,TCP_DEFER_ACCEPT,&seconds,sizeof(seconds));
+        }
+        if(FAST_OPEN_QUEUE>0)
+        {
+            int queue=FAST_OPEN_QUEUE;
+            if(setsockopt(listenfd,IPPROTO_TCP,TCP_FASTOPEN,&queue,sizeof(queue))<0)
+            {
+                printf("TCP_FASTOPEN not supported\n");
+            }
+        }
+        ret=listen(listenfd,LISTEN_BACKLOG);
+        assert(ret>=0);
+    }
     struct epoll_event events[MAX_EVENT_NUMBER];
     int epollfd=epoll_create(5);
     assert(epollfd!=-1);
-    AddFd(epollfd,listenfd,false);
+    BusyPoll::Instance()->SetupEpoll(epollfd);
+	//监听socket的句柄代数为0，不会与连接的句柄相同
+    AddFd(epollfd,listenfd,false,HttpConn::MakeHandle(listenfd,0));
     HttpConn::m_epollfd_=epollfd;
+	//其他线程向WebSocket连接广播后通过eventfd唤醒主循环注册EPOLLOUT
+    int wakefd=-1;
+    if(WebSocketHub::Instance()->Open())
+    {
+        wakefd=WebSocketHub::Instance()->WakeFd();
+        AddFd(epollfd,wakefd,false,HttpConn::MakeHandle(wakefd,0));
+    }
+    std::vector<uint64_t> wake_handles;
+	//冷文件数据读入后唤醒主循环继续发送
+    int diskfd=-1;
+    if(DISK_IO_THREADS>0 && DiskIo::Instance()->Start(DISK_IO_THREADS))
+    {
+        diskfd=DiskIo::Instance()->WakeFd();
+        AddFd(epollfd,diskfd,false,HttpConn::MakeHandle(diskfd,0));
+    }
+	//协程处理函数等待的定时器和描述符由主循环检查
+    int cofd=-1;
+    if(CoReactor::Instance()->Open(epollfd))
+    {
+        cofd=CoReactor::Instance()->WakeFd();
+        AddFd(epollfd,cofd,false,HttpConn::MakeHandle(cofd,0));
+    }
+    SendScheduler::Instance()->Configure(SEND_QUANTUM,EGRESS_RATE_LIMIT,CONN_RATE_LIMIT,SNDBUF_AUTOTUNE);
+    HttpConn::m_inline_max_size_=INLINE_MAX_FILE_SIZE;
+    HttpConn::m_short_max_size_=SHORT_TASK_MAX_FILE_SIZE;
+	//按Host选择根目录，每个主机的缓存分区在预热之前建立
+    if(!HostTable::Instance()->Load(VHOST_CONFIG,doc_root))
+    {
+        return 1;
+    }
+	//指定了归档却打不开时不能退回根目录，否则会服务另一个版本的文件
+    if(strlen(archive)>0 && !FileCache::Instance()->OpenArchive(archive,doc_root))
+    {
+        printf("cannot open archive %s\n",archive);
+        return 1;
+    }
+	//预热文件缓存后通知旧进程停止accept
+    FileCache::Instance()->Prewarm(hot_keys);
+    HotRestart::Ready();
+	//排空旧连接的截止时间
+    time_t drain_deadline=0;
+	//等待新进程就绪通知的通信socket，-1表示没有进行中的热重启
+    int handoffd=-1;
     while(true)
     {
-        int number=epoll_wait(epollfd,events,MAX_EVENT_NUMBER,-1);
+		//排空期间和有WebSocket连接(保活检查)时每秒醒来一次
+        int timeout=(HttpConn::m_draining_ || WebSocketHub::Instance()->Count()>0)?1000:-1;
+		//协程的定时器更早到期时提前醒来
+        int co_timeout=CoReactor::Instance()->NextTimeout(MonotonicMs());
+        if(co_timeout>=0 && (timeout<0 || co_timeout<timeout))
+        {
+            timeout=co_timeout;
+        }
+		//有连接等待下一轮发送或等待限速的令牌
+        int send_timeout=SendScheduler::Instance()->NextTimeout(MonotonicUs());
+        if(send_timeout>=0 && (timeout<0 || send_timeout<timeout))
+        {
+            timeout=send_timeout;
+        }
+		//等待新进程就绪的超时
+        int handoff_timeout=HotRestart::NextTimeout();
+        if(handoff_timeout>=0 && (timeout<0 || handoff_timeout<timeout))
+        {
+            timeout=handoff_timeout;
+        }
+        int number=BusyPoll::Instance()->Wait(epollfd,events,MAX_EVENT_NUMBER,timeout);
         if((number<0)&&(errno!=EINTR))
         {
             printf("epoll failure\n");
             break;
         }
+        if(stats_requested)
+        {
+            stats_requested=0;
+            NumaMemory::Instance()->Report(stdout);
+            DiskIo::Instance()->Report(stdout);
+            pool->Report(stdout);
+            SendScheduler::Instance()->Report(stdout);
+            BusyPoll::Instance()->Report(stdout);
+            HttpConn::ReportAccept(stdout);
+            HostTable::Instance()->Report(stdout);
+            FileCache::Instance()->Report(stdout);
+            if(Tracer::Instance()->Enabled())
+            {
+                char trace_path[64];
+                snprintf(trace_path,sizeof(trace_path),"trace.%d.json",(int)getpid());
+                printf("trace: %s %s\n",trace_path,Tracer::Instance()->DumpFile(trace_path)?"written":"failed");
+            }
+            fflush(stdout);
+        }
+        if(restart_requested && !HttpConn::m_draining_ && handoffd<0)
+        {
+            restart_requested=0;
+            std::vector<std::string> keys;
+            FileCache::Instance()->Snapshot(keys,HotRestart::MAX_SNAPSHOT_KEYS);
+			//新进程预热期间继续服务，就绪通知由主循环处理
+            handoffd=HotRestart::StartHandoff(listenfd,keys);
+            if(handoffd>=0)
+            {
+                AddFd(epollfd,handoffd,false,HttpConn::MakeHandle(handoffd,0));
+            }
+        }
+        if(handoffd>=0 && HotRestart::NextTimeout()==0)
+        {
+            HotRestart::AbortHandoff();
+            handoffd=-1;
+        }
+        if(HttpConn::m_draining_ && (HttpConn::m_user_count_<=0 || time(NULL)>=drain_deadline))
+        {
+            printf("drained, %d connections left\n",HttpConn::m_user_count_);
+            break;
+        }
         for(int i=0;i<number;++i)
         {
-            int sockfd=events[i].data.fd;
-            if(sockfd==listenfd)
+            uint64_t handle=events[i].data.u64;
+            int sockfd=HttpConn::HandleSlot(handle);
+            if(sockfd==listenfd && HttpConn::HandleGeneration(handle)==0)
             {
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength=sizeof(client_address);
-                int connfd=accept(listenfd,(struct sockaddr*)&client_address,&client_addrlength);
-                if(connfd<0)
+				//监听socket是ET模式，一次取完所有已完成的连接
+                while(true)
                 {
-                    printf("errno is:%d\n",errno);
-                    continue;
+                    struct sockaddr_in client_address;
+                    socklen_t client_addrlength=sizeof(client_address);
+                    uint64_t accept_start=Tracer::Now();
+					//直接得到非阻塞的描述符，快速路径不需要再设置
+                    int connfd=accept4(listenfd,(struct sockaddr*)&client_address,&client_addrlength,SOCK_NONBLOCK);
+                    if(connfd<0)
+                    {
+                        if(errno!=EAGAIN && errno!=EWOULDBLOCK)
+                        {
+                            printf("errno is:%d\n",errno);
+                        }
+                        break;
+                    }
+                    if(HttpConn::m_user_count_>=MAX_FD)
+                    {
+                        ShowError(connfd,"Internal server busy");
+                        continue;
+                    }
+					//超过该地址的连接数限制，直接丢弃
+                    RateTicket ticket;
+                    if(!RateLimiter::Instance()->AcquireConnection((struct sockaddr*)&client_address,&ticket))
+                    {
+                        close(connfd);
+                        continue;
+                    }
+                    BusyPoll::Instance()->SetupSocket(connfd);
+					//初始化客户连接
+                    users[connfd].Init(connfd,client_address,ticket,!READ_ON_ACCEPT);
+                    users[connfd].TraceAccept(accept_start);
+					//请求已经到达时省去注册事件和下一轮等待，与可读事件的处理相同
+                    bool ready=false;
+                    if(READ_ON_ACCEPT && !users[connfd].ReadOnAccept(&ready))
+                    {
+                        users[connfd].Close();
+                    }
+                    else if(ready && !users[connfd].ProcessInline())
+                    {
+                        pool->Append(users[connfd].Handle(),users[connfd].LongTask()?TASK_LONG:TASK_SHORT);
+                    }
                 }
-                if(HttpConn::m_user_count_>=MAX_FD)
+            }
+            else if(sockfd==handoffd && HttpConn::HandleGeneration(handle)==0)
+            {
+                int ret=HotRestart::FinishHandoff();
+                if(ret!=0)
                 {
-                    ShowError(connfd,"Internal server busy");
-                    continue;
+                    handoffd=-1;
                 }
-				//初始化客户连接
-                users[connfd].Init(connfd,client_address);
+				//新进程就绪后停止accept，已有连接在截止时间前继续服务
+                if(ret>0)
+                {
+                    RemoveFd(epollfd,listenfd);
+                    close(listenfd);
+                    listenfd=-1;
+                    HttpConn::m_draining_=true;
+                    drain_deadline=time(NULL)+DRAIN_TIMEOUT;
+					//WebSocket连接不会自己结束，通知客户端重连到新进程
+                    WebSocketHub::Instance()->GoingAway();
+                }
+            }
+            else if(sockfd==diskfd && HttpConn::HandleGeneration(handle)==0)
+            {
+                DiskIo::Instance()->ClearWakeup();
+            }
+            else if(sockfd==wakefd && HttpConn::HandleGeneration(handle)==0)
+            {
+                WebSocketHub::Instance()->ClearWakeup();
+            }
+            else if(sockfd==cofd && HttpConn::HandleGeneration(handle)==0)
+            {
+                CoReactor::Instance()->ClearWakeup();
+            }
+			//代数0的其他描述符是协程处理函数等待的描述符
+            else if(HttpConn::HandleGeneration(handle)==0)
+            {
+                CoReactor::Instance()->OnFdEvent(sockfd);
+            }
+			//连接已关闭，槽位可能已被新连接复用，丢弃过期事件
+            else if(users[sockfd].Handle()!=handle)
+            {
+                continue;
             }
 			//异常，直接关闭连接
             else if(events[i].events &(EPOLLRDHUP | EPOLLHUP | EPOLLERR))
@@ -121,7 +499,11 @@ int main()
             {
                 if(users[sockfd].Read())
                 {
-                    pool->Append(users+sockfd);
+					//已缓存的小文件在本线程直接应答，其余交给线程池
+                    if(!users[sockfd].ProcessInline())
+                    {
+                        pool->Append(handle,users[sockfd].LongTask()?TASK_LONG:TASK_SHORT);
+                    }
                 }
                 else
                 {
@@ -138,11 +520,62 @@ int main()
             else
             {
             }
+        }
+		//上一轮用完额度和令牌已补足的连接各再发送一个额度，等待期间它们没有注册事件
+        SendScheduler::Instance()->TakeRunnable(wake_handles,MonotonicUs());
+        for(size_t i=0;i<wake_handles.size();++i)
+        {
+            int sockfd=HttpConn::HandleSlot(wake_handles[i]);
+            if(users[sockfd].Handle()==wake_handles[i] && !users[sockfd].Write())
+            {
+                users[sockfd].Close();
+            }
+        }
+		//冷数据已读入的连接从断点继续发送，等待期间它们没有注册事件
+        DiskIo::Instance()->TakeCompleted(wake_handles);
+        for(size_t i=0;i<wake_handles.size();++i)
+        {
+            int sockfd=HttpConn::HandleSlot(wake_handles[i]);
+            if(users[sockfd].Handle()==wake_handles[i] && !users[sockfd].Write())
+            {
+                users[sockfd].Close();
+            }
+        }
+		//等待条件已满足的协程交给线程池恢复
+        CoReactor::Instance()->TakeReady(wake_handles,MonotonicMs());
+        for(size_t i=0;i<wake_handles.size();++i)
+        {
+            int sockfd=HttpConn::HandleSlot(wake_handles[i]);
+            if(users[sockfd].Handle()==wake_handles[i])
+            {
+                pool->Append(wake_handles[i],TASK_LONG);
+            }
+        }
+		//本轮事件处理完后再处理唤醒：已触发的描述符都已标记为未注册，不会被重复注册
+        WebSocketHub::Instance()->Tick(MonotonicMs());
+        WebSocketHub::Instance()->TakePending(wake_handles);
+        for(size_t i=0;i<wake_handles.size();++i)
+        {
+            int sockfd=HttpConn::HandleSlot(wake_handles[i]);
+            if(users[sockfd].Handle()==wake_handles[i])
+            {
+                users[sockfd].WakeWebSocket();
+            }
         }
     }
     close(epollfd);
-    close(listenfd);
-    delete []users;
+    if(listenfd>=0)
+    {
+        close(listenfd);
+    }
     delete pool;
+    DiskIo::Instance()->Stop();
+    for(int i=0;i<MAX_FD;++i)
+    {
+        users[i].~HttpConn();
+    }
+    NumaMemory::Instance()->Free(users_memory,sizeof(HttpConn)*MAX_FD);
+	//写入所有线程缓冲区中的访问记录
+    AccessLog::Instance()->Close();
     return 0;
 }
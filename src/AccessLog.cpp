@@ -0,0 +1,360 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "AccessLog.h"
+#include "Clock.h"
+
+/*填充记录至少需要一个记录头*/
+static const size_t PAD_MIN=sizeof(AccessRecordHeader);
+/*单条记录的最大长度*/
+static const size_t RECORD_MAX=sizeof(AccessPathRecord)+AccessLog::MAX_PATH_LEN;
+
+/*写入全部数据*/
+static bool WriteAll(int fd,const char* data,size_t len)
+{
+    while(len>0)
+    {
+        ssize_t n=write(fd,data,len);
+        if(n<0)
+        {
+            if(errno==EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data+=n;
+        len-=n;
+    }
+    return true;
+}
+
+/*在缓冲区末尾追加填充记录，使长度是align的倍数*/
+static size_t PadTo(char* data,size_t used,size_t align)
+{
+    size_t rem=used%align;
+    if(rem==0)
+    {
+        return used;
+    }
+    size_t pad=align-rem;
+    if(pad<PAD_MIN)
+    {
+        pad+=align;
+    }
+    AccessRecordHeader header;
+    header.m_type_=ACCESS_RECORD_PAD;
+    header.m_length_=pad;
+    memcpy(data+used,&header,sizeof(header));
+    memset(data+used+sizeof(header),0,pad-sizeof(header));
+    used+=pad;
+    return used;
+}
+
+AccessLog::AccessLog():m_open_(false),m_stop_(false),m_direct_(false),m_rotate_bytes_(0),m_fd_(-1),m_file_bytes_(0),m_sequence_(0),m_pool_(BUFFER_SIZE)
+{
+    pthread_key_create(&m_key_,NULL);
+}
+
+AccessLog::~AccessLog()
+{
+    Close();
+}
+
+AccessLog* AccessLog::Instance()
+{
+    static AccessLog log;
+    return &log;
+}
+
+uint64_t AccessLog::NowUs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    return (uint64_t)ts.tv_sec*1000000+ts.tv_nsec/1000;
+}
+
+bool AccessLog::Open(const char* prefix,uint64_t rotate_bytes,bool direct)
+{
+    m_prefix_=prefix;
+    m_rotate_bytes_=rotate_bytes;
+    m_direct_=direct;
+    if(!Rotate())
+    {
+        return false;
+    }
+    m_stop_=false;
+    if(pthread_create(&m_thread_,NULL,Writer,this)!=0)
+    {
+        close(m_fd_);
+        m_fd_=-1;
+        return false;
+    }
+    m_open_=true;
+    return true;
+}
+
+void AccessLog::Close()
+{
+    if(!m_open_)
+    {
+        return;
+    }
+    m_open_=false;
+    m_stop_=true;
+    m_queue_stat_.Post();
+    pthread_join(m_thread_,NULL);
+    if(m_fd_>=0)
+    {
+        close(m_fd_);
+        m_fd_=-1;
+    }
+}
+
+AccessLog::Buffer AccessLog::NewBuffer(int node)
+{
+    Buffer buffer;
+    /*缓冲池按页对齐，满足O_DIRECT的要求*/
+    buffer.m_node_=node;
+    buffer.m_data_=m_pool_.Get(&buffer.m_node_);
+    buffer.m_used_=0;
+    buffer.m_first_ms_=0;
+    return buffer;
+}
+
+AccessLog::ThreadState* AccessLog::GetThreadState()
+{
+    ThreadState* state=(ThreadState*)pthread_getspecific(m_key_);
+    if(!state)
+    {
+        /*线程第一次写日志时注册，线程状态随进程存在*/
+        state=new ThreadState;
+        state->m_buffer_=NewBuffer();
+        pthread_setspecific(m_key_,state);
+        m_threads_locker_.Lock();
+        m_threads_.push_back(state);
+        m_threads_locker_.Unlock();
+    }
+    return state;
+}
+
+void AccessLog::Reserve(ThreadState* state,size_t len)
+{
+    Buffer& buffer=state->m_buffer_;
+    /*预留对齐填充的空间*/
+    if(buffer.m_used_+len+DIRECT_ALIGN+PAD_MIN>BUFFER_SIZE)
+    {
+        Submit(buffer);
+        buffer=NewBuffer();
+        state->m_paths_.clear();
+    }
+}
+
+void AccessLog::Append(ThreadState* state,const void* data,size_t len)
+{
+    Reserve(state,len);
+    Buffer& buffer=state->m_buffer_;
+    if(!buffer.m_data_)
+    {
+        return;
+    }
+    if(buffer.m_used_==0)
+    {
+        buffer.m_first_ms_=MonotonicCoarseMs();
+    }
+    memcpy(buffer.m_data_+buffer.m_used_,data,len);
+    buffer.m_used_+=len;
+}
+
+void AccessLog::Submit(Buffer& buffer)
+{
+    if(!buffer.m_data_ || buffer.m_used_==0)
+    {
+        return;
+    }
+    m_queue_locker_.Lock();
+    m_queue_.push_back(buffer);
+    m_queue_locker_.Unlock();
+    m_queue_stat_.Post();
+    buffer.m_data_=NULL;
+}
+
+uint32_t AccessLog::InternPath(ThreadState* state,const char* path)
+{
+    /*查询字符串由客户端任意构造，不进入字典*/
+    std::string key(path,strcspn(path,"?"));
+    if(key.size()>MAX_PATH_LEN)
+    {
+        key.resize(MAX_PATH_LEN);
+    }
+    std::unordered_map<std::string,uint32_t>::iterator it=state->m_paths_.find(key);
+    if(it!=state->m_paths_.end())
+    {
+        return it->second;
+    }
+	/*字典大小有上限，随机路径的探测不会让内存无限增长*/
+    if(state->m_paths_.size()>=MAX_BUFFER_PATHS)
+    {
+        return ACCESS_PATH_OTHER;
+    }
+    uint32_t id=state->m_paths_.size();
+    state->m_paths_[key]=id;
+    char record[RECORD_MAX];
+    AccessPathRecord* header=(AccessPathRecord*)record;
+    header->m_header_.m_type_=ACCESS_RECORD_PATH;
+    header->m_header_.m_length_=sizeof(AccessPathRecord)+key.size();
+    header->m_path_id_=id;
+    memcpy(record+sizeof(AccessPathRecord),key.data(),key.size());
+    Append(state,record,header->m_header_.m_length_);
+    return id;
+}
+
+void AccessLog::Log(AccessRequestRecord* record,const char* path)
+{
+    if(!m_open_)
+    {
+        return;
+    }
+    record->m_header_.m_type_=ACCESS_RECORD_REQUEST;
+    record->m_header_.m_length_=sizeof(AccessRequestRecord);
+    ThreadState* state=GetThreadState();
+    state->m_locker_.Lock();
+	/*路径记录和请求记录必须在同一个缓冲区，先一起预留空间*/
+    Reserve(state,RECORD_MAX+sizeof(AccessRequestRecord));
+    record->m_path_id_=InternPath(state,path?path:"");
+    Append(state,record,sizeof(AccessRequestRecord));
+    state->m_locker_.Unlock();
+}
+
+void* AccessLog::Writer(void* arg)
+{
+    AccessLog* log=(AccessLog*)arg;
+    log->Run();
+    return log;
+}
+
+void AccessLog::Run()
+{
+    while(true)
+    {
+        bool woken=m_queue_stat_.TimedWait(FLUSH_INTERVAL_MS);
+        if(!woken || m_stop_)
+        {
+            /*取走超时或(退出时)所有未写满的缓冲区*/
+            uint64_t now=MonotonicCoarseMs();
+            m_threads_locker_.Lock();
+            for(size_t i=0;i<m_threads_.size();++i)
+            {
+                ThreadState* state=m_threads_[i];
+                state->m_locker_.Lock();
+                Buffer& buffer=state->m_buffer_;
+                if(buffer.m_used_>0 && (m_stop_ || now-buffer.m_first_ms_>=(uint64_t)FLUSH_INTERVAL_MS))
+                {
+                    Buffer full=buffer;
+                    /*替换的缓冲区与原来的在同一节点上，路径字典随缓冲区重新开始*/
+                    buffer=NewBuffer(full.m_node_);
+                    state->m_paths_.clear();
+                    state->m_locker_.Unlock();
+                    WriteBuffer(full);
+                    continue;
+                }
+                state->m_locker_.Unlock();
+            }
+            m_threads_locker_.Unlock();
+        }
+        while(true)
+        {
+            m_queue_locker_.Lock();
+            if(m_queue_.empty())
+            {
+                m_queue_locker_.Unlock();
+                break;
+            }
+            Buffer buffer=m_queue_.front();
+            m_queue_.pop_front();
+            m_queue_locker_.Unlock();
+            WriteBuffer(buffer);
+        }
+        if(m_stop_)
+        {
+            break;
+        }
+    }
+}
+
+void AccessLog::WriteBuffer(Buffer& buffer)
+{
+    size_t len=buffer.m_used_;
+    if(m_direct_)
+    {
+        len=PadTo(buffer.m_data_,len,DIRECT_ALIGN);
+    }
+    if(m_fd_>=0 && m_file_bytes_+len>m_rotate_bytes_ && m_file_bytes_>0)
+    {
+        Rotate();
+    }
+    if(m_fd_>=0 && WriteAll(m_fd_,buffer.m_data_,len))
+    {
+        m_file_bytes_+=len;
+    }
+    m_pool_.Put(buffer.m_data_,buffer.m_node_);
+    buffer.m_data_=NULL;
+}
+
+bool AccessLog::Rotate()
+{
+    char name[1024];
+    time_t now=time(NULL);
+    struct tm tm;
+    localtime_r(&now,&tm);
+    char stamp[32];
+    strftime(stamp,sizeof(stamp),"%Y%m%d-%H%M%S",&tm);
+    snprintf(name,sizeof(name),"%s.%s.%d.wsal",m_prefix_.c_str(),stamp,m_sequence_++);
+    int flags=O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    if(m_direct_)
+    {
+        flags|=O_DIRECT;
+    }
+    int fd=open(name,flags,0644);
+    if(fd<0)
+    {
+        printf("access log: cannot open %s: %s\n",name,strerror(errno));
+        return false;
+    }
+    /*每个缓冲区带有自己的路径记录，文件头之后不需要字典，每个文件都可以单独解码*/
+    void* data=NULL;
+    if(posix_memalign(&data,DIRECT_ALIGN,DIRECT_ALIGN*2)!=0)
+    {
+        close(fd);
+        return false;
+    }
+    char* buf=(char*)data;
+    AccessFileHeader header;
+    header.m_magic_=ACCESS_LOG_MAGIC;
+    header.m_version_=ACCESS_LOG_VERSION;
+    header.m_created_us_=NowUs();
+    memcpy(buf,&header,sizeof(header));
+    size_t used=sizeof(header);
+    if(m_direct_)
+    {
+        used=PadTo(buf,used,DIRECT_ALIGN);
+    }
+    bool ok=WriteAll(fd,buf,used);
+    free(data);
+    if(!ok)
+    {
+        close(fd);
+        return false;
+    }
+    if(m_fd_>=0)
+    {
+        close(m_fd_);
+    }
+    m_fd_=fd;
+    m_file_bytes_=used;
+    return true;
+}
@@ -0,0 +1,227 @@
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include "BusyPoll.h"
+#include "Clock.h"
+
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
+/*Linux 6.9起的epoll忙轮询参数，旧的头文件中没有*/
+#ifndef EPIOCSPARAMS
+struct epoll_params
+{
+    uint32_t busy_poll_usecs;
+    uint16_t busy_poll_budget;
+    uint8_t prefer_busy_poll;
+    uint8_t __pad;
+};
+#define EPIOCSPARAMS _IOW(0x8A,0x01,struct epoll_params)
+#endif
+
+/*每次轮询网卡队列最多处理的包数，与内核默认值相同*/
+static const uint16_t EPOLL_BUSY_POLL_BUDGET=8;
+
+/*自旋时让出流水线，减少对同一核上另一个超线程的影响*/
+static inline void CpuRelax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+/*工作线程各自的预算，-1表示尚未初始化*/
+static thread_local int worker_budget_us=-1;
+
+BusyPoll::BusyPoll():m_loop_max_us_(0),m_worker_max_us_(0),m_adaptive_(false),m_loop_budget_us_(0),
+    m_loop_spin_us_(0),m_loop_sleep_us_(0),m_loop_hits_(0),m_loop_misses_(0),
+    m_worker_spin_us_(0),m_worker_sleep_us_(0),m_worker_hits_(0),m_worker_misses_(0),
+    m_socket_ok_(0),m_socket_failed_(0),m_epoll_ok_(false)
+{
+}
+
+BusyPoll::~BusyPoll()
+{
+}
+
+BusyPoll* BusyPoll::Instance()
+{
+    static BusyPoll poll;
+    return &poll;
+}
+
+void BusyPoll::Configure(int loop_us,int worker_us,bool adaptive)
+{
+    m_loop_max_us_=loop_us>0?loop_us:0;
+    m_worker_max_us_=worker_us>0?worker_us:0;
+    m_adaptive_=adaptive;
+	/*只有一个CPU时自旋只会推迟产生事件的线程(包括本机的客户端)*/
+    if(Enabled() && sysconf(_SC_NPROCESSORS_ONLN)<2)
+    {
+        printf("busy poll disabled on a single cpu\n");
+        m_loop_max_us_=0;
+        m_worker_max_us_=0;
+    }
+    m_loop_budget_us_=m_loop_max_us_;
+}
+
+void BusyPoll::SetupSocket(int sockfd)
+{
+    if(m_loop_max_us_<=0)
+    {
+        return;
+    }
+	/*超过net.core.busy_read需要CAP_NET_ADMIN，失败不影响正常收发*/
+    int usecs=m_loop_max_us_;
+    int prefer=1;
+    if(setsockopt(sockfd,SOL_SOCKET,SO_BUSY_POLL,&usecs,sizeof(usecs))==0)
+    {
+        setsockopt(sockfd,SOL_SOCKET,SO_PREFER_BUSY_POLL,&prefer,sizeof(prefer));
+        m_socket_ok_++;
+    }
+    else
+    {
+        m_socket_failed_++;
+    }
+}
+
+void BusyPoll::SetupEpoll(int epollfd)
+{
+    if(m_loop_max_us_<=0)
+    {
+        return;
+    }
+    struct epoll_params params;
+    params.busy_poll_usecs=m_loop_max_us_;
+    params.busy_poll_budget=EPOLL_BUSY_POLL_BUDGET;
+    params.prefer_busy_poll=1;
+    params.__pad=0;
+    m_epoll_ok_=ioctl(epollfd,EPIOCSPARAMS,&params)==0;
+}
+
+int BusyPoll::Adapt(int budget,int max_us,bool adaptive,bool hit,uint64_t slept_us)
+{
+    if(!adaptive || hit || slept_us<=(uint64_t)max_us)
+    {
+        return max_us;
+    }
+    budget/=2;
+    return budget<MIN_SPIN_US?0:budget;
+}
+
+int BusyPoll::Wait(int epollfd,struct epoll_event* events,int max_events,int timeout)
+{
+	/*timeout为0说明已有工作要做，不自旋*/
+    if(m_loop_max_us_<=0 || timeout==0)
+    {
+        return epoll_wait(epollfd,events,max_events,timeout);
+    }
+    uint64_t start=MonotonicUs();
+    uint64_t now=start;
+    uint64_t budget=m_loop_budget_us_;
+    if(timeout>0 && budget>(uint64_t)timeout*1000)
+    {
+        budget=(uint64_t)timeout*1000;
+    }
+    while(now-start<budget)
+    {
+        int number=epoll_wait(epollfd,events,max_events,0);
+        now=MonotonicUs();
+        if(number!=0)
+        {
+            m_loop_spin_us_+=now-start;
+            if(number>0)
+            {
+                m_loop_hits_++;
+                m_loop_budget_us_=Adapt(m_loop_budget_us_,m_loop_max_us_,m_adaptive_,true,0);
+            }
+            return number;
+        }
+        CpuRelax();
+    }
+    m_loop_spin_us_+=now-start;
+    if(budget>0)
+    {
+        m_loop_misses_++;
+    }
+	/*扣除已自旋的时间再阻塞*/
+    int remain=timeout;
+    if(timeout>0)
+    {
+        uint64_t spent_ms=(now-start)/1000;
+        remain=spent_ms>=(uint64_t)timeout?0:timeout-(int)spent_ms;
+    }
+    int number=epoll_wait(epollfd,events,max_events,remain);
+    int saved_errno=errno;
+    uint64_t slept=MonotonicUs()-now;
+    m_loop_sleep_us_+=slept;
+	/*超时醒来不代表有负载，按落空处理*/
+    m_loop_budget_us_=Adapt(m_loop_budget_us_,m_loop_max_us_,m_adaptive_,false,number>0?slept:UINT64_MAX);
+    errno=saved_errno;
+    return number;
+}
+
+bool BusyPoll::WaitSem(Sem& sem)
+{
+    if(m_worker_max_us_<=0)
+    {
+        return sem.Wait();
+    }
+    if(worker_budget_us<0)
+    {
+        worker_budget_us=m_worker_max_us_;
+    }
+    uint64_t start=MonotonicUs();
+    uint64_t now=start;
+    while(now-start<(uint64_t)worker_budget_us)
+    {
+        if(sem.TryWait())
+        {
+            now=MonotonicUs();
+            m_worker_spin_us_+=now-start;
+            m_worker_hits_++;
+            worker_budget_us=Adapt(worker_budget_us,m_worker_max_us_,m_adaptive_,true,0);
+            return true;
+        }
+        CpuRelax();
+        now=MonotonicUs();
+    }
+    m_worker_spin_us_+=now-start;
+    if(worker_budget_us>0)
+    {
+        m_worker_misses_++;
+    }
+    bool ret=sem.Wait();
+    uint64_t slept=MonotonicUs()-now;
+    m_worker_sleep_us_+=slept;
+    worker_budget_us=Adapt(worker_budget_us,m_worker_max_us_,m_adaptive_,false,slept);
+    return ret;
+}
+
+void BusyPoll::Report(FILE* fp)
+{
+    if(!Enabled())
+    {
+        return;
+    }
+    uint64_t worker_spin=m_worker_spin_us_.exchange(0);
+    uint64_t worker_sleep=m_worker_sleep_us_.exchange(0);
+    fprintf(fp,"busy poll: loop budget_us=%d spin_us=%llu sleep_us=%llu hits=%llu misses=%llu sockets=%llu/%llu epoll=%d\n",
+            m_loop_budget_us_,(unsigned long long)m_loop_spin_us_,(unsigned long long)m_loop_sleep_us_,
+            (unsigned long long)m_loop_hits_,(unsigned long long)m_loop_misses_,
+            (unsigned long long)m_socket_ok_.load(),(unsigned long long)(m_socket_ok_.load()+m_socket_failed_.load()),(int)m_epoll_ok_);
+    fprintf(fp,"busy poll: workers spin_us=%llu sleep_us=%llu hits=%llu misses=%llu\n",
+            (unsigned long long)worker_spin,(unsigned long long)worker_sleep,
+            (unsigned long long)m_worker_hits_.exchange(0),(unsigned long long)m_worker_misses_.exchange(0));
+    m_loop_spin_us_=0;
+    m_loop_sleep_us_=0;
+    m_loop_hits_=0;
+    m_loop_misses_=0;
+}
@@ -0,0 +1,548 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <new>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "Coroutine.h"
+#include "HttpConn.h"
+#include "Clock.h"
+
+CoRouter* CoRouter::Instance()
+{
+    static CoRouter router;
+    return &router;
+}
+
+void CoRouter::Add(const char* path,CoHandler handler)
+{
+    m_routes_[path]=handler;
+}
+
+CoHandler CoRouter::Find(const char* target) const
+{
+    if(m_routes_.empty())
+    {
+        return NULL;
+    }
+    const char* query=strchr(target,'?');
+    std::map<std::string,CoHandler>::const_iterator it=m_routes_.find(query?std::string(target,query-target):std::string(target));
+    return it==m_routes_.end()?NULL:it->second;
+}
+
+bool CoRouter::Supported()
+{
+#if defined(__cpp_impl_coroutine)
+    return true;
+#else
+    return false;
+#endif
+}
+
+CoReactor::CoReactor():m_epollfd_(-1),m_wake_fd_(-1)
+{
+}
+
+CoReactor::~CoReactor()
+{
+    if(m_wake_fd_>=0)
+    {
+        close(m_wake_fd_);
+    }
+}
+
+CoReactor* CoReactor::Instance()
+{
+    static CoReactor reactor;
+    return &reactor;
+}
+
+bool CoReactor::Open(int epollfd)
+{
+    m_epollfd_=epollfd;
+    m_wake_fd_=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    return m_wake_fd_>=0;
+}
+
+void CoReactor::AddTimer(uint64_t handle,uint64_t deadline_ms)
+{
+    m_locker_.Lock();
+    bool earliest=m_timers_.empty() || deadline_ms<m_timers_.top().first;
+    m_timers_.push(Timer(deadline_ms,handle));
+    m_locker_.Unlock();
+    /*比I/O线程正在等待的超时更早，需要让它重新计算*/
+    if(earliest)
+    {
+        Wakeup();
+    }
+}
+
+bool CoReactor::WatchFd(int fd,bool write,uint64_t handle)
+{
+    struct epoll_event event;
+    event.data.u64=HttpConn::MakeHandle(fd,0);
+    event.events=(write?EPOLLOUT:EPOLLIN) | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    /*登记在注册之前，事件可能在epoll_ctl返回前就被I/O线程取到*/
+    m_locker_.Lock();
+    m_fds_[fd]=handle;
+    m_locker_.Unlock();
+    if(epoll_ctl(m_epollfd_,EPOLL_CTL_MOD,fd,&event)!=0 &&
+       (errno!=ENOENT || epoll_ctl(m_epollfd_,EPOLL_CTL_ADD,fd,&event)!=0))
+    {
+        m_locker_.Lock();
+        m_fds_.erase(fd);
+        m_locker_.Unlock();
+        return false;
+    }
+    return true;
+}
+
+void CoReactor::OnFdEvent(int fd)
+{
+    m_locker_.Lock();
+    std::map<int,uint64_t>::iterator it=m_fds_.find(fd);
+    if(it!=m_fds_.end())
+    {
+        m_ready_.push_back(it->second);
+        m_fds_.erase(it);
+    }
+    m_locker_.Unlock();
+}
+
+void CoReactor::Ready(uint64_t handle)
+{
+    m_locker_.Lock();
+    bool first=m_ready_.empty();
+    m_ready_.push_back(handle);
+    m_locker_.Unlock();
+    if(first)
+    {
+        Wakeup();
+    }
+}
+
+void CoReactor::ClearWakeup()
+{
+    uint64_t count;
+    ssize_t ret=read(m_wake_fd_,&count,sizeof(count));
+    (void)ret;
+}
+
+void CoReactor::TakeReady(std::vector<uint64_t>& handles,uint64_t now_ms)
+{
+    handles.clear();
+    m_locker_.Lock();
+    handles.swap(m_ready_);
+    while(!m_timers_.empty() && m_timers_.top().first<=now_ms)
+    {
+        handles.push_back(m_timers_.top().second);
+        m_timers_.pop();
+    }
+    m_locker_.Unlock();
+}
+
+int CoReactor::NextTimeout(uint64_t now_ms)
+{
+    m_locker_.Lock();
+    int timeout=-1;
+    if(!m_ready_.empty())
+    {
+        timeout=0;
+    }
+    else if(!m_timers_.empty())
+    {
+        uint64_t deadline=m_timers_.top().first;
+        timeout=deadline<=now_ms?0:(int)(deadline-now_ms);
+    }
+    m_locker_.Unlock();
+    return timeout;
+}
+
+void CoReactor::Wakeup()
+{
+    if(m_wake_fd_<0)
+    {
+        return;
+    }
+    uint64_t one=1;
+    ssize_t ret=write(m_wake_fd_,&one,sizeof(one));
+    (void)ret;
+}
+
+#if defined(__cpp_impl_coroutine)
+/*一个线程缓存的空闲帧，线程结束时释放*/
+struct CoFrameCache
+{
+    std::vector<void*> m_free_[CoFramePool::CLASS_COUNT];
+    ~CoFrameCache()
+    {
+        for(int i=0;i<CoFramePool::CLASS_COUNT;++i)
+        {
+            for(size_t j=0;j<m_free_[i].size();++j)
+            {
+                free(m_free_[i][j]);
+            }
+        }
+    }
+};
+
+static thread_local CoFrameCache frame_cache;
+
+/*size所在的级别，超过最大级别时返回-1*/
+static int FrameClass(size_t size)
+{
+    size_t frame=CoFramePool::MIN_FRAME;
+    for(int i=0;i<CoFramePool::CLASS_COUNT;++i,frame<<=1)
+    {
+        if(size<=frame)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void* CoFramePool::Allocate(size_t size)
+{
+    int index=FrameClass(size);
+    if(index<0)
+    {
+        void* frame=malloc(size);
+        if(!frame)
+        {
+            throw std::bad_alloc();
+        }
+        return frame;
+    }
+    std::vector<void*>& list=frame_cache.m_free_[index];
+    if(!list.empty())
+    {
+        void* frame=list.back();
+        list.pop_back();
+        return frame;
+    }
+    void* frame=malloc(MIN_FRAME<<index);
+    if(!frame)
+    {
+        throw std::bad_alloc();
+    }
+    return frame;
+}
+
+void CoFramePool::Free(void* frame,size_t size)
+{
+    int index=FrameClass(size);
+    if(index<0 || frame_cache.m_free_[index].size()>=MAX_CACHED)
+    {
+        free(frame);
+        return;
+    }
+    frame_cache.m_free_[index].push_back(frame);
+}
+
+CoTask& CoTask::operator=(CoTask&& other) noexcept
+{
+    if(this!=&other)
+    {
+        if(m_handle_)
+        {
+            m_handle_.destroy();
+        }
+        m_handle_=other.m_handle_;
+        other.m_handle_=nullptr;
+    }
+    return *this;
+}
+
+CoTask::~CoTask()
+{
+    /*销毁挂起的协程会析构其中的局部变量，包括正在co_await的子任务*/
+    if(m_handle_)
+    {
+        m_handle_.destroy();
+    }
+}
+
+void CoTask::await_resume()
+{
+    if(m_handle_.promise().m_exception_)
+    {
+        std::rethrow_exception(m_handle_.promise().m_exception_);
+    }
+}
+#endif
+
+CoRequest::CoRequest(int sockfd,int method,const char* target,const HttpRequest* request,size_t content_length,bool keep_alive):
+    m_sockfd_(sockfd),m_method_(method),m_target_(target),m_request_(request),m_content_length_(content_length),
+    m_out_pos_(0),m_keep_alive_(keep_alive),m_broken_(false),m_status_(0),m_bytes_sent_(0),
+    m_wait_(WAIT_NONE),m_deadline_ms_(0),m_wait_fd_(-1),m_wait_failed_(false),m_resume_(NULL),m_task_(NULL)
+{
+    m_body_.reserve(content_length);
+}
+
+CoRequest::~CoRequest()
+{
+#if defined(__cpp_impl_coroutine)
+    delete m_task_;
+#endif
+}
+
+bool CoRequest::Start(CoHandler handler)
+{
+#if defined(__cpp_impl_coroutine)
+    try
+    {
+        m_task_=new CoTask(handler(*this));
+    }
+    catch(...)
+    {
+        return false;
+    }
+    m_resume_=m_task_->GetHandle().address();
+    Resume();
+    return true;
+#else
+    (void)handler;
+    return false;
+#endif
+}
+
+void CoRequest::Resume()
+{
+#if defined(__cpp_impl_coroutine)
+    /*能立即满足的条件已在await_ready中处理，恢复一次就会挂起在新的条件上或结束*/
+    if(!Done() && Resumable())
+    {
+        m_wait_=WAIT_NONE;
+        std::coroutine_handle<>::from_address(m_resume_).resume();
+    }
+#endif
+}
+
+bool CoRequest::Resumable() const
+{
+    switch(m_wait_)
+    {
+        case WAIT_BODY:
+        {
+            return BodyComplete() || m_broken_;
+        }
+        case WAIT_WRITE:
+        {
+            return m_out_pos_>=m_out_.size() || m_broken_;
+        }
+        case WAIT_TIMER:
+        {
+            return MonotonicMs()>=m_deadline_ms_;
+        }
+        default:
+        {
+            /*描述符的等待只由I/O线程的事件结束*/
+            return true;
+        }
+    }
+}
+
+bool CoRequest::Done() const
+{
+#if defined(__cpp_impl_coroutine)
+    return !m_task_ || m_task_->Done();
+#else
+    return true;
+#endif
+}
+
+bool CoRequest::Failed() const
+{
+#if defined(__cpp_impl_coroutine)
+    return m_task_ && m_task_->Failed();
+#else
+    return false;
+#endif
+}
+
+void CoRequest::AppendBody(const char* data,size_t len)
+{
+    size_t room=m_content_length_-m_body_.size();
+    if(len>room)
+    {
+        /*Content-Length之后的数据(流水线请求)不处理*/
+        len=room;
+        m_keep_alive_=false;
+    }
+    m_body_.append(data,len);
+}
+
+CoRequest::FLUSH CoRequest::Flush()
+{
+    while(m_out_pos_<m_out_.size())
+    {
+        ssize_t temp=send(m_sockfd_,m_out_.data()+m_out_pos_,m_out_.size()-m_out_pos_,0);
+        if(temp<0)
+        {
+            if(errno==EAGAIN)
+            {
+                return FLUSH_AGAIN;
+            }
+            m_broken_=true;
+            return FLUSH_ERROR;
+        }
+        m_out_pos_+=temp;
+        m_bytes_sent_+=temp;
+    }
+    m_out_.clear();
+    m_out_pos_=0;
+    return FLUSH_DONE;
+}
+
+const char* CoRequest::Query() const
+{
+    const char* query=strchr(m_target_,'?');
+    return query?query+1:"";
+}
+
+bool CoRequest::Poll(WAIT wait)
+{
+    if(m_broken_ && (wait==WAIT_BODY || wait==WAIT_WRITE))
+    {
+        return true;
+    }
+    switch(wait)
+    {
+        case WAIT_BODY:
+        {
+            return BodyComplete();
+        }
+        case WAIT_WRITE:
+        {
+            return Flush()!=FLUSH_AGAIN;
+        }
+        case WAIT_TIMER:
+        {
+            return MonotonicMs()>=m_deadline_ms_;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+void CoRequest::Suspend(WAIT wait,void* caller_address)
+{
+    m_wait_=wait;
+    m_wait_failed_=false;
+    m_resume_=caller_address;
+}
+
+bool CoRequest::Result(WAIT wait) const
+{
+    switch(wait)
+    {
+        case WAIT_BODY:
+        {
+            return BodyComplete();
+        }
+        case WAIT_WRITE:
+        {
+            return !m_broken_;
+        }
+        case WAIT_TIMER:
+        {
+            return true;
+        }
+        default:
+        {
+            return !m_wait_failed_;
+        }
+    }
+}
+
+#if defined(__cpp_impl_coroutine)
+/*常见状态码的描述*/
+static const char* StatusTitle(int status)
+{
+    switch(status)
+    {
+        case 200: return "OK";
+        case 201: return "Created";
+        case 204: return "No Content";
+        case 301: return "Moved Permanently";
+        case 302: return "Found";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 403: return "Forbidden";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 413: return "Payload Too Large";
+        case 429: return "Too Many Requests";
+        case 502: return "Bad Gateway";
+        case 503: return "Service Unavailable";
+        case 504: return "Gateway Timeout";
+        default: return status<400?"OK":(status<500?"Bad Request":"Internal Error");
+    }
+}
+
+CoRequest::Awaiter CoRequest::Write(const char* data,size_t len)
+{
+    m_out_.append(data,len);
+    return Awaiter(this,WAIT_WRITE);
+}
+
+CoRequest::Awaiter CoRequest::WriteHead(int status,const char* content_type,int64_t content_length)
+{
+    /*消息体没有读完时，剩下的数据会被当作下一个请求，应答后关闭连接*/
+    if(content_length<0 || !BodyComplete())
+    {
+        m_keep_alive_=false;
+    }
+    m_status_=status;
+    char head[512];
+    int len=snprintf(head,sizeof(head),"HTTP/1.1 %d %s\r\n",status,StatusTitle(status));
+    if(content_type && len<(int)sizeof(head))
+    {
+        len+=snprintf(head+len,sizeof(head)-len,"Content-Type: %s\r\n",content_type);
+    }
+    if(content_length>=0 && len<(int)sizeof(head))
+    {
+        len+=snprintf(head+len,sizeof(head)-len,"Content-Length: %lld\r\n",(long long)content_length);
+    }
+    if(len<(int)sizeof(head))
+    {
+        len+=snprintf(head+len,sizeof(head)-len,"Connection: %s\r\n\r\n",m_keep_alive_?"keep-alive":"close");
+    }
+    if(len>=(int)sizeof(head))
+    {
+        len=sizeof(head)-1;
+    }
+    return Write(head,len);
+}
+
+CoRequest::Awaiter CoRequest::Respond(int status,const char* content_type,const std::string& body)
+{
+    WriteHead(status,content_type,body.size());
+    return Write(body);
+}
+
+CoRequest::Awaiter CoRequest::SleepFor(uint64_t ms)
+{
+    m_deadline_ms_=MonotonicMs()+ms;
+    return Awaiter(this,WAIT_TIMER);
+}
+
+CoRequest::Awaiter CoRequest::Readable(int fd)
+{
+    m_wait_fd_=fd;
+    return Awaiter(this,WAIT_READABLE);
+}
+
+CoRequest::Awaiter CoRequest::Writable(int fd)
+{
+    m_wait_fd_=fd;
+    return Awaiter(this,WAIT_WRITABLE);
+}
+#endif
@@ -0,0 +1,236 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include "DiskIo.h"
+#include "FileCache.h"
+
+#ifndef MADV_POPULATE_READ
+#define MADV_POPULATE_READ 22
+#endif
+
+/*页大小*/
+static size_t PageSize()
+{
+    static size_t page=sysconf(_SC_PAGESIZE);
+    return page;
+}
+
+DiskIo::DiskIo():m_stop_(false),m_wake_fd_(-1),m_stalls_(0),m_warmed_bytes_(0),m_overflows_(0)
+{
+}
+
+DiskIo::~DiskIo()
+{
+    Stop();
+    if(m_wake_fd_>=0)
+    {
+        close(m_wake_fd_);
+    }
+}
+
+DiskIo* DiskIo::Instance()
+{
+    static DiskIo io;
+    return &io;
+}
+
+bool DiskIo::Start(int threads)
+{
+    m_wake_fd_=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    if(m_wake_fd_<0)
+    {
+        return false;
+    }
+    for(int i=0;i<threads;++i)
+    {
+        pthread_t thread;
+        if(pthread_create(&thread,NULL,Worker,this)!=0)
+        {
+            break;
+        }
+        m_threads_.push_back(thread);
+    }
+    return !m_threads_.empty();
+}
+
+void DiskIo::Stop()
+{
+    if(m_threads_.empty())
+    {
+        return;
+    }
+    m_jobs_locker_.Lock();
+    m_stop_=true;
+    m_jobs_locker_.Unlock();
+    for(size_t i=0;i<m_threads_.size();++i)
+    {
+        m_jobs_stat_.Post();
+    }
+    for(size_t i=0;i<m_threads_.size();++i)
+    {
+        pthread_join(m_threads_[i],NULL);
+    }
+    m_threads_.clear();
+    for(std::list<Job>::iterator it=m_jobs_.begin();it!=m_jobs_.end();++it)
+    {
+        FileCache::Instance()->Release(it->m_entry_);
+    }
+    m_jobs_.clear();
+}
+
+bool DiskIo::Resident(const char* address,size_t len)
+{
+    if(len==0)
+    {
+        return true;
+    }
+    /*mincore要求起始地址按页对齐*/
+    size_t page=PageSize();
+    uintptr_t start=(uintptr_t)address/page*page;
+    size_t pages=((uintptr_t)address+len-start+page-1)/page;
+    unsigned char stack_vec[WINDOW/4096+2];
+    std::vector<unsigned char> heap_vec;
+    unsigned char* vec=stack_vec;
+    if(pages>sizeof(stack_vec))
+    {
+        heap_vec.resize(pages);
+        vec=&heap_vec[0];
+    }
+    if(mincore((void*)start,pages*page,vec)!=0)
+    {
+        return true;
+    }
+    for(size_t i=0;i<pages;++i)
+    {
+        if(!(vec[i]&1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool DiskIo::Warm(FileEntry* entry,size_t offset,size_t len,uint64_t handle)
+{
+    if(m_threads_.empty())
+    {
+        return false;
+    }
+    m_jobs_locker_.Lock();
+    if(m_stop_ || m_jobs_.size()>=MAX_JOBS)
+    {
+        m_jobs_locker_.Unlock();
+        m_overflows_++;
+        return false;
+    }
+    /*排队期间连接可能释放文件，请求自己持有一个引用*/
+    FileCache::Instance()->Retain(entry);
+    Job job={entry,offset,len,handle};
+    m_jobs_.push_back(job);
+    m_jobs_locker_.Unlock();
+    m_jobs_stat_.Post();
+    if(handle)
+    {
+        m_stalls_++;
+    }
+    return true;
+}
+
+void DiskIo::ClearWakeup()
+{
+    uint64_t count;
+    ssize_t ret=read(m_wake_fd_,&count,sizeof(count));
+    (void)ret;
+}
+
+void DiskIo::TakeCompleted(std::vector<uint64_t>& handles)
+{
+    handles.clear();
+    m_completed_locker_.Lock();
+    handles.swap(m_completed_);
+    m_completed_locker_.Unlock();
+}
+
+void DiskIo::Report(FILE* fp)
+{
+    fprintf(fp,"disk io: threads=%d stalls=%llu warmed_bytes=%llu overflows=%llu\n",(int)m_threads_.size(),
+            (unsigned long long)m_stalls_.load(),(unsigned long long)m_warmed_bytes_.load(),(unsigned long long)m_overflows_.load());
+}
+
+void* DiskIo::Worker(void* arg)
+{
+    DiskIo* io=(DiskIo*)arg;
+    io->Run();
+    return NULL;
+}
+
+void DiskIo::Run()
+{
+    while(true)
+    {
+        m_jobs_stat_.Wait();
+        m_jobs_locker_.Lock();
+        if(m_stop_)
+        {
+            m_jobs_locker_.Unlock();
+            break;
+        }
+        if(m_jobs_.empty())
+        {
+            m_jobs_locker_.Unlock();
+            continue;
+        }
+        Job job=m_jobs_.front();
+        m_jobs_.pop_front();
+        m_jobs_locker_.Unlock();
+        Populate(job);
+        FileCache::Instance()->Release(job.m_entry_);
+        if(job.m_handle_)
+        {
+            m_completed_locker_.Lock();
+            bool first=m_completed_.empty();
+            m_completed_.push_back(job.m_handle_);
+            m_completed_locker_.Unlock();
+            if(first)
+            {
+                uint64_t one=1;
+                ssize_t ret=write(m_wake_fd_,&one,sizeof(one));
+                (void)ret;
+            }
+        }
+    }
+}
+
+void DiskIo::Populate(const Job& job)
+{
+    FileEntry* entry=job.m_entry_;
+    size_t size=entry->m_size_;
+    if(job.m_offset_>=size)
+    {
+        return;
+    }
+    size_t len=job.m_len_<size-job.m_offset_?job.m_len_:size-job.m_offset_;
+    size_t page=PageSize();
+    uintptr_t start=(uintptr_t)(entry->m_address_+job.m_offset_)/page*page;
+    uintptr_t end=(uintptr_t)(entry->m_address_+job.m_offset_+len);
+    /*Linux 5.14起可以一次读入并建立页表，否则逐页访问*/
+    if(madvise((void*)start,end-start,MADV_POPULATE_READ)!=0)
+    {
+        volatile char sink=0;
+        for(uintptr_t p=start;p<end;p+=page)
+        {
+            sink=sink^*(volatile const char*)p;
+        }
+        (void)sink;
+    }
+    m_warmed_bytes_+=len;
+    /*下一个窗口异步预读，I/O线程到达时大概率已在页缓存中*/
+    size_t next=job.m_offset_+len;
+    if(next<size)
+    {
+        size_t next_len=size-next<WINDOW?size-next:WINDOW;
+        uintptr_t next_start=(uintptr_t)(entry->m_address_+next)/page*page;
+        madvise((void*)next_start,(uintptr_t)(entry->m_address_+next+next_len)-next_start,MADV_WILLNEED);
+    }
+}
@@ -0,0 +1,141 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "DocArchive.h"
+#include "FileCache.h"
+
+DocArchive::DocArchive():m_fd_(-1),m_address_(NULL),m_size_(0),m_header_(NULL),m_entries_(NULL),m_seeds_(NULL),m_strings_(NULL)
+{
+}
+
+DocArchive::~DocArchive()
+{
+    for(size_t i=0;i<m_files_.size();++i)
+    {
+        if(m_files_[i])
+        {
+            delete m_files_[i]->m_gzip_;
+            delete m_files_[i];
+        }
+    }
+    if(m_address_)
+    {
+        munmap(m_address_,m_size_);
+    }
+    if(m_fd_>=0)
+    {
+        close(m_fd_);
+    }
+}
+
+bool DocArchive::Open(const char* path)
+{
+    int fd=open(path,O_RDONLY|O_CLOEXEC);
+    if(fd<0)
+    {
+        return false;
+    }
+    struct stat st;
+    if(fstat(fd,&st)<0 || (size_t)st.st_size<sizeof(DocArchiveHeader))
+    {
+        close(fd);
+        return false;
+    }
+    char* address=(char*)mmap(0,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if(address==MAP_FAILED)
+    {
+        close(fd);
+        return false;
+    }
+    /*只检查文件头和各个表的范围，条目在第一次访问时检查，启动时间与文件数无关*/
+    const DocArchiveHeader* header=(const DocArchiveHeader*)address;
+    uint64_t size=st.st_size;
+    bool valid=header->m_magic_==DOC_ARCHIVE_MAGIC && header->m_version_==DOC_ARCHIVE_VERSION && header->m_file_size_==size &&
+               (header->m_count_==0 || header->m_buckets_>0) &&
+               header->m_entries_offset_+(uint64_t)header->m_count_*sizeof(DocArchiveEntry)<=size &&
+               header->m_seeds_offset_+(uint64_t)header->m_buckets_*sizeof(uint32_t)<=size &&
+               header->m_strings_offset_+header->m_strings_size_<=size &&
+               (header->m_strings_size_==0 || address[header->m_strings_offset_+header->m_strings_size_-1]=='\0');
+    if(!valid)
+    {
+        munmap(address,st.st_size);
+        close(fd);
+        return false;
+    }
+    m_fd_=fd;
+    m_address_=address;
+    m_size_=st.st_size;
+    m_header_=header;
+    m_entries_=(const DocArchiveEntry*)(address+header->m_entries_offset_);
+    m_seeds_=(const uint32_t*)(address+header->m_seeds_offset_);
+    m_strings_=address+header->m_strings_offset_;
+    m_files_.assign(header->m_count_,(FileEntry*)NULL);
+    return true;
+}
+
+int DocArchive::Find(const char* path,size_t len) const
+{
+    if(Count()==0)
+    {
+        return -1;
+    }
+    uint64_t hash=DocArchiveHash(path,len);
+    uint32_t slot=DocArchiveSlot(hash,m_seeds_[hash%m_header_->m_buckets_],m_header_->m_count_);
+    const DocArchiveEntry& entry=m_entries_[slot];
+    /*不在归档中的路径也会落到某个位置，需要比较路径*/
+    if(entry.m_hash_!=hash || entry.m_path_len_!=len || entry.m_path_offset_+(uint64_t)len>=m_header_->m_strings_size_ ||
+       memcmp(String(entry.m_path_offset_),path,len)!=0)
+    {
+        return -1;
+    }
+    return (int)slot;
+}
+
+FileEntry* DocArchive::Entry(int index)
+{
+    if(m_files_[index])
+    {
+        return m_files_[index];
+    }
+    const DocArchiveEntry& entry=m_entries_[index];
+    uint64_t strings=m_header_->m_strings_size_;
+    if(entry.m_data_offset_+entry.m_size_>m_size_ || entry.m_gzip_offset_+entry.m_gzip_size_>m_size_ ||
+       entry.m_type_offset_>=strings || entry.m_etag_offset_>=strings)
+    {
+        return NULL;
+    }
+    FileEntry* file=NewEntry(entry,entry.m_data_offset_,entry.m_size_);
+    if(entry.m_gzip_size_>0)
+    {
+        /*字符串表以'\0'结尾，ETag之后的位置不越界*/
+        uint64_t etag=entry.m_etag_offset_+strlen(String(entry.m_etag_offset_))+1;
+        file->m_gzip_=NewEntry(entry,entry.m_gzip_offset_,entry.m_gzip_size_);
+        file->m_gzip_->m_encoding_="gzip";
+        file->m_gzip_->m_etag_=etag<strings?String(etag):NULL;
+    }
+    m_files_[index]=file;
+    return file;
+}
+
+FileEntry* DocArchive::NewEntry(const DocArchiveEntry& entry,uint64_t offset,uint64_t size)
+{
+    FileEntry* file=new FileEntry;
+    file->m_path_.assign(String(entry.m_path_offset_),entry.m_path_len_);
+    file->m_address_=size>0?m_address_+offset:NULL;
+    file->m_size_=size;
+    file->m_mtime_=entry.m_mtime_;
+    file->m_checked_=0;
+    /*归档中的文件始终视为在缓存中，引用计数归零也不会释放*/
+    file->m_refs_=0;
+    file->m_cached_=true;
+    file->m_content_type_=String(entry.m_type_offset_);
+    file->m_etag_=String(entry.m_etag_offset_);
+    file->m_encoding_=NULL;
+    file->m_gzip_=NULL;
+    file->m_fd_=m_fd_;
+    file->m_offset_=offset;
+    file->m_partition_=0;
+    return file;
+}
@@ -0,0 +1,426 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include "FileCache.h"
+#include "DocArchive.h"
+#include "NumaMemory.h"
+
+FileCache::FileCache(size_t capacity,size_t max_entry):m_max_entry_(max_entry),m_archive_(NULL)
+{
+    Partition* partition=new Partition;
+    partition->m_capacity_=capacity;
+    partition->m_size_=0;
+    partition->m_evictions_=0;
+    m_partitions_.push_back(partition);
+}
+
+FileCache::~FileCache()
+{
+    for(size_t i=0;i<m_partitions_.size();++i)
+    {
+        while(!m_partitions_[i]->m_lru_.empty())
+        {
+            Evict(m_partitions_[i]->m_lru_.back());
+        }
+        delete m_partitions_[i];
+    }
+    delete m_archive_;
+}
+
+FileCache* FileCache::Instance()
+{
+    static FileCache cache;
+    return &cache;
+}
+
+int FileCache::AddPartition(const char* root,size_t capacity)
+{
+    std::string prefix=root;
+    while(!prefix.empty() && prefix[prefix.size()-1]=='/')
+    {
+        prefix.erase(prefix.size()-1);
+    }
+    m_locker_.Lock();
+    int index=-1;
+    for(size_t i=1;i<m_partitions_.size() && index<0;++i)
+    {
+        if(m_partitions_[i]->m_root_==prefix)
+        {
+            index=i;
+        }
+    }
+    if(index<0)
+    {
+        Partition* partition=new Partition;
+        partition->m_root_=prefix;
+        partition->m_capacity_=capacity;
+        partition->m_size_=0;
+        partition->m_evictions_=0;
+        index=m_partitions_.size();
+        m_partitions_.push_back(partition);
+    }
+    m_locker_.Unlock();
+    return index;
+}
+
+int FileCache::PartitionOf(const char* path) const
+{
+    int index=0;
+    size_t longest=0;
+    for(size_t i=1;i<m_partitions_.size();++i)
+    {
+        const std::string& root=m_partitions_[i]->m_root_;
+        if(root.size()>=longest && strncmp(path,root.c_str(),root.size())==0 && path[root.size()]=='/')
+        {
+            index=i;
+            longest=root.size();
+        }
+    }
+    return index;
+}
+
+void FileCache::Touch(FileEntry* entry)
+{
+    std::list<FileEntry*>& lru=m_partitions_[entry->m_partition_]->m_lru_;
+    lru.splice(lru.begin(),lru,entry->m_lru_);
+}
+
+bool FileCache::OpenArchive(const char* path,const char* root)
+{
+    DocArchive* archive=new DocArchive;
+    if(!archive->Open(path))
+    {
+        delete archive;
+        return false;
+    }
+    m_archive_=archive;
+    m_archive_root_=root;
+    /*根目录以'/'结尾时去掉，归档中的路径以'/'开头*/
+    while(!m_archive_root_.empty() && m_archive_root_[m_archive_root_.size()-1]=='/')
+    {
+        m_archive_root_.erase(m_archive_root_.size()-1);
+    }
+    return true;
+}
+
+int FileCache::FindArchive(const char* path,bool* in_root) const
+{
+    *in_root=false;
+    if(!m_archive_ || strncmp(path,m_archive_root_.c_str(),m_archive_root_.size())!=0)
+    {
+        return -1;
+    }
+    const char* rel=path+m_archive_root_.size();
+    if(*rel!='/')
+    {
+        return -1;
+    }
+    *in_root=true;
+    return m_archive_->Find(rel,strlen(rel));
+}
+
+FileEntry* FileCache::AcquireArchive(int index)
+{
+    FileEntry* entry=m_archive_->Entry(index);
+    if(entry)
+    {
+        entry->m_refs_++;
+    }
+    return entry;
+}
+
+FileCache::FILE_STATUS FileCache::Acquire(const char* path,FileEntry** entry)
+{
+    bool in_root;
+    int index=FindArchive(path,&in_root);
+    if(in_root)
+    {
+        /*归档是不可变的根目录，不在其中的路径不再访问文件系统*/
+        if(index<0)
+        {
+            return FILE_NOT_FOUND;
+        }
+        m_locker_.Lock();
+        FileEntry* hit=AcquireArchive(index);
+        m_locker_.Unlock();
+        if(!hit)
+        {
+            return FILE_ERROR;
+        }
+        *entry=hit;
+        return FILE_OK;
+    }
+    time_t now=time(NULL);
+    struct stat st;
+	/*校验时已经stat过，下面打开文件时不再重复*/
+    bool have_stat=false;
+    m_locker_.Lock();
+    std::unordered_map<std::string,FileEntry*>::iterator it=m_table_.find(path);
+    if(it!=m_table_.end())
+    {
+        FileEntry* hit=it->second;
+        /*在校验间隔内直接命中，不需要任何系统调用*/
+        if(now-hit->m_checked_<REVALIDATE_INTERVAL)
+        {
+            hit->m_refs_++;
+            Touch(hit);
+            m_locker_.Unlock();
+            *entry=hit;
+            return FILE_OK;
+        }
+        /*stat可能很慢(网络或冷的文件系统)，不能持有I/O线程也要用的锁*/
+        m_locker_.Unlock();
+        have_stat=stat(path,&st)==0;
+        m_locker_.Lock();
+        /*解锁期间条目可能已被淘汰或替换，重新查找*/
+        it=m_table_.find(path);
+        if(it!=m_table_.end())
+        {
+            hit=it->second;
+            if(have_stat && st.st_mtime==hit->m_mtime_ && st.st_size==hit->m_size_ && (st.st_mode&S_IROTH))
+            {
+                hit->m_checked_=now;
+                hit->m_refs_++;
+                Touch(hit);
+                m_locker_.Unlock();
+                *entry=hit;
+                return FILE_OK;
+            }
+            /*文件已被修改或删除，淘汰旧的映射*/
+            Evict(hit);
+        }
+    }
+    m_locker_.Unlock();
+
+    if(!have_stat && stat(path,&st)<0)
+    {
+        return FILE_NOT_FOUND;
+    }
+    if(!(st.st_mode&S_IROTH))
+    {
+        return FILE_FORBIDDEN;
+    }
+    if(S_ISDIR(st.st_mode))
+    {
+        return FILE_IS_DIR;
+    }
+    char* address=NULL;
+    if(st.st_size>0)
+    {
+        int fd=open(path,O_RDONLY);
+        if(fd<0)
+        {
+            return FILE_FORBIDDEN;
+        }
+        /*会被缓存的文件预先读入页面，之后在I/O线程上直接发送也不会因缺页阻塞*/
+        int flags=MAP_PRIVATE|((size_t)st.st_size<=m_max_entry_?MAP_POPULATE:0);
+        address=(char*)mmap(0,st.st_size,PROT_READ,flags,fd,0);
+        close(fd);
+        if(address==MAP_FAILED)
+        {
+            return FILE_ERROR;
+        }
+        if((size_t)st.st_size<=m_max_entry_)
+        {
+            NumaMemory::Instance()->AdviseHuge(address,st.st_size);
+        }
+    }
+    FileEntry* fresh=new FileEntry;
+    fresh->m_path_=path;
+    fresh->m_address_=address;
+    fresh->m_size_=st.st_size;
+    fresh->m_mtime_=st.st_mtime;
+    fresh->m_checked_=now;
+    fresh->m_refs_=1;
+    fresh->m_cached_=false;
+    fresh->m_content_type_=NULL;
+    fresh->m_etag_=NULL;
+    fresh->m_encoding_=NULL;
+    fresh->m_gzip_=NULL;
+    fresh->m_fd_=-1;
+    fresh->m_offset_=0;
+    fresh->m_partition_=PartitionOf(path);
+
+    if((size_t)st.st_size<=m_max_entry_)
+    {
+        m_locker_.Lock();
+        /*其他线程可能已经缓存了同一个文件，此时不再重复插入*/
+        if(m_table_.find(path)==m_table_.end())
+        {
+            Partition* partition=m_partitions_[fresh->m_partition_];
+            fresh->m_cached_=true;
+            partition->m_lru_.push_front(fresh);
+            fresh->m_lru_=partition->m_lru_.begin();
+            m_table_[fresh->m_path_]=fresh;
+            partition->m_size_+=st.st_size;
+            Shrink(partition);
+        }
+        m_locker_.Unlock();
+    }
+    *entry=fresh;
+    return FILE_OK;
+}
+
+bool FileCache::TryAcquire(const char* path,size_t max_size,FileEntry** entry)
+{
+    bool in_root;
+    int index=FindArchive(path,&in_root);
+    if(in_root)
+    {
+        if(index<0 || m_archive_->At(index).m_size_>max_size)
+        {
+            return false;
+        }
+        m_locker_.Lock();
+        FileEntry* hit=AcquireArchive(index);
+        m_locker_.Unlock();
+        *entry=hit;
+        return hit!=NULL;
+    }
+    time_t now=time(NULL);
+    m_locker_.Lock();
+    std::unordered_map<std::string,FileEntry*>::iterator it=m_table_.find(path);
+    if(it==m_table_.end() || now-it->second->m_checked_>=REVALIDATE_INTERVAL || (size_t)it->second->m_size_>max_size)
+    {
+        m_locker_.Unlock();
+        return false;
+    }
+    FileEntry* hit=it->second;
+    hit->m_refs_++;
+    Touch(hit);
+    m_locker_.Unlock();
+    *entry=hit;
+    return true;
+}
+
+off_t FileCache::CachedSize(const char* path)
+{
+    bool in_root;
+    int index=FindArchive(path,&in_root);
+    if(in_root)
+    {
+        return index<0?-1:(off_t)m_archive_->At(index).m_size_;
+    }
+    m_locker_.Lock();
+    std::unordered_map<std::string,FileEntry*>::iterator it=m_table_.find(path);
+    off_t size=it==m_table_.end()?-1:it->second->m_size_;
+    m_locker_.Unlock();
+    return size;
+}
+
+void FileCache::Retain(FileEntry* entry)
+{
+    m_locker_.Lock();
+    entry->m_refs_++;
+    m_locker_.Unlock();
+}
+
+void FileCache::Release(FileEntry* entry)
+{
+    if(!entry)
+    {
+        return;
+    }
+    m_locker_.Lock();
+    bool destroy=(--entry->m_refs_==0) && !entry->m_cached_;
+    m_locker_.Unlock();
+    if(destroy)
+    {
+        Destroy(entry);
+    }
+}
+
+size_t FileCache::Size()
+{
+    m_locker_.Lock();
+    size_t size=0;
+    for(size_t i=0;i<m_partitions_.size();++i)
+    {
+        size+=m_partitions_[i]->m_size_;
+    }
+    m_locker_.Unlock();
+    return size;
+}
+
+void FileCache::Report(FILE* fp)
+{
+    m_locker_.Lock();
+    for(size_t i=0;i<m_partitions_.size();++i)
+    {
+        const Partition* partition=m_partitions_[i];
+        fprintf(fp,"cache %s: %zu/%zu bytes, %zu files, %llu evictions\n",i==0?"(default)":partition->m_root_.c_str(),
+                partition->m_size_,partition->m_capacity_,partition->m_lru_.size(),(unsigned long long)partition->m_evictions_);
+    }
+    m_locker_.Unlock();
+}
+
+void FileCache::Snapshot(std::vector<std::string>& keys,size_t max_keys)
+{
+    m_locker_.Lock();
+	/*各分区轮流取，每个主机最热的文件都能留下*/
+    std::vector<std::list<FileEntry*>::iterator> its;
+    for(size_t i=0;i<m_partitions_.size();++i)
+    {
+        its.push_back(m_partitions_[i]->m_lru_.begin());
+    }
+    bool more=true;
+    while(more && keys.size()<max_keys)
+    {
+        more=false;
+        for(size_t i=0;i<its.size() && keys.size()<max_keys;++i)
+        {
+            if(its[i]!=m_partitions_[i]->m_lru_.end())
+            {
+                keys.push_back((*its[i]++)->m_path_);
+                more=true;
+            }
+        }
+    }
+    m_locker_.Unlock();
+}
+
+void FileCache::Prewarm(const std::vector<std::string>& keys)
+{
+    /*逆序加载，使最热的文件最后进入LRU表头*/
+    for(std::vector<std::string>::const_reverse_iterator it=keys.rbegin();it!=keys.rend();++it)
+    {
+        FileEntry* entry=NULL;
+        if(Acquire(it->c_str(),&entry)==FILE_OK)
+        {
+            Release(entry);
+        }
+    }
+}
+
+void FileCache::Evict(FileEntry* entry)
+{
+    Partition* partition=m_partitions_[entry->m_partition_];
+    m_table_.erase(entry->m_path_);
+    partition->m_lru_.erase(entry->m_lru_);
+    partition->m_size_-=entry->m_size_;
+    entry->m_cached_=false;
+    if(entry->m_refs_==0)
+    {
+        Destroy(entry);
+    }
+}
+
+void FileCache::Shrink(Partition* partition)
+{
+    while(partition->m_size_>partition->m_capacity_ && !partition->m_lru_.empty())
+    {
+        partition->m_evictions_++;
+        Evict(partition->m_lru_.back());
+    }
+}
+
+void FileCache::Destroy(FileEntry* entry)
+{
+    if(entry->m_address_)
+    {
+        munmap(entry->m_address_,entry->m_size_);
+    }
+    delete entry;
+}
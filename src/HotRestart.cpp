@@ -0,0 +1,297 @@
+#include <errno.h>
+#include <stdint.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include "HotRestart.h"
+#include "Clock.h"
+
+const char* HotRestart::ENV_CHANNEL="WEBSERVER_HANDOFF_FD";
+std::string HotRestart::m_exe_;
+std::vector<std::string> HotRestart::m_args_;
+int HotRestart::m_channel_=-1;
+pid_t HotRestart::m_successor_=-1;
+uint64_t HotRestart::m_deadline_ms_=0;
+
+/*新进程中通信socket固定为该描述符*/
+static const int CHANNEL_FD=3;
+
+/*阻塞写入全部数据*/
+static bool WriteAll(int fd,const char* data,size_t len)
+{
+    while(len>0)
+    {
+        ssize_t n=write(fd,data,len);
+        if(n<0)
+        {
+            if(errno==EINTR)
+            {
+                continue;
+            }
+            return false;
+        }
+        data+=n;
+        len-=n;
+    }
+    return true;
+}
+
+/*阻塞读取全部数据*/
+static bool ReadAll(int fd,char* data,size_t len)
+{
+    while(len>0)
+    {
+        ssize_t n=read(fd,data,len);
+        if(n<0 && errno==EINTR)
+        {
+            continue;
+        }
+        if(n<=0)
+        {
+            return false;
+        }
+        data+=n;
+        len-=n;
+    }
+    return true;
+}
+
+void HotRestart::Init(int argc,char* argv[])
+{
+    char path[4096];
+    ssize_t len=readlink("/proc/self/exe",path,sizeof(path)-1);
+    if(len>0)
+    {
+        path[len]='\0';
+        m_exe_=path;
+    }
+    else
+    {
+        m_exe_=argv[0];
+    }
+    m_args_.assign(argv,argv+argc);
+}
+
+int HotRestart::StartHandoff(int listenfd,const std::vector<std::string>& keys)
+{
+    if(m_successor_>0)
+    {
+        return -1;
+    }
+    /*二进制被替换后/proc/self/exe会带上" (deleted)"后缀，去掉后执行新文件*/
+    std::string exe=m_exe_;
+    const char* deleted=" (deleted)";
+    if(exe.size()>strlen(deleted) && exe.compare(exe.size()-strlen(deleted),std::string::npos,deleted)==0)
+    {
+        exe.resize(exe.size()-strlen(deleted));
+    }
+    int sv[2];
+    if(socketpair(AF_UNIX,SOCK_STREAM,0,sv)<0)
+    {
+        return -1;
+    }
+    /*fork之后的子进程只能调用异步信号安全的函数，参数和环境变量提前准备好*/
+    std::vector<char*> argv;
+    for(size_t i=0;i<m_args_.size();++i)
+    {
+        argv.push_back(const_cast<char*>(m_args_[i].c_str()));
+    }
+    argv.push_back(NULL);
+    char channel[16];
+    snprintf(channel,sizeof(channel),"%d",CHANNEL_FD);
+    setenv(ENV_CHANNEL,channel,1);
+    long open_max=sysconf(_SC_OPEN_MAX);
+    pid_t pid=fork();
+    if(pid==0)
+    {
+        /*子进程只保留标准输入输出和通信socket，不能持有旧进程的客户连接*/
+        dup2(sv[1],CHANNEL_FD);
+#ifdef SYS_close_range
+        if(syscall(SYS_close_range,CHANNEL_FD+1,~0U,0)!=0)
+#endif
+        {
+            for(long fd=CHANNEL_FD+1;fd<open_max;++fd)
+            {
+                close(fd);
+            }
+        }
+        execv(exe.c_str(),&argv[0]);
+        _exit(127);
+    }
+    unsetenv(ENV_CHANNEL);
+    close(sv[1]);
+    if(pid<0)
+    {
+        close(sv[0]);
+        return -1;
+    }
+    m_channel_=sv[0];
+    m_successor_=pid;
+    m_deadline_ms_=MonotonicMs()+READY_TIMEOUT;
+	/*新进程启动后立即读取，发送只等待exec，不等待预热*/
+    if(!SendListenFd(sv[0],listenfd,keys))
+    {
+        AbortHandoff();
+        return -1;
+    }
+    return m_channel_;
+}
+
+int HotRestart::FinishHandoff()
+{
+    if(m_successor_<=0)
+    {
+        return -1;
+    }
+    char ack=0;
+    ssize_t n=recv(m_channel_,&ack,1,MSG_DONTWAIT);
+    if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK || errno==EINTR))
+    {
+        return 0;
+    }
+    if(n!=1 || ack!='R')
+    {
+        AbortHandoff();
+        return -1;
+    }
+    printf("hot restart: handed listening socket to %d\n",(int)m_successor_);
+    close(m_channel_);
+    m_channel_=-1;
+    m_successor_=-1;
+    return 1;
+}
+
+int HotRestart::NextTimeout()
+{
+    if(m_successor_<=0)
+    {
+        return -1;
+    }
+    uint64_t now=MonotonicMs();
+    return now>=m_deadline_ms_?0:(int)(m_deadline_ms_-now);
+}
+
+void HotRestart::AbortHandoff()
+{
+    if(m_successor_<=0)
+    {
+        return;
+    }
+    printf("hot restart: successor %d did not become ready\n",(int)m_successor_);
+	/*close会把通信socket从epoll中移除*/
+    close(m_channel_);
+    m_channel_=-1;
+    kill(m_successor_,SIGKILL);
+    waitpid(m_successor_,NULL,0);
+    m_successor_=-1;
+}
+
+int HotRestart::Receive(std::vector<std::string>& keys)
+{
+    const char* channel=getenv(ENV_CHANNEL);
+    if(!channel)
+    {
+        return -1;
+    }
+    m_channel_=atoi(channel);
+    unsetenv(ENV_CHANNEL);
+    int listenfd=RecvListenFd(m_channel_,keys);
+    if(listenfd<0)
+    {
+        close(m_channel_);
+        m_channel_=-1;
+    }
+    return listenfd;
+}
+
+void HotRestart::Ready()
+{
+    if(m_channel_<0)
+    {
+        return;
+    }
+    WriteAll(m_channel_,"R",1);
+    close(m_channel_);
+    m_channel_=-1;
+}
+
+bool HotRestart::SendListenFd(int channel,int listenfd,const std::vector<std::string>& keys)
+{
+    std::string snapshot;
+    for(size_t i=0;i<keys.size();++i)
+    {
+        snapshot.append(keys[i]);
+        snapshot.push_back('\n');
+    }
+    /*第一条消息携带描述符和热点文件列表的长度，列表随后以普通数据发送*/
+    uint32_t len=snapshot.size();
+    struct iovec iov;
+    iov.iov_base=&len;
+    iov.iov_len=sizeof(len);
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control,0,sizeof(control));
+    struct msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov=&iov;
+    msg.msg_iovlen=1;
+    msg.msg_control=control;
+    msg.msg_controllen=sizeof(control);
+    struct cmsghdr* cmsg=CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level=SOL_SOCKET;
+    cmsg->cmsg_type=SCM_RIGHTS;
+    cmsg->cmsg_len=CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg),&listenfd,sizeof(int));
+    if(sendmsg(channel,&msg,0)!=(ssize_t)sizeof(len))
+    {
+        return false;
+    }
+    return WriteAll(channel,snapshot.data(),snapshot.size());
+}
+
+int HotRestart::RecvListenFd(int channel,std::vector<std::string>& keys)
+{
+    uint32_t len=0;
+    struct iovec iov;
+    iov.iov_base=&len;
+    iov.iov_len=sizeof(len);
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg;
+    memset(&msg,0,sizeof(msg));
+    msg.msg_iov=&iov;
+    msg.msg_iovlen=1;
+    msg.msg_control=control;
+    msg.msg_controllen=sizeof(control);
+    if(recvmsg(channel,&msg,MSG_WAITALL)!=(ssize_t)sizeof(len))
+    {
+        return -1;
+    }
+    struct cmsghdr* cmsg=CMSG_FIRSTHDR(&msg);
+    if(!cmsg || cmsg->cmsg_level!=SOL_SOCKET || cmsg->cmsg_type!=SCM_RIGHTS)
+    {
+        return -1;
+    }
+    int listenfd=-1;
+    memcpy(&listenfd,CMSG_DATA(cmsg),sizeof(int));
+    std::string snapshot(len,'\0');
+    if(len>0 && !ReadAll(channel,&snapshot[0],len))
+    {
+        close(listenfd);
+        return -1;
+    }
+    size_t start=0;
+    for(size_t i=0;i<snapshot.size();++i)
+    {
+        if(snapshot[i]=='\n')
+        {
+            keys.push_back(snapshot.substr(start,i-start));
+            start=i+1;
+        }
+    }
+    return listenfd;
+}
@@ -0,0 +1,583 @@
+#include <string.h>
+#include "Hpack.h"
+
+/*HPACK静态表(RFC 7541 附录A)*/
+static const HeaderField static_table[HpackTable::STATIC_TABLE_SIZE]={
+    HeaderField(":authority",""),
+    HeaderField(":method","GET"),
+    HeaderField(":method","POST"),
+    HeaderField(":path","/"),
+    HeaderField(":path","/index.html"),
+    HeaderField(":scheme","http"),
+    HeaderField(":scheme","https"),
+    HeaderField(":status","200"),
+    HeaderField(":status","204"),
+    HeaderField(":status","206"),
+    HeaderField(":status","304"),
+    HeaderField(":status","400"),
+    HeaderField(":status","404"),
+    HeaderField(":status","500"),
+    HeaderField("accept-charset",""),
+    HeaderField("accept-encoding","gzip, deflate"),
+    HeaderField("accept-language",""),
+    HeaderField("accept-ranges",""),
+    HeaderField("accept",""),
+    HeaderField("access-control-allow-origin",""),
+    HeaderField("age",""),
+    HeaderField("allow",""),
+    HeaderField("authorization",""),
+    HeaderField("cache-control",""),
+    HeaderField("content-disposition",""),
+    HeaderField("content-encoding",""),
+    HeaderField("content-language",""),
+    HeaderField("content-length",""),
+    HeaderField("content-location",""),
+    HeaderField("content-range",""),
+    HeaderField("content-type",""),
+    HeaderField("cookie",""),
+    HeaderField("date",""),
+    HeaderField("etag",""),
+    HeaderField("expect",""),
+    HeaderField("expires",""),
+    HeaderField("from",""),
+    HeaderField("host",""),
+    HeaderField("if-match",""),
+    HeaderField("if-modified-since",""),
+    HeaderField("if-none-match",""),
+    HeaderField("if-range",""),
+    HeaderField("if-unmodified-since",""),
+    HeaderField("last-modified",""),
+    HeaderField("link",""),
+    HeaderField("location",""),
+    HeaderField("max-forwards",""),
+    HeaderField("proxy-authenticate",""),
+    HeaderField("proxy-authorization",""),
+    HeaderField("range",""),
+    HeaderField("referer",""),
+    HeaderField("refresh",""),
+    HeaderField("retry-after",""),
+    HeaderField("server",""),
+    HeaderField("set-cookie",""),
+    HeaderField("strict-transport-security",""),
+    HeaderField("transfer-encoding",""),
+    HeaderField("user-agent",""),
+    HeaderField("vary",""),
+    HeaderField("via",""),
+    HeaderField("www-authenticate","")
+};
+
+/*Huffman编码表(RFC 7541 附录B)，下标为符号，256为EOS*/
+static const struct
+{
+    uint32_t code;
+    uint8_t len;
+} huffman_table[257]={
+    {0x1ff8,13}, {0x7fffd8,23}, {0xfffffe2,28}, {0xfffffe3,28},
+    {0xfffffe4,28}, {0xfffffe5,28}, {0xfffffe6,28}, {0xfffffe7,28},
+    {0xfffffe8,28}, {0xffffea,24}, {0x3ffffffc,30}, {0xfffffe9,28},
+    {0xfffffea,28}, {0x3ffffffd,30}, {0xfffffeb,28}, {0xfffffec,28},
+    {0xfffffed,28}, {0xfffffee,28}, {0xfffffef,28}, {0xffffff0,28},
+    {0xffffff1,28}, {0xffffff2,28}, {0x3ffffffe,30}, {0xffffff3,28},
+    {0xffffff4,28}, {0xffffff5,28}, {0xffffff6,28}, {0xffffff7,28},
+    {0xffffff8,28}, {0xffffff9,28}, {0xffffffa,28}, {0xffffffb,28},
+    {0x14,6}, {0x3f8,10}, {0x3f9,10}, {0xffa,12},
+    {0x1ff9,13}, {0x15,6}, {0xf8,8}, {0x7fa,11},
+    {0x3fa,10}, {0x3fb,10}, {0xf9,8}, {0x7fb,11},
+    {0xfa,8}, {0x16,6}, {0x17,6}, {0x18,6},
+    {0x0,5}, {0x1,5}, {0x2,5}, {0x19,6},
+    {0x1a,6}, {0x1b,6}, {0x1c,6}, {0x1d,6},
+    {0x1e,6}, {0x1f,6}, {0x5c,7}, {0xfb,8},
+    {0x7ffc,15}, {0x20,6}, {0xffb,12}, {0x3fc,10},
+    {0x1ffa,13}, {0x21,6}, {0x5d,7}, {0x5e,7},
+    {0x5f,7}, {0x60,7}, {0x61,7}, {0x62,7},
+    {0x63,7}, {0x64,7}, {0x65,7}, {0x66,7},
+    {0x67,7}, {0x68,7}, {0x69,7}, {0x6a,7},
+    {0x6b,7}, {0x6c,7}, {0x6d,7}, {0x6e,7},
+    {0x6f,7}, {0x70,7}, {0x71,7}, {0x72,7},
+    {0xfc,8}, {0x73,7}, {0xfd,8}, {0x1ffb,13},
+    {0x7fff0,19}, {0x1ffc,13}, {0x3ffc,14}, {0x22,6},
+    {0x7ffd,15}, {0x3,5}, {0x23,6}, {0x4,5},
+    {0x24,6}, {0x5,5}, {0x25,6}, {0x26,6},
+    {0x27,6}, {0x6,5}, {0x74,7}, {0x75,7},
+    {0x28,6}, {0x29,6}, {0x2a,6}, {0x7,5},
+    {0x2b,6}, {0x76,7}, {0x2c,6}, {0x8,5},
+    {0x9,5}, {0x2d,6}, {0x77,7}, {0x78,7},
+    {0x79,7}, {0x7a,7}, {0x7b,7}, {0x7ffe,15},
+    {0x7fc,11}, {0x3ffd,14}, {0x1ffd,13}, {0xffffffc,28},
+    {0xfffe6,20}, {0x3fffd2,22}, {0xfffe7,20}, {0xfffe8,20},
+    {0x3fffd3,22}, {0x3fffd4,22}, {0x3fffd5,22}, {0x7fffd9,23},
+    {0x3fffd6,22}, {0x7fffda,23}, {0x7fffdb,23}, {0x7fffdc,23},
+    {0x7fffdd,23}, {0x7fffde,23}, {0xffffeb,24}, {0x7fffdf,23},
+    {0xffffec,24}, {0xffffed,24}, {0x3fffd7,22}, {0x7fffe0,23},
+    {0xffffee,24}, {0x7fffe1,23}, {0x7fffe2,23}, {0x7fffe3,23},
+    {0x7fffe4,23}, {0x1fffdc,21}, {0x3fffd8,22}, {0x7fffe5,23},
+    {0x3fffd9,22}, {0x7fffe6,23}, {0x7fffe7,23}, {0xffffef,24},
+    {0x3fffda,22}, {0x1fffdd,21}, {0xfffe9,20}, {0x3fffdb,22},
+    {0x3fffdc,22}, {0x7fffe8,23}, {0x7fffe9,23}, {0x1fffde,21},
+    {0x7fffea,23}, {0x3fffdd,22}, {0x3fffde,22}, {0xfffff0,24},
+    {0x1fffdf,21}, {0x3fffdf,22}, {0x7fffeb,23}, {0x7fffec,23},
+    {0x1fffe0,21}, {0x1fffe1,21}, {0x3fffe0,22}, {0x1fffe2,21},
+    {0x7fffed,23}, {0x3fffe1,22}, {0x7fffee,23}, {0x7fffef,23},
+    {0xfffea,20}, {0x3fffe2,22}, {0x3fffe3,22}, {0x3fffe4,22},
+    {0x7ffff0,23}, {0x3fffe5,22}, {0x3fffe6,22}, {0x7ffff1,23},
+    {0x3ffffe0,26}, {0x3ffffe1,26}, {0xfffeb,20}, {0x7fff1,19},
+    {0x3fffe7,22}, {0x7ffff2,23}, {0x3fffe8,22}, {0x1ffffec,25},
+    {0x3ffffe2,26}, {0x3ffffe3,26}, {0x3ffffe4,26}, {0x7ffffde,27},
+    {0x7ffffdf,27}, {0x3ffffe5,26}, {0xfffff1,24}, {0x1ffffed,25},
+    {0x7fff2,19}, {0x1fffe3,21}, {0x3ffffe6,26}, {0x7ffffe0,27},
+    {0x7ffffe1,27}, {0x3ffffe7,26}, {0x7ffffe2,27}, {0xfffff2,24},
+    {0x1fffe4,21}, {0x1fffe5,21}, {0x3ffffe8,26}, {0x3ffffe9,26},
+    {0xffffffd,28}, {0x7ffffe3,27}, {0x7ffffe4,27}, {0x7ffffe5,27},
+    {0xfffec,20}, {0xfffff3,24}, {0xfffed,20}, {0x1fffe6,21},
+    {0x3fffe9,22}, {0x1fffe7,21}, {0x1fffe8,21}, {0x7ffff3,23},
+    {0x3fffea,22}, {0x3fffeb,22}, {0x1ffffee,25}, {0x1ffffef,25},
+    {0xfffff4,24}, {0xfffff5,24}, {0x3ffffea,26}, {0x7ffff4,23},
+    {0x3ffffeb,26}, {0x7ffffe6,27}, {0x3ffffec,26}, {0x3ffffed,26},
+    {0x7ffffe7,27}, {0x7ffffe8,27}, {0x7ffffe9,27}, {0x7ffffea,27},
+    {0x7ffffeb,27}, {0xffffffe,28}, {0x7ffffec,27}, {0x7ffffed,27},
+    {0x7ffffee,27}, {0x7ffffef,27}, {0x7fffff0,27}, {0x3ffffee,26},
+    {0x3fffffff,30},
+};
+
+/**
+**Huffman编码是规范编码，同一长度的码字按符号顺序连续分配，
+**所以解码只需每个长度的首个码字和该长度的符号列表
+*/
+struct HuffmanDecodeTable
+{
+	/*每个长度的首个码字*/
+    uint32_t first[31];
+	/*每个长度的码字个数*/
+    uint16_t count[31];
+	/*每个长度的符号在symbols中的起始位置*/
+    uint16_t offset[31];
+	/*按(长度,符号)排序的符号*/
+    uint16_t symbols[257];
+
+    HuffmanDecodeTable()
+    {
+        memset(first,0,sizeof(first));
+        memset(count,0,sizeof(count));
+        memset(offset,0,sizeof(offset));
+        for(int s=0;s<257;++s)
+        {
+            count[huffman_table[s].len]++;
+        }
+        int pos=0;
+        for(int len=1;len<=30;++len)
+        {
+            offset[len]=pos;
+            int n=0;
+            for(int s=0;s<257;++s)
+            {
+                if(huffman_table[s].len==len)
+                {
+                    if(n==0)
+                    {
+                        first[len]=huffman_table[s].code;
+                    }
+                    symbols[pos+n++]=s;
+                }
+            }
+            pos+=n;
+        }
+    }
+};
+
+static const HuffmanDecodeTable huffman_decode_table;
+
+size_t HuffmanEncodedLength(const std::string& str)
+{
+    uint64_t bits=0;
+    for(size_t i=0;i<str.size();++i)
+    {
+        bits+=huffman_table[(uint8_t)str[i]].len;
+    }
+    return (bits+7)/8;
+}
+
+void HuffmanEncode(const std::string& str,std::string& out)
+{
+    uint64_t acc=0;
+    int nbits=0;
+    for(size_t i=0;i<str.size();++i)
+    {
+        const uint8_t sym=(uint8_t)str[i];
+        acc=(acc<<huffman_table[sym].len)|huffman_table[sym].code;
+        nbits+=huffman_table[sym].len;
+        while(nbits>=8)
+        {
+            nbits-=8;
+            out.push_back((char)(acc>>nbits));
+        }
+    }
+    if(nbits>0)
+    {
+        /*用EOS的高位(全1)填充最后一个字节*/
+        out.push_back((char)((acc<<(8-nbits))|(0xff>>nbits)));
+    }
+}
+
+bool HuffmanDecode(const uint8_t* data,size_t len,std::string& out)
+{
+    const HuffmanDecodeTable& t=huffman_decode_table;
+    uint32_t code=0;
+    int code_len=0;
+    for(size_t i=0;i<len;++i)
+    {
+        for(int b=7;b>=0;--b)
+        {
+            code=(code<<1)|((data[i]>>b)&1);
+            code_len++;
+            if(code_len>30)
+            {
+                return false;
+            }
+            if(t.count[code_len] && code>=t.first[code_len] && code-t.first[code_len]<t.count[code_len])
+            {
+                uint16_t sym=t.symbols[t.offset[code_len]+code-t.first[code_len]];
+                /*头部块中出现EOS是解码错误*/
+                if(sym==256)
+                {
+                    return false;
+                }
+                out.push_back((char)sym);
+                code=0;
+                code_len=0;
+            }
+        }
+    }
+    /*填充不能超过7位，且必须全为1*/
+    if(code_len>7 || code!=((1u<<code_len)-1))
+    {
+        return false;
+    }
+    return true;
+}
+
+void HpackEncodeInteger(uint64_t value,int prefix,uint8_t flags,std::string& out)
+{
+    const uint64_t max_prefix=(1u<<prefix)-1;
+    if(value<max_prefix)
+    {
+        out.push_back((char)(flags|value));
+        return;
+    }
+    out.push_back((char)(flags|max_prefix));
+    value-=max_prefix;
+    while(value>=128)
+    {
+        out.push_back((char)((value&0x7f)|0x80));
+        value>>=7;
+    }
+    out.push_back((char)value);
+}
+
+bool HpackDecodeInteger(const uint8_t*& p,const uint8_t* end,int prefix,uint64_t* value)
+{
+    if(p>=end)
+    {
+        return false;
+    }
+    const uint64_t max_prefix=(1u<<prefix)-1;
+    uint64_t v=*p++&max_prefix;
+    if(v<max_prefix)
+    {
+        *value=v;
+        return true;
+    }
+    int shift=0;
+    while(p<end)
+    {
+        uint8_t b=*p++;
+        v+=(uint64_t)(b&0x7f)<<shift;
+        shift+=7;
+        if(!(b&0x80))
+        {
+            *value=v;
+            return true;
+        }
+        /*拒绝超过32位的整数，防止溢出*/
+        if(shift>28)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+HpackTable::HpackTable():m_size_(0),m_max_size_(DEFAULT_TABLE_SIZE)
+{
+}
+
+HpackTable::~HpackTable()
+{
+}
+
+const HeaderField* HpackTable::Get(size_t index) const
+{
+    if(index==0)
+    {
+        return NULL;
+    }
+    if(index<=(size_t)STATIC_TABLE_SIZE)
+    {
+        return &static_table[index-1];
+    }
+    index-=STATIC_TABLE_SIZE+1;
+    if(index>=m_entries_.size())
+    {
+        return NULL;
+    }
+    return &m_entries_[index];
+}
+
+void HpackTable::Add(const std::string& name,const std::string& value)
+{
+    size_t entry_size=name.size()+value.size()+32;
+    /*条目比整个表还大时，清空动态表且不插入*/
+    if(entry_size>m_max_size_)
+    {
+        m_entries_.clear();
+        m_size_=0;
+        return;
+    }
+    m_size_+=entry_size;
+    Evict();
+    m_entries_.push_front(HeaderField(name,value));
+}
+
+void HpackTable::Resize(size_t max_size)
+{
+    m_max_size_=max_size;
+    Evict();
+}
+
+void HpackTable::Evict()
+{
+    while(m_size_>m_max_size_ && !m_entries_.empty())
+    {
+        const HeaderField& last=m_entries_.back();
+        m_size_-=last.first.size()+last.second.size()+32;
+        m_entries_.pop_back();
+    }
+}
+
+size_t HpackTable::Find(const std::string& name,const std::string& value,bool* full) const
+{
+    size_t name_index=0;
+    *full=false;
+    for(int i=0;i<STATIC_TABLE_SIZE;++i)
+    {
+        if(static_table[i].first==name)
+        {
+            if(static_table[i].second==value)
+            {
+                *full=true;
+                return i+1;
+            }
+            if(!name_index)
+            {
+                name_index=i+1;
+            }
+        }
+    }
+    for(size_t i=0;i<m_entries_.size();++i)
+    {
+        if(m_entries_[i].first==name)
+        {
+            if(m_entries_[i].second==value)
+            {
+                *full=true;
+                return STATIC_TABLE_SIZE+1+i;
+            }
+            if(!name_index)
+            {
+                name_index=STATIC_TABLE_SIZE+1+i;
+            }
+        }
+    }
+    return name_index;
+}
+
+HpackDecoder::HpackDecoder():m_settings_size_(HpackTable::DEFAULT_TABLE_SIZE)
+{
+}
+
+HpackDecoder::~HpackDecoder()
+{
+}
+
+bool HpackDecoder::DecodeString(const uint8_t*& p,const uint8_t* end,std::string& out)
+{
+    if(p>=end)
+    {
+        return false;
+    }
+    bool huffman=(*p&0x80)!=0;
+    uint64_t len=0;
+    if(!HpackDecodeInteger(p,end,7,&len) || len>(uint64_t)(end-p))
+    {
+        return false;
+    }
+    out.clear();
+    if(huffman)
+    {
+        if(!HuffmanDecode(p,len,out))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        out.assign((const char*)p,len);
+    }
+    p+=len;
+    return true;
+}
+
+bool HpackDecoder::Decode(const uint8_t* data,size_t len,std::vector<HeaderField>& headers)
+{
+    const uint8_t* p=data;
+    const uint8_t* end=data+len;
+    /*动态表大小更新只能出现在头部块的开头*/
+    bool header_seen=false;
+    while(p<end)
+    {
+        uint8_t b=*p;
+        uint64_t index=0;
+        if(b&0x80)
+        {
+            /*索引头部字段*/
+            if(!HpackDecodeInteger(p,end,7,&index))
+            {
+                return false;
+            }
+            const HeaderField* field=m_table_.Get(index);
+            if(!field)
+            {
+                return false;
+            }
+            headers.push_back(*field);
+            header_seen=true;
+        }
+        else if((b&0xe0)==0x20)
+        {
+            /*动态表大小更新*/
+            if(header_seen || !HpackDecodeInteger(p,end,5,&index) || index>m_settings_size_)
+            {
+                return false;
+            }
+            m_table_.Resize(index);
+        }
+        else
+        {
+            /*字面量：01为增量索引，0000为不索引，0001为永不索引*/
+            bool indexing=(b&0xc0)==0x40;
+            int prefix=indexing?6:4;
+            if(!HpackDecodeInteger(p,end,prefix,&index))
+            {
+                return false;
+            }
+            HeaderField field;
+            if(index)
+            {
+                const HeaderField* name=m_table_.Get(index);
+                if(!name)
+                {
+                    return false;
+                }
+                field.first=name->first;
+            }
+            else if(!DecodeString(p,end,field.first))
+            {
+                return false;
+            }
+            if(!DecodeString(p,end,field.second))
+            {
+                return false;
+            }
+            if(indexing)
+            {
+                m_table_.Add(field.first,field.second);
+            }
+            headers.push_back(field);
+            header_seen=true;
+        }
+    }
+    return true;
+}
+
+HpackEncoder::HpackEncoder():m_pending_size_(-1)
+{
+}
+
+HpackEncoder::~HpackEncoder()
+{
+}
+
+void HpackEncoder::SetMaxTableSize(size_t max_size)
+{
+    /*我们的编码器从不使用超过默认大小的动态表*/
+    if(max_size>HpackTable::DEFAULT_TABLE_SIZE)
+    {
+        max_size=HpackTable::DEFAULT_TABLE_SIZE;
+    }
+    if(max_size!=m_table_.MaxSize())
+    {
+        m_table_.Resize(max_size);
+        m_pending_size_=max_size;
+    }
+}
+
+void HpackEncoder::Begin(std::string& out)
+{
+    if(m_pending_size_>=0)
+    {
+        HpackEncodeInteger(m_pending_size_,5,0x20,out);
+        m_pending_size_=-1;
+    }
+}
+
+void HpackEncoder::EncodeString(const std::string& str,std::string& out)
+{
+    size_t huffman_len=HuffmanEncodedLength(str);
+    if(huffman_len<str.size())
+    {
+        HpackEncodeInteger(huffman_len,7,0x80,out);
+        HuffmanEncode(str,out);
+    }
+    else
+    {
+        HpackEncodeInteger(str.size(),7,0x00,out);
+        out.append(str);
+    }
+}
+
+void HpackEncoder::Encode(const std::string& name,const std::string& value,std::string& out,bool indexing)
+{
+    bool full=false;
+    size_t index=m_table_.Find(name,value,&full);
+    if(full)
+    {
+        HpackEncodeInteger(index,7,0x80,out);
+        return;
+    }
+    if(indexing)
+    {
+        HpackEncodeInteger(index,6,0x40,out);
+    }
+    else
+    {
+        HpackEncodeInteger(index,4,0x00,out);
+    }
+    if(!index)
+    {
+        EncodeString(name,out);
+    }
+    EncodeString(value,out);
+    if(indexing)
+    {
+        m_table_.Add(name,value);
+    }
+}
@@ -0,0 +1,936 @@
+#include <string.h>
+#include <stdio.h>
+#include <time.h>
+#include "AccessLog.h"
+#include "HttpConn.h"
+#include "Http2Session.h"
+#include "DiskIo.h"
+#include "Clock.h"
+
+extern const char* error_400_form;
+extern const char* error_403_form;
+extern const char* error_404_form;
+extern const char* error_500_form;
+extern const char* error_429_form;
+
+const char Http2Session::PREFACE[]="PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+
+/*标志位*/
+static const uint8_t FLAG_END_STREAM=0x1;
+static const uint8_t FLAG_ACK=0x1;
+static const uint8_t FLAG_END_HEADERS=0x4;
+static const uint8_t FLAG_PADDED=0x8;
+static const uint8_t FLAG_PRIORITY=0x20;
+/*SETTINGS参数*/
+static const uint16_t SETTINGS_HEADER_TABLE_SIZE=0x1;
+static const uint16_t SETTINGS_ENABLE_PUSH=0x2;
+static const uint16_t SETTINGS_MAX_CONCURRENT_STREAMS=0x3;
+static const uint16_t SETTINGS_INITIAL_WINDOW_SIZE=0x4;
+static const uint16_t SETTINGS_MAX_FRAME_SIZE=0x5;
+/*窗口的最大值*/
+static const int64_t MAX_WINDOW_SIZE=0x7fffffff;
+/*空文件的响应体，与HTTP/1.1一致*/
+static const char* ok_empty_body="<html><body></body></html>";
+
+static uint32_t ReadUint32(const uint8_t* p)
+{
+    return ((uint32_t)p[0]<<24)|((uint32_t)p[1]<<16)|((uint32_t)p[2]<<8)|p[3];
+}
+
+/*base64url解码HTTP2-Settings头部，忽略填充*/
+static bool DecodeBase64Url(const char* in,std::string& out)
+{
+    uint32_t acc=0;
+    int bits=0;
+    for(;*in && *in!='=';++in)
+    {
+        char c=*in;
+        int v;
+        if(c>='A' && c<='Z') v=c-'A';
+        else if(c>='a' && c<='z') v=c-'a'+26;
+        else if(c>='0' && c<='9') v=c-'0'+52;
+        else if(c=='-' || c=='+') v=62;
+        else if(c=='_' || c=='/') v=63;
+        else return false;
+        acc=(acc<<6)|v;
+        bits+=6;
+        if(bits>=8)
+        {
+            bits-=8;
+            out.push_back((char)(acc>>bits));
+        }
+    }
+    return true;
+}
+
+Http2Session::Http2Session():m_out_pos_(0),m_preface_received_(false),m_goaway_sent_(false),
+    m_continuation_stream_(0),m_last_stream_id_(0),m_send_window_(DEFAULT_WINDOW_SIZE),
+    m_peer_initial_window_(DEFAULT_WINDOW_SIZE),m_peer_max_frame_(DEFAULT_MAX_FRAME_SIZE),m_ticket_(NULL),m_peer_(NULL),m_cold_file_(NULL),m_cold_offset_(0)
+{
+}
+
+Http2Session::~Http2Session()
+{
+    while(!m_streams_.empty())
+    {
+        CloseStream(m_streams_.begin()->second);
+    }
+}
+
+bool Http2Session::IsPreface(const char* buf,int len)
+{
+    return memcmp(buf,PREFACE,len<PREFACE_LEN?len:PREFACE_LEN)==0;
+}
+
+void Http2Session::Start()
+{
+    /*服务端连接前言：一个SETTINGS帧*/
+    WriteFrameHeader(6,SETTINGS,0,0);
+    m_out_.push_back(0);
+    m_out_.push_back((char)SETTINGS_MAX_CONCURRENT_STREAMS);
+    m_out_.push_back((char)(MAX_CONCURRENT_STREAMS>>24));
+    m_out_.push_back((char)(MAX_CONCURRENT_STREAMS>>16));
+    m_out_.push_back((char)(MAX_CONCURRENT_STREAMS>>8));
+    m_out_.push_back((char)MAX_CONCURRENT_STREAMS);
+}
+
+bool Http2Session::Upgrade(const char* settings,const char* method,const char* path,const VirtualHost* host,bool charged)
+{
+    std::string payload;
+    if(!settings || !DecodeBase64Url(settings,payload))
+    {
+        return false;
+    }
+    m_out_.append("HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+    Start();
+    /*HTTP2-Settings等同于一个SETTINGS帧，101响应就是对它的确认，不需要ACK*/
+    if(payload.size()%6!=0 || ApplySettings((const uint8_t*)payload.data(),payload.size())!=NO_ERROR)
+    {
+        return false;
+    }
+    Http2Stream* stream=new Http2Stream();
+    stream->m_id_=1;
+    stream->m_send_window_=m_peer_initial_window_;
+    stream->m_remote_closed_=true;
+    m_streams_[1]=stream;
+    m_last_stream_id_=1;
+    /*升级请求在HttpConn::DoRequest中取过令牌时不再重复计数*/
+    Respond(stream,method,path,host,charged);
+    return true;
+}
+
+bool Http2Session::Append(const char* data,int len)
+{
+    if(m_in_.size()+len>INPUT_LIMIT)
+    {
+        return false;
+    }
+    m_in_.append(data,len);
+    return true;
+}
+
+bool Http2Session::Process()
+{
+    size_t pos=0;
+    if(!m_preface_received_)
+    {
+        size_t n=m_in_.size()<(size_t)PREFACE_LEN?m_in_.size():PREFACE_LEN;
+        if(memcmp(m_in_.data(),PREFACE,n)!=0)
+        {
+            return false;
+        }
+        if(n<(size_t)PREFACE_LEN)
+        {
+            return true;
+        }
+        m_preface_received_=true;
+        pos=PREFACE_LEN;
+    }
+    while(!m_goaway_sent_ && m_in_.size()-pos>=(size_t)FRAME_HEADER_LEN)
+    {
+        const uint8_t* p=(const uint8_t*)m_in_.data()+pos;
+        uint32_t len=((uint32_t)p[0]<<16)|((uint32_t)p[1]<<8)|p[2];
+        uint8_t type=p[3];
+        uint8_t flags=p[4];
+        uint32_t stream_id=ReadUint32(p+5)&0x7fffffff;
+        /*我们没有修改SETTINGS_MAX_FRAME_SIZE，超过默认值即为错误*/
+        if(len>DEFAULT_MAX_FRAME_SIZE)
+        {
+            GoAway(FRAME_SIZE_ERROR);
+            break;
+        }
+        if(m_in_.size()-pos<FRAME_HEADER_LEN+len)
+        {
+            break;
+        }
+        pos+=FRAME_HEADER_LEN+len;
+        if(!OnFrame(type,flags,stream_id,p+FRAME_HEADER_LEN,len))
+        {
+            break;
+        }
+    }
+    if(m_goaway_sent_)
+    {
+        m_in_.clear();
+    }
+    else
+    {
+        m_in_.erase(0,pos);
+    }
+    Pump();
+    return !Finished();
+}
+
+bool Http2Session::OnFrame(uint8_t type,uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len)
+{
+    /*头部块必须连续，中间不能插入其他帧*/
+    if(m_continuation_stream_ && (type!=CONTINUATION || stream_id!=m_continuation_stream_))
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    switch(type)
+    {
+        case DATA:
+        {
+            return OnData(flags,stream_id,payload,len);
+        }
+        case HEADERS:
+        {
+            return OnHeaders(flags,stream_id,payload,len);
+        }
+        case CONTINUATION:
+        {
+            return OnContinuation(flags,stream_id,payload,len);
+        }
+        case PRIORITY:
+        {
+            if(stream_id==0)
+            {
+                return GoAway(PROTOCOL_ERROR);
+            }
+            if(len!=5)
+            {
+                WriteRstStream(stream_id,FRAME_SIZE_ERROR);
+            }
+            return true;
+        }
+        case RST_STREAM:
+        {
+            return OnRstStream(stream_id,len);
+        }
+        case SETTINGS:
+        {
+            return OnSettings(flags,stream_id,payload,len);
+        }
+        case PUSH_PROMISE:
+        {
+            /*客户端不能推送*/
+            return GoAway(PROTOCOL_ERROR);
+        }
+        case PING:
+        {
+            if(stream_id!=0)
+            {
+                return GoAway(PROTOCOL_ERROR);
+            }
+            if(len!=8)
+            {
+                return GoAway(FRAME_SIZE_ERROR);
+            }
+            if(!(flags&FLAG_ACK))
+            {
+                WriteFrameHeader(8,PING,FLAG_ACK,0);
+                m_out_.append((const char*)payload,8);
+            }
+            return true;
+        }
+        case GOAWAY:
+        {
+            /*对端不再发起新的流，已有的响应发送完后关闭连接*/
+            return GoAway(NO_ERROR);
+        }
+        case WINDOW_UPDATE:
+        {
+            return OnWindowUpdate(stream_id,payload,len);
+        }
+        default:
+        {
+            /*忽略未知类型的帧*/
+            return true;
+        }
+    }
+}
+
+bool Http2Session::OnHeaders(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len)
+{
+    if(stream_id==0)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    uint32_t pad=0;
+    if(flags&FLAG_PADDED)
+    {
+        if(len<1)
+        {
+            return GoAway(FRAME_SIZE_ERROR);
+        }
+        pad=payload[0];
+        payload++;
+        len--;
+    }
+    if(flags&FLAG_PRIORITY)
+    {
+        if(len<5)
+        {
+            return GoAway(FRAME_SIZE_ERROR);
+        }
+        payload+=5;
+        len-=5;
+    }
+    if(pad>len)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    len-=pad;
+    Http2Stream* stream=FindStream(stream_id);
+    if(!stream)
+    {
+        /*客户端发起的流必须是奇数且递增*/
+        if((stream_id&1)==0 || stream_id<=m_last_stream_id_)
+        {
+            return GoAway(PROTOCOL_ERROR);
+        }
+        m_last_stream_id_=stream_id;
+        stream=new Http2Stream();
+        stream->m_id_=stream_id;
+        stream->m_send_window_=m_peer_initial_window_;
+        stream->m_time_us_=AccessLog::NowUs();
+        stream->m_start_us_=MonotonicUs();
+        m_streams_[stream_id]=stream;
+    }
+    else if(stream->m_remote_closed_)
+    {
+        return GoAway(STREAM_CLOSED);
+    }
+    stream->m_header_block_.assign((const char*)payload,len);
+    stream->m_end_stream_pending_=(flags&FLAG_END_STREAM)!=0;
+    if(!(flags&FLAG_END_HEADERS))
+    {
+        m_continuation_stream_=stream_id;
+        return true;
+    }
+    return OnRequest(stream);
+}
+
+bool Http2Session::OnContinuation(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len)
+{
+    Http2Stream* stream=FindStream(stream_id);
+    if(!stream || stream_id!=m_continuation_stream_)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    if(stream->m_header_block_.size()+len>INPUT_LIMIT)
+    {
+        return GoAway(INTERNAL_ERROR);
+    }
+    stream->m_header_block_.append((const char*)payload,len);
+    if(!(flags&FLAG_END_HEADERS))
+    {
+        return true;
+    }
+    m_continuation_stream_=0;
+    return OnRequest(stream);
+}
+
+bool Http2Session::OnRequest(Http2Stream* stream)
+{
+    std::vector<HeaderField> headers;
+    /*即使流随后被拒绝，也必须解码头部块以保持动态表同步*/
+    bool ok=m_decoder_.Decode((const uint8_t*)stream->m_header_block_.data(),stream->m_header_block_.size(),headers);
+    std::string().swap(stream->m_header_block_);
+    if(!ok)
+    {
+        return GoAway(COMPRESSION_ERROR);
+    }
+    bool trailers=stream->m_queued_ || stream->m_body_len_>0 || stream->m_file_;
+    if(stream->m_end_stream_pending_)
+    {
+        stream->m_remote_closed_=true;
+    }
+    /*请求尾部字段，响应已经生成*/
+    if(trailers)
+    {
+        return true;
+    }
+    if(m_streams_.size()>MAX_CONCURRENT_STREAMS)
+    {
+        WriteRstStream(stream->m_id_,REFUSED_STREAM);
+        CloseStream(stream);
+        return true;
+    }
+    const char* method=NULL;
+    const char* path=NULL;
+    const char* authority=NULL;
+    for(size_t i=0;i<headers.size();++i)
+    {
+        if(headers[i].first==":method")
+        {
+            method=headers[i].second.c_str();
+        }
+        else if(headers[i].first==":path")
+        {
+            path=headers[i].second.c_str();
+        }
+        /*:authority优先，没有时使用Host头部*/
+        else if(headers[i].first==":authority" || (headers[i].first=="host" && !authority))
+        {
+            authority=headers[i].second.c_str();
+        }
+    }
+    if(!method || !path)
+    {
+        WriteRstStream(stream->m_id_,PROTOCOL_ERROR);
+        CloseStream(stream);
+        return true;
+    }
+    Respond(stream,method,path,HostTable::Instance()->Find(authority));
+    return true;
+}
+
+void Http2Session::Respond(Http2Stream* stream,const char* method,const char* path,const VirtualHost* host,bool charged)
+{
+    int status=200;
+    bool head=strcmp(method,"HEAD")==0;
+    if(stream->m_start_us_==0)
+    {
+        /*h2c升级的流1没有HEADERS帧*/
+        stream->m_time_us_=AccessLog::NowUs();
+        stream->m_start_us_=MonotonicUs();
+    }
+    stream->m_method_=-1;
+    for(int i=0;i<HttpConn::METHOD_COUNT;++i)
+    {
+        if(strcmp(method,HttpConn::MethodName(i))==0)
+        {
+            stream->m_method_=i;
+            break;
+        }
+    }
+    if((!head && strcmp(method,"GET")!=0) || !HttpConn::SafePath(path))
+    {
+        status=400;
+    }
+    else if(!charged && ((m_ticket_ && !RateLimiter::Instance()->AllowRequest(m_ticket_)) || !HostTable::Instance()->AllowRequest(host)))
+    {
+        status=429;
+    }
+    else
+    {
+        /*与HttpConn::DoRequest相同的路径拼接方式*/
+        char real_file[HttpConn::FILENAME_LEN];
+        memset(real_file,'\0',HttpConn::FILENAME_LEN);
+        strcpy(real_file,host->m_root_.c_str());
+        int len=host->m_root_.size();
+        strncpy(real_file+len,path,HttpConn::FILENAME_LEN-len-1);
+        switch(FileCache::Instance()->Acquire(real_file,&stream->m_file_))
+        {
+            case FileCache::FILE_OK:
+            {
+                status=200;
+                break;
+            }
+            case FileCache::FILE_NOT_FOUND:
+            {
+                status=404;
+                break;
+            }
+            case FileCache::FILE_FORBIDDEN:
+            {
+                status=403;
+                break;
+            }
+            case FileCache::FILE_IS_DIR:
+            {
+                status=400;
+                break;
+            }
+            default:
+            {
+                status=500;
+                break;
+            }
+        }
+    }
+    switch(status)
+    {
+        case 200:
+        {
+            if(stream->m_file_->m_size_>0)
+            {
+                stream->m_body_len_=stream->m_file_->m_size_;
+            }
+            else
+            {
+                stream->m_body_=ok_empty_body;
+                stream->m_body_len_=strlen(ok_empty_body);
+            }
+            break;
+        }
+        case 400:
+        {
+            stream->m_body_=error_400_form;
+            break;
+        }
+        case 403:
+        {
+            stream->m_body_=error_403_form;
+            break;
+        }
+        case 404:
+        {
+            stream->m_body_=error_404_form;
+            break;
+        }
+        case 429:
+        {
+            stream->m_body_=error_429_form;
+            break;
+        }
+        default:
+        {
+            stream->m_body_=error_500_form;
+            break;
+        }
+    }
+    if(status!=200)
+    {
+        stream->m_body_len_=strlen(stream->m_body_);
+    }
+    stream->m_status_=status;
+    stream->m_path_=path;
+    stream->m_respond_us_=MonotonicUs();
+    char buf[24];
+    std::string block;
+    m_encoder_.Begin(block);
+    snprintf(buf,sizeof(buf),"%d",status);
+    m_encoder_.Encode(":status",buf,block);
+    snprintf(buf,sizeof(buf),"%lld",(long long)stream->m_body_len_);
+    m_encoder_.Encode("content-length",buf,block,false);
+    if(head)
+    {
+        stream->m_body_len_=0;
+    }
+    WriteFrameHeader(block.size(),HEADERS,FLAG_END_HEADERS|(stream->m_body_len_==0?FLAG_END_STREAM:0),stream->m_id_);
+    m_out_.append(block);
+    if(stream->m_body_len_==0)
+    {
+        if(!stream->m_remote_closed_)
+        {
+            /*响应已完整，告诉客户端不必再发送请求体*/
+            WriteRstStream(stream->m_id_,NO_ERROR);
+        }
+        LogStream(stream);
+        CloseStream(stream);
+        return;
+    }
+    stream->m_queued_=true;
+    m_send_queue_.push_back(stream);
+}
+
+bool Http2Session::OnData(uint8_t flags,uint32_t stream_id,const uint8_t*,uint32_t len)
+{
+    if(stream_id==0)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    if(stream_id>m_last_stream_id_)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    /*请求体被丢弃，立即归还流量控制窗口*/
+    if(len>0)
+    {
+        WriteWindowUpdate(0,len);
+    }
+    Http2Stream* stream=FindStream(stream_id);
+    if(!stream)
+    {
+        return true;
+    }
+    if(stream->m_remote_closed_)
+    {
+        return GoAway(STREAM_CLOSED);
+    }
+    if(flags&FLAG_END_STREAM)
+    {
+        stream->m_remote_closed_=true;
+    }
+    else if(len>0)
+    {
+        WriteWindowUpdate(stream_id,len);
+    }
+    return true;
+}
+
+bool Http2Session::OnSettings(uint8_t flags,uint32_t stream_id,const uint8_t* payload,uint32_t len)
+{
+    if(stream_id!=0)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    if(flags&FLAG_ACK)
+    {
+        return len==0?true:GoAway(FRAME_SIZE_ERROR);
+    }
+    if(len%6!=0)
+    {
+        return GoAway(FRAME_SIZE_ERROR);
+    }
+    uint32_t error=ApplySettings(payload,len);
+    if(error!=NO_ERROR)
+    {
+        return GoAway(error);
+    }
+    WriteFrameHeader(0,SETTINGS,FLAG_ACK,0);
+    return true;
+}
+
+uint32_t Http2Session::ApplySettings(const uint8_t* payload,uint32_t len)
+{
+    for(uint32_t i=0;i<len;i+=6)
+    {
+        uint16_t id=((uint16_t)payload[i]<<8)|payload[i+1];
+        uint32_t value=ReadUint32(payload+i+2);
+        switch(id)
+        {
+            case SETTINGS_HEADER_TABLE_SIZE:
+            {
+                m_encoder_.SetMaxTableSize(value);
+                break;
+            }
+            case SETTINGS_ENABLE_PUSH:
+            {
+                if(value>1)
+                {
+                    return PROTOCOL_ERROR;
+                }
+                break;
+            }
+            case SETTINGS_INITIAL_WINDOW_SIZE:
+            {
+                if(value>MAX_WINDOW_SIZE)
+                {
+                    return FLOW_CONTROL_ERROR;
+                }
+                /*所有流的发送窗口按差值调整*/
+                int64_t delta=(int64_t)value-m_peer_initial_window_;
+                m_peer_initial_window_=value;
+                for(std::map<uint32_t,Http2Stream*>::iterator it=m_streams_.begin();it!=m_streams_.end();++it)
+                {
+                    it->second->m_send_window_+=delta;
+                }
+                break;
+            }
+            case SETTINGS_MAX_FRAME_SIZE:
+            {
+                if(value<DEFAULT_MAX_FRAME_SIZE || value>0xffffff)
+                {
+                    return PROTOCOL_ERROR;
+                }
+                m_peer_max_frame_=value;
+                break;
+            }
+            default:
+            {
+                break;
+            }
+        }
+    }
+    return NO_ERROR;
+}
+
+bool Http2Session::OnWindowUpdate(uint32_t stream_id,const uint8_t* payload,uint32_t len)
+{
+    if(len!=4)
+    {
+        return GoAway(FRAME_SIZE_ERROR);
+    }
+    uint32_t increment=ReadUint32(payload)&0x7fffffff;
+    if(stream_id==0)
+    {
+        if(increment==0)
+        {
+            return GoAway(PROTOCOL_ERROR);
+        }
+        m_send_window_+=increment;
+        if(m_send_window_>MAX_WINDOW_SIZE)
+        {
+            return GoAway(FLOW_CONTROL_ERROR);
+        }
+        return true;
+    }
+    Http2Stream* stream=FindStream(stream_id);
+    if(!stream)
+    {
+        return true;
+    }
+    if(increment==0 || stream->m_send_window_+increment>MAX_WINDOW_SIZE)
+    {
+        WriteRstStream(stream_id,increment==0?PROTOCOL_ERROR:FLOW_CONTROL_ERROR);
+        CloseStream(stream);
+        return true;
+    }
+    stream->m_send_window_+=increment;
+    return true;
+}
+
+bool Http2Session::OnRstStream(uint32_t stream_id,uint32_t len)
+{
+    if(stream_id==0)
+    {
+        return GoAway(PROTOCOL_ERROR);
+    }
+    if(len!=4)
+    {
+        return GoAway(FRAME_SIZE_ERROR);
+    }
+    Http2Stream* stream=FindStream(stream_id);
+    if(stream)
+    {
+        CloseStream(stream);
+    }
+    return true;
+}
+
+void Http2Session::Pump(bool blocking)
+{
+    m_cold_file_=NULL;
+    /*每轮每个流最多发送一帧，发送后移到队尾，实现流之间的轮询*/
+    bool progress=true;
+    while(progress && m_out_.size()-m_out_pos_<OUTPUT_HIGH_WATER && m_send_window_>0 && !m_send_queue_.empty())
+    {
+        progress=false;
+        size_t n=m_send_queue_.size();
+        for(size_t i=0;i<n && m_out_.size()-m_out_pos_<OUTPUT_HIGH_WATER && m_send_window_>0;++i)
+        {
+            Http2Stream* stream=m_send_queue_.front();
+            m_send_queue_.pop_front();
+            int64_t chunk=stream->m_body_len_-stream->m_sent_;
+            if(chunk>(int64_t)m_peer_max_frame_)
+            {
+                chunk=m_peer_max_frame_;
+            }
+            if(chunk>stream->m_send_window_)
+            {
+                chunk=stream->m_send_window_;
+            }
+            if(chunk>m_send_window_)
+            {
+                chunk=m_send_window_;
+            }
+            if(chunk<=0)
+            {
+                /*流的窗口已用完，等待WINDOW_UPDATE*/
+                m_send_queue_.push_back(stream);
+                continue;
+            }
+            const char* body=stream->m_file_ && stream->m_file_->m_size_>0?stream->m_file_->m_address_:stream->m_body_;
+            /*按窗口检查文件数据是否在内存中，不在时跳过该流，由I/O线程交给磁盘线程读入*/
+            if(!blocking && body!=stream->m_body_ && stream->m_sent_+chunk>stream->m_resident_end_)
+            {
+                int64_t window=stream->m_body_len_-stream->m_sent_;
+                if(window>(int64_t)DiskIo::WINDOW)
+                {
+                    window=DiskIo::WINDOW;
+                }
+                if(!DiskIo::Resident(body+stream->m_sent_,window))
+                {
+                    if(!m_cold_file_)
+                    {
+                        m_cold_file_=stream->m_file_;
+                        m_cold_offset_=stream->m_sent_;
+                    }
+                    m_send_queue_.push_back(stream);
+                    continue;
+                }
+                stream->m_resident_end_=stream->m_sent_+window;
+            }
+            if(!blocking && body!=stream->m_body_ && chunk>stream->m_resident_end_-stream->m_sent_)
+            {
+                chunk=stream->m_resident_end_-stream->m_sent_;
+            }
+            bool last=stream->m_sent_+chunk==stream->m_body_len_;
+            WriteFrameHeader(chunk,DATA,last?FLAG_END_STREAM:0,stream->m_id_);
+            m_out_.append(body+stream->m_sent_,chunk);
+            stream->m_sent_+=chunk;
+            stream->m_send_window_-=chunk;
+            m_send_window_-=chunk;
+            progress=true;
+            if(last)
+            {
+                stream->m_queued_=false;
+                if(!stream->m_remote_closed_)
+                {
+                    WriteRstStream(stream->m_id_,NO_ERROR);
+                }
+                LogStream(stream);
+                CloseStream(stream);
+            }
+            else
+            {
+                m_send_queue_.push_back(stream);
+            }
+        }
+    }
+}
+
+void Http2Session::OutConsume(size_t n)
+{
+    m_out_pos_+=n;
+    if(m_out_pos_>=m_out_.size())
+    {
+        m_out_.clear();
+        m_out_pos_=0;
+    }
+    else if(m_out_pos_>=OUTPUT_HIGH_WATER)
+    {
+        m_out_.erase(0,m_out_pos_);
+        m_out_pos_=0;
+    }
+}
+
+void Http2Session::Drain()
+{
+    GoAway(NO_ERROR);
+}
+
+bool Http2Session::ColdWindow(FileEntry** entry,size_t* offset) const
+{
+    if(!m_cold_file_)
+    {
+        return false;
+    }
+    *entry=m_cold_file_;
+    *offset=m_cold_offset_;
+    return true;
+}
+
+bool Http2Session::WantWrite() const
+{
+    /*有冷数据时也注册EPOLLOUT，由I/O线程把它交给磁盘线程*/
+    return OutSize()>0 || m_cold_file_;
+}
+
+bool Http2Session::Finished() const
+{
+    return m_goaway_sent_ && m_send_queue_.empty() && OutSize()==0;
+}
+
+void Http2Session::WriteFrameHeader(uint32_t len,uint8_t type,uint8_t flags,uint32_t stream_id)
+{
+    char header[FRAME_HEADER_LEN];
+    header[0]=(char)(len>>16);
+    header[1]=(char)(len>>8);
+    header[2]=(char)len;
+    header[3]=(char)type;
+    header[4]=(char)flags;
+    header[5]=(char)(stream_id>>24);
+    header[6]=(char)(stream_id>>16);
+    header[7]=(char)(stream_id>>8);
+    header[8]=(char)stream_id;
+    m_out_.append(header,FRAME_HEADER_LEN);
+}
+
+void Http2Session::WriteWindowUpdate(uint32_t stream_id,uint32_t increment)
+{
+    WriteFrameHeader(4,WINDOW_UPDATE,0,stream_id);
+    m_out_.push_back((char)(increment>>24));
+    m_out_.push_back((char)(increment>>16));
+    m_out_.push_back((char)(increment>>8));
+    m_out_.push_back((char)increment);
+}
+
+void Http2Session::WriteRstStream(uint32_t stream_id,uint32_t error)
+{
+    WriteFrameHeader(4,RST_STREAM,0,stream_id);
+    m_out_.push_back((char)(error>>24));
+    m_out_.push_back((char)(error>>16));
+    m_out_.push_back((char)(error>>8));
+    m_out_.push_back((char)error);
+}
+
+bool Http2Session::GoAway(uint32_t error)
+{
+    if(m_goaway_sent_)
+    {
+        return false;
+    }
+    WriteFrameHeader(8,GOAWAY,0,0);
+    m_out_.push_back((char)(m_last_stream_id_>>24));
+    m_out_.push_back((char)(m_last_stream_id_>>16));
+    m_out_.push_back((char)(m_last_stream_id_>>8));
+    m_out_.push_back((char)m_last_stream_id_);
+    m_out_.push_back((char)(error>>24));
+    m_out_.push_back((char)(error>>16));
+    m_out_.push_back((char)(error>>8));
+    m_out_.push_back((char)error);
+    m_goaway_sent_=true;
+    /*连接错误时丢弃未完成的响应*/
+    if(error!=NO_ERROR)
+    {
+        while(!m_streams_.empty())
+        {
+            CloseStream(m_streams_.begin()->second);
+        }
+    }
+    return false;
+}
+
+void Http2Session::CloseStream(Http2Stream* stream)
+{
+    if(stream->m_queued_)
+    {
+        m_send_queue_.remove(stream);
+    }
+    if(m_continuation_stream_==stream->m_id_)
+    {
+        m_continuation_stream_=0;
+    }
+    FileCache::Instance()->Release(stream->m_file_);
+    m_streams_.erase(stream->m_id_);
+    delete stream;
+}
+
+void Http2Session::LogStream(Http2Stream* stream)
+{
+    AccessLog* log=AccessLog::Instance();
+    if(!log->IsOpen())
+    {
+        return;
+    }
+    uint64_t now=MonotonicUs();
+    AccessRequestRecord record;
+    memset(&record,0,sizeof(record));
+    record.m_method_=stream->m_method_;
+    record.m_flags_=ACCESS_FLAG_HTTP2|ACCESS_FLAG_KEEPALIVE;
+    record.m_status_=stream->m_status_;
+    if(m_peer_)
+    {
+        record.m_addr_=m_peer_->sin_addr.s_addr;
+        record.m_port_=m_peer_->sin_port;
+    }
+    record.m_time_us_=stream->m_time_us_;
+    /*响应体全部排入输出时的字节数，不含帧头部*/
+    record.m_bytes_=stream->m_sent_;
+    record.m_total_us_=now-stream->m_start_us_;
+    /*多路复用的流没有单独的读和排队阶段*/
+    record.m_stage_us_[STAGE_PROCESS]=stream->m_respond_us_-stream->m_start_us_;
+    record.m_stage_us_[STAGE_WRITE]=now-stream->m_respond_us_;
+    log->Log(&record,stream->m_path_.c_str());
+}
+
+Http2Stream* Http2Session::FindStream(uint32_t stream_id)
+{
+    std::map<uint32_t,Http2Stream*>::iterator it=m_streams_.find(stream_id);
+    return it==m_streams_.end()?NULL:it->second;
+}
@@ -4,12 +4,26 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/epoll.h>
-#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/sendfile.h>
+#include <sys/socket.h>
 #include "HttpConn.h"
+#include "AccessLog.h"
+#include "FileCache.h"
+#include "Http2Session.h"
+#include "RateLimiter.h"
+#include "WebSocket.h"
+#include "DiskIo.h"
+#include "Coroutine.h"
+#include "SendScheduler.h"
+#include "Trace.h"
+#include "Clock.h"
 
 const char* ok_200_title="OK";
+const char* not_modified_304_title="Not Modified";
 const char* error_400_title="Bad Request";
 const char* error_400_form="You request had bad syntax or is inherently impossible to satisfy.\n";
 const char* error_403_title="Forbidden";
@@ -18,6 +32,10 @@ const char* error_404_title="Not Found";
 const char* error_404_form="The requested file was not found on this server.\n";
 const char* error_500_title="Internal Error";
 const char* error_500_form="There was an unusual problem serving the requested file.\n";
+const char* error_429_title="Too Many Requests";
+const char* error_429_form="Too many requests from your address, please retry later.\n";
+/*预先生成的429应答，限流时不再格式化*/
+static const char error_429_response[]="HTTP/1.1 429 Too Many Requests\r\nContent-Length: 57\r\nRetry-After: 1\r\nConnection: close\r\n\r\nToo many requests from your address, please retry later.\n";
 
 const char* doc_root="/var/www/html";
 
@@ -30,11 +48,13 @@ int SetNonblocking(int fd)
     return old_option;
 }
 
-/*将文件描述符添加到epoll内核事件表中，one_shot表示是否只触发一次该事件，防止多个线程处理同一个事件*/
-void AddFd(int epollfd,int fd,bool one_shot)
+/*将文件描述符添加到epoll内核事件表中，one_shot表示是否只触发一次该事件，防止多个线程处理同一个事件
+**handle随事件返回，用于识别过期的事件
+*/
+void AddFd(int epollfd,int fd,bool one_shot,uint64_t handle)
 {
     struct epoll_event event;
-    event.data.fd=fd;
+    event.data.u64=handle;
     /*可读，设置事件为ET模式，ET （edge-triggered）是高速工作方式，只支持no-block socket，
     **连接断开，或处于半关闭状态
     */
@@ -53,46 +73,89 @@ void RemoveFd(int epollfd,int fd)
     epoll_ctl(epollfd,EPOLL_CTL_DEL,fd,0);
 }
 
-/*修改事件表中的文件描述符*/
-void ModFd(int epollfd,int fd,int ev)
+/*修改事件表中的文件描述符，accept后直接处理的连接还不在事件表中，此时加入*/
+void ModFd(int epollfd,int fd,int ev,uint64_t handle)
 {
     struct epoll_event event;
-    event.data.fd=fd;
+    event.data.u64=handle;
     event.events=ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
-    epoll_ctl(epollfd,EPOLL_CTL_MOD,fd,&event);
+    if(epoll_ctl(epollfd,EPOLL_CTL_MOD,fd,&event)<0 && errno==ENOENT)
+    {
+        epoll_ctl(epollfd,EPOLL_CTL_ADD,fd,&event);
+    }
 }
 
 int HttpConn::m_user_count_=0;
 int HttpConn::m_epollfd_ =-1;
+bool HttpConn::m_draining_=false;
+size_t HttpConn::m_inline_max_size_=0;
+size_t HttpConn::m_short_max_size_=0;
+uint64_t HttpConn::m_accept_ready_=0;
+uint64_t HttpConn::m_accept_wait_=0;
 
-HttpConn::HttpConn()
+HttpConn::HttpConn():m_sockfd_(-1),m_slot_(-1),m_generation_(1),m_file_address_(0),m_file_(0),m_h2_(0),m_ws_(0),m_handler_(0),m_co_(0),m_trace_(0)
 {
 }
 
 HttpConn::~HttpConn()
 {
+    delete m_trace_;
 }
 
 void HttpConn::Close(bool real_close)
 {
     if(real_close && (m_sockfd_ !=-1))
     {
+        /*先让句柄失效，描述符关闭后可能立即被新连接复用*/
+        uint32_t generation=m_generation_.load(std::memory_order_relaxed)+1;
+        m_generation_.store(generation?generation:1,std::memory_order_release);
         RemoveFd(m_epollfd_,m_sockfd_);
+        close(m_sockfd_);
         m_sockfd_=-1;
+        RateLimiter::Instance()->ReleaseConnection(&m_ticket_);
+        Unmap();
+        delete m_h2_;
+        m_h2_=0;
+        if(m_ws_)
+        {
+            WebSocketHub::Instance()->Unregister(m_ws_);
+            delete m_ws_;
+            m_ws_=0;
+        }
+		/*销毁挂起的协程，处理函数的局部变量随之析构*/
+        delete m_co_;
+        m_co_=0;
         m_user_count_--;
     }
 }
 
-void HttpConn::Init(int sockfd,const struct sockaddr_in& addr)
+void HttpConn::Init(int sockfd,const struct sockaddr_in& addr,const RateTicket& ticket,bool arm)
 {
     m_sockfd_=sockfd;
+    m_slot_=sockfd;
     m_address_=addr;
+    m_ticket_=ticket;
+    SendScheduler::Instance()->InitBucket(&m_send_bucket_,MonotonicUs());
+    m_tune_us_=0;
+    m_sndbuf_=0;
+    if(Tracer::Instance()->Enabled())
+    {
+        if(!m_trace_)
+        {
+            m_trace_=new RequestTrace;
+        }
+        m_trace_->Reset();
+    }
    /*注释部分避免超时*/
 //    int reuse=1;
 //    setsockopt(m_sockfd_,SOL_SOCKET,SO_REUSEADDR,&reuse,sizeof(reuse));
-    AddFd(m_epollfd_,sockfd,true);
     m_user_count_++;
     Init();
+    /*注册事件放在最后，之后连接可能被其他线程处理*/
+    if(arm)
+    {
+        AddFd(m_epollfd_,sockfd,true,Handle());
+    }
 }
 
 void HttpConn::Init()
@@ -111,6 +174,19 @@ void HttpConn::Init()
     m_content_length_=0;
     /*主机名*/
     m_host_=0;
+    m_vhost_=HostTable::Instance()->Default();
+    /*h2c升级*/
+    m_h2c_upgrade_=false;
+    m_charged_=false;
+    /*WebSocket升级*/
+    m_ws_upgrade_=false;
+    /*快速路径*/
+    m_inline_=false;
+    m_deferred_=false;
+    m_h2_settings_=0;
+    m_handler_=0;
+    /*头部表*/
+    m_request_.Reset();
     /*当前正在解析的行的起始位置*/
     m_start_line_=0;
     /*当前正在分析的字符在读缓冲区中的位置*/
@@ -119,6 +195,10 @@ void HttpConn::Init()
     m_read_idx_=0;
     /*写缓冲区中待发送的字节数*/
     m_write_idx_=0;
+    /*访问日志*/
+    m_status_=0;
+    m_bytes_sent_=0;
+    m_bytes_to_send_=0;
     memset(m_read_buf,'\0',READ_BUFFER_SIZE);
     memset(m_write_buf,'\0',WRITE_BUFFER_SIZE);
     memset(m_real_file,'\0',FILENAME_LEN);
@@ -171,10 +251,47 @@ HttpConn::LINE_STATUS HttpConn::ParseLine()
 
 bool HttpConn::Read()
 {
+    if(m_ws_)
+    {
+        return ReadWebSocket();
+    }
+    if(m_co_)
+    {
+        return ReadCoroutine();
+    }
     if(m_read_idx_>=READ_BUFFER_SIZE)
         return false;
     int bytes_read=0;
-    while(true)
+    /*HTTP/2连接的数据交给会话缓存，读缓冲区只作为中转*/
+    while(m_h2_)
+    {
+        bytes_read=recv(m_sockfd_,m_read_buf,READ_BUFFER_SIZE,0);
+        if(bytes_read==-1)
+        {
+            if(errno==EAGAIN || errno ==EWOULDBLOCK)
+            {
+                return true;
+            }
+            return false;
+        }
+        else if(bytes_read==0)
+        {
+            return false;
+        }
+        if(!m_h2_->Append(m_read_buf,bytes_read))
+        {
+            return false;
+        }
+    }
+    uint64_t trace_start=m_trace_?Tracer::Now():0;
+    /*新请求的第一次读，记录请求开始时间*/
+    if(m_read_idx_==0)
+    {
+        m_start_us_=AccessLog::NowUs();
+        m_stamp_[STAGE_READ]=MonotonicUs();
+    }
+    /*缓冲区满时先交给解析，头部之后的消息体可能由协程处理函数继续读取*/
+    while(m_read_idx_<READ_BUFFER_SIZE)
     {
         bytes_read=recv(m_sockfd_,m_read_buf+m_read_idx_,READ_BUFFER_SIZE-m_read_idx_,0);
         if(bytes_read==-1)
@@ -191,8 +308,39 @@ bool HttpConn::Read()
         }
         m_read_idx_+=bytes_read;
     }
+    m_stamp_[STAGE_QUEUE]=MonotonicUs();
+    if(m_trace_)
+    {
+        Trace(SPAN_READ,trace_start);
+        m_trace_->m_queued_=Tracer::Now();
+    }
     return true;
 }
+bool HttpConn::ReadOnAccept(bool* ready)
+{
+    *ready=false;
+    if(!Read())
+    {
+        return false;
+    }
+    if(m_read_idx_>0)
+    {
+        m_accept_ready_++;
+        *ready=true;
+        return true;
+    }
+    m_accept_wait_++;
+    AddFd(m_epollfd_,m_sockfd_,true,Handle());
+    return true;
+}
+
+void HttpConn::ReportAccept(FILE* fp)
+{
+    uint64_t total=m_accept_ready_+m_accept_wait_;
+    fprintf(fp,"accept: %llu read on accept, %llu waited for data (%.1f%% fast path)\n",(unsigned long long)m_accept_ready_,
+            (unsigned long long)m_accept_wait_,total>0?100.0*m_accept_ready_/total:0.0);
+}
+
 //解析HTTP请求行，获得请求方法，目标URL，以及HTTP版本号
 HttpConn::HTTP_CODE HttpConn::ParseRequestLine(char* text)
 {
@@ -205,14 +353,17 @@ HttpConn::HTTP_CODE HttpConn::ParseRequestLine(char* text)
     }
     *m_url_++='\0';
     char* method=text;
-    if(strcasecmp(method,"GET")==0)
+    /*GET以外的方法只交给协程处理函数*/
+    int index=0;
+    while(index<METHOD_COUNT && strcasecmp(method,MethodName(index))!=0)
     {
-        m_method_=GET;
+        ++index;
     }
-    else
+    if(index==METHOD_COUNT)
     {
         return BAD_REQUEST;
     }
+    m_method_=(METHOD)index;
     /*返回字符串中第一个不在指定字符串中出现的字符下标*/
     m_url_+=strspn(m_url_," \t");
     m_version_=strpbrk(m_url_," \t");
@@ -249,6 +400,61 @@ HttpConn::HTTP_CODE HttpConn::ParseHeaders(char* text)
     /*遇到一个空行，得到一个正确的HTTP请求*/
     if(text[0] == '\0')
     {
+        /*所有头部(包括折行)都已收齐，再提取连接需要的字段*/
+        const HttpRequest::Header* header=m_request_.Find(HttpRequest::HEADER_CONTENT_LENGTH);
+        if(header)
+        {
+            /*把字符串转换成长整型数*/
+            m_content_length_=atol(header->m_value_.m_data_);
+            if(m_content_length_<0)
+            {
+                return BAD_REQUEST;
+            }
+            /*多个Content-Length的值不同时无法确定消息体的边界(请求走私)*/
+            for(const HttpRequest::Header* next=m_request_.Next(header);next;next=m_request_.Next(next))
+            {
+                if(atol(next->m_value_.m_data_)!=m_content_length_)
+                {
+                    return BAD_REQUEST;
+                }
+            }
+        }
+        header=m_request_.Find(HttpRequest::HEADER_HOST);
+        if(header)
+        {
+            /*Host只能出现一次，否则不同的组件可能选出不同的虚拟主机*/
+            if(m_request_.Next(header))
+            {
+                return BAD_REQUEST;
+            }
+            m_host_=const_cast<char*>(header->m_value_.m_data_);
+            m_vhost_=HostTable::Instance()->Find(m_host_);
+        }
+        if(m_request_.HasToken(HttpRequest::HEADER_CONNECTION,"keep-alive"))
+        {
+            m_linger_=true;
+        }
+        if(m_request_.HasToken(HttpRequest::HEADER_UPGRADE,"h2c"))
+        {
+            header=m_request_.Find(HttpRequest::HEADER_HTTP2_SETTINGS);
+            m_h2c_upgrade_=true;
+            m_h2_settings_=header?const_cast<char*>(header->m_value_.m_data_):0;
+        }
+        if(m_request_.HasToken(HttpRequest::HEADER_UPGRADE,"websocket") && m_request_.HasToken(HttpRequest::HEADER_CONNECTION,"upgrade"))
+        {
+            m_ws_upgrade_=true;
+        }
+        /*有处理函数的路径不等消息体，由处理函数自己读取*/
+        m_handler_=CoRouter::Instance()->Find(m_url_);
+        if(m_handler_)
+        {
+            return GET_REQUEST;
+        }
+        if(m_method_!=GET)
+        {
+            m_linger_=false;
+            return BAD_REQUEST;
+        }
         if(m_content_length_!=0)
         {
             m_check_state_=CHECK_STATE_CONTENT;
@@ -256,31 +462,17 @@ HttpConn::HTTP_CODE HttpConn::ParseHeaders(char* text)
         }
         return GET_REQUEST;
     }
-    else if(strncasecmp(text,"Connection:",11)==0)
+    /*以空白开头的行是上一个头部的折行(obs-fold)*/
+    else if(text[0]==' ' || text[0]=='\t')
     {
-        text+=11;
-        text+=strspn(text,"  \t");
-        if(strcasecmp(text,"keep-alive")==0)
+        if(!m_request_.Fold(text))
         {
-            m_linger_=true;
+            return BAD_REQUEST;
         }
     }
-    else if(strncasecmp(text,"Content-Length",15)==0)
-    {
-        text+=15;
-        text+=strspn(text," \t");
-        /*把字符串转换成长整型数*/
-        m_content_length_=atol(text);
-    }
-    else if(strncasecmp(text,"Host:",5)==0)
+    else if(!m_request_.AddHeader(text))
     {
-        text+=5;
-        text+=strspn(text," \t");
-        m_host_=text;
-    }
-    else
-    {
-        printf("Unknow header %s.\n",text);
+        return BAD_REQUEST;
     }
     return NO_REQUEST;
 }
@@ -307,7 +499,6 @@ HttpConn::HTTP_CODE HttpConn::ProcessRead()
         text=GetLine();
         /*记录下一行的起始位置*/
         m_start_line_=m_checked_idx_;
-        printf("Got 1 http line: %s.\n",text);
         switch(m_check_state_)
         {
             /*分析请求行*/
@@ -354,85 +545,270 @@ HttpConn::HTTP_CODE HttpConn::ProcessRead()
     return NO_REQUEST;
 }
 
+bool HttpConn::SafePath(const char* path)
+{
+    if(path[0]!='/')
+    {
+        return false;
+    }
+    for(const char* p=path;*p && *p!='?';++p)
+    {
+        /*"/.."之后是段的结束，拼接后会跳出根目录*/
+        if(p[0]=='/' && p[1]=='.' && p[2]=='.' && (p[3]=='/' || p[3]=='\0' || p[3]=='?'))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
 HttpConn::HTTP_CODE HttpConn::DoRequest()
 {
+    if(!SafePath(m_url_))
+    {
+        return BAD_REQUEST;
+    }
     /*分析请求文件的完整路径及文件是否存在*/
-    strcpy(m_real_file,doc_root);
-    int len=strlen(doc_root);
+    strcpy(m_real_file,m_vhost_->m_root_.c_str());
+    int len=m_vhost_->m_root_.size();
     strncpy(m_real_file+len,m_url_,FILENAME_LEN-len-1);
-    if(stat(m_real_file,&m_file_stat_)<0)
+    /*I/O线程上只处理不需要系统调用的缓存命中，其余在工作线程上重新进入*/
+    if(m_inline_ && (m_h2c_upgrade_ || m_ws_upgrade_ || m_handler_ || m_inline_max_size_==0 || !FileCache::Instance()->TryAcquire(m_real_file,m_inline_max_size_,&m_file_)))
     {
-        return NO_RESOURCE;
+        return DEFERRED_REQUEST;
     }
-    if(!(m_file_stat_.st_mode&S_IROTH))
+    /*超过该客户端或该主机的请求速率，不再访问文件*/
+    if(!RateLimiter::Instance()->AllowRequest(&m_ticket_) || !HostTable::Instance()->AllowRequest(m_vhost_))
     {
-        return FORBIDDEN_REQUEST;
+        Unmap();
+        return TOO_MANY_REQUESTS;
     }
-    if(S_ISDIR(m_file_stat_.st_mode))
+    m_charged_=true;
+    if(m_handler_)
     {
-        return BAD_REQUEST;
+        return HANDLER_REQUEST;
+    }
+    /*WebSocket的路径只用作广播频道，不对应文件*/
+    if(m_ws_upgrade_)
+    {
+        return WEBSOCKET_REQUEST;
+    }
+    if(m_file_)
+    {
+        return PrepareFile();
+    }
+    uint64_t trace_start=m_trace_?Tracer::Now():0;
+    FileCache::FILE_STATUS status=FileCache::Instance()->Acquire(m_real_file,&m_file_);
+    Trace(SPAN_FILE,trace_start);
+    switch(status)
+    {
+        case FileCache::FILE_OK:
+        {
+            break;
+        }
+        case FileCache::FILE_NOT_FOUND:
+        {
+            return NO_RESOURCE;
+        }
+        case FileCache::FILE_FORBIDDEN:
+        {
+            return FORBIDDEN_REQUEST;
+        }
+        case FileCache::FILE_IS_DIR:
+        {
+            return BAD_REQUEST;
+        }
+        default:
+        {
+            return INTERNAL_ERROR;
+        }
+    }
+    return PrepareFile();
+}
+
+HttpConn::HTTP_CODE HttpConn::PrepareFile()
+{
+    /*先选定返回的内容，两种内容的ETag不同*/
+    if(m_file_->m_gzip_ && m_request_.HasToken(HttpRequest::HEADER_ACCEPT_ENCODING,"gzip"))
+    {
+        FileEntry* variant=m_file_->m_gzip_;
+        FileCache::Instance()->Retain(variant);
+        FileCache::Instance()->Release(m_file_);
+        m_file_=variant;
+    }
+    if(m_file_->m_etag_)
+    {
+        const HttpRequest::Header* match=m_request_.Find(HttpRequest::HEADER_IF_NONE_MATCH);
+        if(match && (strcmp(match->m_value_.m_data_,"*")==0 || strstr(match->m_value_.m_data_,m_file_->m_etag_)))
+        {
+            return NOT_MODIFIED;
+        }
     }
-    int fd=open(m_real_file,O_RDONLY);
-    /*将文件地址映射到m_file_address_中*/
-    m_file_address_=(char*)mmap(0,m_file_stat_.st_size,PROT_READ,MAP_PRIVATE,fd,0);
-    close(fd);
+    /*文件缓存中的映射地址*/
+    m_file_address_=m_file_->m_address_;
     return FILE_REQUEST;
 }
 
 void HttpConn::Unmap()
 {
-    if(m_file_address_)
+    if(m_file_)
     {
-        munmap(m_file_address_,m_file_stat_.st_size);
+        FileCache::Instance()->Release(m_file_);
+        m_file_=0;
         m_file_address_=0;
     }
 }
 
 bool HttpConn::Write()
 {
+    if(m_h2_)
+    {
+        return WriteHttp2();
+    }
+    if(m_ws_)
+    {
+        return WriteWebSocket();
+    }
+    if(m_co_)
+    {
+        return WriteCoroutine();
+    }
     int temp;
-    int bytes_have_send=0;
-    int bytes_to_send=m_write_idx_;
-    if(bytes_to_send==0)
+    if(m_bytes_to_send_==0)
     {
-        ModFd(m_epollfd_,m_sockfd_,EPOLLIN);
+        ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
         Init();
         return true;
     }
+    size_t budget=SendBudget();
+    if(budget==0)
+    {
+        return true;
+    }
     while(true)
     {
-        temp=writev(m_sockfd_,m_iv,m_iv_count_);
+        /*文件数据不在内存中，读入后由I/O线程重新调用Write，期间连接不注册事件*/
+        if(!PrepareFileWindow())
+        {
+            return true;
+        }
+        /*本轮额度用完，下一轮事件循环再继续，期间连接不注册事件*/
+        if(budget==0)
+        {
+            SendScheduler::Instance()->Defer(Handle());
+            return true;
+        }
+        struct iovec iv[2];
+        int count=0;
+        size_t left=budget;
+        for(int i=0;i<m_iv_count_ && left>0;++i)
+        {
+            iv[count]=m_iv[i];
+            if(iv[count].iov_len>left)
+            {
+                iv[count].iov_len=left;
+            }
+            left-=iv[count].iov_len;
+            ++count;
+        }
+        uint64_t trace_start=m_trace_?Tracer::Now():0;
+        /*头部发完后归档中的文件用sendfile从归档的描述符发送，不经过用户态*/
+        if(m_iv_count_==2 && m_iv[0].iov_len==0 && m_file_ && m_file_->m_fd_>=0)
+        {
+            off_t offset=m_file_->m_offset_+((char*)m_iv[1].iov_base-m_file_address_);
+            temp=sendfile(m_sockfd_,m_file_->m_fd_,&offset,iv[1].iov_len);
+        }
+        else
+        {
+            temp=writev(m_sockfd_,iv,count);
+        }
+        Trace(SPAN_WRITE,trace_start);
         if(temp<=-1)
         {
             /*如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，服务器无法立即接受同一客户的下一个请求*/
             if(errno==EAGAIN)
             {
-                ModFd(m_epollfd_,m_sockfd_,EPOLLOUT);
+                ModFd(m_epollfd_,m_sockfd_,EPOLLOUT,Handle());
                 return true;
             }
             Unmap();
             return false;
         }
-        bytes_to_send-=temp;
-        bytes_have_send+=temp;
-        if(bytes_to_send<=bytes_have_send)
+        budget-=temp;
+        SendScheduler::Instance()->Consume(&m_send_bucket_,temp);
+        m_bytes_to_send_-=temp;
+        m_bytes_sent_+=temp;
+        /*部分发送时跳过已发送的内容，下次从断点继续*/
+        size_t sent=temp;
+        for(int i=0;i<m_iv_count_ && sent>0;++i)
         {
+            size_t n=sent<m_iv[i].iov_len?sent:m_iv[i].iov_len;
+            m_iv[i].iov_base=(char*)m_iv[i].iov_base+n;
+            m_iv[i].iov_len-=n;
+            sent-=n;
+        }
+        if(m_bytes_to_send_==0)
+        {
+            m_stamp_[STAGE_COUNT]=MonotonicUs();
+            LogAccess();
+            FinishTrace();
             Unmap();
             if(m_linger_)
             {
                 Init();
-                ModFd(m_epollfd_,m_sockfd_,EPOLLIN);
+                ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
                 return true;
             }
             else
             {
-                ModFd(m_epollfd_,m_sockfd_,EPOLLIN);
+                ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
                 return false;
             }
         }
     }
 }
 
+size_t HttpConn::SendBudget()
+{
+    SendScheduler* scheduler=SendScheduler::Instance();
+    uint64_t now=MonotonicUs();
+    scheduler->Tune(m_sockfd_,now,&m_tune_us_,&m_sndbuf_);
+    uint64_t wait_us;
+    size_t budget=scheduler->Grant(&m_send_bucket_,now,&wait_us);
+    if(budget==0)
+    {
+        /*令牌不足，补足后由I/O线程重新调用Write，期间连接不注册事件*/
+        scheduler->Throttle(Handle(),now+wait_us);
+    }
+    return budget;
+}
+
+bool HttpConn::PrepareFileWindow()
+{
+    if(m_iv_count_<2)
+    {
+        return true;
+    }
+    /*每次writev最多发送一个窗口，保证访问的页面都检查过*/
+    if(m_iv[1].iov_len==0 && m_file_left_>0)
+    {
+        m_iv[1].iov_len=m_file_left_<DiskIo::WINDOW?m_file_left_:DiskIo::WINDOW;
+        m_file_left_-=m_iv[1].iov_len;
+    }
+    else if(m_iv[1].iov_len>DiskIo::WINDOW)
+    {
+        m_file_left_+=m_iv[1].iov_len-DiskIo::WINDOW;
+        m_iv[1].iov_len=DiskIo::WINDOW;
+    }
+    if(m_iv[1].iov_len==0 || DiskIo::Resident((const char*)m_iv[1].iov_base,m_iv[1].iov_len))
+    {
+        return true;
+    }
+    size_t offset=(char*)m_iv[1].iov_base-m_file_address_;
+    /*磁盘线程的队列满时直接发送，退化为缺页阻塞*/
+    return !DiskIo::Instance()->Warm(m_file_,offset,m_iv[1].iov_len,Handle());
+}
+
 bool HttpConn::AddResponse(const char* format,...)
 {
     if(m_write_idx_>=WRITE_BUFFER_SIZE)
@@ -453,6 +829,7 @@ bool HttpConn::AddResponse(const char* format,...)
 
 bool HttpConn::AddStatusLine(int status,const char* title)
 {
+    m_status_=status;
     return AddResponse("%s %d %s\r\n","HTTP/1.1",status,title);
 }
 
@@ -466,6 +843,28 @@ bool HttpConn::AddContentLength(int content_len)
     return AddResponse("Content-Length: %d\r\n",content_len);
 }
 
+bool HttpConn::AddFileHeaders()
+{
+    if(m_file_->m_content_type_ && !AddResponse("Content-Type: %s\r\n",m_file_->m_content_type_))
+    {
+        return false;
+    }
+    if(m_file_->m_etag_ && !AddResponse("ETag: %s\r\n",m_file_->m_etag_))
+    {
+        return false;
+    }
+    if(m_file_->m_encoding_ && !AddResponse("Content-Encoding: %s\r\n",m_file_->m_encoding_))
+    {
+        return false;
+    }
+    /*有预压缩变体的文件，应答随Accept-Encoding变化*/
+    if((m_file_->m_gzip_ || m_file_->m_encoding_) && !AddResponse("Vary: Accept-Encoding\r\n"))
+    {
+        return false;
+    }
+    return true;
+}
+
 bool HttpConn::AddLinger()
 {
     return AddResponse("Connection: %s \r\n",(m_linger_==true)?"keep-alive":"close");
@@ -485,6 +884,18 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
 {
     switch(ret)
     {
+        case TOO_MANY_REQUESTS:
+        {
+            /*直接发送预先生成的应答，然后关闭连接*/
+            m_linger_=false;
+            m_status_=429;
+            m_write_idx_=sizeof(error_429_response)-1;
+            m_iv[0].iov_base=(char*)error_429_response;
+            m_iv[0].iov_len=m_write_idx_;
+            m_iv_count_=1;
+            m_bytes_to_send_=m_write_idx_;
+            return true;
+        }
         case INTERNAL_ERROR:
         {
             AddStatusLine(500,error_500_title);
@@ -498,7 +909,7 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
         case BAD_REQUEST:
         {
             AddStatusLine(400,error_400_title);
-            AddHeaders(strlen(error_400_title));
+            AddHeaders(strlen(error_400_form));
             if(!AddContent(error_400_form))
             {
                 return false;
@@ -508,7 +919,7 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
         case NO_RESOURCE:
         {
             AddStatusLine(404,error_404_title);
-            AddHeaders(strlen(error_404_title));
+            AddHeaders(strlen(error_404_form));
             if(!AddContent(error_404_form))
             {
                 return false;
@@ -518,24 +929,36 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
         case FORBIDDEN_REQUEST:
         {
             AddStatusLine(403,error_403_title);
-            AddHeaders(strlen(error_403_title));
+            AddHeaders(strlen(error_403_form));
             if(!AddContent(error_403_form))
             {
                 return false;
             }
             break;
         }
+        case NOT_MODIFIED:
+        {
+            AddStatusLine(304,not_modified_304_title);
+            if(!AddFileHeaders() || !AddLinger() || !AddBlankLine())
+            {
+                return false;
+            }
+            break;
+        }
         case FILE_REQUEST:
         {
             AddStatusLine(200,ok_200_title);
-            if(m_file_stat_.st_size!=0)
+            AddFileHeaders();
+            if(m_file_->m_size_!=0)
             {
-                AddHeaders(m_file_stat_.st_size);
+                AddHeaders(m_file_->m_size_);
                 m_iv[0].iov_base=m_write_buf;
                 m_iv[0].iov_len=m_write_idx_;
                 m_iv[1].iov_base=m_file_address_;
-                m_iv[1].iov_len=m_file_stat_.st_size;
+                m_iv[1].iov_len=m_file_->m_size_;
                 m_iv_count_=2;
+                m_file_left_=0;
+                m_bytes_to_send_=m_write_idx_+m_file_->m_size_;
                 return true;
             }
             else
@@ -556,21 +979,613 @@ bool HttpConn::ProcessWrite(HTTP_CODE ret)
     m_iv[0].iov_base=m_write_buf;
     m_iv[0].iov_len=m_write_idx_;
     m_iv_count_=1;
+    m_bytes_to_send_=m_write_idx_;
     return true;
 }
 
 void HttpConn::Process()
 {
+    if(m_h2_)
+    {
+        ProcessHttp2();
+        return;
+    }
+    if(m_ws_)
+    {
+        ProcessWebSocket();
+        return;
+    }
+    if(m_co_)
+    {
+        ProcessCoroutine();
+        return;
+    }
+    /*以HTTP/2连接前言开头(prior knowledge)，直接切换到HTTP/2*/
+    if(m_check_state_==CHECK_STATE_REQUESTLINE && m_read_idx_>0 && Http2Session::IsPreface(m_read_buf,m_read_idx_))
+    {
+        if(m_read_idx_<Http2Session::PREFACE_LEN)
+        {
+            ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
+            return;
+        }
+        m_h2_=new Http2Session;
+        m_h2_->SetTicket(&m_ticket_);
+        m_h2_->SetPeer(&m_address_);
+        m_h2_->Start();
+        m_h2_->Append(m_read_buf,m_read_idx_);
+        m_read_idx_=0;
+        ProcessHttp2();
+        return;
+    }
+    m_stamp_[STAGE_PROCESS]=MonotonicUs();
+    uint64_t trace_start=0;
+    if(m_trace_)
+    {
+        trace_start=Tracer::Now();
+        if(m_trace_->m_queued_)
+        {
+            m_trace_->Add(SPAN_QUEUE,m_trace_->m_queued_,trace_start);
+            m_trace_->m_queued_=0;
+        }
+    }
+    HTTP_CODE read_ret;
+    if(m_deferred_)
+    {
+        m_deferred_=false;
+        read_ret=DoRequest();
+    }
+    else
+    {
+        read_ret=ProcessRead();
+    }
+    Trace(SPAN_PARSE,trace_start);
+    if(read_ret==NO_REQUEST)
+    {
+        ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
+        return;
+    }
+    /*被限流的请求按HTTP/1.1应答429，不升级*/
+    if(m_h2c_upgrade_ && read_ret!=BAD_REQUEST && read_ret!=HANDLER_REQUEST && read_ret!=TOO_MANY_REQUESTS && !m_draining_ && UpgradeHttp2())
+    {
+        return;
+    }
+    if(read_ret==WEBSOCKET_REQUEST)
+    {
+        if(!m_draining_ && UpgradeWebSocket())
+        {
+            return;
+        }
+        read_ret=BAD_REQUEST;
+    }
+    if(read_ret==HANDLER_REQUEST)
+    {
+        if(StartCoroutine())
+        {
+            return;
+        }
+        m_linger_=false;
+        read_ret=INTERNAL_ERROR;
+    }
+    /*排空期间应答后关闭连接，客户端会在新进程上重连*/
+    if(m_draining_)
+    {
+        m_linger_=false;
+    }
+    trace_start=m_trace_?Tracer::Now():0;
+    if(!ProcessWrite(read_ret))
+    {
+        /*描述符已关闭，槽位可能已被I/O线程上的新连接复用，不能再访问成员*/
+        Close();
+        return;
+    }
+    m_stamp_[STAGE_WRITE]=MonotonicUs();
+    if(m_trace_)
+    {
+        Trace(SPAN_RESPOND,trace_start);
+        m_trace_->m_send_start_=Tracer::Now();
+    }
+    ModFd(m_epollfd_,m_sockfd_,EPOLLOUT,Handle());
+}
+
+bool HttpConn::ProcessInline()
+{
+    if(m_h2_ || m_ws_ || m_co_)
+    {
+        return false;
+    }
+    /*HTTP/2连接前言交给工作线程*/
+    if(m_check_state_==CHECK_STATE_REQUESTLINE && m_read_idx_>0 && Http2Session::IsPreface(m_read_buf,m_read_idx_))
+    {
+        return false;
+    }
+    m_stamp_[STAGE_PROCESS]=MonotonicUs();
+    uint64_t trace_start=m_trace_?Tracer::Now():0;
+    m_inline_=true;
     HTTP_CODE read_ret=ProcessRead();
+    m_inline_=false;
+    Trace(SPAN_PARSE,trace_start);
+    if(read_ret==DEFERRED_REQUEST)
+    {
+        m_deferred_=true;
+        return false;
+    }
+    /*在I/O线程上完成，不经过线程池的队列*/
+    if(m_trace_)
+    {
+        m_trace_->m_queued_=0;
+    }
     if(read_ret==NO_REQUEST)
     {
-        ModFd(m_epollfd_,m_sockfd_,EPOLLIN);
+        ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
+        return true;
+    }
+    if(m_draining_)
+    {
+        m_linger_=false;
+    }
+    trace_start=m_trace_?Tracer::Now():0;
+    if(!ProcessWrite(read_ret))
+    {
+        Close();
+        return true;
+    }
+    m_stamp_[STAGE_WRITE]=MonotonicUs();
+    if(m_trace_)
+    {
+        Trace(SPAN_RESPOND,trace_start);
+        m_trace_->m_send_start_=Tracer::Now();
+    }
+    /*直接发送，不用等下一轮EPOLLOUT；发送不完时Write会注册EPOLLOUT*/
+    if(!Write())
+    {
+        Close();
+    }
+    return true;
+}
+
+bool HttpConn::LongTask() const
+{
+    /*协程处理函数，包括恢复执行*/
+    if(m_co_ || m_handler_)
+    {
+        return true;
+    }
+    /*HTTP/2和WebSocket的帧处理，以及还没有解析完的请求*/
+    if(m_h2_ || m_ws_ || !m_deferred_ || m_h2c_upgrade_ || m_ws_upgrade_)
+    {
+        return false;
+    }
+    /*快速路径没有命中：文件未缓存(需要打开并读入)，或者超过了快速路径的大小*/
+    off_t size=FileCache::Instance()->CachedSize(m_real_file);
+    return size<0 || (size_t)size>m_short_max_size_;
+}
+
+bool HttpConn::UpgradeHttp2()
+{
+    Http2Session* session=new Http2Session;
+    session->SetTicket(&m_ticket_);
+    session->SetPeer(&m_address_);
+    if(!session->Upgrade(m_h2_settings_,MethodName(m_method_),m_url_,m_vhost_,m_charged_))
+    {
+        /*升级失败，继续按HTTP/1.1应答*/
+        delete session;
+        return false;
+    }
+    /*客户端可能在请求之后紧接着发送了连接前言*/
+    session->Append(m_read_buf+m_checked_idx_,m_read_idx_-m_checked_idx_);
+    Unmap();
+    m_h2_=session;
+    m_read_idx_=0;
+    ProcessHttp2();
+    return true;
+}
+
+void HttpConn::ProcessHttp2()
+{
+    if(m_draining_)
+    {
+        m_h2_->Drain();
+    }
+    if(!m_h2_->Process())
+    {
+        Close();
         return;
     }
-    bool write_ret=ProcessWrite(read_ret);
-    if(!write_ret)
+    ModFd(m_epollfd_,m_sockfd_,EPOLLIN | (m_h2_->WantWrite()?(int)EPOLLOUT:0),Handle());
+}
+
+bool HttpConn::WriteHttp2()
+{
+    size_t budget=SendBudget();
+    if(budget==0)
+    {
+        return true;
+    }
+    while(true)
+    {
+        if(m_h2_->OutSize()==0)
+        {
+            /*输出已发送完，在流量控制允许时继续生成DATA帧*/
+            m_h2_->Pump();
+            if(m_h2_->OutSize()==0)
+            {
+                /*剩下的流都在等冷数据，读入后由I/O线程重新调用Write，期间连接不注册事件*/
+                FileEntry* file;
+                size_t offset;
+                if(!m_h2_->ColdWindow(&file,&offset))
+                {
+                    break;
+                }
+                if(DiskIo::Instance()->Warm(file,offset,DiskIo::WINDOW,Handle()))
+                {
+                    return true;
+                }
+                m_h2_->Pump(true);
+                if(m_h2_->OutSize()==0)
+                {
+                    break;
+                }
+            }
+        }
+        if(budget==0)
+        {
+            SendScheduler::Instance()->Defer(Handle());
+            return true;
+        }
+        size_t size=m_h2_->OutSize()<budget?m_h2_->OutSize():budget;
+        int temp=send(m_sockfd_,m_h2_->OutData(),size,0);
+        if(temp<0)
+        {
+            if(errno==EAGAIN)
+            {
+                ModFd(m_epollfd_,m_sockfd_,EPOLLIN | EPOLLOUT,Handle());
+                return true;
+            }
+            return false;
+        }
+        budget-=temp;
+        SendScheduler::Instance()->Consume(&m_send_bucket_,temp);
+        m_h2_->OutConsume(temp);
+    }
+    if(m_h2_->Finished())
+    {
+        return false;
+    }
+    ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
+    return true;
+}
+
+bool HttpConn::UpgradeWebSocket()
+{
+    const HttpRequest::Header* version=m_request_.Find(HttpRequest::HEADER_SEC_WEBSOCKET_VERSION);
+    const HttpRequest::Header* key=m_request_.Find(HttpRequest::HEADER_SEC_WEBSOCKET_KEY);
+    std::string accept;
+    if(m_method_!=GET || !m_host_ || !version || strcmp(version->m_value_.m_data_,"13")!=0 ||
+       !key || !WebSocketSession::AcceptKey(key->m_value_.m_data_,accept))
+    {
+        return false;
+    }
+    /*不支持子协议和扩展，应答中不带对应的头部*/
+    std::string response("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: ");
+    response.append(accept);
+    response.append("\r\n\r\n");
+    /*握手按一个请求记录访问日志*/
+    m_status_=101;
+    m_bytes_sent_=response.size();
+    m_stamp_[STAGE_WRITE]=m_stamp_[STAGE_COUNT]=MonotonicUs();
+    LogAccess();
+    FinishTrace();
+    Unmap();
+    /*入队会唤醒I/O线程，之前要先挂到连接上*/
+    m_ws_=new WebSocketSession(Handle(),m_url_,MonotonicMs());
+    WebSocketSession* session=m_ws_;
+    /*客户端可能在握手之后紧接着发送了帧*/
+    session->Append(m_read_buf+m_checked_idx_,m_read_idx_-m_checked_idx_,MonotonicMs());
+    session->Enqueue(WebSocketFrame(new std::string(response)),true);
+    m_read_idx_=0;
+    /*登记之后其他线程才能向它广播*/
+    WebSocketHub::Instance()->Register(session);
+    ProcessWebSocket();
+    return true;
+}
+
+void HttpConn::ProcessWebSocket()
+{
+    m_ws_->Process();
+    /*连接只在I/O线程上关闭，出错时注册EPOLLOUT，由Write发现后关闭*/
+    m_ws_->Lock();
+    ArmWebSocket();
+    m_ws_->Unlock();
+}
+
+void HttpConn::ArmWebSocket()
+{
+    ModFd(m_epollfd_,m_sockfd_,EPOLLIN | (m_ws_->WantWrite()?(int)EPOLLOUT:0),Handle());
+    m_ws_->SetArmed(true);
+}
+
+bool HttpConn::ReadWebSocket()
+{
+    /*事件已触发，EPOLLONESHOT使描述符处于未注册状态*/
+    m_ws_->Lock();
+    m_ws_->SetArmed(false);
+    m_ws_->Unlock();
+    uint64_t now_ms=MonotonicMs();
+    while(true)
+    {
+        int bytes_read=recv(m_sockfd_,m_read_buf,READ_BUFFER_SIZE,0);
+        if(bytes_read==-1)
+        {
+            if(errno==EAGAIN || errno ==EWOULDBLOCK)
+            {
+                return true;
+            }
+            return false;
+        }
+        else if(bytes_read==0)
+        {
+            return false;
+        }
+        if(!m_ws_->Append(m_read_buf,bytes_read,now_ms))
+        {
+            return false;
+        }
+    }
+}
+
+bool HttpConn::WriteWebSocket()
+{
+    m_ws_->Lock();
+    m_ws_->SetArmed(false);
+    while(!m_ws_->Finished())
+    {
+        struct iovec iov[WebSocketSession::MAX_IOV];
+        int count=m_ws_->OutVec(iov,WebSocketSession::MAX_IOV);
+        if(count==0)
+        {
+            break;
+        }
+        int temp=writev(m_sockfd_,iov,count);
+        if(temp<0)
+        {
+            if(errno==EAGAIN)
+            {
+                break;
+            }
+            m_ws_->Unlock();
+            return false;
+        }
+        m_ws_->OutConsume(temp);
+    }
+    if(m_ws_->Finished())
+    {
+        m_ws_->Unlock();
+        return false;
+    }
+    ArmWebSocket();
+    m_ws_->Unlock();
+    return true;
+}
+
+void HttpConn::WakeWebSocket()
+{
+    if(!m_ws_)
+    {
+        return;
+    }
+    m_ws_->Lock();
+    m_ws_->ClearWake();
+    /*描述符未注册时连接正在其他线程处理，它结束时会按发送队列重新注册*/
+    if(!m_ws_->Armed())
+    {
+        m_ws_->Unlock();
+        return;
+    }
+    bool finished=m_ws_->Finished();
+    if(!finished)
+    {
+        ArmWebSocket();
+    }
+    m_ws_->Unlock();
+    if(finished)
+    {
+        Close();
+    }
+}
+
+bool HttpConn::StartCoroutine()
+{
+    /*消息体只能在内存中完整读取*/
+    if((size_t)m_content_length_>CoRequest::MAX_BODY_SIZE)
+    {
+        return false;
+    }
+    m_co_=new CoRequest(m_sockfd_,m_method_,m_url_,&m_request_,m_content_length_,m_linger_ && !m_draining_);
+    /*头部之后已经读到的消息体*/
+    m_co_->AppendBody(m_read_buf+m_checked_idx_,m_read_idx_-m_checked_idx_);
+    if(!m_co_->Start(m_handler_))
+    {
+        delete m_co_;
+        m_co_=0;
+        return false;
+    }
+    ProcessCoroutine();
+    return true;
+}
+
+void HttpConn::ProcessCoroutine()
+{
+    uint64_t trace_start=m_trace_?Tracer::Now():0;
+    m_co_->Resume();
+    Trace(SPAN_HANDLER,trace_start);
+    if(!m_co_->Done())
+    {
+        /*协程已挂起，注册它等待的条件是本线程最后的操作，之后连接可能立即被其他线程处理*/
+        switch(m_co_->Wait())
+        {
+            case CoRequest::WAIT_BODY:
+            {
+                ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
+                break;
+            }
+            case CoRequest::WAIT_WRITE:
+            {
+                ModFd(m_epollfd_,m_sockfd_,EPOLLOUT,Handle());
+                break;
+            }
+            case CoRequest::WAIT_TIMER:
+            {
+                CoReactor::Instance()->AddTimer(Handle(),m_co_->Deadline());
+                break;
+            }
+            default:
+            {
+                uint64_t handle=Handle();
+                if(!CoReactor::Instance()->WatchFd(m_co_->WaitFd(),m_co_->Wait()==CoRequest::WAIT_WRITABLE,handle))
+                {
+                    m_co_->FailWait();
+                    CoReactor::Instance()->Ready(handle);
+                }
+                break;
+            }
+        }
+        return;
+    }
+    /*处理函数结束，所有发送都已完成*/
+    bool responded=m_co_->Responded();
+    bool keep_alive=responded && !m_co_->Failed() && m_co_->KeepAlive() && !m_draining_;
+    m_status_=m_co_->Status();
+    m_bytes_sent_=m_co_->BytesSent();
+    delete m_co_;
+    m_co_=0;
+    if(!responded)
+    {
+        /*没有应答(包括抛出异常)时返回500*/
+        m_linger_=false;
+        if(!ProcessWrite(INTERNAL_ERROR))
+        {
+            Close();
+            return;
+        }
+        m_stamp_[STAGE_WRITE]=MonotonicUs();
+        if(m_trace_)
+        {
+            m_trace_->m_send_start_=Tracer::Now();
+        }
+        ModFd(m_epollfd_,m_sockfd_,EPOLLOUT,Handle());
+        return;
+    }
+    m_stamp_[STAGE_WRITE]=m_stamp_[STAGE_COUNT]=MonotonicUs();
+    m_linger_=keep_alive;
+    LogAccess();
+    FinishTrace();
+    if(!keep_alive)
     {
         Close();
+        return;
+    }
+    Init();
+    ModFd(m_epollfd_,m_sockfd_,EPOLLIN,Handle());
+}
+
+bool HttpConn::ReadCoroutine()
+{
+    char buf[READ_BUFFER_SIZE];
+    while(true)
+    {
+        int bytes_read=recv(m_sockfd_,buf,READ_BUFFER_SIZE,0);
+        if(bytes_read==-1)
+        {
+            if(errno==EAGAIN || errno ==EWOULDBLOCK)
+            {
+                return true;
+            }
+            return false;
+        }
+        else if(bytes_read==0)
+        {
+            return false;
+        }
+        m_co_->AppendBody(buf,bytes_read);
+    }
+}
+
+bool HttpConn::WriteCoroutine()
+{
+    uint64_t trace_start=m_trace_?Tracer::Now():0;
+    CoRequest::FLUSH ret=m_co_->Flush();
+    Trace(SPAN_WRITE,trace_start);
+    switch(ret)
+    {
+        case CoRequest::FLUSH_DONE:
+        {
+            /*连接保持未注册状态，由工作线程恢复协程*/
+            CoReactor::Instance()->Ready(Handle());
+            return true;
+        }
+        case CoRequest::FLUSH_AGAIN:
+        {
+            ModFd(m_epollfd_,m_sockfd_,EPOLLOUT,Handle());
+            return true;
+        }
+        default:
+        {
+            return false;
+        }
+    }
+}
+
+void HttpConn::LogAccess()
+{
+    AccessLog* log=AccessLog::Instance();
+    if(!log->IsOpen())
+    {
+        return;
+    }
+    AccessRequestRecord record;
+    memset(&record,0,sizeof(record));
+    record.m_method_=m_method_;
+    record.m_flags_=m_linger_?ACCESS_FLAG_KEEPALIVE:0;
+    record.m_status_=m_status_;
+    record.m_addr_=m_address_.sin_addr.s_addr;
+    record.m_port_=m_address_.sin_port;
+    record.m_time_us_=m_start_us_;
+    record.m_bytes_=m_bytes_sent_;
+    record.m_total_us_=m_stamp_[STAGE_COUNT]-m_stamp_[STAGE_READ];
+    for(int i=0;i<STAGE_COUNT;++i)
+    {
+        record.m_stage_us_[i]=m_stamp_[i+1]-m_stamp_[i];
+    }
+    log->Log(&record,m_url_);
+}
+
+void HttpConn::TraceAccept(uint64_t start)
+{
+    if(m_trace_)
+    {
+        m_trace_->Add(SPAN_ACCEPT,start,Tracer::Now());
+    }
+}
+
+void HttpConn::Trace(TRACE_SPAN span,uint64_t start)
+{
+    if(m_trace_)
+    {
+        m_trace_->Add(span,start,Tracer::Now());
+    }
+}
+
+void HttpConn::FinishTrace()
+{
+    if(!m_trace_)
+    {
+        return;
+    }
+    /*发送阶段包括等待可写和磁盘线程读入的时间*/
+    if(m_trace_->m_send_start_)
+    {
+        Trace(SPAN_SEND,m_trace_->m_send_start_);
     }
-    ModFd(m_epollfd_,m_sockfd_,EPOLLOUT);
+    Tracer::Instance()->Commit(m_trace_,m_sockfd_);
+    m_trace_->Reset();
 }
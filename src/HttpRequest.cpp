@@ -0,0 +1,251 @@
+#include <string.h>
+#include <strings.h>
+#include "HttpRequest.h"
+
+/*已知头部的小写名字，顺序与HEADER_ID一致*/
+struct KnownHeader
+{
+    const char* m_name_;
+    int m_len_;
+};
+
+static constexpr KnownHeader known_headers[HttpRequest::HEADER_COUNT]={
+    {"accept",6},
+    {"accept-encoding",15},
+    {"accept-language",15},
+    {"authorization",13},
+    {"cache-control",13},
+    {"connection",10},
+    {"content-length",14},
+    {"content-type",12},
+    {"cookie",6},
+    {"expect",6},
+    {"host",4},
+    {"if-match",8},
+    {"if-modified-since",17},
+    {"if-none-match",13},
+    {"if-range",8},
+    {"if-unmodified-since",19},
+    {"keep-alive",10},
+    {"origin",6},
+    {"pragma",6},
+    {"range",5},
+    {"referer",7},
+    {"te",2},
+    {"transfer-encoding",17},
+    {"upgrade",7},
+    {"user-agent",10},
+    {"via",3},
+    {"x-forwarded-for",15},
+    {"x-real-ip",9},
+    {"http2-settings",14},
+    {"sec-websocket-key",17},
+    {"sec-websocket-version",21},
+    {"sec-websocket-protocol",22},
+    {"sec-websocket-extensions",24}
+};
+
+/*哈希槽到HEADER_ID的映射，-1为空槽*/
+static constexpr signed char header_slots[HttpRequest::HASH_SIZE]={
+    -1,17,-1,-1,-1,-1,-1,29,-1,25,27,-1,-1,32,16,-1,
+    -1,6,-1,-1,21,-1,-1,-1,14,-1,-1,11,-1,-1,-1,-1,
+    -1,-1,-1,26,13,-1,-1,-1,15,12,-1,-1,19,-1,18,-1,
+    -1,-1,20,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,
+    -1,9,-1,-1,8,-1,-1,-1,-1,5,4,-1,-1,-1,-1,-1,
+    -1,-1,-1,7,-1,1,-1,-1,-1,0,2,-1,-1,-1,3,-1,
+    23,24,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,-1,22,-1,-1,
+    -1,-1,-1,-1,-1,31,28,-1,-1,-1,-1,10,30,-1,-1,-1
+};
+
+/*只取长度、首字符、中间字符和末字符，参数经过搜索保证已知头部之间没有冲突*/
+static constexpr unsigned HeaderHash(unsigned len,unsigned first,unsigned middle,unsigned last)
+{
+    return (len+first*58+middle+last)&(HttpRequest::HASH_SIZE-1);
+}
+
+static constexpr unsigned KnownHash(int id)
+{
+    return HeaderHash(known_headers[id].m_len_,known_headers[id].m_name_[0],
+        known_headers[id].m_name_[known_headers[id].m_len_/2],known_headers[id].m_name_[known_headers[id].m_len_-1]);
+}
+
+/*编译期校验：每个已知头部都落在自己的槽里，即哈希对这组名字是完美的*/
+static constexpr bool CheckSlots(int id)
+{
+    return id==HttpRequest::HEADER_COUNT || (header_slots[KnownHash(id)]==id && CheckSlots(id+1));
+}
+static_assert(CheckSlots(0),"header perfect hash has collisions, regenerate header_slots");
+
+static inline unsigned char Lower(char c)
+{
+    return (c>='A' && c<='Z')?c-'A'+'a':c;
+}
+
+HttpRequest::HEADER_ID HttpRequest::Lookup(const char* name,int len)
+{
+    if(len<=0)
+    {
+        return HEADER_UNKNOWN;
+    }
+    int id=header_slots[HeaderHash(len,Lower(name[0]),Lower(name[len/2]),Lower(name[len-1]))];
+    if(id<0 || known_headers[id].m_len_!=len || strncasecmp(known_headers[id].m_name_,name,len)!=0)
+    {
+        return HEADER_UNKNOWN;
+    }
+    return (HEADER_ID)id;
+}
+
+HttpRequest::HttpRequest()
+{
+    Reset();
+}
+
+HttpRequest::~HttpRequest()
+{
+}
+
+void HttpRequest::Reset()
+{
+    m_count_=0;
+    memset(m_first_,-1,sizeof(m_first_));
+    memset(m_last_,-1,sizeof(m_last_));
+}
+
+bool HttpRequest::AddHeader(char* line)
+{
+    if(m_count_>=MAX_HEADERS)
+    {
+        return false;
+    }
+    char* colon=strchr(line,':');
+    /*名字不能为空，名字和冒号之间不能有空白*/
+    if(!colon || colon==line || colon[-1]==' ' || colon[-1]=='\t')
+    {
+        return false;
+    }
+    char* value=colon+1;
+    value+=strspn(value," \t");
+    char* end=value+strlen(value);
+    while(end>value && (end[-1]==' ' || end[-1]=='\t'))
+    {
+        --end;
+    }
+    *end='\0';
+    Header& header=m_headers_[m_count_];
+    header.m_name_.m_data_=line;
+    header.m_name_.m_len_=colon-line;
+    header.m_value_.m_data_=value;
+    header.m_value_.m_len_=end-value;
+    header.m_id_=Lookup(line,colon-line);
+    header.m_next_=-1;
+    if(header.m_id_!=HEADER_UNKNOWN)
+    {
+        if(m_first_[header.m_id_]<0)
+        {
+            m_first_[header.m_id_]=m_count_;
+        }
+        else
+        {
+            m_headers_[m_last_[header.m_id_]].m_next_=m_count_;
+        }
+        m_last_[header.m_id_]=m_count_;
+    }
+    m_count_++;
+    return true;
+}
+
+bool HttpRequest::Fold(char* line)
+{
+    if(m_count_==0)
+    {
+        return false;
+    }
+    Header& header=m_headers_[m_count_-1];
+    char* value=const_cast<char*>(header.m_value_.m_data_);
+    char* end=value+header.m_value_.m_len_;
+    /*上一行的值和本行之间只有空白和被替换成'\0'的CRLF*/
+    if(end>line)
+    {
+        return false;
+    }
+    for(char* p=end;p<line;++p)
+    {
+        *p=' ';
+    }
+    end=line+strlen(line);
+    while(end>value && (end[-1]==' ' || end[-1]=='\t'))
+    {
+        --end;
+    }
+    *end='\0';
+    header.m_value_.m_len_=end-value;
+    return true;
+}
+
+const HttpRequest::Header* HttpRequest::Find(HEADER_ID id) const
+{
+    if(id<0 || id>=HEADER_COUNT || m_first_[id]<0)
+    {
+        return 0;
+    }
+    return &m_headers_[m_first_[id]];
+}
+
+const HttpRequest::Header* HttpRequest::Next(const Header* header) const
+{
+    if(!header || header->m_next_<0)
+    {
+        return 0;
+    }
+    return &m_headers_[header->m_next_];
+}
+
+const HttpRequest::Header* HttpRequest::Find(const char* name) const
+{
+    int len=strlen(name);
+    HEADER_ID id=Lookup(name,len);
+    if(id!=HEADER_UNKNOWN)
+    {
+        return Find(id);
+    }
+    for(int i=0;i<m_count_;++i)
+    {
+        if(m_headers_[i].m_name_.m_len_==len && strncasecmp(m_headers_[i].m_name_.m_data_,name,len)==0)
+        {
+            return &m_headers_[i];
+        }
+    }
+    return 0;
+}
+
+bool HttpRequest::HasToken(HEADER_ID id,const char* token) const
+{
+    int token_len=strlen(token);
+    for(const Header* header=Find(id);header;header=Next(header))
+    {
+        const char* p=header->m_value_.m_data_;
+        const char* end=p+header->m_value_.m_len_;
+        while(p<end)
+        {
+            while(p<end && (*p==' ' || *p=='\t' || *p==','))
+            {
+                ++p;
+            }
+            const char* start=p;
+            while(p<end && *p!=',')
+            {
+                ++p;
+            }
+            const char* stop=p;
+            while(stop>start && (stop[-1]==' ' || stop[-1]=='\t'))
+            {
+                --stop;
+            }
+            if(stop-start==token_len && strncasecmp(start,token,token_len)==0)
+            {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -1,5 +1,7 @@
 #include <exception>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 #include "Locker.h"
 
 Locker::Locker()
@@ -44,6 +46,29 @@ bool Sem::Wait()
     return sem_wait(&m_sem_) == 0;
 }
 
+bool Sem::TimedWait(int ms)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME,&ts);
+    ts.tv_sec+=ms/1000;
+    ts.tv_nsec+=(long)(ms%1000)*1000000;
+    if(ts.tv_nsec>=1000000000)
+    {
+        ts.tv_sec++;
+        ts.tv_nsec-=1000000000;
+    }
+    int ret;
+    while((ret=sem_timedwait(&m_sem_,&ts))!=0 && errno==EINTR)
+    {
+    }
+    return ret==0;
+}
+
+bool Sem::TryWait()
+{
+    return sem_trywait(&m_sem_) == 0;
+}
+
 bool Sem::Post()
 {
     return sem_post(&m_sem_) ==0;
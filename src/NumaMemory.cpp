@@ -0,0 +1,379 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include "NumaMemory.h"
+
+/*mbind/set_mempolicy的策略，与<numaif.h>一致*/
+static const int MPOL_PREFERRED_MODE=1;
+static const int MPOL_INTERLEAVE_MODE=3;
+
+static long Mbind(void* address,size_t len,int mode,const unsigned long* mask,unsigned long max_node)
+{
+    return syscall(SYS_mbind,address,len,mode,mask,max_node,0);
+}
+
+static long SetMempolicy(int mode,const unsigned long* mask,unsigned long max_node)
+{
+    return syscall(SYS_set_mempolicy,mode,mask,max_node);
+}
+
+/*解析"0-3,8-11"形式的列表，对每个编号调用visit*/
+template<typename Visitor>
+static bool ParseList(const char* path,Visitor visit)
+{
+    FILE* fp=fopen(path,"r");
+    if(!fp)
+    {
+        return false;
+    }
+    char line[4096];
+    bool ok=fgets(line,sizeof(line),fp)!=NULL;
+    fclose(fp);
+    if(!ok)
+    {
+        return false;
+    }
+    char* p=line;
+    while(*p>='0' && *p<='9')
+    {
+        int first=strtol(p,&p,10);
+        int last=first;
+        if(*p=='-')
+        {
+            last=strtol(p+1,&p,10);
+        }
+        for(int i=first;i<=last;++i)
+        {
+            visit(i);
+        }
+        if(*p==',')
+        {
+            ++p;
+        }
+    }
+    return true;
+}
+
+NumaMemory::NumaMemory():m_huge_pages_(false),m_numa_(false),m_huge_bytes_(0),m_thp_bytes_(0),m_fallbacks_(0),
+    m_file_thp_bytes_(0),m_interleaved_bytes_(0),m_bind_failures_(0)
+{
+    for(int i=0;i<MAX_NODES;++i)
+    {
+        m_node_bytes_[i]=0;
+    }
+    LoadTopology();
+}
+
+NumaMemory::~NumaMemory()
+{
+    for(int c=0;c<COUNTER_COUNT;++c)
+    {
+        for(size_t i=0;i<m_counter_fds_[c].size();++i)
+        {
+            if(m_counter_fds_[c][i]>=0)
+            {
+                close(m_counter_fds_[c][i]);
+            }
+        }
+    }
+}
+
+NumaMemory* NumaMemory::Instance()
+{
+    static NumaMemory memory;
+    return &memory;
+}
+
+void NumaMemory::LoadTopology()
+{
+    std::vector<int> ids;
+    ParseList("/sys/devices/system/node/online",[&ids](int id){if(id<MAX_NODES) ids.push_back(id);});
+    for(size_t i=0;i<ids.size();++i)
+    {
+        char path[128];
+        snprintf(path,sizeof(path),"/sys/devices/system/node/node%d/cpulist",ids[i]);
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        int index=(int)m_node_ids_.size();
+        std::vector<int>& cpu_node=m_cpu_node_;
+        bool has_cpu=false;
+        ParseList(path,[&](int cpu)
+        {
+            if(cpu>=CPU_SETSIZE)
+            {
+                return;
+            }
+            CPU_SET(cpu,&cpus);
+            if((int)cpu_node.size()<=cpu)
+            {
+                cpu_node.resize(cpu+1,0);
+            }
+            cpu_node[cpu]=index;
+            has_cpu=true;
+        });
+		/*只有内存没有CPU的节点不参与线程绑定*/
+        if(has_cpu)
+        {
+            m_node_ids_.push_back(ids[i]);
+            m_node_cpus_.push_back(cpus);
+        }
+    }
+    if(m_node_ids_.empty())
+    {
+        cpu_set_t cpus;
+        sched_getaffinity(0,sizeof(cpus),&cpus);
+        m_node_ids_.push_back(0);
+        m_node_cpus_.push_back(cpus);
+        m_cpu_node_.clear();
+    }
+}
+
+void NumaMemory::Configure(bool huge_pages,bool numa)
+{
+    m_huge_pages_=huge_pages;
+    m_numa_=numa;
+}
+
+int NumaMemory::CurrentNode() const
+{
+    int cpu=sched_getcpu();
+    if(cpu<0 || cpu>=(int)m_cpu_node_.size())
+    {
+        return 0;
+    }
+    return m_cpu_node_[cpu];
+}
+
+size_t NumaMemory::RoundUp(size_t size) const
+{
+    size_t unit=m_huge_pages_?HUGE_PAGE_SIZE:(size_t)sysconf(_SC_PAGESIZE);
+    return (size+unit-1)/unit*unit;
+}
+
+void* NumaMemory::Allocate(size_t size,int node)
+{
+    size_t len=RoundUp(size);
+    void* address=MAP_FAILED;
+    if(m_huge_pages_)
+    {
+		/*需要预留的大页(vm.nr_hugepages)，没有时退回普通页*/
+        address=mmap(0,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB,-1,0);
+        if(address!=MAP_FAILED)
+        {
+            m_huge_bytes_+=len;
+        }
+    }
+    if(address==MAP_FAILED)
+    {
+        address=mmap(0,len,PROT_READ|PROT_WRITE,MAP_PRIVATE|MAP_ANONYMOUS,-1,0);
+        if(address==MAP_FAILED)
+        {
+            return NULL;
+        }
+        if(m_huge_pages_)
+        {
+            m_fallbacks_++;
+            if(madvise(address,len,MADV_HUGEPAGE)==0)
+            {
+                m_thp_bytes_+=len;
+            }
+        }
+    }
+	/*页面在第一次访问时才分配，策略在此之前设置*/
+    if(m_numa_ && Nodes()>1)
+    {
+        unsigned long mask=0;
+        int mode=MPOL_PREFERRED_MODE;
+        if(node<0 || node>=Nodes())
+        {
+            for(int i=0;i<Nodes();++i)
+            {
+                mask|=1ul<<m_node_ids_[i];
+            }
+            mode=MPOL_INTERLEAVE_MODE;
+        }
+        else
+        {
+            mask=1ul<<m_node_ids_[node];
+        }
+        if(Mbind(address,len,mode,&mask,MAX_NODES+1)!=0)
+        {
+            m_bind_failures_++;
+        }
+        else if(mode==MPOL_INTERLEAVE_MODE)
+        {
+            m_interleaved_bytes_+=len;
+        }
+        else
+        {
+            m_node_bytes_[node]+=len;
+        }
+    }
+    return address;
+}
+
+void NumaMemory::Free(void* address,size_t size)
+{
+    if(address)
+    {
+        munmap(address,RoundUp(size));
+    }
+}
+
+void NumaMemory::AdviseHuge(void* address,size_t size)
+{
+    if(!m_huge_pages_ || size<HUGE_PAGE_SIZE)
+    {
+        return;
+    }
+	/*文件映射需要内核支持只读文件的透明大页，由khugepaged在后台合并*/
+    if(madvise(address,size,MADV_HUGEPAGE)==0)
+    {
+        m_file_thp_bytes_+=size;
+    }
+}
+
+void NumaMemory::BindWorker(int index)
+{
+    if(m_numa_ && Nodes()>1)
+    {
+        int node=index%Nodes();
+        unsigned long mask=1ul<<m_node_ids_[node];
+        sched_setaffinity(0,sizeof(cpu_set_t),&m_node_cpus_[node]);
+        if(SetMempolicy(MPOL_PREFERRED_MODE,&mask,MAX_NODES+1)!=0)
+        {
+            m_bind_failures_++;
+        }
+    }
+    AttachThread();
+}
+
+void NumaMemory::AttachThread()
+{
+    static const uint64_t configs[COUNTER_COUNT]={
+        PERF_COUNT_HW_CACHE_DTLB|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16),
+        PERF_COUNT_HW_CACHE_NODE|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_ACCESS<<16),
+        PERF_COUNT_HW_CACHE_NODE|(PERF_COUNT_HW_CACHE_OP_READ<<8)|(PERF_COUNT_HW_CACHE_RESULT_MISS<<16)};
+    int fds[COUNTER_COUNT];
+    for(int c=0;c<COUNTER_COUNT;++c)
+    {
+        struct perf_event_attr attr;
+        memset(&attr,0,sizeof(attr));
+        attr.size=sizeof(attr);
+        attr.type=PERF_TYPE_HW_CACHE;
+        attr.config=configs[c];
+		/*只统计用户态，perf_event_paranoid为2时也能打开*/
+        attr.exclude_kernel=1;
+        attr.exclude_hv=1;
+        fds[c]=syscall(SYS_perf_event_open,&attr,0,-1,-1,PERF_FLAG_FD_CLOEXEC);
+    }
+    m_counter_locker_.Lock();
+    for(int c=0;c<COUNTER_COUNT;++c)
+    {
+        m_counter_fds_[c].push_back(fds[c]);
+    }
+    m_counter_locker_.Unlock();
+}
+
+void NumaMemory::Report(FILE* fp)
+{
+    static const char* counter_names[COUNTER_COUNT]={"dtlb_load_misses","node_loads","remote_node_loads"};
+    fprintf(fp,"memory: nodes=%d huge_pages=%s numa=%s hugetlb_bytes=%llu thp_bytes=%llu fallbacks=%llu file_thp_bytes=%llu\n",
+            Nodes(),m_huge_pages_?"on":"off",m_numa_?"on":"off",(unsigned long long)m_huge_bytes_.load(),
+            (unsigned long long)m_thp_bytes_.load(),(unsigned long long)m_fallbacks_.load(),(unsigned long long)m_file_thp_bytes_.load());
+    fprintf(fp,"memory: interleaved_bytes=%llu bind_failures=%llu",(unsigned long long)m_interleaved_bytes_.load(),
+            (unsigned long long)m_bind_failures_.load());
+    for(int i=0;i<Nodes();++i)
+    {
+        fprintf(fp," node%d_bytes=%llu",m_node_ids_[i],(unsigned long long)m_node_bytes_[i].load());
+    }
+    fprintf(fp,"\n");
+	/*硬件计数器在虚拟机或容器中可能不可用*/
+    m_counter_locker_.Lock();
+    for(int c=0;c<COUNTER_COUNT;++c)
+    {
+        uint64_t total=0;
+        int threads=0;
+        for(size_t i=0;i<m_counter_fds_[c].size();++i)
+        {
+            uint64_t value;
+            if(m_counter_fds_[c][i]>=0 && read(m_counter_fds_[c][i],&value,sizeof(value))==sizeof(value))
+            {
+                total+=value;
+                ++threads;
+            }
+        }
+        if(threads>0)
+        {
+            fprintf(fp,"memory: %s=%llu threads=%d\n",counter_names[c],(unsigned long long)total,threads);
+        }
+        else
+        {
+            fprintf(fp,"memory: %s=unavailable\n",counter_names[c]);
+        }
+    }
+    m_counter_locker_.Unlock();
+}
+
+NumaBufferPool::NumaBufferPool(size_t buffer_size):m_buffer_size_(buffer_size)
+{
+}
+
+NumaBufferPool::~NumaBufferPool()
+{
+    for(size_t i=0;i<m_chunks_.size();++i)
+    {
+        NumaMemory::Instance()->Free(m_chunks_[i].m_address_,m_chunks_[i].m_size_);
+    }
+}
+
+char* NumaBufferPool::Get(int* node)
+{
+    NumaMemory* memory=NumaMemory::Instance();
+    int index=*node;
+    if(index<0 || index>=memory->Nodes())
+    {
+        index=memory->CurrentNode();
+    }
+    *node=index;
+    Node& pool=m_nodes_[index];
+    pool.m_locker_.Lock();
+    if(pool.m_free_.empty())
+    {
+		/*按大页大小成块申请，一块切成多个缓冲区*/
+        size_t size=m_buffer_size_<NumaMemory::HUGE_PAGE_SIZE?NumaMemory::HUGE_PAGE_SIZE/m_buffer_size_*m_buffer_size_:m_buffer_size_;
+        char* address=(char*)memory->Allocate(size,index);
+        if(!address)
+        {
+            pool.m_locker_.Unlock();
+            return NULL;
+        }
+        for(size_t offset=0;offset+m_buffer_size_<=size;offset+=m_buffer_size_)
+        {
+            pool.m_free_.push_back(address+offset);
+        }
+        Chunk chunk={address,size};
+        m_chunks_locker_.Lock();
+        m_chunks_.push_back(chunk);
+        m_chunks_locker_.Unlock();
+    }
+    char* data=pool.m_free_.back();
+    pool.m_free_.pop_back();
+    pool.m_locker_.Unlock();
+    return data;
+}
+
+void NumaBufferPool::Put(char* data,int node)
+{
+    if(!data)
+    {
+        return;
+    }
+    Node& pool=m_nodes_[node];
+    pool.m_locker_.Lock();
+    pool.m_free_.push_back(data);
+    pool.m_locker_.Unlock();
+}
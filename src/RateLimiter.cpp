@@ -0,0 +1,276 @@
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include "RateLimiter.h"
+#include "Clock.h"
+
+/*令牌桶字段的布局*/
+static const int BUCKET_TIME_BITS=40;
+static const uint64_t BUCKET_TIME_MASK=(1ull<<BUCKET_TIME_BITS)-1;
+static const uint64_t BUCKET_MAX_TOKENS=(1ull<<24)-1;
+/*连接数字段的布局*/
+static const int OWNER_COUNT_BITS=16;
+static const uint64_t OWNER_COUNT_MASK=(1ull<<OWNER_COUNT_BITS)-1;
+/*键的类型，区分单个地址和地址前缀*/
+static const uint64_t KEY_IPV4=1;
+static const uint64_t KEY_IPV4_PREFIX=2;
+static const uint64_t KEY_IPV6=3;
+static const uint64_t KEY_IPV6_PREFIX=4;
+static const uint64_t KEY_HOST=5;
+
+/*splitmix64终结函数，把键打散到64位*/
+static inline uint64_t Mix(uint64_t x)
+{
+    x^=x>>30;
+    x*=0xbf58476d1ce4e5b9ull;
+    x^=x>>27;
+    x*=0x94d049bb133111ebull;
+    x^=x>>31;
+    return x;
+}
+
+/*48位非零标签*/
+static inline uint64_t Tag(uint64_t hash)
+{
+    return (hash>>16)|1;
+}
+
+RateLimiter::RateLimiter():m_max_conn_per_ip_(0),m_max_conn_per_prefix_(0),m_rate_per_ip_(0),m_burst_per_ip_(0),
+    m_rate_per_prefix_(0),m_burst_per_prefix_(0),m_rejected_connections_(0),m_rejected_requests_(0)
+{
+    m_table_=new Entry[TABLE_SIZE];
+    for(int i=0;i<TABLE_SIZE;++i)
+    {
+        m_table_[i].m_owner_.store(0,std::memory_order_relaxed);
+        m_table_[i].m_bucket_.store(0,std::memory_order_relaxed);
+    }
+}
+
+RateLimiter::~RateLimiter()
+{
+    delete []m_table_;
+}
+
+RateLimiter* RateLimiter::Instance()
+{
+    static RateLimiter limiter;
+    return &limiter;
+}
+
+void RateLimiter::Configure(int max_conn_per_ip,int max_conn_per_prefix,int rate_per_ip,int burst_per_ip,int rate_per_prefix,int burst_per_prefix)
+{
+    const int max_burst=BUCKET_MAX_TOKENS/1000-1;
+    m_max_conn_per_ip_=max_conn_per_ip<(int)OWNER_COUNT_MASK?max_conn_per_ip:OWNER_COUNT_MASK;
+    m_max_conn_per_prefix_=max_conn_per_prefix<(int)OWNER_COUNT_MASK?max_conn_per_prefix:OWNER_COUNT_MASK;
+    m_rate_per_ip_=rate_per_ip;
+    m_burst_per_ip_=burst_per_ip<max_burst?burst_per_ip:max_burst;
+    m_rate_per_prefix_=rate_per_prefix;
+    m_burst_per_prefix_=burst_per_prefix<max_burst?burst_per_prefix:max_burst;
+}
+
+int RateLimiter::FindSlot(uint64_t hash,uint64_t now)
+{
+    const uint64_t tag=Tag(hash);
+    for(int probe=0;probe<MAX_PROBES;++probe)
+    {
+        int slot=(hash+probe)&(TABLE_SIZE-1);
+        Entry& entry=m_table_[slot];
+        uint64_t owner=entry.m_owner_.load(std::memory_order_acquire);
+        while(true)
+        {
+            if((owner>>OWNER_COUNT_BITS)==tag)
+            {
+                return slot;
+            }
+            bool idle=false;
+            if(owner!=0 && (owner&OWNER_COUNT_MASK)==0)
+            {
+                uint64_t last=entry.m_bucket_.load(std::memory_order_relaxed)&BUCKET_TIME_MASK;
+                idle=now-last>IDLE_RECLAIM_MS;
+            }
+            if(owner!=0 && !idle)
+            {
+                break;
+            }
+            /*占用空槽或回收连接数为0的空闲槽，与连接数在同一个原子字中，不会回收有连接的槽*/
+            if(entry.m_owner_.compare_exchange_weak(owner,tag<<OWNER_COUNT_BITS,std::memory_order_acq_rel))
+            {
+                entry.m_bucket_.store((BUCKET_MAX_TOKENS<<BUCKET_TIME_BITS)|(now&BUCKET_TIME_MASK),std::memory_order_relaxed);
+                return slot;
+            }
+        }
+    }
+    return -1;
+}
+
+bool RateLimiter::AddConnection(int slot,uint64_t tag,int limit)
+{
+    std::atomic<uint64_t>& owner=m_table_[slot].m_owner_;
+    uint64_t cur=owner.load(std::memory_order_relaxed);
+    while(true)
+    {
+        if((cur>>OWNER_COUNT_BITS)!=tag)
+        {
+            /*槽在查找后被回收，放行*/
+            return true;
+        }
+        uint64_t count=cur&OWNER_COUNT_MASK;
+        if((limit>0 && count>=(uint64_t)limit) || count==OWNER_COUNT_MASK)
+        {
+            return false;
+        }
+        if(owner.compare_exchange_weak(cur,cur+1,std::memory_order_acq_rel))
+        {
+            return true;
+        }
+    }
+}
+
+void RateLimiter::RemoveConnection(int slot,uint64_t tag)
+{
+    std::atomic<uint64_t>& owner=m_table_[slot].m_owner_;
+    uint64_t cur=owner.load(std::memory_order_relaxed);
+    while((cur>>OWNER_COUNT_BITS)==tag && (cur&OWNER_COUNT_MASK)>0)
+    {
+        if(owner.compare_exchange_weak(cur,cur-1,std::memory_order_acq_rel))
+        {
+            /*记录最后活动时间，空闲超时从此刻开始计算*/
+            std::atomic<uint64_t>& bucket=m_table_[slot].m_bucket_;
+            uint64_t b=bucket.load(std::memory_order_relaxed);
+            uint64_t now=MonotonicCoarseMs();
+            bucket.compare_exchange_strong(b,(b&~BUCKET_TIME_MASK)|(now&BUCKET_TIME_MASK),std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+bool RateLimiter::TakeToken(int slot,uint64_t tag,int rate,int burst,uint64_t now)
+{
+    if(rate<=0 || slot<0 || (m_table_[slot].m_owner_.load(std::memory_order_relaxed)>>OWNER_COUNT_BITS)!=tag)
+    {
+        return true;
+    }
+    std::atomic<uint64_t>& bucket=m_table_[slot].m_bucket_;
+    const uint64_t capacity=(uint64_t)(burst>0?burst:rate)*1000;
+    uint64_t cur=bucket.load(std::memory_order_relaxed);
+    while(true)
+    {
+        uint64_t tokens=cur>>BUCKET_TIME_BITS;
+        uint64_t last=cur&BUCKET_TIME_MASK;
+        uint64_t elapsed=(now&BUCKET_TIME_MASK)>last?(now&BUCKET_TIME_MASK)-last:0;
+        /*每毫秒补充rate个千分之一令牌，即每秒rate个令牌*/
+        tokens+=elapsed*rate;
+        if(tokens>capacity)
+        {
+            tokens=capacity;
+        }
+        if(tokens<1000)
+        {
+            return false;
+        }
+        uint64_t next=((tokens-1000)<<BUCKET_TIME_BITS)|(elapsed?(now&BUCKET_TIME_MASK):last);
+        if(bucket.compare_exchange_weak(cur,next,std::memory_order_relaxed))
+        {
+            return true;
+        }
+    }
+}
+
+bool RateLimiter::AcquireConnection(const struct sockaddr* addr,RateTicket* ticket)
+{
+    ticket->m_ip_slot_=-1;
+    ticket->m_prefix_slot_=-1;
+    uint64_t ip_hash;
+    uint64_t prefix_hash;
+    if(addr->sa_family==AF_INET)
+    {
+        uint32_t ip=ntohl(((const struct sockaddr_in*)addr)->sin_addr.s_addr);
+        ip_hash=Mix((KEY_IPV4<<56)|ip);
+        prefix_hash=Mix((KEY_IPV4_PREFIX<<56)|(ip>>8));
+    }
+    else if(addr->sa_family==AF_INET6)
+    {
+        const uint8_t* bytes=((const struct sockaddr_in6*)addr)->sin6_addr.s6_addr;
+        uint64_t high;
+        uint64_t low;
+        memcpy(&high,bytes,8);
+        memcpy(&low,bytes+8,8);
+        prefix_hash=Mix(Mix(KEY_IPV6_PREFIX)^high);
+        ip_hash=Mix(Mix(KEY_IPV6)^high^Mix(low));
+    }
+    else
+    {
+        return true;
+    }
+    uint64_t now=MonotonicCoarseMs();
+    int ip_slot=FindSlot(ip_hash,now);
+    int prefix_slot=FindSlot(prefix_hash,now);
+    /*表满时放行，不让限流表本身成为拒绝服务的原因*/
+    if(ip_slot>=0 && !AddConnection(ip_slot,Tag(ip_hash),m_max_conn_per_ip_))
+    {
+        m_rejected_connections_.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    if(prefix_slot>=0 && !AddConnection(prefix_slot,Tag(prefix_hash),m_max_conn_per_prefix_))
+    {
+        if(ip_slot>=0)
+        {
+            RemoveConnection(ip_slot,Tag(ip_hash));
+        }
+        m_rejected_connections_.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    ticket->m_ip_slot_=ip_slot;
+    ticket->m_ip_tag_=Tag(ip_hash);
+    ticket->m_prefix_slot_=prefix_slot;
+    ticket->m_prefix_tag_=Tag(prefix_hash);
+    return true;
+}
+
+void RateLimiter::ReleaseConnection(RateTicket* ticket)
+{
+    if(ticket->m_ip_slot_>=0)
+    {
+        RemoveConnection(ticket->m_ip_slot_,ticket->m_ip_tag_);
+        ticket->m_ip_slot_=-1;
+    }
+    if(ticket->m_prefix_slot_>=0)
+    {
+        RemoveConnection(ticket->m_prefix_slot_,ticket->m_prefix_tag_);
+        ticket->m_prefix_slot_=-1;
+    }
+}
+
+bool RateLimiter::AllowRequest(const RateTicket* ticket)
+{
+    if(m_rate_per_ip_<=0 && m_rate_per_prefix_<=0)
+    {
+        return true;
+    }
+    uint64_t now=MonotonicCoarseMs();
+    if(!TakeToken(ticket->m_ip_slot_,ticket->m_ip_tag_,m_rate_per_ip_,m_burst_per_ip_,now) ||
+       !TakeToken(ticket->m_prefix_slot_,ticket->m_prefix_tag_,m_rate_per_prefix_,m_burst_per_prefix_,now))
+    {
+        m_rejected_requests_.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+bool RateLimiter::AllowHost(int host,int rate,int burst)
+{
+    if(rate<=0)
+    {
+        return true;
+    }
+    const int max_burst=BUCKET_MAX_TOKENS/1000-1;
+    uint64_t hash=Mix((KEY_HOST<<56)|(uint32_t)host);
+    uint64_t now=MonotonicCoarseMs();
+	/*主机的槽没有连接数，空闲时可能被回收，回收后令牌桶重新装满*/
+    if(!TakeToken(FindSlot(hash,now),Tag(hash),rate,burst<max_burst?burst:max_burst,now))
+    {
+        m_rejected_requests_.fetch_add(1,std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,197 @@
+#include <time.h>
+#include <netinet/in.h>
+#include <linux/tcp.h>
+#include <sys/socket.h>
+#include "SendScheduler.h"
+#include "Clock.h"
+
+SendScheduler::SendScheduler():m_quantum_(DEFAULT_QUANTUM),m_global_rate_(0),m_conn_rate_(0),m_autotune_(false),
+    m_deferrals_(0),m_throttles_(0),m_tunes_(0)
+{
+    m_global_.m_tokens_=0;
+    m_global_.m_last_us_=0;
+}
+
+SendScheduler::~SendScheduler()
+{
+}
+
+SendScheduler* SendScheduler::Instance()
+{
+    static SendScheduler scheduler;
+    return &scheduler;
+}
+
+void SendScheduler::Configure(size_t quantum,uint64_t global_rate,uint64_t conn_rate,bool autotune)
+{
+    m_quantum_=quantum>0?quantum:DEFAULT_QUANTUM;
+    m_global_rate_=global_rate;
+    m_conn_rate_=conn_rate;
+    m_autotune_=autotune;
+    m_global_.m_tokens_=Burst(global_rate);
+    m_global_.m_last_us_=MonotonicUs();
+}
+
+void SendScheduler::InitBucket(TokenBucket* bucket,uint64_t now_us) const
+{
+    bucket->m_tokens_=Burst(m_conn_rate_);
+    bucket->m_last_us_=now_us;
+}
+
+int64_t SendScheduler::Burst(uint64_t rate) const
+{
+    /*至少能发送一个额度，否则限速比额度小时永远攒不够*/
+    int64_t burst=rate*BURST_US/1000000;
+    return burst>(int64_t)m_quantum_?burst:(int64_t)m_quantum_;
+}
+
+void SendScheduler::Refill(TokenBucket* bucket,uint64_t rate,uint64_t now_us) const
+{
+    if(now_us<=bucket->m_last_us_)
+    {
+        return;
+    }
+    bucket->m_tokens_+=(int64_t)((now_us-bucket->m_last_us_)*rate/1000000);
+    bucket->m_last_us_=now_us;
+    int64_t burst=Burst(rate);
+    if(bucket->m_tokens_>burst)
+    {
+        bucket->m_tokens_=burst;
+    }
+}
+
+size_t SendScheduler::Grant(TokenBucket* bucket,uint64_t now_us,uint64_t* wait_us)
+{
+    int64_t grant=m_quantum_;
+    uint64_t wait=0;
+    if(m_global_rate_>0)
+    {
+        Refill(&m_global_,m_global_rate_,now_us);
+        if(m_global_.m_tokens_<grant)
+        {
+            grant=m_global_.m_tokens_;
+        }
+        if(m_global_.m_tokens_<(int64_t)MIN_GRANT)
+        {
+            wait=(MIN_GRANT-m_global_.m_tokens_)*1000000/m_global_rate_;
+        }
+    }
+    if(m_conn_rate_>0)
+    {
+        Refill(bucket,m_conn_rate_,now_us);
+        if(bucket->m_tokens_<grant)
+        {
+            grant=bucket->m_tokens_;
+        }
+        if(bucket->m_tokens_<(int64_t)MIN_GRANT)
+        {
+            uint64_t conn_wait=(MIN_GRANT-bucket->m_tokens_)*1000000/m_conn_rate_;
+            wait=conn_wait>wait?conn_wait:wait;
+        }
+    }
+    if(wait>0 || grant<=0)
+    {
+        *wait_us=wait>0?wait:1000;
+        return 0;
+    }
+    return grant;
+}
+
+void SendScheduler::Consume(TokenBucket* bucket,size_t bytes)
+{
+    if(m_global_rate_>0)
+    {
+        m_global_.m_tokens_-=bytes;
+    }
+    if(m_conn_rate_>0)
+    {
+        bucket->m_tokens_-=bytes;
+    }
+}
+
+void SendScheduler::Defer(uint64_t handle)
+{
+    m_deferred_.push_back(handle);
+    m_deferrals_++;
+}
+
+void SendScheduler::Throttle(uint64_t handle,uint64_t until_us)
+{
+    m_throttled_.push(Wakeup(until_us,handle));
+    m_throttles_++;
+}
+
+void SendScheduler::TakeRunnable(std::vector<uint64_t>& handles,uint64_t now_us)
+{
+    handles.clear();
+    handles.swap(m_deferred_);
+    while(!m_throttled_.empty() && m_throttled_.top().first<=now_us)
+    {
+        handles.push_back(m_throttled_.top().second);
+        m_throttled_.pop();
+    }
+}
+
+int SendScheduler::NextTimeout(uint64_t now_us) const
+{
+    if(!m_deferred_.empty())
+    {
+        return 0;
+    }
+    if(m_throttled_.empty())
+    {
+        return -1;
+    }
+    uint64_t until=m_throttled_.top().first;
+    /*向上取整，避免醒来时还差不到1毫秒而空转*/
+    return until<=now_us?0:(int)((until-now_us+999)/1000);
+}
+
+void SendScheduler::Tune(int sockfd,uint64_t now_us,uint64_t* next_us,int* sndbuf)
+{
+    if(!m_autotune_ || now_us<*next_us)
+    {
+        return;
+    }
+    *next_us=now_us+TUNE_INTERVAL_US;
+    struct tcp_info info;
+    socklen_t len=sizeof(info);
+    if(getsockopt(sockfd,IPPROTO_TCP,TCP_INFO,&info,&len)!=0 || info.tcpi_rtt==0)
+    {
+        return;
+    }
+    /*带宽时延积取拥塞窗口和按交付速率估算的较大者，留一倍余量给下一个RTT的增长*/
+    uint64_t bdp=(uint64_t)info.tcpi_snd_cwnd*info.tcpi_snd_mss;
+    if(len>=offsetof(struct tcp_info,tcpi_delivery_rate)+sizeof(info.tcpi_delivery_rate))
+    {
+        uint64_t delivered=info.tcpi_delivery_rate*info.tcpi_rtt/1000000;
+        bdp=delivered>bdp?delivered:bdp;
+    }
+    uint64_t target=bdp*2;
+    if(target<(uint64_t)MIN_SNDBUF)
+    {
+        target=MIN_SNDBUF;
+    }
+    if(target>(uint64_t)MAX_SNDBUF)
+    {
+        target=MAX_SNDBUF;
+    }
+    /*变化不到四分之一时不调整*/
+    if(*sndbuf>0 && target*4>=(uint64_t)*sndbuf*3 && target*4<=(uint64_t)*sndbuf*5)
+    {
+        return;
+    }
+    int value=(int)target;
+    if(setsockopt(sockfd,SOL_SOCKET,SO_SNDBUF,&value,sizeof(value))==0)
+    {
+        *sndbuf=value;
+        m_tunes_++;
+    }
+}
+
+void SendScheduler::Report(FILE* fp)
+{
+    fprintf(fp,"send: quantum=%d global_rate=%llu conn_rate=%llu autotune=%d deferrals=%llu throttles=%llu tunes=%llu\n",
+            (int)m_quantum_,(unsigned long long)m_global_rate_,(unsigned long long)m_conn_rate_,(int)m_autotune_,
+            (unsigned long long)m_deferrals_,(unsigned long long)m_throttles_,(unsigned long long)m_tunes_);
+}
@@ -0,0 +1,220 @@
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+#include "Trace.h"
+#include "Clock.h"
+
+/*阶段在导出文件中的名字，与TRACE_SPAN对应*/
+static const char* span_names[SPAN_COUNT]={"accept","read","queue","parse","file","respond","handler","write","send"};
+
+/*校准时间戳计数器的等待时间(毫秒)*/
+static const int CALIBRATE_MS=10;
+
+void RequestTrace::Reset()
+{
+    m_id_=0;
+    m_first_=0;
+    m_last_=0;
+    m_queued_=0;
+    m_send_start_=0;
+    m_count_=0;
+    m_dropped_=0;
+}
+
+void RequestTrace::Add(TRACE_SPAN span,uint64_t start,uint64_t end)
+{
+    if(m_id_==0)
+    {
+        m_id_=Tracer::Instance()->NextId();
+        m_first_=start;
+    }
+    if(end>m_last_)
+    {
+        m_last_=end;
+    }
+    if(m_count_>=(span==SPAN_SEND?MAX_SPANS:MAX_SPANS-1))
+    {
+        m_dropped_++;
+        return;
+    }
+    TraceSpan& s=m_spans_[m_count_++];
+    s.m_start_=start;
+    s.m_end_=end;
+    s.m_tid_=Tracer::ThreadId();
+    s.m_span_=span;
+}
+
+Tracer::Tracer():m_sample_every_(0),m_slow_ticks_(0),m_buffer_events_(0),m_base_ticks_(0),m_base_ns_(0),m_ticks_per_us_(1000),
+    m_next_id_(0),m_committed_(0),m_dropped_(0)
+{
+    pthread_key_create(&m_key_,NULL);
+}
+
+Tracer::~Tracer()
+{
+}
+
+Tracer* Tracer::Instance()
+{
+    static Tracer tracer;
+    return &tracer;
+}
+
+uint64_t Tracer::Now()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return MonotonicNs();
+#endif
+}
+
+uint32_t Tracer::ThreadId()
+{
+    static thread_local uint32_t tid=0;
+    if(tid==0)
+    {
+        tid=(uint32_t)syscall(SYS_gettid);
+    }
+    return tid;
+}
+
+void Tracer::Configure(int sample_every,int slow_ms,size_t buffer_events)
+{
+    m_sample_every_=sample_every>0?sample_every:0;
+    m_buffer_events_=buffer_events>0?buffer_events:1;
+    m_slow_ticks_=0;
+    if(m_sample_every_==0 && slow_ms<=0)
+    {
+        return;
+    }
+    /*按单调时钟估算时间戳计数器的频率，导出时再用更长的间隔修正*/
+    m_base_ticks_=Now();
+    m_base_ns_=MonotonicNs();
+    struct timespec ts={0,CALIBRATE_MS*1000000L};
+    nanosleep(&ts,NULL);
+    uint64_t ns=MonotonicNs()-m_base_ns_;
+    if(ns>0)
+    {
+        m_ticks_per_us_=(double)(Now()-m_base_ticks_)*1000/ns;
+    }
+    if(slow_ms>0)
+    {
+        m_slow_ticks_=(uint64_t)(slow_ms*1000*m_ticks_per_us_);
+    }
+}
+
+Tracer::ThreadBuffer* Tracer::GetThreadBuffer()
+{
+    ThreadBuffer* buffer=(ThreadBuffer*)pthread_getspecific(m_key_);
+    if(!buffer)
+    {
+        /*线程第一次保留请求时注册，缓冲区随进程存在*/
+        buffer=new ThreadBuffer;
+        buffer->m_events_.resize(m_buffer_events_);
+        buffer->m_total_=0;
+        pthread_setspecific(m_key_,buffer);
+        m_threads_locker_.Lock();
+        m_threads_.push_back(buffer);
+        m_threads_locker_.Unlock();
+    }
+    return buffer;
+}
+
+void Tracer::Commit(const RequestTrace* trace,int fd)
+{
+    if(!Enabled() || trace->m_count_==0)
+    {
+        return;
+    }
+    bool keep=m_sample_every_>0 && trace->m_id_%m_sample_every_==0;
+    if(!keep && m_slow_ticks_>0)
+    {
+        keep=trace->m_last_-trace->m_first_>=m_slow_ticks_;
+    }
+    if(!keep)
+    {
+        return;
+    }
+    ThreadBuffer* buffer=GetThreadBuffer();
+    size_t capacity=buffer->m_events_.size();
+    buffer->m_locker_.Lock();
+    for(int i=0;i<trace->m_count_;++i)
+    {
+        Event& event=buffer->m_events_[buffer->m_total_++%capacity];
+        event.m_span_=trace->m_spans_[i];
+        event.m_id_=trace->m_id_;
+        event.m_fd_=fd;
+    }
+    buffer->m_locker_.Unlock();
+    m_committed_++;
+    m_dropped_+=trace->m_dropped_;
+}
+
+double Tracer::ToUs(uint64_t ticks,uint64_t base_ticks,double ticks_per_us) const
+{
+    return (double)m_base_ns_/1000+((double)ticks-(double)base_ticks)/ticks_per_us;
+}
+
+std::string Tracer::Dump()
+{
+    std::string out="{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    if(!Enabled())
+    {
+        return out+"]}\n";
+    }
+    /*运行超过一秒后用启动以来的间隔重新估算频率*/
+    double ticks_per_us=m_ticks_per_us_;
+    uint64_t now_ns=MonotonicNs();
+    uint64_t now_ticks=Now();
+    if(now_ns-m_base_ns_>1000000000ull)
+    {
+        ticks_per_us=(double)(now_ticks-m_base_ticks_)*1000/(now_ns-m_base_ns_);
+    }
+    int pid=getpid();
+    bool first=true;
+    char line[256];
+    m_threads_locker_.Lock();
+    for(size_t t=0;t<m_threads_.size();++t)
+    {
+        ThreadBuffer* buffer=m_threads_[t];
+        buffer->m_locker_.Lock();
+        size_t capacity=buffer->m_events_.size();
+        uint64_t begin=buffer->m_total_>capacity?buffer->m_total_-capacity:0;
+        for(uint64_t i=begin;i<buffer->m_total_;++i)
+        {
+            const Event& event=buffer->m_events_[i%capacity];
+            const TraceSpan& span=event.m_span_;
+            double ts=ToUs(span.m_start_,m_base_ticks_,ticks_per_us);
+            double dur=span.m_end_>span.m_start_?(span.m_end_-span.m_start_)/ticks_per_us:0;
+            snprintf(line,sizeof(line),"%s\n{\"name\":\"%s\",\"cat\":\"http\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%u,"
+                     "\"args\":{\"fd\":%d,\"request\":%llu}}",first?"":",",span_names[span.m_span_],ts,dur,pid,span.m_tid_,
+                     event.m_fd_,(unsigned long long)event.m_id_);
+            out+=line;
+            first=false;
+        }
+        buffer->m_locker_.Unlock();
+    }
+    m_threads_locker_.Unlock();
+    snprintf(line,sizeof(line),"\n],\"otherData\":{\"requests\":%llu,\"committed\":%llu,\"dropped_spans\":%llu}}\n",
+             (unsigned long long)m_next_id_.load(),(unsigned long long)m_committed_.load(),(unsigned long long)m_dropped_.load());
+    out+=line;
+    return out;
+}
+
+bool Tracer::DumpFile(const char* path)
+{
+    std::string data=Dump();
+    FILE* fp=fopen(path,"w");
+    if(!fp)
+    {
+        return false;
+    }
+    bool ok=fwrite(data.data(),1,data.size(),fp)==data.size();
+    return fclose(fp)==0 && ok;
+}
@@ -0,0 +1,268 @@
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "VirtualHost.h"
+#include "FileCache.h"
+#include "RateLimiter.h"
+
+/*配置文件一行的最大长度*/
+static const int MAX_LINE=4096;
+
+HostTable::HostTable():m_mask_(0),m_default_(NULL)
+{
+}
+
+HostTable::~HostTable()
+{
+    for(size_t i=0;i<m_hosts_.size();++i)
+    {
+        delete m_hosts_[i];
+    }
+}
+
+HostTable* HostTable::Instance()
+{
+    static HostTable table;
+    return &table;
+}
+
+size_t HostTable::NameLength(const char* host)
+{
+    size_t len=0;
+    /*IPv6地址在方括号中，之后才是端口*/
+    if(host[0]=='[')
+    {
+        const char* end=strchr(host,']');
+        len=end?end-host+1:strlen(host);
+    }
+    else
+    {
+        len=strcspn(host,":");
+    }
+    while(len>0 && host[len-1]=='.')
+    {
+        len--;
+    }
+    return len;
+}
+
+uint64_t HostTable::Hash(const char* name,size_t len)
+{
+    uint64_t hash=14695981039346656037ull;
+    for(size_t i=0;i<len;++i)
+    {
+        hash^=(unsigned char)tolower((unsigned char)name[i]);
+        hash*=1099511628211ull;
+    }
+    return hash;
+}
+
+bool HostTable::Insert(const std::string& name,VirtualHost* host)
+{
+    uint64_t hash=Hash(name.data(),name.size());
+    size_t i=hash&m_mask_;
+    while(m_slots_[i].m_host_)
+    {
+        if(m_slots_[i].m_hash_==hash && strcasecmp(m_slots_[i].m_name_.c_str(),name.c_str())==0)
+        {
+            return false;
+        }
+        i=(i+1)&m_mask_;
+    }
+    m_slots_[i].m_hash_=hash;
+    m_slots_[i].m_name_=name;
+    m_slots_[i].m_host_=host;
+    return true;
+}
+
+bool HostTable::ParseLine(char* line,int lineno,const char* path,std::vector<std::pair<std::string,VirtualHost*> >& names)
+{
+    char* comment=strchr(line,'#');
+    if(comment)
+    {
+        *comment='\0';
+    }
+    char* save=NULL;
+    const char* fields[5]={NULL,NULL,NULL,NULL,NULL};
+    int count=0;
+    for(char* token=strtok_r(line," \t\r\n",&save);token;token=strtok_r(NULL," \t\r\n",&save))
+    {
+        if(count==5)
+        {
+            printf("%s:%d: too many fields\n",path,lineno);
+            return false;
+        }
+        fields[count++]=token;
+    }
+    if(count==0)
+    {
+        return true;
+    }
+    if(count<3)
+    {
+        printf("%s:%d: expected names root cache_mb [rate [burst]]\n",path,lineno);
+        return false;
+    }
+    struct stat st;
+    if(strlen(fields[1])>MAX_ROOT_LEN || stat(fields[1],&st)<0 || !S_ISDIR(st.st_mode))
+    {
+        printf("%s:%d: %s is not a directory\n",path,lineno,fields[1]);
+        return false;
+    }
+    VirtualHost* host=new VirtualHost;
+    host->m_root_=fields[1];
+    while(host->m_root_.size()>1 && host->m_root_[host->m_root_.size()-1]=='/')
+    {
+        host->m_root_.erase(host->m_root_.size()-1);
+    }
+    host->m_index_=m_hosts_.size();
+    host->m_rate_=count>3?atoi(fields[3]):0;
+    host->m_burst_=count>4?atoi(fields[4]):host->m_rate_;
+    host->m_requests_=0;
+    host->m_rejected_=0;
+    m_hosts_.push_back(host);
+	/*每个根目录在文件缓存中有自己的预算，一个主机的大文件不会挤掉其他主机的热点文件*/
+    FileCache::Instance()->AddPartition(host->m_root_.c_str(),(size_t)atol(fields[2])*1024*1024);
+    std::string list=fields[0];
+    size_t start=0;
+    while(start<=list.size())
+    {
+        size_t end=list.find(',',start);
+        if(end==std::string::npos)
+        {
+            end=list.size();
+        }
+        std::string name=list.substr(start,end-start);
+        start=end+1;
+        while(!name.empty() && name[name.size()-1]=='.')
+        {
+            name.erase(name.size()-1);
+        }
+        if(name.empty() || name.size()>MAX_NAME_LEN)
+        {
+            printf("%s:%d: bad host name\n",path,lineno);
+            return false;
+        }
+        if(host->m_name_.empty())
+        {
+            host->m_name_=name;
+        }
+        if(name=="*")
+        {
+            if(m_default_)
+            {
+                printf("%s:%d: duplicate default host\n",path,lineno);
+                return false;
+            }
+            m_default_=host;
+            continue;
+        }
+        names.push_back(std::make_pair(name,host));
+    }
+    return true;
+}
+
+bool HostTable::Load(const char* path,const char* root)
+{
+    std::vector<std::pair<std::string,VirtualHost*> > names;
+    if(path && path[0])
+    {
+        FILE* fp=fopen(path,"r");
+        if(!fp)
+        {
+            printf("%s: cannot open\n",path);
+            return false;
+        }
+        char line[MAX_LINE];
+        int lineno=0;
+        bool ok=true;
+        while(ok && fgets(line,sizeof(line),fp))
+        {
+            ok=ParseLine(line,++lineno,path,names);
+        }
+        fclose(fp);
+        if(!ok)
+        {
+            return false;
+        }
+    }
+	/*没有配置默认主机时用命令行的根目录，使用缓存的默认分区*/
+    if(!m_default_)
+    {
+        VirtualHost* host=new VirtualHost;
+        host->m_name_="*";
+        host->m_root_=root;
+        host->m_index_=m_hosts_.size();
+        host->m_rate_=0;
+        host->m_burst_=0;
+        host->m_requests_=0;
+        host->m_rejected_=0;
+        m_hosts_.push_back(host);
+        m_default_=host;
+    }
+    size_t size=1;
+    while(size<names.size()*2)
+    {
+        size<<=1;
+    }
+    HostName empty;
+    empty.m_hash_=0;
+    empty.m_host_=NULL;
+    m_slots_.assign(size,empty);
+    m_mask_=size-1;
+    for(size_t i=0;i<names.size();++i)
+    {
+        if(!Insert(names[i].first,names[i].second))
+        {
+            printf("%s: duplicate host name %s\n",path,names[i].first.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+const VirtualHost* HostTable::Find(const char* host) const
+{
+    if(!host || m_slots_.empty())
+    {
+        return m_default_;
+    }
+    size_t len=NameLength(host);
+    if(len==0 || len>MAX_NAME_LEN)
+    {
+        return m_default_;
+    }
+    uint64_t hash=Hash(host,len);
+    for(size_t i=hash&m_mask_;m_slots_[i].m_host_;i=(i+1)&m_mask_)
+    {
+        const HostName& slot=m_slots_[i];
+        if(slot.m_hash_==hash && slot.m_name_.size()==len && strncasecmp(slot.m_name_.data(),host,len)==0)
+        {
+            return slot.m_host_;
+        }
+    }
+    return m_default_;
+}
+
+bool HostTable::AllowRequest(const VirtualHost* host)
+{
+    host->m_requests_.fetch_add(1,std::memory_order_relaxed);
+    if(host->m_rate_<=0 || RateLimiter::Instance()->AllowHost(host->m_index_,host->m_rate_,host->m_burst_))
+    {
+        return true;
+    }
+    host->m_rejected_.fetch_add(1,std::memory_order_relaxed);
+    return false;
+}
+
+void HostTable::Report(FILE* fp)
+{
+    for(size_t i=0;i<m_hosts_.size();++i)
+    {
+        const VirtualHost* host=m_hosts_[i];
+        fprintf(fp,"host %s: root %s, %llu requests, %llu rejected by host rate\n",host->m_name_.c_str(),host->m_root_.c_str(),
+                (unsigned long long)host->m_requests_.load(std::memory_order_relaxed),
+                (unsigned long long)host->m_rejected_.load(std::memory_order_relaxed));
+    }
+}
@@ -0,0 +1,662 @@
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+#include "WebSocket.h"
+#include "Clock.h"
+
+/*握手时拼接在Sec-WebSocket-Key之后的GUID*/
+static const char WEBSOCKET_GUID[]="258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+/*帧头部的标志位*/
+static const uint8_t FLAG_FIN=0x80;
+static const uint8_t FLAG_RSV=0x70;
+static const uint8_t FLAG_MASK=0x80;
+
+static uint32_t Rotl(uint32_t x,int n)
+{
+    return (x<<n)|(x>>(32-n));
+}
+
+/*SHA-1，只用于计算握手应答*/
+static void Sha1(const uint8_t* data,size_t len,uint8_t digest[20])
+{
+    uint32_t h[5]={0x67452301,0xefcdab89,0x98badcfe,0x10325476,0xc3d2e1f0};
+    /*补齐：0x80，若干个0，最后8字节是以位计的长度*/
+    std::string msg((const char*)data,len);
+    msg.push_back((char)0x80);
+    while(msg.size()%64!=56)
+    {
+        msg.push_back(0);
+    }
+    uint64_t bits=(uint64_t)len*8;
+    for(int i=7;i>=0;--i)
+    {
+        msg.push_back((char)(bits>>(i*8)));
+    }
+    for(size_t block=0;block<msg.size();block+=64)
+    {
+        const uint8_t* p=(const uint8_t*)msg.data()+block;
+        uint32_t w[80];
+        for(int i=0;i<16;++i)
+        {
+            w[i]=((uint32_t)p[i*4]<<24)|((uint32_t)p[i*4+1]<<16)|((uint32_t)p[i*4+2]<<8)|p[i*4+3];
+        }
+        for(int i=16;i<80;++i)
+        {
+            w[i]=Rotl(w[i-3]^w[i-8]^w[i-14]^w[i-16],1);
+        }
+        uint32_t a=h[0],b=h[1],c=h[2],d=h[3],e=h[4];
+        for(int i=0;i<80;++i)
+        {
+            uint32_t f,k;
+            if(i<20)
+            {
+                f=(b&c)|(~b&d);
+                k=0x5a827999;
+            }
+            else if(i<40)
+            {
+                f=b^c^d;
+                k=0x6ed9eba1;
+            }
+            else if(i<60)
+            {
+                f=(b&c)|(b&d)|(c&d);
+                k=0x8f1bbcdc;
+            }
+            else
+            {
+                f=b^c^d;
+                k=0xca62c1d6;
+            }
+            uint32_t temp=Rotl(a,5)+f+e+k+w[i];
+            e=d;
+            d=c;
+            c=Rotl(b,30);
+            b=a;
+            a=temp;
+        }
+        h[0]+=a;
+        h[1]+=b;
+        h[2]+=c;
+        h[3]+=d;
+        h[4]+=e;
+    }
+    for(int i=0;i<5;++i)
+    {
+        digest[i*4]=(uint8_t)(h[i]>>24);
+        digest[i*4+1]=(uint8_t)(h[i]>>16);
+        digest[i*4+2]=(uint8_t)(h[i]>>8);
+        digest[i*4+3]=(uint8_t)h[i];
+    }
+}
+
+static void EncodeBase64(const uint8_t* data,size_t len,std::string& out)
+{
+    static const char table[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    for(size_t i=0;i<len;i+=3)
+    {
+        uint32_t v=(uint32_t)data[i]<<16;
+        if(i+1<len) v|=(uint32_t)data[i+1]<<8;
+        if(i+2<len) v|=data[i+2];
+        out.push_back(table[(v>>18)&0x3f]);
+        out.push_back(table[(v>>12)&0x3f]);
+        out.push_back(i+1<len?table[(v>>6)&0x3f]:'=');
+        out.push_back(i+2<len?table[v&0x3f]:'=');
+    }
+}
+
+/*去掉掩码：先按16字节(SSE2)，再按8字节异或，最后逐字节处理剩余部分
+**每次处理的字节数都是4的倍数，所以剩余部分从掩码的i%4处继续
+*/
+static void Unmask(uint8_t* data,size_t len,const uint8_t key[4])
+{
+    uint32_t key32;
+    memcpy(&key32,key,4);
+    uint64_t key64=((uint64_t)key32<<32)|key32;
+    size_t i=0;
+#ifdef __SSE2__
+    __m128i key128=_mm_set1_epi64x((long long)key64);
+    for(;i+16<=len;i+=16)
+    {
+        __m128i v=_mm_loadu_si128((const __m128i*)(data+i));
+        _mm_storeu_si128((__m128i*)(data+i),_mm_xor_si128(v,key128));
+    }
+#endif
+    for(;i+8<=len;i+=8)
+    {
+        uint64_t v;
+        memcpy(&v,data+i,8);
+        v^=key64;
+        memcpy(data+i,&v,8);
+    }
+    for(;i<len;++i)
+    {
+        data[i]^=key[i&3];
+    }
+}
+
+/*检查文本消息是否是合法的UTF-8，拒绝过长编码、代理项和超过U+10FFFF的码点*/
+static bool ValidUtf8(const uint8_t* s,size_t len)
+{
+    size_t i=0;
+    while(i<len)
+    {
+        uint8_t c=s[i];
+        if(c<0x80)
+        {
+            ++i;
+            continue;
+        }
+        int n;
+        uint32_t cp;
+        if((c&0xe0)==0xc0)
+        {
+            n=1;
+            cp=c&0x1f;
+        }
+        else if((c&0xf0)==0xe0)
+        {
+            n=2;
+            cp=c&0x0f;
+        }
+        else if((c&0xf8)==0xf0)
+        {
+            n=3;
+            cp=c&0x07;
+        }
+        else
+        {
+            return false;
+        }
+        if(i+n>=len)
+        {
+            return false;
+        }
+        for(int k=1;k<=n;++k)
+        {
+            if((s[i+k]&0xc0)!=0x80)
+            {
+                return false;
+            }
+            cp=(cp<<6)|(s[i+k]&0x3f);
+        }
+        static const uint32_t min_cp[4]={0,0x80,0x800,0x10000};
+        if(cp<min_cp[n] || cp>0x10ffff || (cp>=0xd800 && cp<=0xdfff))
+        {
+            return false;
+        }
+        i+=n+1;
+    }
+    return true;
+}
+
+WebSocketSession::WebSocketSession(uint64_t handle,const char* channel,uint64_t now_ms):m_handle_(handle),m_channel_(channel),
+    m_message_opcode_(0),m_fragmented_(false),m_close_received_(false),m_last_recv_ms_(now_ms),m_ping_sent_(false),
+    m_out_pos_(0),m_out_bytes_(0),m_close_sent_(false),m_failed_(false),m_armed_(false),m_wake_pending_(false)
+{
+}
+
+WebSocketSession::~WebSocketSession()
+{
+}
+
+bool WebSocketSession::AcceptKey(const char* key,std::string& accept)
+{
+    /*客户端的key是16字节随机数的base64编码*/
+    if(!key || strlen(key)!=24 || key[22]!='=' || key[23]!='=')
+    {
+        return false;
+    }
+    std::string input(key);
+    input.append(WEBSOCKET_GUID);
+    uint8_t digest[20];
+    Sha1((const uint8_t*)input.data(),input.size(),digest);
+    EncodeBase64(digest,sizeof(digest),accept);
+    return true;
+}
+
+WebSocketFrame WebSocketSession::BuildFrame(int opcode,const char* data,size_t len)
+{
+    std::string* frame=new std::string;
+    frame->reserve(len+10);
+    frame->push_back((char)(FLAG_FIN|opcode));
+    if(len<126)
+    {
+        frame->push_back((char)len);
+    }
+    else if(len<=0xffff)
+    {
+        frame->push_back((char)126);
+        frame->push_back((char)(len>>8));
+        frame->push_back((char)len);
+    }
+    else
+    {
+        frame->push_back((char)127);
+        for(int i=7;i>=0;--i)
+        {
+            frame->push_back((char)((uint64_t)len>>(i*8)));
+        }
+    }
+    frame->append(data,len);
+    return WebSocketFrame(frame);
+}
+
+bool WebSocketSession::Append(const char* data,int len,uint64_t now_ms)
+{
+    if(m_in_.size()+len>INPUT_LIMIT)
+    {
+        return false;
+    }
+    m_in_.append(data,len);
+    m_last_recv_ms_=now_ms;
+    m_ping_sent_=false;
+    return true;
+}
+
+void WebSocketSession::Process()
+{
+    size_t pos=0;
+    while(!m_close_received_ && m_in_.size()-pos>=2)
+    {
+        uint8_t* p=(uint8_t*)&m_in_[pos];
+        bool fin=(p[0]&FLAG_FIN)!=0;
+        int opcode=p[0]&0x0f;
+        uint64_t len=p[1]&0x7f;
+        size_t header=2;
+        /*没有协商扩展，RSV位必须为0；客户端发送的帧必须加掩码*/
+        if((p[0]&FLAG_RSV) || !(p[1]&FLAG_MASK))
+        {
+            Fail(CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+        if(len==126)
+        {
+            header=4;
+        }
+        else if(len==127)
+        {
+            header=10;
+        }
+        if(m_in_.size()-pos<header+4)
+        {
+            break;
+        }
+        if(len==126)
+        {
+            len=((uint64_t)p[2]<<8)|p[3];
+        }
+        else if(len==127)
+        {
+            len=0;
+            for(int i=0;i<8;++i)
+            {
+                len=(len<<8)|p[2+i];
+            }
+        }
+        /*控制帧不能分片，负载不超过125字节*/
+        if((opcode&0x8) && (!fin || len>125))
+        {
+            Fail(CLOSE_PROTOCOL_ERROR);
+            break;
+        }
+        if(len>MAX_MESSAGE_SIZE || (opcode==CONTINUATION && m_message_.size()+len>MAX_MESSAGE_SIZE))
+        {
+            Fail(CLOSE_TOO_BIG);
+            break;
+        }
+        if(m_in_.size()-pos<header+4+len)
+        {
+            break;
+        }
+        uint8_t* payload=p+header+4;
+        Unmask(payload,len,p+header);
+        pos+=header+4+len;
+        if(!OnFrame(fin,opcode,(const char*)payload,len))
+        {
+            break;
+        }
+    }
+    if(m_close_received_)
+    {
+        m_in_.clear();
+    }
+    else
+    {
+        m_in_.erase(0,pos);
+    }
+}
+
+bool WebSocketSession::OnFrame(bool fin,int opcode,const char* payload,size_t len)
+{
+    switch(opcode)
+    {
+        case CONTINUATION:
+        {
+            if(!m_fragmented_)
+            {
+                return Fail(CLOSE_PROTOCOL_ERROR);
+            }
+            m_message_.append(payload,len);
+            if(!fin)
+            {
+                return true;
+            }
+            m_fragmented_=false;
+            bool ret=OnMessage(m_message_opcode_,m_message_.data(),m_message_.size());
+            m_message_.clear();
+            return ret;
+        }
+        case TEXT:
+        case BINARY:
+        {
+            /*上一条分片消息还没结束*/
+            if(m_fragmented_)
+            {
+                return Fail(CLOSE_PROTOCOL_ERROR);
+            }
+            if(fin)
+            {
+                return OnMessage(opcode,payload,len);
+            }
+            m_fragmented_=true;
+            m_message_opcode_=opcode;
+            m_message_.assign(payload,len);
+            return true;
+        }
+        case CLOSE:
+        {
+            m_close_received_=true;
+            int code=CLOSE_NORMAL;
+            if(len==1)
+            {
+                code=CLOSE_PROTOCOL_ERROR;
+            }
+            else if(len>=2 && !ValidUtf8((const uint8_t*)payload+2,len-2))
+            {
+                code=CLOSE_INVALID_DATA;
+            }
+            /*回应关闭帧，发送完后关闭连接*/
+            SendClose(code);
+            return false;
+        }
+        case PING:
+        {
+            Enqueue(BuildFrame(PONG,payload,len),true);
+            return true;
+        }
+        case PONG:
+        {
+            /*收到数据时已更新保活时间*/
+            return true;
+        }
+        default:
+        {
+            return Fail(CLOSE_PROTOCOL_ERROR);
+        }
+    }
+}
+
+bool WebSocketSession::OnMessage(int opcode,const char* data,size_t len)
+{
+    if(opcode==TEXT && !ValidUtf8((const uint8_t*)data,len))
+    {
+        return Fail(CLOSE_INVALID_DATA);
+    }
+    WebSocketHub::Instance()->Dispatch(this,opcode,data,len);
+    return true;
+}
+
+bool WebSocketSession::Fail(int code)
+{
+    m_close_received_=true;
+    SendClose(code);
+    return false;
+}
+
+bool WebSocketSession::Send(int opcode,const char* data,size_t len)
+{
+    return Enqueue(BuildFrame(opcode,data,len),false);
+}
+
+bool WebSocketSession::Enqueue(const WebSocketFrame& frame,bool control)
+{
+    return Push(frame,control,false);
+}
+
+bool WebSocketSession::Push(const WebSocketFrame& frame,bool control,bool close)
+{
+    Lock();
+    /*关闭帧之后不能再发送任何帧*/
+    if(m_close_sent_ || m_failed_)
+    {
+        Unlock();
+        return !m_failed_;
+    }
+    if(!control && m_out_bytes_+frame->size()>MAX_SEND_QUEUE)
+    {
+        m_failed_=true;
+    }
+    else
+    {
+        m_out_.push_back(frame);
+        m_out_bytes_+=frame->size();
+        m_close_sent_=close;
+    }
+    bool failed=m_failed_;
+    bool wake=!m_wake_pending_;
+    m_wake_pending_=true;
+    Unlock();
+    if(wake)
+    {
+        WebSocketHub::Instance()->Wake(m_handle_);
+    }
+    return !failed;
+}
+
+void WebSocketSession::SendClose(int code)
+{
+    char payload[2]={(char)(code>>8),(char)code};
+    Push(BuildFrame(CLOSE,payload,sizeof(payload)),true,true);
+}
+
+void WebSocketSession::Tick(uint64_t now_ms)
+{
+    if(now_ms-m_last_recv_ms_<PING_INTERVAL_MS)
+    {
+        return;
+    }
+    if(!m_ping_sent_)
+    {
+        m_ping_sent_=true;
+        Enqueue(BuildFrame(PING,"",0),true);
+    }
+    else if(now_ms-m_last_recv_ms_>=PING_INTERVAL_MS+PONG_TIMEOUT_MS)
+    {
+        Lock();
+        m_failed_=true;
+        bool wake=!m_wake_pending_;
+        m_wake_pending_=true;
+        Unlock();
+        if(wake)
+        {
+            WebSocketHub::Instance()->Wake(m_handle_);
+        }
+    }
+}
+
+int WebSocketSession::OutVec(struct iovec* iov,int max) const
+{
+    int count=0;
+    for(std::deque<WebSocketFrame>::const_iterator it=m_out_.begin();it!=m_out_.end() && count<max;++it,++count)
+    {
+        size_t skip=count==0?m_out_pos_:0;
+        iov[count].iov_base=const_cast<char*>((*it)->data())+skip;
+        iov[count].iov_len=(*it)->size()-skip;
+    }
+    return count;
+}
+
+void WebSocketSession::OutConsume(size_t n)
+{
+    m_out_bytes_-=n;
+    while(n>0)
+    {
+        size_t left=m_out_.front()->size()-m_out_pos_;
+        if(n<left)
+        {
+            m_out_pos_+=n;
+            return;
+        }
+        n-=left;
+        m_out_.pop_front();
+        m_out_pos_=0;
+    }
+}
+
+WebSocketHub::WebSocketHub():m_count_(0),m_handler_(Relay),m_wake_fd_(-1),m_last_tick_ms_(0)
+{
+}
+
+WebSocketHub::~WebSocketHub()
+{
+    if(m_wake_fd_>=0)
+    {
+        close(m_wake_fd_);
+    }
+}
+
+WebSocketHub* WebSocketHub::Instance()
+{
+    static WebSocketHub hub;
+    return &hub;
+}
+
+bool WebSocketHub::Open()
+{
+    m_wake_fd_=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    return m_wake_fd_>=0;
+}
+
+void WebSocketHub::SetHandler(WebSocketHandler handler)
+{
+    m_handler_=handler?handler:Relay;
+}
+
+void WebSocketHub::Register(WebSocketSession* session)
+{
+    m_locker_.Lock();
+    m_channels_[session->Channel()].insert(session);
+    m_count_.fetch_add(1,std::memory_order_relaxed);
+    m_locker_.Unlock();
+}
+
+void WebSocketHub::Unregister(WebSocketSession* session)
+{
+    m_locker_.Lock();
+    std::map<std::string,std::set<WebSocketSession*> >::iterator it=m_channels_.find(session->Channel());
+    if(it!=m_channels_.end() && it->second.erase(session))
+    {
+        if(it->second.empty())
+        {
+            m_channels_.erase(it);
+        }
+        m_count_.fetch_sub(1,std::memory_order_relaxed);
+    }
+    m_locker_.Unlock();
+}
+
+int WebSocketHub::Broadcast(const char* channel,int opcode,const char* data,size_t len)
+{
+    /*只编码一次，各连接的发送队列引用同一个帧*/
+    WebSocketFrame frame=WebSocketSession::BuildFrame(opcode,data,len);
+    int count=0;
+    m_locker_.Lock();
+    std::map<std::string,std::set<WebSocketSession*> >::iterator it=channel?m_channels_.find(channel):m_channels_.begin();
+    for(;it!=m_channels_.end();++it)
+    {
+        for(std::set<WebSocketSession*>::iterator s=it->second.begin();s!=it->second.end();++s)
+        {
+            /*跟不上的连接由I/O线程断开，不影响其他连接*/
+            if((*s)->Enqueue(frame,false))
+            {
+                ++count;
+            }
+        }
+        if(channel)
+        {
+            break;
+        }
+    }
+    m_locker_.Unlock();
+    return count;
+}
+
+void WebSocketHub::Wake(uint64_t handle)
+{
+    m_pending_locker_.Lock();
+    bool first=m_pending_.empty();
+    m_pending_.push_back(handle);
+    m_pending_locker_.Unlock();
+    if(first && m_wake_fd_>=0)
+    {
+        uint64_t one=1;
+        ssize_t ret=write(m_wake_fd_,&one,sizeof(one));
+        (void)ret;
+    }
+}
+
+void WebSocketHub::ClearWakeup()
+{
+    uint64_t count;
+    ssize_t ret=read(m_wake_fd_,&count,sizeof(count));
+    (void)ret;
+}
+
+void WebSocketHub::TakePending(std::vector<uint64_t>& handles)
+{
+    handles.clear();
+    m_pending_locker_.Lock();
+    handles.swap(m_pending_);
+    m_pending_locker_.Unlock();
+}
+
+void WebSocketHub::Tick(uint64_t now_ms)
+{
+    if(now_ms-m_last_tick_ms_<TICK_INTERVAL_MS)
+    {
+        return;
+    }
+    m_last_tick_ms_=now_ms;
+    m_locker_.Lock();
+    for(std::map<std::string,std::set<WebSocketSession*> >::iterator it=m_channels_.begin();it!=m_channels_.end();++it)
+    {
+        for(std::set<WebSocketSession*>::iterator s=it->second.begin();s!=it->second.end();++s)
+        {
+            (*s)->Tick(now_ms);
+        }
+    }
+    m_locker_.Unlock();
+}
+
+void WebSocketHub::GoingAway()
+{
+    m_locker_.Lock();
+    for(std::map<std::string,std::set<WebSocketSession*> >::iterator it=m_channels_.begin();it!=m_channels_.end();++it)
+    {
+        for(std::set<WebSocketSession*>::iterator s=it->second.begin();s!=it->second.end();++s)
+        {
+            (*s)->SendClose(WebSocketSession::CLOSE_GOING_AWAY);
+        }
+    }
+    m_locker_.Unlock();
+}
+
+void WebSocketHub::Relay(WebSocketSession* session,int opcode,const char* data,size_t len)
+{
+    WebSocketHub::Instance()->Broadcast(session->Channel().c_str(),opcode,data,len);
+}
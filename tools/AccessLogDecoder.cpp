@@ -0,0 +1,264 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <arpa/inet.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "AccessLog.h"
+#include "HttpConn.h"
+
+/**
+**二进制访问日志解码工具
+**用法：AccessLogDecoder [-f text|json|csv] file.wsal...
+**按顺序读取记录，路径记录定义之后请求记录使用的路径编号；编号只在写出它的缓冲区内有效，后来的路径记录会覆盖它
+*/
+
+static const char* stage_names[STAGE_COUNT]={"read","queue","process","write"};
+
+enum OUTPUT_FORMAT{FORMAT_TEXT=0,FORMAT_JSON,FORMAT_CSV};
+
+/*读入整个文件，检查文件头*/
+static bool LoadFile(const char* name,std::string& data)
+{
+    FILE* fp=fopen(name,"rb");
+    if(!fp)
+    {
+        fprintf(stderr,"%s: cannot open\n",name);
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while((n=fread(buf,1,sizeof(buf),fp))>0)
+    {
+        data.append(buf,n);
+    }
+    fclose(fp);
+    AccessFileHeader header;
+    if(data.size()<sizeof(header))
+    {
+        fprintf(stderr,"%s: truncated header\n",name);
+        return false;
+    }
+    memcpy(&header,data.data(),sizeof(header));
+    if(header.m_magic_!=ACCESS_LOG_MAGIC || header.m_version_!=ACCESS_LOG_VERSION)
+    {
+        fprintf(stderr,"%s: not an access log\n",name);
+        return false;
+    }
+    return true;
+}
+
+/*遍历文件中的记录，对每条记录调用visit，由visit按类型跳过不认识的记录*/
+template<typename Visitor>
+static void ForEachRecord(const std::string& data,const char* name,Visitor& visit)
+{
+    size_t pos=sizeof(AccessFileHeader);
+    while(pos+sizeof(AccessRecordHeader)<=data.size())
+    {
+        AccessRecordHeader header;
+        memcpy(&header,data.data()+pos,sizeof(header));
+        if(header.m_length_<sizeof(header) || pos+header.m_length_>data.size())
+        {
+            fprintf(stderr,"%s: truncated record at offset %zu\n",name,pos);
+            return;
+        }
+        visit(header.m_type_,data.data()+pos,header.m_length_);
+        pos+=header.m_length_;
+    }
+}
+
+/*输出字符串，按格式转义*/
+static void PrintString(const std::string& s,OUTPUT_FORMAT format)
+{
+    if(format==FORMAT_TEXT)
+    {
+        fwrite(s.data(),1,s.size(),stdout);
+        return;
+    }
+    putchar('"');
+    for(size_t i=0;i<s.size();++i)
+    {
+        unsigned char c=s[i];
+        if(format==FORMAT_CSV && c=='"')
+        {
+            fputs("\"\"",stdout);
+        }
+        else if(format==FORMAT_JSON && (c=='"' || c=='\\'))
+        {
+            printf("\\%c",c);
+        }
+        else if(format==FORMAT_JSON && c<0x20)
+        {
+            printf("\\u%04x",c);
+        }
+        else
+        {
+            putchar(c);
+        }
+    }
+    putchar('"');
+}
+
+/*更新路径字典，输出请求记录*/
+struct RequestPrinter
+{
+    std::map<uint32_t,std::string> m_paths_;
+    OUTPUT_FORMAT m_format_;
+    bool m_first_;
+    void operator()(uint16_t type,const char* data,size_t len)
+    {
+        if(type==ACCESS_RECORD_PATH && len>=sizeof(AccessPathRecord))
+        {
+            AccessPathRecord path;
+            memcpy(&path,data,sizeof(path));
+            m_paths_[path.m_path_id_].assign(data+sizeof(path),len-sizeof(path));
+            return;
+        }
+        if(type!=ACCESS_RECORD_REQUEST || len<sizeof(AccessRequestRecord))
+        {
+            return;
+        }
+        AccessRequestRecord record;
+        memcpy(&record,data,sizeof(record));
+        char addr[INET_ADDRSTRLEN];
+        struct in_addr in;
+        in.s_addr=record.m_addr_;
+        inet_ntop(AF_INET,&in,addr,sizeof(addr));
+        const char* method=HttpConn::MethodName(record.m_method_);
+        if(!method)
+        {
+            method="-";
+        }
+        std::string path="?";
+        if(record.m_path_id_==ACCESS_PATH_OTHER)
+        {
+            /*写日志时路径字典已满*/
+            path="-";
+        }
+        else
+        {
+            std::map<uint32_t,std::string>::iterator it=m_paths_.find(record.m_path_id_);
+            if(it!=m_paths_.end())
+            {
+                path=it->second;
+            }
+        }
+        const char* protocol=(record.m_flags_&ACCESS_FLAG_HTTP2)?"HTTP/2":"HTTP/1.1";
+        bool keepalive=(record.m_flags_&ACCESS_FLAG_KEEPALIVE)!=0;
+        switch(m_format_)
+        {
+            case FORMAT_TEXT:
+            {
+                time_t sec=record.m_time_us_/1000000;
+                struct tm tm;
+                localtime_r(&sec,&tm);
+                char stamp[32];
+                strftime(stamp,sizeof(stamp),"%Y-%m-%d %H:%M:%S",&tm);
+                printf("%s.%06u %s:%u %s ",stamp,(unsigned)(record.m_time_us_%1000000),addr,ntohs(record.m_port_),method);
+                PrintString(path,m_format_);
+                printf(" %s %u %llu %uus",protocol,record.m_status_,(unsigned long long)record.m_bytes_,record.m_total_us_);
+                for(int i=0;i<STAGE_COUNT;++i)
+                {
+                    printf(" %s=%u",stage_names[i],record.m_stage_us_[i]);
+                }
+                printf("%s\n",keepalive?" keep-alive":"");
+                break;
+            }
+            case FORMAT_JSON:
+            {
+                printf("%s{\"time_us\":%llu,\"addr\":\"%s\",\"port\":%u,\"method\":\"%s\",\"path\":",m_first_?"":",\n",
+                       (unsigned long long)record.m_time_us_,addr,ntohs(record.m_port_),method);
+                PrintString(path,m_format_);
+                printf(",\"protocol\":\"%s\",\"status\":%u,\"bytes\":%llu,\"keepalive\":%s,\"total_us\":%u",
+                       protocol,record.m_status_,(unsigned long long)record.m_bytes_,keepalive?"true":"false",record.m_total_us_);
+                for(int i=0;i<STAGE_COUNT;++i)
+                {
+                    printf(",\"%s_us\":%u",stage_names[i],record.m_stage_us_[i]);
+                }
+                printf("}");
+                break;
+            }
+            case FORMAT_CSV:
+            {
+                printf("%llu,%s,%u,%s,",(unsigned long long)record.m_time_us_,addr,ntohs(record.m_port_),method);
+                PrintString(path,m_format_);
+                printf(",%s,%u,%llu,%d,%u",protocol,record.m_status_,(unsigned long long)record.m_bytes_,keepalive?1:0,record.m_total_us_);
+                for(int i=0;i<STAGE_COUNT;++i)
+                {
+                    printf(",%u",record.m_stage_us_[i]);
+                }
+                printf("\n");
+                break;
+            }
+        }
+        m_first_=false;
+    }
+};
+
+static void Usage(const char* prog)
+{
+    fprintf(stderr,"usage: %s [-f text|json|csv] file.wsal...\n",prog);
+}
+
+int main(int argc,char* argv[])
+{
+    OUTPUT_FORMAT format=FORMAT_TEXT;
+    int first=1;
+    if(argc>2 && strcmp(argv[1],"-f")==0)
+    {
+        if(strcmp(argv[2],"text")==0)
+        {
+            format=FORMAT_TEXT;
+        }
+        else if(strcmp(argv[2],"json")==0)
+        {
+            format=FORMAT_JSON;
+        }
+        else if(strcmp(argv[2],"csv")==0)
+        {
+            format=FORMAT_CSV;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+        first=3;
+    }
+    if(first>=argc)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    RequestPrinter printer;
+    printer.m_format_=format;
+    printer.m_first_=true;
+    if(format==FORMAT_JSON)
+    {
+        printf("[\n");
+    }
+    else if(format==FORMAT_CSV)
+    {
+        printf("time_us,addr,port,method,path,protocol,status,bytes,keepalive,total_us");
+        for(int i=0;i<STAGE_COUNT;++i)
+        {
+            printf(",%s_us",stage_names[i]);
+        }
+        printf("\n");
+    }
+    for(int i=first;i<argc;++i)
+    {
+        std::string data;
+        if(LoadFile(argv[i],data))
+        {
+            ForEachRecord(data,argv[i],printer);
+        }
+    }
+    if(format==FORMAT_JSON)
+    {
+        printf("\n]\n");
+    }
+    return 0;
+}
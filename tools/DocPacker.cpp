@@ -0,0 +1,467 @@
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#include "DocArchive.h"
+
+/**
+**把网站根目录打包成服务端可以直接映射的归档
+**用法：DocPacker [-z] [-m min_bytes] root_dir output
+**-z为文本类文件生成gzip预压缩内容(压缩后至少小10%才保留)，-m为预压缩的最小文件大小(默认256)
+**编译：g++ -std=c++11 -O2 -Iinclude tools/DocPacker.cpp -lz -o DocPacker
+*/
+
+/*每个桶的位移值最多尝试的次数*/
+static const uint32_t MAX_SEED=1u<<24;
+
+/*扩展名对应的Content-Type，compress表示值得预压缩*/
+struct MimeType
+{
+    const char* m_ext_;
+    const char* m_type_;
+    bool m_compress_;
+};
+
+static const MimeType mime_types[]={
+    {"html","text/html; charset=utf-8",true},{"htm","text/html; charset=utf-8",true},
+    {"css","text/css; charset=utf-8",true},{"js","application/javascript; charset=utf-8",true},
+    {"mjs","application/javascript; charset=utf-8",true},{"json","application/json",true},
+    {"map","application/json",true},{"txt","text/plain; charset=utf-8",true},
+    {"xml","application/xml",true},{"svg","image/svg+xml",true},{"csv","text/csv; charset=utf-8",true},
+    {"wasm","application/wasm",true},{"ico","image/x-icon",true},
+    {"png","image/png",false},{"jpg","image/jpeg",false},{"jpeg","image/jpeg",false},
+    {"gif","image/gif",false},{"webp","image/webp",false},{"avif","image/avif",false},
+    {"woff","font/woff",false},{"woff2","font/woff2",false},{"pdf","application/pdf",false},
+    {"mp4","video/mp4",false},{"webm","video/webm",false},{"mp3","audio/mpeg",false},
+    {"zip","application/zip",false},{"gz","application/gzip",false}
+};
+static const MimeType default_type={"","application/octet-stream",false};
+
+/*待打包的文件*/
+struct PackFile
+{
+	/*磁盘上的路径和归档中的路径(以'/'开头)*/
+    std::string m_disk_path_;
+    std::string m_path_;
+    uint64_t m_size_;
+    int64_t m_mtime_;
+    const MimeType* m_type_;
+    std::string m_etag_;
+    std::string m_gzip_;
+    std::string m_gzip_etag_;
+};
+
+static void Usage(const char* name)
+{
+    fprintf(stderr,"usage: %s [-z] [-m min_bytes] root_dir output\n",name);
+}
+
+static const MimeType* FindType(const std::string& path)
+{
+    size_t dot=path.rfind('.');
+    if(dot==std::string::npos || path.find('/',dot)!=std::string::npos)
+    {
+        return &default_type;
+    }
+    std::string ext=path.substr(dot+1);
+    for(size_t i=0;i<ext.size();++i)
+    {
+        ext[i]=tolower(ext[i]);
+    }
+    for(size_t i=0;i<sizeof(mime_types)/sizeof(mime_types[0]);++i)
+    {
+        if(ext==mime_types[i].m_ext_)
+        {
+            return &mime_types[i];
+        }
+    }
+    return &default_type;
+}
+
+/*递归收集目录下的普通文件，跳过隐藏文件和其他用户不可读的文件(服务端同样不会提供)*/
+static bool Collect(const std::string& dir,const std::string& prefix,std::vector<PackFile>& files)
+{
+    DIR* dp=opendir(dir.c_str());
+    if(!dp)
+    {
+        fprintf(stderr,"%s: cannot open directory\n",dir.c_str());
+        return false;
+    }
+    bool ok=true;
+    struct dirent* de;
+    while((de=readdir(dp))!=NULL)
+    {
+        if(de->d_name[0]=='.')
+        {
+            continue;
+        }
+        std::string disk=dir+"/"+de->d_name;
+        std::string path=prefix+"/"+de->d_name;
+        struct stat st;
+        if(stat(disk.c_str(),&st)<0)
+        {
+            continue;
+        }
+        if(S_ISDIR(st.st_mode))
+        {
+            ok=Collect(disk,path,files) && ok;
+        }
+        else if(S_ISREG(st.st_mode) && (st.st_mode&S_IROTH))
+        {
+            PackFile file;
+            file.m_disk_path_=disk;
+            file.m_path_=path;
+            file.m_size_=st.st_size;
+            file.m_mtime_=st.st_mtime;
+            file.m_type_=FindType(path);
+            files.push_back(file);
+        }
+    }
+    closedir(dp);
+    return ok;
+}
+
+static bool ReadFile(const std::string& path,std::string& data)
+{
+    FILE* fp=fopen(path.c_str(),"rb");
+    if(!fp)
+    {
+        return false;
+    }
+    char buf[65536];
+    size_t n;
+    while((n=fread(buf,1,sizeof(buf),fp))>0)
+    {
+        data.append(buf,n);
+    }
+    bool ok=!ferror(fp);
+    fclose(fp);
+    return ok;
+}
+
+static bool Gzip(const std::string& data,std::string& out)
+{
+    z_stream stream;
+    memset(&stream,0,sizeof(stream));
+	/*窗口位数加16表示输出gzip格式*/
+    if(deflateInit2(&stream,9,Z_DEFLATED,15+16,9,Z_DEFAULT_STRATEGY)!=Z_OK)
+    {
+        return false;
+    }
+    out.resize(deflateBound(&stream,data.size()));
+    stream.next_in=(Bytef*)data.data();
+    stream.avail_in=data.size();
+    stream.next_out=(Bytef*)&out[0];
+    stream.avail_out=out.size();
+    int ret=deflate(&stream,Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ret==Z_STREAM_END;
+}
+
+/*读入文件计算ETag，需要时生成预压缩内容*/
+static bool Prepare(PackFile& file,bool compress,size_t min_bytes)
+{
+    std::string data;
+    if(!ReadFile(file.m_disk_path_,data))
+    {
+        fprintf(stderr,"%s: cannot read\n",file.m_disk_path_.c_str());
+        return false;
+    }
+    file.m_size_=data.size();
+    char etag[64];
+    snprintf(etag,sizeof(etag),"\"%llx-%016llx\"",(unsigned long long)data.size(),
+             (unsigned long long)DocArchiveHash(data.data(),data.size()));
+    file.m_etag_=etag;
+    std::string gzip;
+    if(compress && file.m_type_->m_compress_ && data.size()>=min_bytes && Gzip(data,gzip) && gzip.size()*10<data.size()*9)
+    {
+        file.m_gzip_.swap(gzip);
+        file.m_gzip_etag_=file.m_etag_.substr(0,file.m_etag_.size()-1)+"-gz\"";
+    }
+    return true;
+}
+
+/*构造最小完美哈希：按桶从大到小为每个桶找一个位移值，使桶中的路径都落到空位置*/
+static bool BuildIndex(const std::vector<uint64_t>& hashes,uint32_t buckets,std::vector<uint32_t>& seeds,std::vector<uint32_t>& slots)
+{
+    uint32_t count=hashes.size();
+    std::vector<std::vector<uint32_t> > members(buckets);
+    for(uint32_t i=0;i<count;++i)
+    {
+        members[hashes[i]%buckets].push_back(i);
+    }
+    std::vector<std::pair<size_t,uint32_t> > order;
+    for(uint32_t b=0;b<buckets;++b)
+    {
+        order.push_back(std::make_pair(members[b].size(),b));
+    }
+    std::sort(order.rbegin(),order.rend());
+    seeds.assign(buckets,0);
+    slots.assign(count,0);
+    std::vector<bool> used(count,false);
+    std::vector<uint32_t> trial;
+    for(size_t k=0;k<order.size() && order[k].first>0;++k)
+    {
+        const std::vector<uint32_t>& bucket=members[order[k].second];
+        uint32_t seed=0;
+        for(;seed<MAX_SEED;++seed)
+        {
+            trial.clear();
+            bool ok=true;
+            for(size_t i=0;i<bucket.size() && ok;++i)
+            {
+                uint32_t slot=DocArchiveSlot(hashes[bucket[i]],seed,count);
+                ok=!used[slot] && std::find(trial.begin(),trial.end(),slot)==trial.end();
+                trial.push_back(slot);
+            }
+            if(ok)
+            {
+                break;
+            }
+        }
+        if(seed==MAX_SEED)
+        {
+            return false;
+        }
+        seeds[order[k].second]=seed;
+        for(size_t i=0;i<bucket.size();++i)
+        {
+            used[trial[i]]=true;
+            slots[bucket[i]]=trial[i];
+        }
+    }
+    return true;
+}
+
+static uint64_t Align(uint64_t offset,uint64_t align)
+{
+    return (offset+align-1)/align*align;
+}
+
+/*把data写到文件的offset处，中间的空洞补0*/
+static bool WriteAt(FILE* fp,uint64_t* pos,uint64_t offset,const char* data,size_t len)
+{
+    static const char zeros[DOC_ARCHIVE_ALIGN]={0};
+    while(*pos<offset)
+    {
+        size_t n=offset-*pos<sizeof(zeros)?offset-*pos:sizeof(zeros);
+        if(fwrite(zeros,1,n,fp)!=n)
+        {
+            return false;
+        }
+        *pos+=n;
+    }
+    if(len>0 && fwrite(data,1,len,fp)!=len)
+    {
+        return false;
+    }
+    *pos+=len;
+    return true;
+}
+
+int main(int argc,char* argv[])
+{
+    bool compress=false;
+    size_t min_bytes=256;
+    int first=1;
+    while(first<argc && argv[first][0]=='-')
+    {
+        if(strcmp(argv[first],"-z")==0)
+        {
+            compress=true;
+            first++;
+        }
+        else if(strcmp(argv[first],"-m")==0 && first+1<argc)
+        {
+            min_bytes=strtoul(argv[first+1],NULL,10);
+            first+=2;
+        }
+        else
+        {
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if(argc-first!=2)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    std::string root=argv[first];
+    while(root.size()>1 && root[root.size()-1]=='/')
+    {
+        root.erase(root.size()-1);
+    }
+    const char* output=argv[first+1];
+    std::vector<PackFile> files;
+    if(!Collect(root,"",files))
+    {
+        return 1;
+    }
+    uint64_t raw_bytes=0;
+    uint64_t gzip_bytes=0;
+    int gzip_count=0;
+    for(size_t i=0;i<files.size();++i)
+    {
+        if(!Prepare(files[i],compress,min_bytes))
+        {
+            return 1;
+        }
+        raw_bytes+=files[i].m_size_;
+        if(!files[i].m_gzip_.empty())
+        {
+            gzip_bytes+=files[i].m_gzip_.size();
+            gzip_count++;
+        }
+    }
+
+    /*完美哈希，失败时增加桶数重试；完全相同的哈希无法分开*/
+    uint32_t count=files.size();
+    std::vector<uint64_t> hashes(count);
+    for(uint32_t i=0;i<count;++i)
+    {
+        hashes[i]=DocArchiveHash(files[i].m_path_.data(),files[i].m_path_.size());
+    }
+    std::vector<uint64_t> sorted(hashes);
+    std::sort(sorted.begin(),sorted.end());
+    if(std::adjacent_find(sorted.begin(),sorted.end())!=sorted.end())
+    {
+        fprintf(stderr,"path hash collision, cannot build index\n");
+        return 1;
+    }
+    uint32_t buckets=count/4+1;
+    std::vector<uint32_t> seeds;
+    std::vector<uint32_t> slots;
+    while(!BuildIndex(hashes,buckets,seeds,slots))
+    {
+        if(buckets>=count)
+        {
+            fprintf(stderr,"cannot build index\n");
+            return 1;
+        }
+        buckets=buckets*2<count?buckets*2:count;
+    }
+
+    /*字符串表：第一个字节为空串，Content-Type去重*/
+    std::string strings(1,'\0');
+    std::map<std::string,uint32_t> interned;
+    std::vector<DocArchiveEntry> entries(count);
+    for(uint32_t i=0;i<count;++i)
+    {
+        PackFile& file=files[i];
+        DocArchiveEntry& entry=entries[slots[i]];
+        memset(&entry,0,sizeof(entry));
+        entry.m_hash_=hashes[i];
+        entry.m_size_=file.m_size_;
+        entry.m_gzip_size_=file.m_gzip_.size();
+        entry.m_mtime_=file.m_mtime_;
+        entry.m_path_offset_=strings.size();
+        entry.m_path_len_=file.m_path_.size();
+        strings.append(file.m_path_.c_str(),file.m_path_.size()+1);
+        std::map<std::string,uint32_t>::iterator it=interned.find(file.m_type_->m_type_);
+        if(it==interned.end())
+        {
+            it=interned.insert(std::make_pair(std::string(file.m_type_->m_type_),(uint32_t)strings.size())).first;
+            strings.append(file.m_type_->m_type_,strlen(file.m_type_->m_type_)+1);
+        }
+        entry.m_type_offset_=it->second;
+        entry.m_etag_offset_=strings.size();
+        strings.append(file.m_etag_.c_str(),file.m_etag_.size()+1);
+        if(!file.m_gzip_.empty())
+        {
+            strings.append(file.m_gzip_etag_.c_str(),file.m_gzip_etag_.size()+1);
+        }
+    }
+
+    /*布局：文件头、条目表、位移表、字符串表，之后每个文件内容按页对齐*/
+    DocArchiveHeader header;
+    memset(&header,0,sizeof(header));
+    header.m_magic_=DOC_ARCHIVE_MAGIC;
+    header.m_version_=DOC_ARCHIVE_VERSION;
+    header.m_count_=count;
+    header.m_buckets_=buckets;
+    header.m_entries_offset_=Align(sizeof(header),8);
+    header.m_seeds_offset_=header.m_entries_offset_+(uint64_t)count*sizeof(DocArchiveEntry);
+    header.m_strings_offset_=header.m_seeds_offset_+(uint64_t)buckets*sizeof(uint32_t);
+    header.m_strings_size_=strings.size();
+    header.m_created_=time(NULL);
+    uint64_t offset=Align(header.m_strings_offset_+strings.size(),DOC_ARCHIVE_ALIGN);
+    for(uint32_t i=0;i<count;++i)
+    {
+        DocArchiveEntry& entry=entries[slots[i]];
+        entry.m_data_offset_=offset;
+        offset=Align(offset+entry.m_size_,DOC_ARCHIVE_ALIGN);
+        if(entry.m_gzip_size_>0)
+        {
+            entry.m_gzip_offset_=offset;
+            offset=Align(offset+entry.m_gzip_size_,DOC_ARCHIVE_ALIGN);
+        }
+    }
+	/*最后一个文件之后不补齐*/
+    uint64_t file_size=header.m_strings_offset_+strings.size();
+    for(uint32_t i=0;i<count;++i)
+    {
+        const DocArchiveEntry& entry=entries[i];
+        uint64_t end=entry.m_gzip_size_>0?entry.m_gzip_offset_+entry.m_gzip_size_:entry.m_data_offset_+entry.m_size_;
+        file_size=end>file_size?end:file_size;
+    }
+    header.m_file_size_=file_size;
+
+	/*先写临时文件再改名，服务端不会打开写了一半的归档*/
+    std::string temp=std::string(output)+".tmp";
+    FILE* fp=fopen(temp.c_str(),"wb");
+    if(!fp)
+    {
+        fprintf(stderr,"%s: cannot create\n",temp.c_str());
+        return 1;
+    }
+    uint64_t pos=0;
+    bool ok=WriteAt(fp,&pos,0,(const char*)&header,sizeof(header)) &&
+            WriteAt(fp,&pos,header.m_entries_offset_,(const char*)&entries[0],count*sizeof(DocArchiveEntry)) &&
+            WriteAt(fp,&pos,header.m_seeds_offset_,(const char*)&seeds[0],buckets*sizeof(uint32_t)) &&
+            WriteAt(fp,&pos,header.m_strings_offset_,strings.data(),strings.size());
+	/*按内容在归档中的顺序写入*/
+    std::vector<std::pair<uint64_t,uint32_t> > layout;
+    for(uint32_t i=0;i<count;++i)
+    {
+        layout.push_back(std::make_pair(entries[slots[i]].m_data_offset_,i));
+    }
+    std::sort(layout.begin(),layout.end());
+    for(size_t k=0;k<layout.size() && ok;++k)
+    {
+        PackFile& file=files[layout[k].second];
+        const DocArchiveEntry& entry=entries[slots[layout[k].second]];
+        std::string data;
+        ok=ReadFile(file.m_disk_path_,data) && data.size()==entry.m_size_;
+        if(!ok)
+        {
+            fprintf(stderr,"%s: changed while packing\n",file.m_disk_path_.c_str());
+            break;
+        }
+        ok=WriteAt(fp,&pos,entry.m_data_offset_,data.data(),data.size());
+        if(ok && entry.m_gzip_size_>0)
+        {
+            ok=WriteAt(fp,&pos,entry.m_gzip_offset_,file.m_gzip_.data(),file.m_gzip_.size());
+        }
+    }
+    ok=ok && pos==file_size;
+    if(fclose(fp)!=0 || !ok || rename(temp.c_str(),output)!=0)
+    {
+        fprintf(stderr,"%s: write failed\n",output);
+        unlink(temp.c_str());
+        return 1;
+    }
+    printf("%u files, %llu bytes, %d gzip variants (%llu bytes), %u buckets, archive %llu bytes\n",count,
+           (unsigned long long)raw_bytes,gzip_count,(unsigned long long)gzip_bytes,buckets,(unsigned long long)file_size);
+    return 0;
+}
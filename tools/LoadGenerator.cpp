@@ -0,0 +1,819 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+/**
+**HTTP负载生成和请求回放工具
+**用法：LoadGenerator [-a 地址] [-p 端口] [-t 线程数] [-c 连接数] [-d 测试秒数] [-w 预热秒数]
+**                    [-r 每秒请求数] [-n 每个连接的请求数] [-P 流水线深度] [-T 超时毫秒] [-f 请求文件] [-S]
+**-r为0时是闭环模式(每个连接收到应答后立即发送下一个请求)，否则是开环模式(按固定到达率发送)
+**开环模式的延迟从请求计划发送的时刻算起，不受服务端变慢后客户端少发请求的影响(coordinated omission)
+**-n为0时连接一直保持，否则每个连接发送n个请求后关闭重连，最后一个请求带Connection: close
+**-S让每个连接绑定127.0.0.0/8中不同/24的源地址，服务端按地址限流时把每个连接看作一个客户端
+**请求文件每行一个请求，格式为"方法 路径"或"路径"，按顺序循环发送；不指定时请求/index.html
+**结果以JSON输出到标准输出
+*/
+
+/*服务端读缓冲区的大小(HttpConn::READ_BUFFER_SIZE)，超过的请求无法被处理*/
+static const size_t MAX_REQUEST_LEN=2048;
+/*连接失败后重连的间隔(纳秒)*/
+static const uint64_t RECONNECT_DELAY_NS=10*1000*1000;
+/*每次epoll_wait最多返回的事件数*/
+static const int MAX_EVENTS=256;
+/*检查超时和重连的间隔(毫秒)*/
+static const int HOUSEKEEPING_MS=10;
+
+static uint64_t NowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return (uint64_t)ts.tv_sec*1000000000+ts.tv_nsec;
+}
+
+/**
+**延迟直方图(微秒)，每个2的幂区间分为64个桶，相对误差小于1.6%
+*/
+class Histogram
+{
+    public:
+        static const int SUB_BITS=6;
+        static const int SUB_COUNT=1<<SUB_BITS;
+        static const int BUCKETS=(64-SUB_BITS)*SUB_COUNT+SUB_COUNT;
+    public:
+        Histogram():m_counts_(BUCKETS,0),m_total_(0),m_sum_(0),m_max_(0)
+        {
+        }
+        void Record(uint64_t value)
+        {
+            m_counts_[Index(value)]++;
+            m_total_++;
+            m_sum_+=value;
+            if(value>m_max_)
+            {
+                m_max_=value;
+            }
+        }
+        void Merge(const Histogram& other)
+        {
+            for(int i=0;i<BUCKETS;++i)
+            {
+                m_counts_[i]+=other.m_counts_[i];
+            }
+            m_total_+=other.m_total_;
+            m_sum_+=other.m_sum_;
+            if(other.m_max_>m_max_)
+            {
+                m_max_=other.m_max_;
+            }
+        }
+		/*第q分位数，返回所在桶的上界*/
+        uint64_t Percentile(double q) const
+        {
+            if(m_total_==0)
+            {
+                return 0;
+            }
+            uint64_t rank=(uint64_t)(q*m_total_+0.5);
+            if(rank<1)
+            {
+                rank=1;
+            }
+            uint64_t seen=0;
+            for(int i=0;i<BUCKETS;++i)
+            {
+                seen+=m_counts_[i];
+                if(seen>=rank)
+                {
+                    uint64_t upper=Upper(i);
+                    return upper<m_max_?upper:m_max_;
+                }
+            }
+            return m_max_;
+        }
+        uint64_t Total() const {return m_total_;}
+        uint64_t Max() const {return m_max_;}
+        double Mean() const {return m_total_?(double)m_sum_/m_total_:0;}
+    private:
+        static int Index(uint64_t value)
+        {
+            if(value<(uint64_t)SUB_COUNT*2)
+            {
+                return (int)value;
+            }
+            int shift=63-__builtin_clzll(value)-SUB_BITS;
+            return (shift+1)*SUB_COUNT+(int)(value>>shift)-SUB_COUNT;
+        }
+        static uint64_t Upper(int index)
+        {
+            if(index<SUB_COUNT*2)
+            {
+                return index;
+            }
+            int shift=index/SUB_COUNT-1;
+            uint64_t mantissa=index%SUB_COUNT+SUB_COUNT;
+            return ((mantissa+1)<<shift)-1;
+        }
+    private:
+        std::vector<uint64_t> m_counts_;
+        uint64_t m_total_;
+        uint64_t m_sum_;
+        uint64_t m_max_;
+};
+
+/*命令行参数*/
+struct Options
+{
+    const char* m_address_;
+    int m_port_;
+    int m_threads_;
+    int m_connections_;
+    double m_duration_;
+    double m_warmup_;
+    double m_rate_;
+    int m_per_connection_;
+    int m_pipeline_;
+    int m_timeout_ms_;
+    const char* m_corpus_;
+    bool m_spread_;
+};
+
+/*预先生成的请求，分别是保持连接和最后一个请求的两种形式*/
+struct Request
+{
+    std::string m_keepalive_;
+    std::string m_close_;
+    bool m_head_;
+};
+
+/*已发送、等待应答的请求*/
+struct InFlight
+{
+	/*计划发送的时刻，开环模式下可能早于实际发送时刻*/
+    uint64_t m_intended_;
+    uint64_t m_sent_;
+    bool m_head_;
+};
+
+/*一个客户端连接*/
+struct Connection
+{
+	/*所有线程中的连接编号*/
+    int m_id_;
+    int m_fd_;
+    bool m_connecting_;
+	/*已经发送了带Connection: close的请求，或服务端要求关闭*/
+    bool m_closing_;
+	/*本连接已发送的请求数*/
+    int m_requests_;
+	/*下次允许重连的时刻，m_fd_为-1时有效*/
+    uint64_t m_retry_at_;
+    std::string m_out_;
+    size_t m_out_pos_;
+    std::string m_in_;
+    std::deque<InFlight> m_inflight_;
+};
+
+/*每个线程的统计*/
+struct Stats
+{
+    Stats():m_requests_(0),m_bytes_(0),m_connect_errors_(0),m_read_errors_(0),m_timeouts_(0),m_reconnects_(0),m_backlog_(0)
+    {
+        memset(m_status_,0,sizeof(m_status_));
+    }
+    Histogram m_latency_;
+    uint64_t m_requests_;
+    uint64_t m_bytes_;
+    uint64_t m_status_[6];
+    uint64_t m_connect_errors_;
+    uint64_t m_read_errors_;
+    uint64_t m_timeouts_;
+    uint64_t m_reconnects_;
+	/*开环模式下到测试结束还没有发出的请求*/
+    uint64_t m_backlog_;
+};
+
+static Options options;
+static std::vector<Request> corpus;
+static struct sockaddr_in server_address;
+
+/**
+**一个负载线程，拥有自己的epoll和连接
+*/
+class Worker
+{
+    public:
+		/*index决定线程从请求文件的哪一行开始，各线程交错回放；first_id是本线程第一个连接的编号*/
+        Worker(int index,int first_id,int connections,double rate):m_rate_(rate),m_next_request_(index),m_issued_(0),m_connections_(connections),m_cursor_(0)
+        {
+            for(int i=0;i<connections;++i)
+            {
+                m_connections_[i].m_id_=first_id+i;
+            }
+        }
+        static void* Start(void* arg)
+        {
+            ((Worker*)arg)->Run();
+            return arg;
+        }
+        const Stats& GetStats() const {return m_stats_;}
+    private:
+        void Run();
+		/*开环模式：把到期的请求加入待发送队列*/
+        void Schedule(uint64_t now);
+		/*在连接允许时发送请求*/
+        void Dispatch(Connection& conn,uint64_t now);
+        bool Connect(Connection& conn,uint64_t now);
+		/*关闭连接，重连时间由调用者决定*/
+        void Drop(Connection& conn,uint64_t retry_at);
+        void OnWritable(Connection& conn,uint64_t now);
+        void OnReadable(Connection& conn,uint64_t now);
+		/*解析已收到的完整应答，返回false表示应答格式错误*/
+        bool ParseResponses(Connection& conn,uint64_t now);
+        void Flush(Connection& conn);
+        void UpdateEvents(Connection& conn);
+        bool Recording(uint64_t intended) const {return intended>=m_record_from_ && intended<m_end_;}
+    private:
+        double m_rate_;
+        int m_epollfd_;
+		/*开环模式下在下一个请求的计划时刻唤醒，不用忙等*/
+        int m_timerfd_;
+        size_t m_next_request_;
+        uint64_t m_start_;
+        uint64_t m_record_from_;
+        uint64_t m_end_;
+		/*开环模式已经计划的请求数，以及计划了但还没有连接可以发送的请求*/
+        uint64_t m_issued_;
+        std::deque<uint64_t> m_backlog_;
+        std::vector<Connection> m_connections_;
+		/*每轮从不同的连接开始分发，避免请求集中在前面的连接上*/
+        size_t m_cursor_;
+        Stats m_stats_;
+};
+
+bool Worker::Connect(Connection& conn,uint64_t now)
+{
+    conn.m_fd_=socket(AF_INET,SOCK_STREAM|SOCK_NONBLOCK,0);
+    conn.m_connecting_=true;
+    conn.m_closing_=false;
+    conn.m_requests_=0;
+    conn.m_out_.clear();
+    conn.m_out_pos_=0;
+    conn.m_in_.clear();
+    if(conn.m_fd_<0)
+    {
+        m_stats_.m_connect_errors_++;
+        conn.m_retry_at_=now+RECONNECT_DELAY_NS;
+        return false;
+    }
+    int one=1;
+    setsockopt(conn.m_fd_,IPPROTO_TCP,TCP_NODELAY,&one,sizeof(one));
+    if(options.m_spread_)
+    {
+        struct sockaddr_in local;
+        memset(&local,0,sizeof(local));
+        local.sin_family=AF_INET;
+        local.sin_addr.s_addr=htonl(0x7f000001|((uint32_t)(conn.m_id_&0xffff)<<8));
+        bind(conn.m_fd_,(struct sockaddr*)&local,sizeof(local));
+    }
+    if(connect(conn.m_fd_,(struct sockaddr*)&server_address,sizeof(server_address))<0 && errno!=EINPROGRESS)
+    {
+        m_stats_.m_connect_errors_++;
+        close(conn.m_fd_);
+        conn.m_fd_=-1;
+        conn.m_retry_at_=now+RECONNECT_DELAY_NS;
+        return false;
+    }
+    struct epoll_event event;
+    event.events=EPOLLIN|EPOLLOUT;
+    event.data.ptr=&conn;
+    epoll_ctl(m_epollfd_,EPOLL_CTL_ADD,conn.m_fd_,&event);
+    return true;
+}
+
+void Worker::Drop(Connection& conn,uint64_t retry_at)
+{
+    if(conn.m_fd_>=0)
+    {
+        epoll_ctl(m_epollfd_,EPOLL_CTL_DEL,conn.m_fd_,NULL);
+        close(conn.m_fd_);
+        conn.m_fd_=-1;
+    }
+    /*开环模式下未完成的请求回到待发送队列，保留原来的计划时刻*/
+    while(!conn.m_inflight_.empty())
+    {
+        if(m_rate_>0)
+        {
+            m_backlog_.push_front(conn.m_inflight_.back().m_intended_);
+        }
+        conn.m_inflight_.pop_back();
+    }
+    conn.m_retry_at_=retry_at;
+}
+
+void Worker::UpdateEvents(Connection& conn)
+{
+    struct epoll_event event;
+    event.events=EPOLLIN|((conn.m_connecting_ || conn.m_out_pos_<conn.m_out_.size())?(int)EPOLLOUT:0);
+    event.data.ptr=&conn;
+    epoll_ctl(m_epollfd_,EPOLL_CTL_MOD,conn.m_fd_,&event);
+}
+
+void Worker::Schedule(uint64_t now)
+{
+    if(m_rate_<=0)
+    {
+        return;
+    }
+    while(true)
+    {
+        uint64_t due=m_start_+(uint64_t)(m_issued_*1e9/m_rate_);
+        if(due>now || due>=m_end_)
+        {
+            break;
+        }
+        m_backlog_.push_back(due);
+        m_issued_++;
+    }
+}
+
+void Worker::Dispatch(Connection& conn,uint64_t now)
+{
+    if(conn.m_fd_<0 || conn.m_connecting_)
+    {
+        return;
+    }
+    bool queued=false;
+    while(!conn.m_closing_ && (int)conn.m_inflight_.size()<options.m_pipeline_ && now<m_end_)
+    {
+        uint64_t intended=now;
+        if(m_rate_>0)
+        {
+            if(m_backlog_.empty())
+            {
+                break;
+            }
+            intended=m_backlog_.front();
+            m_backlog_.pop_front();
+        }
+        const Request& request=corpus[m_next_request_%corpus.size()];
+        m_next_request_+=options.m_threads_;
+        conn.m_requests_++;
+        bool last=options.m_per_connection_>0 && conn.m_requests_>=options.m_per_connection_;
+        conn.m_out_.append(last?request.m_close_:request.m_keepalive_);
+        InFlight inflight;
+        inflight.m_intended_=intended;
+        inflight.m_sent_=now;
+        inflight.m_head_=request.m_head_;
+        conn.m_inflight_.push_back(inflight);
+        conn.m_closing_=last;
+        queued=true;
+    }
+    if(queued)
+    {
+        Flush(conn);
+    }
+}
+
+void Worker::Flush(Connection& conn)
+{
+    while(conn.m_out_pos_<conn.m_out_.size())
+    {
+        ssize_t n=send(conn.m_fd_,conn.m_out_.data()+conn.m_out_pos_,conn.m_out_.size()-conn.m_out_pos_,MSG_NOSIGNAL);
+        if(n<0)
+        {
+            if(errno==EAGAIN || errno==EWOULDBLOCK)
+            {
+                break;
+            }
+            /*写失败时连接已经不可用，读事件会报告错误*/
+            conn.m_out_pos_=conn.m_out_.size();
+            break;
+        }
+        conn.m_out_pos_+=n;
+    }
+    if(conn.m_out_pos_==conn.m_out_.size())
+    {
+        conn.m_out_.clear();
+        conn.m_out_pos_=0;
+    }
+    UpdateEvents(conn);
+}
+
+void Worker::OnWritable(Connection& conn,uint64_t now)
+{
+    if(conn.m_connecting_)
+    {
+        int error=0;
+        socklen_t len=sizeof(error);
+        getsockopt(conn.m_fd_,SOL_SOCKET,SO_ERROR,&error,&len);
+        if(error!=0)
+        {
+            m_stats_.m_connect_errors_++;
+            Drop(conn,now+RECONNECT_DELAY_NS);
+            return;
+        }
+        conn.m_connecting_=false;
+        UpdateEvents(conn);
+        Dispatch(conn,now);
+        return;
+    }
+    Flush(conn);
+}
+
+bool Worker::ParseResponses(Connection& conn,uint64_t now)
+{
+    size_t pos=0;
+    while(!conn.m_inflight_.empty())
+    {
+        size_t end=conn.m_in_.find("\r\n\r\n",pos);
+        if(end==std::string::npos)
+        {
+            break;
+        }
+        if(conn.m_in_.compare(pos,9,"HTTP/1.1 ")!=0 && conn.m_in_.compare(pos,9,"HTTP/1.0 ")!=0)
+        {
+            return false;
+        }
+        int status=atoi(conn.m_in_.c_str()+pos+9);
+        long long content_length=0;
+        bool close_after=false;
+        /*逐行解析头部，只关心Content-Length和Connection*/
+        size_t line=conn.m_in_.find("\r\n",pos)+2;
+        while(line<end)
+        {
+            size_t next=conn.m_in_.find("\r\n",line);
+            const char* text=conn.m_in_.c_str()+line;
+            if(strncasecmp(text,"Content-Length:",15)==0)
+            {
+                content_length=atoll(text+15);
+            }
+            else if(strncasecmp(text,"Connection:",11)==0)
+            {
+                const char* value=text+11;
+                while(*value==' ')
+                {
+                    ++value;
+                }
+                close_after=strncasecmp(value,"close",5)==0;
+            }
+            line=next+2;
+        }
+        InFlight& inflight=conn.m_inflight_.front();
+        size_t body=inflight.m_head_?0:content_length;
+        size_t total=end+4-pos+body;
+        if(conn.m_in_.size()-pos<total)
+        {
+            break;
+        }
+        if(Recording(inflight.m_intended_))
+        {
+            m_stats_.m_latency_.Record((now-inflight.m_intended_)/1000);
+            m_stats_.m_requests_++;
+            m_stats_.m_bytes_+=total;
+            m_stats_.m_status_[status>=100 && status<600?status/100:0]++;
+        }
+        conn.m_inflight_.pop_front();
+        pos+=total;
+        if(close_after)
+        {
+            conn.m_closing_=true;
+        }
+    }
+    conn.m_in_.erase(0,pos);
+    return true;
+}
+
+void Worker::OnReadable(Connection& conn,uint64_t now)
+{
+    char buf[65536];
+    bool eof=false;
+    while(true)
+    {
+        ssize_t n=recv(conn.m_fd_,buf,sizeof(buf),0);
+        if(n>0)
+        {
+            conn.m_in_.append(buf,n);
+            continue;
+        }
+        if(n<0 && (errno==EAGAIN || errno==EWOULDBLOCK))
+        {
+            break;
+        }
+        eof=true;
+        break;
+    }
+    if(!ParseResponses(conn,now))
+    {
+        m_stats_.m_read_errors_++;
+        Drop(conn,now);
+        return;
+    }
+    if(eof || (conn.m_closing_ && conn.m_inflight_.empty()))
+    {
+        /*服务端在应答完成前关闭连接*/
+        if(!conn.m_inflight_.empty())
+        {
+            m_stats_.m_read_errors_++;
+        }
+        m_stats_.m_reconnects_++;
+        Drop(conn,now);
+        return;
+    }
+    Dispatch(conn,now);
+}
+
+void Worker::Run()
+{
+    m_epollfd_=epoll_create1(0);
+    m_timerfd_=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK);
+    struct epoll_event timer_event;
+    timer_event.events=EPOLLIN;
+    timer_event.data.ptr=NULL;
+    epoll_ctl(m_epollfd_,EPOLL_CTL_ADD,m_timerfd_,&timer_event);
+    m_start_=NowNs();
+    m_record_from_=m_start_+(uint64_t)(options.m_warmup_*1e9);
+    m_end_=m_record_from_+(uint64_t)(options.m_duration_*1e9);
+    for(size_t i=0;i<m_connections_.size();++i)
+    {
+        m_connections_[i].m_fd_=-1;
+        m_connections_[i].m_retry_at_=m_start_;
+    }
+    struct epoll_event events[MAX_EVENTS];
+    while(true)
+    {
+        uint64_t now=NowNs();
+        /*测试结束后等待已发出的请求完成，最多等一个超时时间*/
+        bool pending=false;
+        for(size_t i=0;i<m_connections_.size();++i)
+        {
+            if(!m_connections_[i].m_inflight_.empty())
+            {
+                pending=true;
+            }
+        }
+        if(now>=m_end_ && (!pending || now>=m_end_+(uint64_t)options.m_timeout_ms_*1000000))
+        {
+            break;
+        }
+        Schedule(now);
+        m_cursor_=(m_cursor_+1)%m_connections_.size();
+        for(size_t i=0;i<m_connections_.size();++i)
+        {
+            Connection& conn=m_connections_[(m_cursor_+i)%m_connections_.size()];
+            if(conn.m_fd_<0)
+            {
+                if(now<m_end_ && now>=conn.m_retry_at_)
+                {
+                    Connect(conn,now);
+                }
+                continue;
+            }
+            /*最早的请求超时，放弃连接；开环模式下这些请求重新排队，延迟继续累积*/
+            if(!conn.m_inflight_.empty() && now-conn.m_inflight_.front().m_sent_>(uint64_t)options.m_timeout_ms_*1000000)
+            {
+                m_stats_.m_timeouts_++;
+                Drop(conn,now);
+                continue;
+            }
+            Dispatch(conn,now);
+        }
+        if(m_rate_>0)
+        {
+            uint64_t due=m_start_+(uint64_t)(m_issued_*1e9/m_rate_);
+            struct itimerspec spec;
+            memset(&spec,0,sizeof(spec));
+            spec.it_value.tv_sec=due/1000000000;
+            spec.it_value.tv_nsec=due%1000000000;
+            timerfd_settime(m_timerfd_,TFD_TIMER_ABSTIME,&spec,NULL);
+        }
+        int timeout=HOUSEKEEPING_MS;
+        int number=epoll_wait(m_epollfd_,events,MAX_EVENTS,timeout);
+        now=NowNs();
+        for(int i=0;i<number;++i)
+        {
+            if(!events[i].data.ptr)
+            {
+                uint64_t expirations;
+                if(read(m_timerfd_,&expirations,sizeof(expirations))<0)
+                {
+                }
+                continue;
+            }
+            Connection& conn=*(Connection*)events[i].data.ptr;
+            if(conn.m_fd_<0)
+            {
+                continue;
+            }
+            if(events[i].events&(EPOLLOUT|EPOLLERR|EPOLLHUP))
+            {
+                OnWritable(conn,now);
+            }
+            if(conn.m_fd_>=0 && !conn.m_connecting_ && (events[i].events&(EPOLLIN|EPOLLERR|EPOLLHUP)))
+            {
+                OnReadable(conn,now);
+            }
+        }
+    }
+    for(size_t i=0;i<m_connections_.size();++i)
+    {
+        Connection& conn=m_connections_[i];
+        m_stats_.m_backlog_+=conn.m_inflight_.size();
+        if(conn.m_fd_>=0)
+        {
+            close(conn.m_fd_);
+        }
+    }
+    m_stats_.m_backlog_+=m_backlog_.size();
+    close(m_timerfd_);
+    close(m_epollfd_);
+}
+
+/*读取请求文件，生成两种形式的请求*/
+static bool LoadCorpus(const char* path)
+{
+    std::vector<std::string> lines;
+    if(path)
+    {
+        FILE* fp=fopen(path,"r");
+        if(!fp)
+        {
+            fprintf(stderr,"cannot open %s\n",path);
+            return false;
+        }
+        char buf[4096];
+        while(fgets(buf,sizeof(buf),fp))
+        {
+            size_t len=strcspn(buf,"\r\n");
+            buf[len]='\0';
+            if(len>0 && buf[0]!='#')
+            {
+                lines.push_back(buf);
+            }
+        }
+        fclose(fp);
+    }
+    else
+    {
+        lines.push_back("GET /index.html");
+    }
+    char host[64];
+    snprintf(host,sizeof(host),"%s:%d",options.m_address_,options.m_port_);
+    for(size_t i=0;i<lines.size();++i)
+    {
+        std::string method="GET";
+        std::string target=lines[i];
+        size_t space=target.find(' ');
+        if(space!=std::string::npos)
+        {
+            method=target.substr(0,space);
+            target=target.substr(space+1);
+        }
+        Request request;
+        std::string head=method+" "+target+" HTTP/1.1\r\nHost: "+host+"\r\nUser-Agent: LoadGenerator\r\n";
+        request.m_keepalive_=head+"Connection: keep-alive\r\n\r\n";
+        request.m_close_=head+"Connection: close\r\n\r\n";
+        request.m_head_=method=="HEAD";
+        if(request.m_keepalive_.size()>MAX_REQUEST_LEN)
+        {
+            fprintf(stderr,"skipping request longer than %zu bytes: %s\n",MAX_REQUEST_LEN,lines[i].c_str());
+            continue;
+        }
+        corpus.push_back(request);
+    }
+    if(corpus.empty())
+    {
+        fprintf(stderr,"no usable requests\n");
+        return false;
+    }
+    return true;
+}
+
+static void Usage(const char* prog)
+{
+    fprintf(stderr,"usage: %s [-a address] [-p port] [-t threads] [-c connections] [-d seconds] [-w warmup_seconds]\n"
+                   "          [-r requests_per_second] [-n requests_per_connection] [-P pipeline] [-T timeout_ms] [-f corpus] [-S]\n",prog);
+}
+
+int main(int argc,char* argv[])
+{
+    options.m_address_="127.0.0.1";
+    options.m_port_=8080;
+    options.m_threads_=2;
+    options.m_connections_=16;
+    options.m_duration_=10;
+    options.m_warmup_=1;
+    options.m_rate_=0;
+    options.m_per_connection_=0;
+    options.m_pipeline_=1;
+    options.m_timeout_ms_=2000;
+    options.m_corpus_=NULL;
+    options.m_spread_=false;
+    int opt;
+    while((opt=getopt(argc,argv,"a:p:t:c:d:w:r:n:P:T:f:S"))!=-1)
+    {
+        switch(opt)
+        {
+            case 'a': options.m_address_=optarg; break;
+            case 'p': options.m_port_=atoi(optarg); break;
+            case 't': options.m_threads_=atoi(optarg); break;
+            case 'c': options.m_connections_=atoi(optarg); break;
+            case 'd': options.m_duration_=atof(optarg); break;
+            case 'w': options.m_warmup_=atof(optarg); break;
+            case 'r': options.m_rate_=atof(optarg); break;
+            case 'n': options.m_per_connection_=atoi(optarg); break;
+            case 'P': options.m_pipeline_=atoi(optarg); break;
+            case 'T': options.m_timeout_ms_=atoi(optarg); break;
+            case 'f': options.m_corpus_=optarg; break;
+            case 'S': options.m_spread_=true; break;
+            default: Usage(argv[0]); return 1;
+        }
+    }
+    if(options.m_threads_<=0 || options.m_connections_<options.m_threads_ || options.m_pipeline_<=0 || options.m_duration_<=0)
+    {
+        Usage(argv[0]);
+        return 1;
+    }
+    memset(&server_address,0,sizeof(server_address));
+    server_address.sin_family=AF_INET;
+    server_address.sin_port=htons(options.m_port_);
+    if(inet_pton(AF_INET,options.m_address_,&server_address.sin_addr)!=1)
+    {
+        fprintf(stderr,"bad address %s\n",options.m_address_);
+        return 1;
+    }
+    if(!LoadCorpus(options.m_corpus_))
+    {
+        return 1;
+    }
+    std::vector<Worker*> workers;
+    std::vector<pthread_t> threads(options.m_threads_);
+    int first_id=0;
+    for(int i=0;i<options.m_threads_;++i)
+    {
+        int connections=options.m_connections_/options.m_threads_+(i<options.m_connections_%options.m_threads_?1:0);
+        workers.push_back(new Worker(i,first_id,connections,options.m_rate_/options.m_threads_));
+        first_id+=connections;
+    }
+    for(int i=0;i<options.m_threads_;++i)
+    {
+        pthread_create(&threads[i],NULL,Worker::Start,workers[i]);
+    }
+    Stats total;
+    for(int i=0;i<options.m_threads_;++i)
+    {
+        pthread_join(threads[i],NULL);
+        const Stats& stats=workers[i]->GetStats();
+        total.m_latency_.Merge(stats.m_latency_);
+        total.m_requests_+=stats.m_requests_;
+        total.m_bytes_+=stats.m_bytes_;
+        for(int j=0;j<6;++j)
+        {
+            total.m_status_[j]+=stats.m_status_[j];
+        }
+        total.m_connect_errors_+=stats.m_connect_errors_;
+        total.m_read_errors_+=stats.m_read_errors_;
+        total.m_timeouts_+=stats.m_timeouts_;
+        total.m_reconnects_+=stats.m_reconnects_;
+        total.m_backlog_+=stats.m_backlog_;
+        delete workers[i];
+    }
+    const Histogram& latency=total.m_latency_;
+    printf("{\n");
+    printf("  \"mode\": \"%s\",\n",options.m_rate_>0?"open":"closed");
+    printf("  \"target_rate\": %.1f,\n",options.m_rate_);
+    printf("  \"threads\": %d,\n  \"connections\": %d,\n  \"pipeline\": %d,\n  \"requests_per_connection\": %d,\n",
+           options.m_threads_,options.m_connections_,options.m_pipeline_,options.m_per_connection_);
+    printf("  \"duration_s\": %.3f,\n  \"corpus_size\": %zu,\n",options.m_duration_,corpus.size());
+    printf("  \"requests\": %llu,\n",(unsigned long long)total.m_requests_);
+    printf("  \"throughput_rps\": %.1f,\n",total.m_requests_/options.m_duration_);
+    printf("  \"throughput_mbps\": %.2f,\n",total.m_bytes_*8/options.m_duration_/1e6);
+    printf("  \"status\": {\"1xx\": %llu, \"2xx\": %llu, \"3xx\": %llu, \"4xx\": %llu, \"5xx\": %llu, \"other\": %llu},\n",
+           (unsigned long long)total.m_status_[1],(unsigned long long)total.m_status_[2],(unsigned long long)total.m_status_[3],
+           (unsigned long long)total.m_status_[4],(unsigned long long)total.m_status_[5],(unsigned long long)total.m_status_[0]);
+    printf("  \"errors\": {\"connect\": %llu, \"read\": %llu, \"timeout\": %llu, \"unsent\": %llu},\n",
+           (unsigned long long)total.m_connect_errors_,(unsigned long long)total.m_read_errors_,
+           (unsigned long long)total.m_timeouts_,(unsigned long long)total.m_backlog_);
+    printf("  \"reconnects\": %llu,\n",(unsigned long long)total.m_reconnects_);
+    printf("  \"coordinated_omission_corrected\": %s,\n",options.m_rate_>0?"true":"false");
+    printf("  \"latency_us\": {\"mean\": %.1f, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p99.9\": %llu, \"max\": %llu}\n",
+           latency.Mean(),(unsigned long long)latency.Percentile(0.5),(unsigned long long)latency.Percentile(0.9),
+           (unsigned long long)latency.Percentile(0.99),(unsigned long long)latency.Percentile(0.999),(unsigned long long)latency.Max());
+    printf("}\n");
+    return 0;
+}
@@ -0,0 +1,95 @@
+#!/bin/bash
+# 在本机启动一个服务端实例并用LoadGenerator压测，每项结果以JSON写入$BUILD_DIR/results
+# 用法：tools/bench.sh [corpus]
+# 环境变量：BUILD_DIR(默认_bench) PORT(默认8090) DURATION(秒，默认10) WARMUP(秒，默认2)
+#           THREADS(默认2) CONNECTIONS(默认128) RATE(开环模式每秒请求数，默认5000) CHURN(每个连接的请求数，默认10)
+set -e
+
+ROOT=$(cd "$(dirname "$0")/.." && pwd)
+BUILD_DIR=${BUILD_DIR:-$ROOT/_bench}
+PORT=${PORT:-8090}
+DURATION=${DURATION:-10}
+WARMUP=${WARMUP:-2}
+THREADS=${THREADS:-2}
+CONNECTIONS=${CONNECTIONS:-128}
+RATE=${RATE:-5000}
+CHURN=${CHURN:-10}
+CXX=${CXX:-g++}
+# 协程处理函数(/echo等路径)需要C++20，压测的应当是完整的服务端
+CXXFLAGS=${CXXFLAGS:--std=c++20 -O2}
+
+mkdir -p "$BUILD_DIR/results"
+cd "$BUILD_DIR"
+
+if ! printf '#ifndef __cpp_impl_coroutine\n#error\n#endif\n' | $CXX $CXXFLAGS -x c++ -E - > /dev/null 2>&1; then
+    echo "CXXFLAGS ($CXXFLAGS) compile out the coroutine handlers, use -std=c++20" >&2
+    exit 1
+fi
+echo "building in $BUILD_DIR" >&2
+$CXX $CXXFLAGS -I"$ROOT/include" "$ROOT/main.cpp" "$ROOT"/src/*.cpp -lpthread -o webserver
+$CXX $CXXFLAGS "$ROOT/tools/LoadGenerator.cpp" -lpthread -o LoadGenerator
+$CXX $CXXFLAGS -I"$ROOT/include" "$ROOT/tools/AccessLogDecoder.cpp" -o AccessLogDecoder
+
+# 生成网站根目录：大量小文件(走快速路径)、少量中等文件和一个超过缓存单项上限的大文件
+WWW="$BUILD_DIR/www"
+rm -rf "$WWW"
+mkdir -p "$WWW/assets"
+echo "hello world" > "$WWW/index.html"
+for i in $(seq 0 31); do
+    head -c $((512 << (i % 7))) /dev/urandom | base64 > "$WWW/assets/small$i.css"
+done
+for i in $(seq 0 3); do
+    head -c $((256 * 1024)) /dev/urandom > "$WWW/assets/medium$i.bin"
+done
+head -c $((8 * 1024 * 1024)) /dev/urandom > "$WWW/assets/large.bin"
+chmod -R a+r "$WWW"
+
+# 默认请求文件：约90%小文件，其余是中等文件、大文件和不存在的路径
+CORPUS=${1:-$BUILD_DIR/corpus.txt}
+if [ -z "$1" ]; then
+    {
+        for i in $(seq 0 31); do
+            echo "GET /assets/small$i.css"
+            echo "GET /index.html"
+            echo "GET /assets/small$(( (i * 7) % 32 )).css"
+        done
+        for i in $(seq 0 3); do
+            echo "GET /assets/medium$i.bin"
+            echo "GET /missing$i.html"
+        done
+        echo "GET /assets/large.bin"
+    } > "$CORPUS"
+fi
+
+rm -f access.*.wsal
+./webserver "$PORT" "$WWW" > server.log 2>&1 &
+SERVER=$!
+trap 'kill $SERVER 2>/dev/null; wait $SERVER 2>/dev/null' EXIT
+for i in $(seq 50); do
+    if (exec 3<>"/dev/tcp/127.0.0.1/$PORT") 2>/dev/null; then
+        break
+    fi
+    sleep 0.1
+done
+
+# -S让每个连接使用不同的源地址，避免本机压测触发按地址的限流
+COMMON="-a 127.0.0.1 -p $PORT -t $THREADS -d $DURATION -w $WARMUP -f $CORPUS -S"
+run() {
+    local name=$1
+    shift
+    echo "running $name" >&2
+    ./LoadGenerator $COMMON "$@" > "results/$name.json"
+    cat "results/$name.json"
+}
+
+run closed-keepalive -c "$CONNECTIONS"
+run open-keepalive -c "$CONNECTIONS" -r "$RATE"
+run closed-churn -c "$CONNECTIONS" -n "$CHURN"
+
+# 服务端视角的各阶段耗时，访问日志每秒刷新一次
+sleep 1.5
+kill $SERVER
+wait $SERVER 2>/dev/null || true
+trap - EXIT
+./AccessLogDecoder -f csv access.*.wsal > results/access.csv 2>/dev/null || true
+echo "server access log: $BUILD_DIR/results/access.csv" >&2